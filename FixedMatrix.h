@@ -0,0 +1,97 @@
+#pragma once
+//compile-time sized matrices for the fusion kernel, stored in place (no heap memory), with loop bounds that are known at compile time so that the compiler can fully unroll the small matrix operations
+
+template <int ROWS, int COLS, typename T = double>
+struct FixedMatrix {//ROWS x COLS matrix of T (double or float) elements (plain data, so it can be copied with memcpy and embedded in other structures)
+	T m[ROWS][COLS];//elements, m[row][column]
+
+	void SetZero() {//set every element to 0
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				m[i][j] = 0;
+			}
+		}
+	}
+
+	void SetIdentity() {//set the diagonal to 1 and every other element to 0
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				m[i][j] = (i==j) ? 1 : 0;
+			}
+		}
+	}
+
+	template <int N>
+	void Multiply(const FixedMatrix<ROWS,N,T> &a, const FixedMatrix<N,COLS,T> &b) {//this = a * b (must not be the same object as a or b)
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				T dSum = 0;
+				for (int k=0;k<N;k++) {
+					dSum += a.m[i][k]*b.m[k][j];
+				}
+				m[i][j] = dSum;
+			}
+		}
+	}
+
+	template <int N>
+	void MultiplyTransposed(const FixedMatrix<ROWS,N,T> &a, const FixedMatrix<COLS,N,T> &b) {//this = a * transpose(b) (must not be the same object as a or b)
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				T dSum = 0;
+				for (int k=0;k<N;k++) {
+					dSum += a.m[i][k]*b.m[j][k];
+				}
+				m[i][j] = dSum;
+			}
+		}
+	}
+
+	void Add(const FixedMatrix<ROWS,COLS,T> &a) {//this = this + a
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				m[i][j] += a.m[i][j];
+			}
+		}
+	}
+
+	void Subtract(const FixedMatrix<ROWS,COLS,T> &a) {//this = this - a
+		for (int i=0;i<ROWS;i++) {
+			for (int j=0;j<COLS;j++) {
+				m[i][j] -= a.m[i][j];
+			}
+		}
+	}
+
+	void Symmetrize() {//replace each pair of off-diagonal elements of a square matrix with their average, to stop round-off from making a covariance matrix asymmetric
+		for (int i=0;i<ROWS;i++) {
+			for (int j=i+1;j<COLS;j++) {
+				T dAvg = T(0.5)*(m[i][j] + m[j][i]);
+				m[i][j] = dAvg;
+				m[j][i] = dAvg;
+			}
+		}
+	}
+};
+
+template <typename T>
+inline bool InvertMatrix3x3(const FixedMatrix<3,3,T> &a, FixedMatrix<3,3,T> &inv) {//inv = inverse of a (by cofactors), returns false if a is singular
+	T c00 = a.m[1][1]*a.m[2][2] - a.m[1][2]*a.m[2][1];
+	T c01 = a.m[1][2]*a.m[2][0] - a.m[1][0]*a.m[2][2];
+	T c02 = a.m[1][0]*a.m[2][1] - a.m[1][1]*a.m[2][0];
+	T dDet = a.m[0][0]*c00 + a.m[0][1]*c01 + a.m[0][2]*c02;
+	if (dDet==0) {
+		return false;
+	}
+	T dInvDet = 1/dDet;
+	inv.m[0][0] = c00*dInvDet;
+	inv.m[1][0] = c01*dInvDet;
+	inv.m[2][0] = c02*dInvDet;
+	inv.m[0][1] = (a.m[0][2]*a.m[2][1] - a.m[0][1]*a.m[2][2])*dInvDet;
+	inv.m[1][1] = (a.m[0][0]*a.m[2][2] - a.m[0][2]*a.m[2][0])*dInvDet;
+	inv.m[2][1] = (a.m[0][1]*a.m[2][0] - a.m[0][0]*a.m[2][1])*dInvDet;
+	inv.m[0][2] = (a.m[0][1]*a.m[1][2] - a.m[0][2]*a.m[1][1])*dInvDet;
+	inv.m[1][2] = (a.m[0][2]*a.m[1][0] - a.m[0][0]*a.m[1][2])*dInvDet;
+	inv.m[2][2] = (a.m[0][0]*a.m[1][1] - a.m[0][1]*a.m[1][0])*dInvDet;
+	return true;
+}
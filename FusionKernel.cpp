@@ -0,0 +1,933 @@
+/**
+ * @file FusionKernel.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the FusionKernel class (allocation-free acc/mag/gyro fusion used by IMU::ComputeOrientation)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <cmath>
+#include <string.h>
+#include "FusionKernel.h"
+
+/**
+ * @brief clear the orientation state, so that the next update starts from the acc/mag orientation, and select the default engine (FUSION_ENGINE_SLERP)
+ *
+ * @param pState the orientation state to clear
+ */
+template <typename T>
+void FusionKernelT<T>::Reset(FUSION_STATE_T<T> *pState) {
+	SetEngine(pState, FUSION_ENGINE_SLERP, 0, 0);
+}
+
+/**
+ * @brief select the fusion engine and its gains, and clear the orientation state (including the gyro bias estimate), so that the next update starts from the acc/mag orientation
+ *
+ * @param pState the orientation state
+ * @param nEngine one of the FUSION_ENGINE_... values
+ * @param dGain the Madgwick beta (rad/sec), Mahony Kp (rad/sec), or Kalman filter gyro noise density (rad/sec/sqrt(Hz)), e.g. FUSION_MADGWICK_DEFAULT_BETA, FUSION_MAHONY_DEFAULT_KP, or FUSION_EKF_DEFAULT_GYRO_NOISE (not used by FUSION_ENGINE_SLERP)
+ * @param dBiasGain the Madgwick zeta (rad/sec^2), Mahony Ki (rad/sec^2), or Kalman filter gyro bias random walk (rad/sec^2/sqrt(Hz)), e.g. FUSION_MADGWICK_DEFAULT_ZETA, FUSION_MAHONY_DEFAULT_KI, or FUSION_EKF_DEFAULT_BIAS_NOISE. Use 0 to turn off gyro bias estimation in the Madgwick and Mahony engines, or to treat the bias as constant in the Kalman filter (not used by FUSION_ENGINE_SLERP)
+ * @return true if the engine was selected
+ * @return false if nEngine is not a valid engine or a gain is negative (the state is not changed in that case)
+ */
+template <typename T>
+bool FusionKernelT<T>::SetEngine(FUSION_STATE_T<T> *pState, int nEngine, T dGain, T dBiasGain) {
+	if (nEngine<FUSION_ENGINE_SLERP||nEngine>FUSION_ENGINE_EKF||dGain<0||dBiasGain<0) {
+		return false;
+	}
+	pState->engine = nEngine;
+	pState->gain = dGain;
+	pState->bias_gain = dBiasGain;
+	pState->q.w = 1;
+	pState->q.x = 0;
+	pState->q.y = 0;
+	pState->q.z = 0;
+	pState->have_quat = false;
+	pState->last_sample_time_sec = 0;
+	pState->last_correction_time_sec = 0;
+	pState->prev_rot_vec[0] = 0;
+	pState->prev_rot_vec[1] = 0;
+	pState->prev_rot_vec[2] = 0;
+	pState->gyro_bias[0] = 0;
+	pState->gyro_bias[1] = 0;
+	pState->gyro_bias[2] = 0;
+	pState->ekf_cov.SetZero();
+	pState->ekf_acc_nis = 0;
+	pState->ekf_mag_nis = 0;
+	return true;
+}
+
+/**
+ * @brief find out whether the selected engine estimates the gyro bias itself, in which case the gyro high-pass filter is not needed (and would only attenuate slow real turns)
+ *
+ * @param pState the orientation state
+ * @return true for FUSION_ENGINE_EKF, and for FUSION_ENGINE_MADGWICK and FUSION_ENGINE_MAHONY with a bias gain above 0
+ * @return false if the gyro bias is not estimated
+ */
+template <typename T>
+bool FusionKernelT<T>::EstimatesGyroBias(const FUSION_STATE_T<T> *pState) {
+	if (pState->engine==FUSION_ENGINE_EKF) {
+		return true;
+	}
+	return (pState->engine==FUSION_ENGINE_MADGWICK||pState->engine==FUSION_ENGINE_MAHONY)&&pState->bias_gain>0;
+}
+
+/**
+ * @brief get the orientation uncertainty (from the Kalman filter covariance) and the gyro bias estimate, for health monitoring. The uncertainty is only available with FUSION_ENGINE_EKF; the other engines report their gyro bias estimate only.
+ *
+ * @param pState the orientation state
+ * @param pHealth pointer to the structure that receives the uncertainty and gyro bias estimate
+ */
+template <typename T>
+void FusionKernelT<T>::GetHealth(const FUSION_STATE_T<T> *pState, FUSION_HEALTH *pHealth) {
+	const T RAD_TO_DEG = T(57.29578);
+	memset(pHealth, 0, sizeof(FUSION_HEALTH));
+	//map the bias back from forward-right-down onto the angular_rate axes
+	pHealth->gyro_bias_dps[0] = -pState->gyro_bias[0]*RAD_TO_DEG;
+	pHealth->gyro_bias_dps[1] = pState->gyro_bias[1]*RAD_TO_DEG;
+	pHealth->gyro_bias_dps[2] = -pState->gyro_bias[2]*RAD_TO_DEG;
+	if (pState->engine!=FUSION_ENGINE_EKF||!pState->have_quat) {
+		return;
+	}
+	const FixedMatrix<FUSION_EKF_NUM_STATES,FUSION_EKF_NUM_STATES,T> &P = pState->ekf_cov;
+	pHealth->have_covariance = true;
+	for (int i=0;i<3;i++) {
+		pHealth->attitude_sd_deg[i] = std::sqrt(P.m[i][i])*RAD_TO_DEG;
+		pHealth->gyro_bias_sd_dps[i] = std::sqrt(P.m[i+3][i+3])*RAD_TO_DEG;
+	}
+	//heading variance: attitude covariance projected onto the down direction
+	const FUSION_QUAT_T<T> &q = pState->q;
+	T down[3] = {2*(q.x*q.z - q.w*q.y), 2*(q.y*q.z + q.w*q.x), 1 - 2*(q.x*q.x + q.y*q.y)};
+	T dHeadingVar = 0;
+	for (int i=0;i<3;i++) {
+		for (int j=0;j<3;j++) {
+			dHeadingVar += down[i]*P.m[i][j]*down[j];
+		}
+	}
+	pHealth->heading_sd_deg = std::sqrt(dHeadingVar)*RAD_TO_DEG;
+	pHealth->acc_nis = pState->ekf_acc_nis;
+	pHealth->mag_nis = pState->ekf_mag_nis;
+}
+
+/**
+ * @brief fuse one acc/mag/gyro sample into the orientation state with the selected engine. Every engine returns angles with the same conventions, so they can be swapped without changing anything that uses the angles.
+ *
+ * @param pState the orientation state, updated in place
+ * @param acc_data the acceleration vector (X,Y,Z, in G)
+ * @param mag_data the magnetometer vector (X,Y,Z, normalized units)
+ * @param angular_rate the angular rate vector (RX,RY,RZ, deg/s)
+ * @param dSampleTimeSec the time of the sample in seconds
+ * @param roll the returned roll angle in degrees (-180 to 180)
+ * @param pitch the returned pitch angle in degrees
+ * @param heading the returned heading angle in degrees (0 to 360)
+ */
+template <typename T>
+void FusionKernelT<T>::Update(FUSION_STATE_T<T> *pState, T *acc_data, T *mag_data, T *angular_rate, double dSampleTimeSec, T &roll, T &pitch, T &heading) {
+	UpdateQuaternion(pState, acc_data, mag_data, angular_rate, dSampleTimeSec);
+	GetAngles(pState, roll, pitch, heading);
+}
+
+/**
+ * @brief fuse one acc/mag/gyro sample into the orientation state with the selected engine, without computing any angles. Use GetQuaternion (or GetAngles) afterwards to get the orientation.
+ *
+ * @param pState the orientation state, updated in place
+ * @param acc_data the acceleration vector (X,Y,Z, in G)
+ * @param mag_data the magnetometer vector (X,Y,Z, normalized units)
+ * @param angular_rate the angular rate vector (RX,RY,RZ, deg/s)
+ * @param dSampleTimeSec the time of the sample in seconds
+ */
+template <typename T>
+void FusionKernelT<T>::UpdateQuaternion(FUSION_STATE_T<T> *pState, T *acc_data, T *mag_data, T *angular_rate, double dSampleTimeSec) {
+	if (pState->engine==FUSION_ENGINE_SLERP) {
+		FUSION_QUAT_T<T> accMagQuat;
+		AccMagAMOSQuat(acc_data, mag_data, accMagQuat);
+		UpdateSlerp(pState, accMagQuat, angular_rate, dSampleTimeSec);
+		return;
+	}
+	T acc[3], mag[3], gyro[3];
+	T dAccNorm = 0, dMagNorm = 0;
+	ToBodyAxes(acc_data, mag_data, angular_rate, acc, mag, gyro, dAccNorm, dMagNorm);
+	if (pState->engine==FUSION_ENGINE_EKF) {
+		UpdateEKF(pState, acc, dAccNorm, mag, dMagNorm, gyro, dSampleTimeSec);
+	}
+	else {
+		UpdateGradient(pState, acc, dAccNorm, mag, dMagNorm, gyro, dSampleTimeSec);
+	}
+}
+
+/**
+ * @brief get the orientation as a quaternion that rotates the forward-right-down sensor axes into north-east-down world axes. This is the same for every engine, and ToNEDAngles turns it into the same angles that GetAngles returns. The Madgwick, Mahony, and Kalman filter engines keep this quaternion as their state, so it is just copied; FUSION_ENGINE_SLERP keeps an AMOS quaternion with the opposite roll sense (which is not a rotation of this one), so its quaternion is built from its angles.
+ *
+ * @param pState the orientation state
+ * @param q the returned orientation quaternion (the identity before the first update)
+ */
+template <typename T>
+void FusionKernelT<T>::GetQuaternion(const FUSION_STATE_T<T> *pState, FUSION_QUAT_T<T> &q) {
+	if (pState->engine!=FUSION_ENGINE_SLERP) {
+		q = pState->q;
+		return;
+	}
+	T roll, pitch, heading;
+	ToAMOSRPY(pState->q, roll, pitch, heading);
+	FromNEDAngles(roll, pitch, heading, q);
+}
+
+/**
+ * @brief get the roll, pitch, and heading angles of the orientation state, computed straight from the quaternion components (with the same conventions for every engine)
+ *
+ * @param pState the orientation state
+ * @param roll the returned roll angle in degrees (-180 to 180)
+ * @param pitch the returned pitch angle in degrees
+ * @param heading the returned heading angle in degrees (0 to 360)
+ */
+template <typename T>
+void FusionKernelT<T>::GetAngles(const FUSION_STATE_T<T> *pState, T &roll, T &pitch, T &heading) {
+	if (pState->engine==FUSION_ENGINE_SLERP) {
+		ToAMOSRPY(pState->q, roll, pitch, heading);
+	}
+	else {
+		ToNEDAngles(pState->q, roll, pitch, heading);
+	}
+}
+
+/**
+ * @brief fuse a block of samples held as separate arrays for each component (e.g. a recorded log, or samples gathered by another thread), and get the orientation angles of every sample. This gives exactly the same results as calling Update for each sample in turn, but the work that does not depend on the previous sample (mapping the sensor axes, normalizing the acc and mag vectors, and the acc/mag orientation of FUSION_ENGINE_SLERP) is done for FUSION_BATCH_BLOCK_SIZE samples at a time in separate loops (the axis mapping and normalization written so that the compiler can vectorize them), so that only the filter recursion itself is left in the per-sample loop. The quaternions and angles are also computed in a separate pass, and only for the outputs that are asked for.
+ *
+ * @param pState the orientation state, updated in place
+ * @param pSamples the sample arrays (each one holding nNumSamples values, see FUSION_SAMPLE_SPANS)
+ * @param nNumSamples the number of samples
+ * @param pAngles the arrays that receive the orientation quaternion (see GetQuaternion) and the angles of each sample (see FUSION_ORIENTATION_SPANS), any of them can be nullptr if they are not needed
+ */
+template <typename T>
+void FusionKernelT<T>::UpdateBatch(FUSION_STATE_T<T> *pState, const FUSION_SAMPLE_SPANS_T<T> *pSamples, int nNumSamples, FUSION_ORIENTATION_SPANS_T<T> *pAngles) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	const int B = FUSION_BATCH_BLOCK_SIZE;
+	T acc[3][B], mag[3][B], gyro[3][B];//normalized forward-right-down acc and mag directions, and angular rates (rad/sec), as in ToBodyAxes
+	T accNorm[B], magNorm[B];//lengths of the acc and mag vectors before they were normalized
+	FUSION_QUAT_T<T> accMagQuat[B];//acc/mag orientation of each sample (FUSION_ENGINE_SLERP only)
+	FUSION_QUAT_T<T> q[B];//orientation after each sample
+	bool bSlerp = pState->engine==FUSION_ENGINE_SLERP;
+	for (int nStart=0;nStart<nNumSamples;nStart+=B) {
+		int nCount = nNumSamples - nStart < B ? nNumSamples - nStart : B;
+		const double *t = pSamples->t + nStart;
+		//pass 1: per-sample preprocessing, with no dependence on the previous sample
+		if (bSlerp) {
+			for (int i=0;i<nCount;i++) {
+				T acc_data[3] = {pSamples->ax[nStart+i], pSamples->ay[nStart+i], pSamples->az[nStart+i]};
+				T mag_data[3] = {pSamples->mx[nStart+i], pSamples->my[nStart+i], pSamples->mz[nStart+i]};
+				AccMagAMOSQuat(acc_data, mag_data, accMagQuat[i]);
+			}
+		}
+		else {
+			const T *ax = pSamples->ax + nStart, *ay = pSamples->ay + nStart, *az = pSamples->az + nStart;
+			const T *mx = pSamples->mx + nStart, *my = pSamples->my + nStart, *mz = pSamples->mz + nStart;
+			const T *gx = pSamples->gx + nStart, *gy = pSamples->gy + nStart, *gz = pSamples->gz + nStart;
+			for (int i=0;i<nCount;i++) {//(same arithmetic as ToBodyAxes, so that the results are identical)
+				T a0 = -ax[i], a1 = ay[i], a2 = -az[i];
+				T m0 = mx[i], m1 = -my[i], m2 = -mz[i];
+				T dAccNorm = std::sqrt(a0*a0 + a1*a1 + a2*a2);
+				T dMagNorm = std::sqrt(m0*m0 + m1*m1 + m2*m2);
+				T dAccScale = 1/(dAccNorm + (dAccNorm>0 ? T(0) : T(1)));
+				T dMagScale = 1/(dMagNorm + (dMagNorm>0 ? T(0) : T(1)));
+				acc[0][i] = a0*dAccScale; acc[1][i] = a1*dAccScale; acc[2][i] = a2*dAccScale;
+				mag[0][i] = m0*dMagScale; mag[1][i] = m1*dMagScale; mag[2][i] = m2*dMagScale;
+				accNorm[i] = dAccNorm;
+				magNorm[i] = dMagNorm;
+				gyro[0][i] = -gx[i]*DEG_TO_RAD;
+				gyro[1][i] = gy[i]*DEG_TO_RAD;
+				gyro[2][i] = -gz[i]*DEG_TO_RAD;
+			}
+		}
+		//pass 2: the filter recursion, one sample after another
+		for (int i=0;i<nCount;i++) {
+			if (bSlerp) {
+				T angular_rate[3] = {pSamples->gx[nStart+i], pSamples->gy[nStart+i], pSamples->gz[nStart+i]};
+				UpdateSlerp(pState, accMagQuat[i], angular_rate, t[i]);
+			}
+			else {
+				T acc_i[3] = {acc[0][i], acc[1][i], acc[2][i]};
+				T mag_i[3] = {mag[0][i], mag[1][i], mag[2][i]};
+				T gyro_i[3] = {gyro[0][i], gyro[1][i], gyro[2][i]};
+				if (pState->engine==FUSION_ENGINE_EKF) {
+					UpdateEKF(pState, acc_i, accNorm[i], mag_i, magNorm[i], gyro_i, t[i]);
+				}
+				else {
+					UpdateGradient(pState, acc_i, accNorm[i], mag_i, magNorm[i], gyro_i, t[i]);
+				}
+			}
+			q[i] = pState->q;
+		}
+		//pass 3: orientation quaternions and angles, only for the outputs that were asked for
+		bool bWantAngles = pAngles->roll!=nullptr||pAngles->pitch!=nullptr||pAngles->heading!=nullptr;
+		bool bWantQuats = pAngles->qw!=nullptr||pAngles->qx!=nullptr||pAngles->qy!=nullptr||pAngles->qz!=nullptr;
+		if (!bSlerp&&bWantQuats) {//(already north-east-down)
+			for (int i=0;i<nCount;i++) {
+				if (pAngles->qw) pAngles->qw[nStart+i] = q[i].w;
+				if (pAngles->qx) pAngles->qx[nStart+i] = q[i].x;
+				if (pAngles->qy) pAngles->qy[nStart+i] = q[i].y;
+				if (pAngles->qz) pAngles->qz[nStart+i] = q[i].z;
+			}
+		}
+		if (!bWantAngles&&!(bSlerp&&bWantQuats)) {
+			continue;
+		}
+		for (int i=0;i<nCount;i++) {
+			T roll = 0, pitch = 0, heading = 0;
+			if (bSlerp) {
+				ToAMOSRPY(q[i], roll, pitch, heading);
+			}
+			else {
+				ToNEDAngles(q[i], roll, pitch, heading);
+			}
+			if (pAngles->roll) pAngles->roll[nStart+i] = roll;
+			if (pAngles->pitch) pAngles->pitch[nStart+i] = pitch;
+			if (pAngles->heading) pAngles->heading[nStart+i] = heading;
+			if (bSlerp&&bWantQuats) {//(same as GetQuaternion)
+				FUSION_QUAT_T<T> nedQuat;
+				FromNEDAngles(roll, pitch, heading, nedQuat);
+				if (pAngles->qw) pAngles->qw[nStart+i] = nedQuat.w;
+				if (pAngles->qx) pAngles->qx[nStart+i] = nedQuat.x;
+				if (pAngles->qy) pAngles->qy[nStart+i] = nedQuat.y;
+				if (pAngles->qz) pAngles->qz[nStart+i] = nedQuat.z;
+			}
+		}
+	}
+}
+
+/**
+ * @brief propagate the orientation with a run of gyro readings (e.g. every reading of an LSM6DS33 FIFO run) between acc/mag corrections, in one call. Each reading rotates the orientation from the time of the previous reading (or of the last update) to its own time, so uneven reading times are handled correctly; readings that are not newer than the last update are skipped. Follow this with an Update at the time of the last reading, which then only applies the acc/mag correction. Nothing is propagated before the first Update (or after last_sample_time_sec was set to 0), since the orientation then restarts from the acc/mag data.
+ *
+ * @param pState the orientation state, updated in place
+ * @param angular_rates the angular rate vectors of the readings (RX,RY,RZ of each reading, deg/s)
+ * @param reading_times the time of each reading in seconds (same clock as the dSampleTimeSec values passed to Update, in increasing order)
+ * @param nNumReadings the number of readings
+ */
+template <typename T>
+void FusionKernelT<T>::Propagate(FUSION_STATE_T<T> *pState, const T *angular_rates, const double *reading_times, int nNumReadings) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	if (!pState->have_quat||pState->last_sample_time_sec==0) {
+		return;
+	}
+	for (int i=0;i<nNumReadings;i++) {
+		T dt = T(reading_times[i] - pState->last_sample_time_sec);
+		if (dt<=0) {
+			continue;
+		}
+		pState->last_sample_time_sec = reading_times[i];
+		const T *rate = &angular_rates[3*i];
+		if (pState->engine==FUSION_ENGINE_SLERP) {
+			T rot_vec[3] = {-rate[0]*DEG_TO_RAD*dt, rate[2]*DEG_TO_RAD*dt, -rate[1]*DEG_TO_RAD*dt};//AMOS x, y, z axes
+			IntegrateRotation(pState, rot_vec);
+			continue;
+		}
+		T gyro[3] = {-rate[0]*DEG_TO_RAD, rate[1]*DEG_TO_RAD, -rate[2]*DEG_TO_RAD};//forward-right-down axes, as in ToBodyAxes
+		if (pState->engine==FUSION_ENGINE_EKF) {
+			EKFPredict(pState, gyro, dt);
+		}
+		else {
+			T rot_vec[3] = {(gyro[0] - pState->gyro_bias[0])*dt, (gyro[1] - pState->gyro_bias[1])*dt, (gyro[2] - pState->gyro_bias[2])*dt};
+			IntegrateRotation(pState, rot_vec);
+		}
+	}
+}
+
+/**
+ * @brief FUSION_ENGINE_SLERP update. The acc/mag orientation (see AccMagAMOSQuat) is blended (by spherical linear interpolation) with the previous orientation rotated by the integrated gyro rates. The acc/mag orientation and the blending are the same as in the quaternion2 based calculation that this replaced, but the gyro rotation is now the exact rotation of the whole rotation vector (with coning correction) instead of three single-axis rotations applied in a cycling order.
+ *
+ * @param pState the orientation state, updated in place
+ * @param accMagQuat the acc/mag orientation of the sample
+ * @param angular_rate the angular rate vector (RX,RY,RZ, deg/s)
+ * @param dSampleTimeSec the time of the sample in seconds
+ */
+template <typename T>
+void FusionKernelT<T>::UpdateSlerp(FUSION_STATE_T<T> *pState, const FUSION_QUAT_T<T> &accMagQuat, const T *angular_rate, double dSampleTimeSec) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	const T SLERP_FACTOR = T(0.97);
+	if (!pState->have_quat||pState->last_sample_time_sec==0) {
+		pState->q = accMagQuat;
+		pState->have_quat = true;
+		pState->prev_rot_vec[0] = pState->prev_rot_vec[1] = pState->prev_rot_vec[2] = 0;
+		pState->last_sample_time_sec = dSampleTimeSec;
+	}
+	else {//combine gyro and acc/mag results together using spherical linear interpolation
+		T dTimeElapsedSec = T(dSampleTimeSec - pState->last_sample_time_sec);
+		if (dTimeElapsedSec>0) {//(0 after Propagate has already brought the orientation up to this sample)
+			//rotation vector about the AMOS x (roll), y (yaw), and z (pitch) axes in radians
+			T rot_vec[3] = {-angular_rate[0]*dTimeElapsedSec*DEG_TO_RAD, angular_rate[2]*dTimeElapsedSec*DEG_TO_RAD, -angular_rate[1]*dTimeElapsedSec*DEG_TO_RAD};
+			IntegrateRotation(pState, rot_vec);
+			pState->last_sample_time_sec = dSampleTimeSec;
+		}
+		Slerp(pState->q, accMagQuat, 1-SLERP_FACTOR);
+	}
+}
+
+/**
+ * @brief FUSION_ENGINE_MADGWICK and FUSION_ENGINE_MAHONY update. Both engines keep a north-east-down orientation quaternion that is propagated with the bias-corrected gyro rates (here, or by Propagate), and corrected by the error between the measured acc and mag directions and the directions predicted from the orientation (the cross products of measured and predicted directions, so no Euler angles or inverse trig functions are needed). The Madgwick engine takes a normalized gradient step of size beta, and integrates the step direction into the gyro bias estimate with gain zeta; the Mahony engine feeds the error back with proportional gain Kp and integral gain Ki. The first update (or the first one after last_sample_time_sec is set to 0) starts from the acc/mag orientation.
+ *
+ * @param pState the orientation state, updated in place
+ * @param acc the normalized acceleration direction (forward-right-down axes, see ToBodyAxes)
+ * @param dAccNorm the length of the acceleration vector before it was normalized (in G)
+ * @param mag the normalized magnetic field direction (forward-right-down axes)
+ * @param dMagNorm the length of the magnetometer vector before it was normalized
+ * @param gyro the angular rate vector (rad/sec, forward-right-down axes)
+ * @param dSampleTimeSec the time of the sample in seconds
+ */
+template <typename T>
+void FusionKernelT<T>::UpdateGradient(FUSION_STATE_T<T> *pState, const T *acc, T dAccNorm, const T *mag, T dMagNorm, const T *gyro, double dSampleTimeSec) {
+	if (!pState->have_quat||pState->last_sample_time_sec==0) {
+		if (dAccNorm>0) {
+			FromAccMag(acc, mag, pState->q);
+			pState->have_quat = true;
+		}
+		pState->prev_rot_vec[0] = pState->prev_rot_vec[1] = pState->prev_rot_vec[2] = 0;
+		pState->last_sample_time_sec = dSampleTimeSec;
+		pState->last_correction_time_sec = dSampleTimeSec;
+		return;
+	}
+	T dt = T(dSampleTimeSec - pState->last_sample_time_sec);
+	if (dt>0) {//(0 after Propagate has already brought the orientation up to this sample)
+		T rot_vec[3] = {(gyro[0] - pState->gyro_bias[0])*dt, (gyro[1] - pState->gyro_bias[1])*dt, (gyro[2] - pState->gyro_bias[2])*dt};
+		IntegrateRotation(pState, rot_vec);
+		pState->last_sample_time_sec = dSampleTimeSec;
+	}
+	//the feedback acts over the whole time since the last correction, however many gyro readings were propagated in between
+	T dCorrectionTime = T(dSampleTimeSec - pState->last_correction_time_sec);
+	if (dCorrectionTime<0) {
+		dCorrectionTime = 0;
+	}
+	pState->last_correction_time_sec = dSampleTimeSec;
+	T up[3], field[3];//predicted up and magnetic field directions
+	PredictDirections(pState->q, mag, up, field);
+	//error between the measured and predicted directions (measured x predicted), in sensor axes
+	T err[3] = {0, 0, 0};
+	if (dAccNorm>0) {
+		err[0] += acc[1]*up[2] - acc[2]*up[1];
+		err[1] += acc[2]*up[0] - acc[0]*up[2];
+		err[2] += acc[0]*up[1] - acc[1]*up[0];
+	}
+	if (dMagNorm>0) {
+		err[0] += mag[1]*field[2] - mag[2]*field[1];
+		err[1] += mag[2]*field[0] - mag[0]*field[2];
+		err[2] += mag[0]*field[1] - mag[1]*field[0];
+	}
+	T correction[3];//correction rotation vector (rad)
+	if (pState->engine==FUSION_ENGINE_MADGWICK) {
+		T dErrNorm = std::sqrt(err[0]*err[0] + err[1]*err[1] + err[2]*err[2]);
+		for (int i=0;i<3;i++) {
+			T dStep = dErrNorm>0 ? err[i]/dErrNorm : 0;//normalized gradient step (negated gradient), in sensor axes
+			pState->gyro_bias[i] -= 2*pState->bias_gain*dStep*dCorrectionTime;
+			correction[i] = 2*pState->gain*dStep*dCorrectionTime;
+		}
+	}
+	else {
+		for (int i=0;i<3;i++) {
+			pState->gyro_bias[i] -= pState->bias_gain*err[i]*dCorrectionTime;
+			correction[i] = pState->gain*err[i]*dCorrectionTime;
+		}
+	}
+	Rotate(pState->q, correction);
+}
+
+/**
+ * @brief FUSION_ENGINE_EKF update. An error-state (multiplicative) extended Kalman filter: the north-east-down orientation quaternion and the gyro bias are the nominal state, and a 6 element error state (small rotation about the sensor axes, then gyro bias error) carries the covariance. The predict step integrates the bias-corrected gyro rates and propagates the covariance; the accelerometer then corrects the tilt (its noise grows when the acceleration magnitude is far from 1 G), and the magnetometer corrects only the rotation about the vertical, so that magnetic disturbances cannot pull the roll and pitch. The first update (or the first one after last_sample_time_sec is set to 0) starts from the acc/mag orientation; the gyro bias estimate is kept across restarts.
+ *
+ * @param pState the orientation state, updated in place
+ * @param acc the normalized acceleration direction (forward-right-down axes, see ToBodyAxes)
+ * @param dAccNorm the length of the acceleration vector before it was normalized (in G)
+ * @param mag the normalized magnetic field direction (forward-right-down axes)
+ * @param dMagNorm the length of the magnetometer vector before it was normalized
+ * @param gyro the angular rate vector (rad/sec, forward-right-down axes)
+ * @param dSampleTimeSec the time of the sample in seconds
+ */
+template <typename T>
+void FusionKernelT<T>::UpdateEKF(FUSION_STATE_T<T> *pState, const T *acc, T dAccNorm, const T *mag, T dMagNorm, const T *gyro, double dSampleTimeSec) {
+	const T INIT_ATTITUDE_SD = T(0.1);//standard deviation of the initial acc/mag orientation (rad)
+	const T INIT_BIAS_SD = T(0.02);//standard deviation of the initial gyro bias (rad/sec)
+	const T ACC_SD = T(0.03);//standard deviation of the measured up direction (unit vector)
+	const T ACC_SD_PER_G = 2;//extra standard deviation of the measured up direction per G that the acceleration magnitude differs from 1 G
+	const T MAG_SD = T(0.05);//standard deviation of the measured field direction (unit vector)
+	const int N = FUSION_EKF_NUM_STATES;
+	FixedMatrix<N,N,T> &P = pState->ekf_cov;
+	if (!pState->have_quat||pState->last_sample_time_sec==0) {
+		if (dAccNorm>0) {
+			if (!pState->have_quat) {
+				P.SetZero();
+				for (int i=3;i<N;i++) {
+					P.m[i][i] = INIT_BIAS_SD*INIT_BIAS_SD;
+				}
+			}
+			//restart the attitude (and its correlation with the bias), but keep the bias estimate
+			for (int i=0;i<3;i++) {
+				for (int j=0;j<N;j++) {
+					P.m[i][j] = 0;
+					P.m[j][i] = 0;
+				}
+				P.m[i][i] = INIT_ATTITUDE_SD*INIT_ATTITUDE_SD;
+			}
+			FromAccMag(acc, mag, pState->q);
+			pState->have_quat = true;
+		}
+		pState->prev_rot_vec[0] = pState->prev_rot_vec[1] = pState->prev_rot_vec[2] = 0;
+		pState->last_sample_time_sec = dSampleTimeSec;
+		return;
+	}
+	T dt = T(dSampleTimeSec - pState->last_sample_time_sec);
+	if (dt>0) {//(0 after Propagate has already brought the orientation up to this sample)
+		EKFPredict(pState, gyro, dt);
+		pState->last_sample_time_sec = dSampleTimeSec;
+	}
+	//correct: the measured minus predicted direction, for a small rotation e of the sensor axes, changes by (predicted x e)
+	T up[3], field[3];//predicted up and magnetic field directions
+	PredictDirections(pState->q, mag, up, field);
+	if (dAccNorm>0) {
+		FixedMatrix<3,3,T> J = {{{0, -up[2], up[1]}, {up[2], 0, -up[0]}, {-up[1], up[0], 0}}};
+		T dSD = ACC_SD + ACC_SD_PER_G*std::fabs(dAccNorm - 1);
+		EKFMeasurement(pState, acc, up, J, dSD*dSD, pState->ekf_acc_nis);
+		PredictDirections(pState->q, mag, up, field);
+	}
+	if (dMagNorm>0) {
+		//only the rotation about the vertical (the down direction d = -up) is observed: J = [field x] * d * d'
+		FixedMatrix<3,3,T> skew = {{{0, -field[2], field[1]}, {field[2], 0, -field[0]}, {-field[1], field[0], 0}}};
+		FixedMatrix<3,1,T> down = {{{-up[0]}, {-up[1]}, {-up[2]}}};
+		FixedMatrix<3,3,T> ddT;
+		ddT.MultiplyTransposed(down, down);
+		FixedMatrix<3,3,T> J;
+		J.Multiply(skew, ddT);
+		EKFMeasurement(pState, mag, field, J, MAG_SD*MAG_SD, pState->ekf_mag_nis);
+	}
+}
+
+template <typename T>
+void FusionKernelT<T>::EKFPredict(FUSION_STATE_T<T> *pState, const T *gyro, T dt) {//Kalman filter predict step: integrate the bias-corrected rate, and propagate the covariance (P = F * P * F' + Q)
+	//gyro = angular rate (rad/sec, forward-right-down axes)
+	//dt = time step in seconds
+	const int N = FUSION_EKF_NUM_STATES;
+	FixedMatrix<N,N,T> &P = pState->ekf_cov;
+	T rate[3] = {gyro[0] - pState->gyro_bias[0], gyro[1] - pState->gyro_bias[1], gyro[2] - pState->gyro_bias[2]};
+	T rot_vec[3] = {rate[0]*dt, rate[1]*dt, rate[2]*dt};
+	IntegrateRotation(pState, rot_vec);
+	FixedMatrix<N,N,T> F;
+	F.SetIdentity();
+	F.m[0][1] = rate[2]*dt;//attitude rows: I - [rate x] * dt, then -I * dt for the bias
+	F.m[0][2] = -rate[1]*dt;
+	F.m[1][0] = -rate[2]*dt;
+	F.m[1][2] = rate[0]*dt;
+	F.m[2][0] = rate[1]*dt;
+	F.m[2][1] = -rate[0]*dt;
+	F.m[0][3] = -dt;
+	F.m[1][4] = -dt;
+	F.m[2][5] = -dt;
+	FixedMatrix<N,N,T> FP;
+	FP.Multiply(F, P);
+	P.MultiplyTransposed(FP, F);
+	T dAttitudeNoise = pState->gain*pState->gain*dt;
+	T dBiasNoise = pState->bias_gain*pState->bias_gain*dt;
+	for (int i=0;i<3;i++) {
+		P.m[i][i] += dAttitudeNoise;
+		P.m[i+3][i+3] += dBiasNoise;
+	}
+}
+
+template <typename T>
+void FusionKernelT<T>::EKFMeasurement(FUSION_STATE_T<T> *pState, const T *measured, const T *predicted, const FixedMatrix<3,3,T> &attitudeJacobian, T dVariance, T &dNIS) {//Kalman filter correction with one measured direction
+	//measured = the measured unit direction in sensor axes
+	//predicted = the same direction predicted from the current orientation
+	//attitudeJacobian = change in (measured - predicted) for a small rotation of the sensor axes (the gyro bias columns of the measurement Jacobian are 0)
+	//dVariance = variance of each component of the measured direction
+	//dNIS = returns the normalized innovation squared
+	const int N = FUSION_EKF_NUM_STATES;
+	FixedMatrix<N,N,T> &P = pState->ekf_cov;
+	FixedMatrix<3,N,T> H;
+	H.SetZero();
+	for (int i=0;i<3;i++) {
+		for (int j=0;j<3;j++) {
+			H.m[i][j] = attitudeJacobian.m[i][j];
+		}
+	}
+	FixedMatrix<N,3,T> PHt;//P * H'
+	PHt.MultiplyTransposed(P, H);
+	FixedMatrix<3,3,T> S;//innovation covariance H * P * H' + R
+	S.Multiply(H, PHt);
+	for (int i=0;i<3;i++) {
+		S.m[i][i] += dVariance;
+	}
+	FixedMatrix<3,3,T> SInv;
+	if (!InvertMatrix3x3(S, SInv)) {
+		return;
+	}
+	FixedMatrix<N,3,T> K;//Kalman gain
+	K.Multiply(PHt, SInv);
+	T y[3] = {measured[0] - predicted[0], measured[1] - predicted[1], measured[2] - predicted[2]};
+	dNIS = 0;
+	for (int i=0;i<3;i++) {
+		for (int j=0;j<3;j++) {
+			dNIS += y[i]*SInv.m[i][j]*y[j];
+		}
+	}
+	T dx[N];//error state estimate
+	for (int i=0;i<N;i++) {
+		dx[i] = K.m[i][0]*y[0] + K.m[i][1]*y[1] + K.m[i][2]*y[2];
+	}
+	//P = P - K * (P * H')'
+	FixedMatrix<N,N,T> KHP;
+	KHP.MultiplyTransposed(K, PHt);
+	P.Subtract(KHP);
+	P.Symmetrize();
+	//move the error state into the orientation and gyro bias (the error state is then 0 again)
+	Rotate(pState->q, dx);
+	for (int i=0;i<3;i++) {
+		pState->gyro_bias[i] += dx[i+3];
+	}
+}
+
+/**
+ * @brief get the quaternion for a set of AMOS roll, pitch, yaw angles (yaw, then pitch, then roll, about the +y, +z, +x axes respectively)
+ *
+ * @param roll the roll angle in degrees
+ * @param pitch the pitch angle in degrees
+ * @param yaw the yaw angle in degrees
+ * @param q the returned (normalized) quaternion
+ */
+template <typename T>
+void FusionKernelT<T>::FromAMOSEuler(T roll, T pitch, T yaw, FUSION_QUAT_T<T> &q) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	T dHalfRoll = roll*DEG_TO_RAD/2;
+	T dHalfPitch = pitch*DEG_TO_RAD/2;
+	T dHalfYaw = yaw*DEG_TO_RAD/2;
+	FUSION_QUAT_T<T> qx = {std::cos(dHalfRoll), std::sin(dHalfRoll), 0, 0};
+	FUSION_QUAT_T<T> qz = {std::cos(dHalfPitch), 0, 0, std::sin(dHalfPitch)};
+	FUSION_QUAT_T<T> qy = {std::cos(dHalfYaw), 0, std::sin(dHalfYaw), 0};
+	FUSION_QUAT_T<T> qt1;
+	Multiply(qy, qz, qt1);
+	Multiply(qt1, qx, q);
+	T dLength = std::sqrt(q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z);
+	q.w/=dLength;
+	q.x/=dLength;
+	q.y/=dLength;
+	q.z/=dLength;
+}
+
+/**
+ * @brief get the AMOS roll, pitch, yaw angles of a quaternion, straight from the rotation matrix elements that the angles depend on (the same angles as OrientationMath::MatrixToEuler of the rotation matrix, except within about 0.1 degree of straight up or down pitch, where that splits the roll and yaw differently)
+ *
+ * @param q the quaternion (does not need to be normalized)
+ * @param roll the returned roll angle in degrees (-180 to 180)
+ * @param pitch the returned pitch angle in degrees
+ * @param yaw the returned yaw angle in degrees (0 to 360)
+ */
+template <typename T>
+void FusionKernelT<T>::ToAMOSRPY(const FUSION_QUAT_T<T> &q, T &roll, T &pitch, T &yaw) {
+	T n = q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z;
+	T s = n>0 ? 2/n : 0;
+	T xs = q.x*s;	T ys = q.y*s;	T zs = q.z*s;
+	T wx = q.w*xs;	T wy = q.w*ys;	T wz = q.w*zs;
+	T xx = q.x*xs;	T xy = q.x*ys;	T xz = q.x*zs;
+	T yy = q.y*ys;	T yz = q.y*zs;	T zz = q.z*zs;
+	//only 5 elements of the rotation matrix are needed: pitch from the y component of the rotated x axis, yaw from its x and z components, and roll from the y components of the rotated y and z axes
+	const T RAD_TO_DEG = T(57.295779513082);
+	T m10 = xy + wz;
+	if (m10>1) m10 = 1;
+	else if (m10<-1) m10 = -1;
+	pitch = -std::asin(m10)*RAD_TO_DEG;
+	yaw = std::atan2(xz - wy, 1 - (yy + zz))*RAD_TO_DEG;
+	roll = std::atan2(yz - wx, 1 - (xx + zz))*RAD_TO_DEG;
+	//check limits of yaw (should be 0 to 360) and roll (should be -180 to 180)
+	if (yaw<0) {
+		yaw+=360;
+	}
+	else if (yaw>360) {
+		yaw-=360;
+	}
+	if (roll<-180) {
+		roll+=360;
+	}
+	else if (roll>180) {
+		roll-=360;
+	}
+}
+
+template <typename T>
+void FusionKernelT<T>::Multiply(const FUSION_QUAT_T<T> &q1, const FUSION_QUAT_T<T> &q2, FUSION_QUAT_T<T> &result) {//quaternion product q1 * q2
+	//result must not be the same object as q1 or q2
+	result.w = q1.w*q2.w - (q1.x*q2.x + q1.y*q2.y + q1.z*q2.z);
+	result.x = q1.w*q2.x + q2.w*q1.x + (q1.y*q2.z - q1.z*q2.y);
+	result.y = q1.w*q2.y + q2.w*q1.y + (q1.z*q2.x - q1.x*q2.z);
+	result.z = q1.w*q2.z + q2.w*q1.z + (q1.x*q2.y - q1.y*q2.x);
+}
+
+template <typename T>
+void FusionKernelT<T>::Slerp(FUSION_QUAT_T<T> &q, const FUSION_QUAT_T<T> &other, T t) {//spherical linear interpolation from q towards other (same as quaternion2::slerp)
+	//t = the fraction of other in the result (0 to 1)
+	T dSign = 1;
+	T dDotproduct = other.w*q.w + other.x*q.x + other.y*q.y + other.z*q.z;
+	if (dDotproduct<0) {
+		dSign = -1;
+		dDotproduct = -dDotproduct;
+	}
+	if (dDotproduct>T(0.99999)) return; //practically the same
+	T dAngle = std::acos(dDotproduct);
+	T dSinAngle = std::sin(dAngle);
+	T dFactor1 = std::sin((1-t)*dAngle)/dSinAngle;
+	T dFactor2 = dSign*std::sin(t*dAngle)/dSinAngle;
+	q.w = q.w*dFactor1 + other.w*dFactor2;
+	q.x = q.x*dFactor1 + other.x*dFactor2;
+	q.y = q.y*dFactor1 + other.y*dFactor2;
+	q.z = q.z*dFactor1 + other.z*dFactor2;
+}
+
+template <typename T>
+void FusionKernelT<T>::ToBodyAxes(T *acc_data, T *mag_data, T *angular_rate, T *acc, T *mag, T *gyro, T &dAccNorm, T &dMagNorm) {//map the sensor vectors onto forward-right-down axes, normalize the acc and mag vectors, and convert the gyro rates to rad/sec
+	//acc, mag = return the normalized directions (acc points up when at rest), left as they are if their length is 0
+	//gyro = returns the angular rates in rad/sec
+	//dAccNorm, dMagNorm = return the lengths of the acc and mag vectors before they were normalized
+	//(the acc z axis and mag x, y axes were already flipped when the data was read, see IMU::GetAccData and IMU::GetMagnetometerData)
+	const T DEG_TO_RAD = T(0.01745329251994);
+	acc[0] = -acc_data[0];
+	acc[1] = acc_data[1];
+	acc[2] = -acc_data[2];
+	mag[0] = mag_data[0];
+	mag[1] = -mag_data[1];
+	mag[2] = -mag_data[2];
+	gyro[0] = -angular_rate[0]*DEG_TO_RAD;
+	gyro[1] = angular_rate[1]*DEG_TO_RAD;
+	gyro[2] = -angular_rate[2]*DEG_TO_RAD;
+	dAccNorm = std::sqrt(acc[0]*acc[0] + acc[1]*acc[1] + acc[2]*acc[2]);
+	dMagNorm = std::sqrt(mag[0]*mag[0] + mag[1]*mag[1] + mag[2]*mag[2]);
+	//(scale by the reciprocal, written without branches so that the same arithmetic vectorizes in UpdateBatch)
+	T dAccScale = 1/(dAccNorm + (dAccNorm>0 ? T(0) : T(1)));
+	T dMagScale = 1/(dMagNorm + (dMagNorm>0 ? T(0) : T(1)));
+	acc[0]*=dAccScale; acc[1]*=dAccScale; acc[2]*=dAccScale;
+	mag[0]*=dMagScale; mag[1]*=dMagScale; mag[2]*=dMagScale;
+}
+
+template <typename T>
+void FusionKernelT<T>::AccMagAMOSQuat(const T *acc_data, const T *mag_data, FUSION_QUAT_T<T> &q) {//AMOS orientation straight from the acc and mag vectors, for FUSION_ENGINE_SLERP
+	//roll and pitch come from the acceleration vector, and the heading from the tilt-compensated magnetometer vector
+	const T RAD_TO_DEG = T(57.29578);
+	T dPitchAngleRad = std::asin(-acc_data[0]);//pitch angle in radians
+	T dCosPitch = std::cos(dPitchAngleRad);
+	T dSinPitch = std::sin(dPitchAngleRad);
+	T dRollAngleRad = 0;//roll angle in radians
+	if (dCosPitch!=0) {
+		dRollAngleRad = std::asin(acc_data[1] / dCosPitch);
+	}
+	T dCosRoll = std::cos(dRollAngleRad);
+	T dSinRoll = std::sin(dRollAngleRad);
+	T mx2 = mag_data[0]*dCosPitch - mag_data[2]*dSinPitch;
+	T my2 = mag_data[0]*dSinPitch*dSinRoll + mag_data[1]*dCosRoll + mag_data[2]*dCosPitch*dSinRoll;
+	T dHeadingAngleRad = std::atan2(my2,mx2);//heading angle in radians
+	T dHeading = dHeadingAngleRad*RAD_TO_DEG;
+	//make sure heading is between 0 and 360
+	if (dHeading<0) dHeading+=360;
+	else if (dHeading>360) dHeading-=360;
+	FromAMOSEuler(-dRollAngleRad*RAD_TO_DEG, -dPitchAngleRad*RAD_TO_DEG, -dHeading, q);
+}
+
+template <typename T>
+void FusionKernelT<T>::PredictDirections(const FUSION_QUAT_T<T> &q, const T *mag, T *up, T *field) {//up and magnetic field directions (in sensor axes) predicted from a north-east-down orientation
+	//mag = the measured (normalized) field direction, used for the field reference
+	//up = returns the predicted up direction: third row of the sensor to world rotation matrix, negated
+	//field = returns the predicted field direction: the measured field rotated into the world, with its horizontal part turned to north (so that only the direction of north matters, not the local declination), and rotated back into sensor axes
+	up[0] = -2*(q.x*q.z - q.w*q.y);
+	up[1] = -2*(q.y*q.z + q.w*q.x);
+	up[2] = -(1 - 2*(q.x*q.x + q.y*q.y));
+	T hx = (1 - 2*(q.y*q.y + q.z*q.z))*mag[0] + 2*(q.x*q.y - q.w*q.z)*mag[1] + 2*(q.x*q.z + q.w*q.y)*mag[2];
+	T hy = 2*(q.x*q.y + q.w*q.z)*mag[0] + (1 - 2*(q.x*q.x + q.z*q.z))*mag[1] + 2*(q.y*q.z - q.w*q.x)*mag[2];
+	T hz = -up[0]*mag[0] - up[1]*mag[1] - up[2]*mag[2];
+	T bx = std::sqrt(hx*hx + hy*hy);
+	field[0] = (1 - 2*(q.y*q.y + q.z*q.z))*bx - up[0]*hz;
+	field[1] = 2*(q.x*q.y - q.w*q.z)*bx - up[1]*hz;
+	field[2] = 2*(q.x*q.z + q.w*q.y)*bx - up[2]*hz;
+}
+
+template <typename T>
+void FusionKernelT<T>::IntegrateRotation(FUSION_STATE_T<T> *pState, T *rot_vec) {//rotate the orientation by one gyro step, with coning correction
+	//rot_vec = rotation vector of the step (rate * dt, in radians, in the axes of q), gets replaced by the coning-corrected rotation vector
+	//the coning correction (1/12 of the cross product of the previous and current steps) accounts for the rotation axis itself turning during the step
+	T *prev = pState->prev_rot_vec;
+	T raw[3] = {rot_vec[0], rot_vec[1], rot_vec[2]};
+	rot_vec[0] += (prev[1]*raw[2] - prev[2]*raw[1])/12;
+	rot_vec[1] += (prev[2]*raw[0] - prev[0]*raw[2])/12;
+	rot_vec[2] += (prev[0]*raw[1] - prev[1]*raw[0])/12;
+	prev[0] = raw[0];
+	prev[1] = raw[1];
+	prev[2] = raw[2];
+	Rotate(pState->q, rot_vec);
+}
+
+template <typename T>
+void FusionKernelT<T>::Rotate(FUSION_QUAT_T<T> &q, const T *rot_vec) {//q = q * exp(rot_vec / 2), the exact rotation by a rotation vector (radians, in the axes of q), then renormalize
+	T dAngleSq = rot_vec[0]*rot_vec[0] + rot_vec[1]*rot_vec[1] + rot_vec[2]*rot_vec[2];
+	T dCos, dSinFactor;//cos(angle/2), and sin(angle/2)/angle
+	if (dAngleSq<T(1e-4)) {//series expansion (exact to double precision below 0.01 rad, which covers single gyro steps below about 1 rad/sec at 104 Hz, and avoids the trig functions)
+		dCos = 1 - dAngleSq/8 + dAngleSq*dAngleSq/384;
+		dSinFactor = T(0.5) - dAngleSq/48 + dAngleSq*dAngleSq/3840;
+	}
+	else {
+		T dAngle = std::sqrt(dAngleSq);
+		dCos = std::cos(T(0.5)*dAngle);
+		dSinFactor = std::sin(T(0.5)*dAngle)/dAngle;
+	}
+	FUSION_QUAT_T<T> dq = {dCos, rot_vec[0]*dSinFactor, rot_vec[1]*dSinFactor, rot_vec[2]*dSinFactor};
+	FUSION_QUAT_T<T> rotated;
+	Multiply(q, dq, rotated);
+	T dLength = std::sqrt(rotated.w*rotated.w + rotated.x*rotated.x + rotated.y*rotated.y + rotated.z*rotated.z);
+	q.w = rotated.w/dLength;
+	q.x = rotated.x/dLength;
+	q.y = rotated.y/dLength;
+	q.z = rotated.z/dLength;
+}
+
+template <typename T>
+void FusionKernelT<T>::FromAccMag(const T *acc, const T *mag, FUSION_QUAT_T<T> &q) {//north-east-down orientation straight from the (normalized, forward-right-down) acc and mag vectors
+	//acc = the measured up direction, mag = the measured field direction (can be a null vector if there is no magnetometer data, then the sensor x axis is taken as north)
+	//rows of the sensor to world rotation matrix: the down, east, and north directions in sensor axes
+	T down[3] = {-acc[0], -acc[1], -acc[2]};
+	T east[3] = {down[1]*mag[2] - down[2]*mag[1], down[2]*mag[0] - down[0]*mag[2], down[0]*mag[1] - down[1]*mag[0]};
+	T dEastNorm = std::sqrt(east[0]*east[0] + east[1]*east[1] + east[2]*east[2]);
+	if (dEastNorm<T(1e-9)) {//no field, or field straight up or down
+		east[0] = 0;
+		east[1] = -down[2];
+		east[2] = down[1];
+		dEastNorm = std::sqrt(east[1]*east[1] + east[2]*east[2]);
+		if (dEastNorm<T(1e-9)) {//sensor x axis straight up or down
+			east[1] = 1;
+			dEastNorm = 1;
+		}
+	}
+	east[0]/=dEastNorm; east[1]/=dEastNorm; east[2]/=dEastNorm;
+	T north[3] = {east[1]*down[2] - east[2]*down[1], east[2]*down[0] - east[0]*down[2], east[0]*down[1] - east[1]*down[0]};
+	//rotation matrix to quaternion
+	T m00 = north[0], m01 = north[1], m02 = north[2];
+	T m10 = east[0], m11 = east[1], m12 = east[2];
+	T m20 = down[0], m21 = down[1], m22 = down[2];
+	T dTrace = m00 + m11 + m22;
+	if (dTrace>0) {
+		T s = 2*std::sqrt(dTrace + 1);
+		q.w = T(0.25)*s;
+		q.x = (m21 - m12)/s;
+		q.y = (m02 - m20)/s;
+		q.z = (m10 - m01)/s;
+	}
+	else if (m00>m11&&m00>m22) {
+		T s = 2*std::sqrt(1 + m00 - m11 - m22);
+		q.w = (m21 - m12)/s;
+		q.x = T(0.25)*s;
+		q.y = (m01 + m10)/s;
+		q.z = (m02 + m20)/s;
+	}
+	else if (m11>m22) {
+		T s = 2*std::sqrt(1 + m11 - m00 - m22);
+		q.w = (m02 - m20)/s;
+		q.x = (m01 + m10)/s;
+		q.y = T(0.25)*s;
+		q.z = (m12 + m21)/s;
+	}
+	else {
+		T s = 2*std::sqrt(1 + m22 - m00 - m11);
+		q.w = (m10 - m01)/s;
+		q.x = (m02 + m20)/s;
+		q.y = (m12 + m21)/s;
+		q.z = T(0.25)*s;
+	}
+}
+
+/**
+ * @brief get the roll, pitch, and heading angles of a north-east-down orientation quaternion (e.g. from GetQuaternion), with the same sign conventions as ToAMOSRPY. The heading is the yaw of the forward axis (clockwise from north), the pitch is positive with the forward axis above the horizon, and the roll is the opposite of the usual right-side-down roll, to match the acc/mag angles of FUSION_ENGINE_SLERP.
+ *
+ * @param q the orientation quaternion (forward-right-down sensor axes to north-east-down world axes)
+ * @param roll the returned roll angle in degrees (-180 to 180)
+ * @param pitch the returned pitch angle in degrees
+ * @param heading the returned heading angle in degrees (0 to 360)
+ */
+template <typename T>
+void FusionKernelT<T>::ToNEDAngles(const FUSION_QUAT_T<T> &q, T &roll, T &pitch, T &heading) {
+	const T RAD_TO_DEG = T(57.29578);
+	T dSinPitch = 2*(q.w*q.y - q.x*q.z);
+	if (dSinPitch>1) dSinPitch = 1;
+	else if (dSinPitch<-1) dSinPitch = -1;
+	pitch = std::asin(dSinPitch)*RAD_TO_DEG;
+	roll = -std::atan2(2*(q.w*q.x + q.y*q.z), 1 - 2*(q.x*q.x + q.y*q.y))*RAD_TO_DEG;
+	heading = std::atan2(2*(q.w*q.z + q.x*q.y), 1 - 2*(q.y*q.y + q.z*q.z))*RAD_TO_DEG;
+	if (heading<0) heading+=360;
+}
+
+/**
+ * @brief get the north-east-down orientation quaternion of a set of roll, pitch, and heading angles (the inverse of ToNEDAngles)
+ *
+ * @param roll the roll angle in degrees (ToNEDAngles convention, the opposite of the usual right-side-down roll)
+ * @param pitch the pitch angle in degrees
+ * @param heading the heading angle in degrees
+ * @param q the returned orientation quaternion (forward-right-down sensor axes to north-east-down world axes)
+ */
+template <typename T>
+void FusionKernelT<T>::FromNEDAngles(T roll, T pitch, T heading, FUSION_QUAT_T<T> &q) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	//heading about down, then pitch about right, then roll about forward
+	T dHalfRoll = -roll*DEG_TO_RAD/2;
+	T dHalfPitch = pitch*DEG_TO_RAD/2;
+	T dHalfHeading = heading*DEG_TO_RAD/2;
+	T cr = std::cos(dHalfRoll), sr = std::sin(dHalfRoll);
+	T cp = std::cos(dHalfPitch), sp = std::sin(dHalfPitch);
+	T ch = std::cos(dHalfHeading), sh = std::sin(dHalfHeading);
+	q.w = ch*cp*cr + sh*sp*sr;
+	q.x = ch*cp*sr - sh*sp*cr;
+	q.y = ch*sp*cr + sh*cp*sr;
+	q.z = sh*cp*cr - ch*sp*sr;
+}
+
+/**
+ * @brief get the angular rate of a sample about the forward-right-down sensor axes (the axes of GetQuaternion), in rad/sec, with the gyro bias estimated by the engine removed (FUSION_ENGINE_SLERP does not estimate a bias, so only the axes and units are changed)
+ *
+ * @param pState the orientation state
+ * @param angular_rate the angular rate vector of the sample (RX,RY,RZ, deg/s)
+ * @param rate the returned bias-corrected angular rate (forward, right, down, rad/sec)
+ */
+template <typename T>
+void FusionKernelT<T>::GetCorrectedRate(const FUSION_STATE_T<T> *pState, const T *angular_rate, T *rate) {
+	const T DEG_TO_RAD = T(0.01745329251994);
+	rate[0] = -angular_rate[0]*DEG_TO_RAD - pState->gyro_bias[0];
+	rate[1] = angular_rate[1]*DEG_TO_RAD - pState->gyro_bias[1];
+	rate[2] = -angular_rate[2]*DEG_TO_RAD - pState->gyro_bias[2];
+}
+
+/**
+ * @brief extrapolate an orientation quaternion by dt seconds, assuming that the angular rate stays constant over that time. This is a single exact rotation (see Rotate), which for the short extrapolations it is meant for (a few ms) stays in the series expansion and needs no trig functions.
+ *
+ * @param q the orientation quaternion (forward-right-down sensor axes to north-east-down world axes, see GetQuaternion)
+ * @param rate the angular rate (forward, right, down, rad/sec, see GetCorrectedRate)
+ * @param dt the time to extrapolate by in seconds (can be negative)
+ * @param predicted the returned orientation quaternion (can be the same as q)
+ */
+template <typename T>
+void FusionKernelT<T>::PredictQuaternion(const FUSION_QUAT_T<T> &q, const T *rate, T dt, FUSION_QUAT_T<T> &predicted) {
+	T rot_vec[3] = {rate[0]*dt, rate[1]*dt, rate[2]*dt};
+	predicted = q;
+	Rotate(predicted, rot_vec);
+}
+
+/**
+ * @brief get the linear (dynamic) acceleration of a sample about the north-east-down world axes, by rotating its specific force (what the accelerometer measures) from the sensor axes with the orientation, and removing gravity. This only uses products of the quaternion components (no trig functions), so it can run on every sample along with the orientation update.
+ *
+ * @param q the orientation quaternion of the sample (forward-right-down sensor axes to north-east-down world axes, see GetQuaternion)
+ * @param specific_force the specific force vector of the sample in G (calibrated but not normalized, with the same axes and signs as acc_data)
+ * @param linear_acc the returned acceleration in G (north, east, down), which is zero when the sensor is not accelerating
+ */
+template <typename T>
+void FusionKernelT<T>::GetLinearAcceleration(const FUSION_QUAT_T<T> &q, const T *specific_force, T *linear_acc) {
+	//map onto forward-right-down axes (the same as ToBodyAxes, so that the specific force points up when the sensor is at rest)
+	T f[3] = {-specific_force[0], specific_force[1], -specific_force[2]};
+	T xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+	T xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+	T wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+	//rotate into north-east-down axes, then add the 1 G that gravity takes away from the down axis of the specific force
+	linear_acc[0] = (1 - 2*(yy + zz))*f[0] + 2*(xy - wz)*f[1] + 2*(xz + wy)*f[2];
+	linear_acc[1] = 2*(xy + wz)*f[0] + (1 - 2*(xx + zz))*f[1] + 2*(yz - wx)*f[2];
+	linear_acc[2] = 2*(xz - wy)*f[0] + 2*(yz + wx)*f[1] + (1 - 2*(xx + yy))*f[2] + 1;
+}
+
+template class FusionKernelT<double>;
+template class FusionKernelT<float>;
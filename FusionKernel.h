@@ -0,0 +1,124 @@
+#pragma once
+#include "FixedMatrix.h"
+//allocation-free acc/mag/gyro fusion kernel used by IMU::ComputeOrientation, built on plain fixed-size structures (no virtual functions, object counters, or heap memory), so that it is cheap enough to run at kHz rates
+//the kernel and its structures are templates on the element type, instantiated for double (FusionKernel, used by IMU) and float (FusionKernelF, for targets without double-precision hardware, and twice the SIMD width in UpdateBatch); sample times are kept in double for both, so that long runs keep their time resolution
+
+//fusion engines (see FusionKernel::SetEngine)
+#define FUSION_ENGINE_SLERP 0 //acc/mag Euler angles blended with the gyro-rotated orientation by spherical linear interpolation (default)
+#define FUSION_ENGINE_MADGWICK 1 //Madgwick gradient-descent filter working directly on the acc, mag, and gyro vectors, with gyro bias drift compensation
+#define FUSION_ENGINE_MAHONY 2 //Mahony nonlinear complementary filter working directly on the acc, mag, and gyro vectors, with integral (gyro bias) feedback
+#define FUSION_ENGINE_EKF 3 //error-state extended Kalman filter that estimates the orientation and gyro bias, along with their covariance
+#define FUSION_MADGWICK_DEFAULT_BETA 0.1 //default gradient step gain (rad/sec) of the Madgwick filter
+#define FUSION_MADGWICK_DEFAULT_ZETA 0.004 //default gyro bias drift gain (rad/sec^2) of the Madgwick filter
+#define FUSION_MAHONY_DEFAULT_KP 1.0 //default proportional gain (rad/sec) of the Mahony filter
+#define FUSION_MAHONY_DEFAULT_KI 0.05 //default integral gain (rad/sec^2) of the Mahony filter
+#define FUSION_EKF_DEFAULT_GYRO_NOISE 0.005 //default gyro noise density (rad/sec/sqrt(Hz)) of the error-state Kalman filter
+#define FUSION_EKF_DEFAULT_BIAS_NOISE 0.0002 //default gyro bias random walk (rad/sec^2/sqrt(Hz)) of the error-state Kalman filter
+#define FUSION_EKF_NUM_STATES 6 //size of the error state: 3 attitude errors (rad) followed by 3 gyro bias errors (rad/sec)
+#define FUSION_BATCH_BLOCK_SIZE 128 //number of samples that FusionKernel::UpdateBatch preprocesses at a time (sized so that the block buffers stay in the L1 cache)
+
+template <typename T>
+struct FUSION_QUAT_T {//quaternion (w = scalar part, x, y, z = vector part), same convention as quaternion2
+	T w;
+	T x;
+	T y;
+	T z;
+};
+typedef FUSION_QUAT_T<double> FUSION_QUAT;
+typedef FUSION_QUAT_T<float> FUSION_QUATF;
+
+template <typename T>
+struct FUSION_SAMPLE_SPANS_T {//a block of samples held as one array per component (struct of arrays), for FusionKernel::UpdateBatch
+	const double *t;//time of each sample in seconds
+	const T *ax;//acceleration X components (in G)
+	const T *ay;//acceleration Y components (in G)
+	const T *az;//acceleration Z components (in G)
+	const T *mx;//magnetometer X components (normalized units)
+	const T *my;//magnetometer Y components (normalized units)
+	const T *mz;//magnetometer Z components (normalized units)
+	const T *gx;//angular rate RX components (deg/sec)
+	const T *gy;//angular rate RY components (deg/sec)
+	const T *gz;//angular rate RZ components (deg/sec)
+};
+typedef FUSION_SAMPLE_SPANS_T<double> FUSION_SAMPLE_SPANS;
+typedef FUSION_SAMPLE_SPANS_T<float> FUSION_SAMPLE_SPANSF;
+
+template <typename T>
+struct FUSION_ORIENTATION_SPANS_T {//arrays that receive the orientation of a block of samples, any of them can be nullptr if they are not needed
+	T *qw;//scalar parts of the orientation quaternions (forward-right-down sensor axes to north-east-down, see FusionKernel::GetQuaternion)
+	T *qx;//x parts of the orientation quaternions
+	T *qy;//y parts of the orientation quaternions
+	T *qz;//z parts of the orientation quaternions
+	T *roll;//roll angles in degrees (-180 to 180)
+	T *pitch;//pitch angles in degrees
+	T *heading;//heading angles in degrees (0 to 360)
+};
+typedef FUSION_ORIENTATION_SPANS_T<double> FUSION_ORIENTATION_SPANS;
+typedef FUSION_ORIENTATION_SPANS_T<float> FUSION_ORIENTATION_SPANSF;
+
+template <typename T>
+struct FUSION_STATE_T {//orientation state carried from one fusion update to the next
+	int engine;//one of the FUSION_ENGINE_... values
+	T gain;//Madgwick beta, Mahony Kp, or Kalman filter gyro noise density (not used by FUSION_ENGINE_SLERP)
+	T bias_gain;//Madgwick zeta, Mahony Ki, or Kalman filter gyro bias random walk (not used by FUSION_ENGINE_SLERP)
+	FUSION_QUAT_T<T> q;//current orientation (AMOS convention, y-up world, for FUSION_ENGINE_SLERP; sensor to north-east-down world for the other engines)
+	bool have_quat;//true once q holds an orientation
+	double last_sample_time_sec;//time of the last update (in seconds), set this to 0 to restart from the acc/mag orientation without integrating the gyros (e.g. after the sensors were powered down)
+	double last_correction_time_sec;//time of the last acc/mag correction (in seconds), used by the Madgwick and Mahony engines so that the feedback covers the readings integrated by Propagate
+	T prev_rot_vec[3];//rotation vector of the previous gyro step (in radians, in the axes of q), for the coning correction
+	T gyro_bias[3];//estimated gyro bias (rad/sec, forward-right-down sensor axes) that gets subtracted from the angular rates by the Madgwick, Mahony, and Kalman filter engines
+	FixedMatrix<FUSION_EKF_NUM_STATES,FUSION_EKF_NUM_STATES,T> ekf_cov;//error-state covariance of the Kalman filter engine (attitude errors in rad about the forward-right-down sensor axes, then gyro bias errors in rad/sec)
+	T ekf_acc_nis;//normalized innovation squared of the last Kalman filter accelerometer update (about 2 on average when the filter is consistent)
+	T ekf_mag_nis;//normalized innovation squared of the last Kalman filter magnetometer update (about 1 on average when the filter is consistent)
+};
+typedef FUSION_STATE_T<double> FUSION_STATE;
+typedef FUSION_STATE_T<float> FUSION_STATEF;
+
+struct FUSION_HEALTH {//orientation uncertainty and gyro bias estimate of the fusion engine, for health monitoring
+	bool have_covariance;//true if the engine keeps a covariance (FUSION_ENGINE_EKF) and has started, otherwise the standard deviations and innovation values are all 0
+	double attitude_sd_deg[3];//standard deviation of the orientation error about the forward, right, and down sensor axes (in degrees)
+	double heading_sd_deg;//standard deviation of the heading (in degrees)
+	double gyro_bias_dps[3];//estimated gyro bias in the axes of IMU_DATASAMPLE::angular_rate (in deg/sec, already subtracted from the angular rates by the fusion engine)
+	double gyro_bias_sd_dps[3];//standard deviation of the gyro bias estimate (in deg/sec)
+	double acc_nis;//normalized innovation squared of the last accelerometer update, values that stay well above 2 mean that the acceleration is not just gravity (or the filter is overconfident)
+	double mag_nis;//normalized innovation squared of the last magnetometer update, values that stay well above 1 mean magnetic disturbances
+};
+
+template <typename T>
+class FusionKernelT {//fuses acc/mag orientation with integrated gyro rates, using one of the FUSION_ENGINE_... engines (use the FusionKernel or FusionKernelF instantiations)
+public:
+	static void Reset(FUSION_STATE_T<T> *pState);//clear the orientation state and select the default (FUSION_ENGINE_SLERP) engine
+	static bool SetEngine(FUSION_STATE_T<T> *pState, int nEngine, T dGain, T dBiasGain);//select the fusion engine and its gains, and clear the orientation state
+	static bool EstimatesGyroBias(const FUSION_STATE_T<T> *pState);//returns true if the selected engine estimates (and removes) the gyro bias itself
+	static void GetHealth(const FUSION_STATE_T<T> *pState, FUSION_HEALTH *pHealth);//get the orientation uncertainty and gyro bias estimate
+	static void Update(FUSION_STATE_T<T> *pState, T *acc_data, T *mag_data, T *angular_rate, double dSampleTimeSec, T &roll, T &pitch, T &heading);//fuse one acc/mag/gyro sample into the orientation state, and get the resulting orientation angles in degrees
+	static void UpdateQuaternion(FUSION_STATE_T<T> *pState, T *acc_data, T *mag_data, T *angular_rate, double dSampleTimeSec);//fuse one acc/mag/gyro sample into the orientation state, without computing any angles
+	static void GetQuaternion(const FUSION_STATE_T<T> *pState, FUSION_QUAT_T<T> &q);//get the orientation as a forward-right-down to north-east-down quaternion (the same for every engine)
+	static void GetAngles(const FUSION_STATE_T<T> *pState, T &roll, T &pitch, T &heading);//get the orientation angles in degrees of the orientation state
+	static void UpdateBatch(FUSION_STATE_T<T> *pState, const FUSION_SAMPLE_SPANS_T<T> *pSamples, int nNumSamples, FUSION_ORIENTATION_SPANS_T<T> *pAngles);//fuse a block of samples held as one array per component, with the same results as calling Update for each one
+	static void Propagate(FUSION_STATE_T<T> *pState, const T *angular_rates, const double *reading_times, int nNumReadings);//propagate the orientation with a run of gyro readings (e.g. a FIFO run) between acc/mag corrections
+	static void FromAMOSEuler(T roll, T pitch, T yaw, FUSION_QUAT_T<T> &q);//quaternion for AMOS roll, pitch, yaw angles in degrees (same as the quaternion2 roll, pitch, yaw constructor)
+	static void ToAMOSRPY(const FUSION_QUAT_T<T> &q, T &roll, T &pitch, T &yaw);//AMOS roll, pitch, yaw angles in degrees of a quaternion, straight from its components (same angles as quaternion2::getRotMatrix followed by tmatrix::getAMOSRPY, away from straight up or down pitch)
+	static void ToNEDAngles(const FUSION_QUAT_T<T> &q, T &roll, T &pitch, T &heading);//roll, pitch, heading in degrees of a north-east-down orientation quaternion, with the same sign conventions as ToAMOSRPY
+	static void FromNEDAngles(T roll, T pitch, T heading, FUSION_QUAT_T<T> &q);//north-east-down orientation quaternion of a set of roll, pitch, heading angles in degrees (the inverse of ToNEDAngles)
+	static void GetCorrectedRate(const FUSION_STATE_T<T> *pState, const T *angular_rate, T *rate);//angular rate in rad/sec about the forward-right-down sensor axes, with the estimated gyro bias removed
+	static void PredictQuaternion(const FUSION_QUAT_T<T> &q, const T *rate, T dt, FUSION_QUAT_T<T> &predicted);//extrapolate a north-east-down orientation quaternion by dt seconds at a constant (forward-right-down, rad/sec) angular rate
+	static void GetLinearAcceleration(const FUSION_QUAT_T<T> &q, const T *specific_force, T *linear_acc);//acceleration in G about the north-east-down world axes with gravity removed, from the specific force of a sample (same axes and signs as acc_data) and its orientation
+	static void Multiply(const FUSION_QUAT_T<T> &q1, const FUSION_QUAT_T<T> &q2, FUSION_QUAT_T<T> &result);//quaternion product q1 * q2
+	static void Slerp(FUSION_QUAT_T<T> &q, const FUSION_QUAT_T<T> &other, T t);//spherical linear interpolation from q towards other (same as quaternion2::slerp)
+
+private:
+	static void UpdateSlerp(FUSION_STATE_T<T> *pState, const FUSION_QUAT_T<T> &accMagQuat, const T *angular_rate, double dSampleTimeSec);//FUSION_ENGINE_SLERP update
+	static void UpdateGradient(FUSION_STATE_T<T> *pState, const T *acc, T dAccNorm, const T *mag, T dMagNorm, const T *gyro, double dSampleTimeSec);//FUSION_ENGINE_MADGWICK and FUSION_ENGINE_MAHONY update, with the sample already in forward-right-down axes
+	static void UpdateEKF(FUSION_STATE_T<T> *pState, const T *acc, T dAccNorm, const T *mag, T dMagNorm, const T *gyro, double dSampleTimeSec);//FUSION_ENGINE_EKF update, with the sample already in forward-right-down axes
+	static void EKFPredict(FUSION_STATE_T<T> *pState, const T *gyro, T dt);//Kalman filter predict step
+	static void EKFMeasurement(FUSION_STATE_T<T> *pState, const T *measured, const T *predicted, const FixedMatrix<3,3,T> &attitudeJacobian, T dVariance, T &dNIS);//Kalman filter correction with one measured direction
+	static void ToBodyAxes(T *acc_data, T *mag_data, T *angular_rate, T *acc, T *mag, T *gyro, T &dAccNorm, T &dMagNorm);//map the sensor vectors onto forward-right-down axes, normalize the acc and mag vectors, and convert the gyro rates to rad/sec
+	static void AccMagAMOSQuat(const T *acc_data, const T *mag_data, FUSION_QUAT_T<T> &q);//AMOS orientation straight from the acc and mag vectors, for FUSION_ENGINE_SLERP
+	static void PredictDirections(const FUSION_QUAT_T<T> &q, const T *mag, T *up, T *field);//up and magnetic field directions (in sensor axes) predicted from a north-east-down orientation
+	static void IntegrateRotation(FUSION_STATE_T<T> *pState, T *rot_vec);//rotate the orientation by one gyro step, with coning correction
+	static void Rotate(FUSION_QUAT_T<T> &q, const T *rot_vec);//q = q * exp(rot_vec / 2), the exact rotation by a rotation vector
+	static void FromAccMag(const T *acc, const T *mag, FUSION_QUAT_T<T> &q);//north-east-down orientation straight from the (normalized, forward-right-down) acc and mag vectors
+};
+typedef FusionKernelT<double> FusionKernel;//double-precision fusion kernel
+typedef FusionKernelT<float> FusionKernelF;//single-precision fusion kernel
@@ -13,6 +13,7 @@
 #include <fcntl.h>				//Needed for I2C port
 #include <sys/ioctl.h>			//Needed for I2C port
 #include <linux/i2c-dev.h>		//Needed for I2C port
+#include <linux/i2c.h>			//Needed for combined (I2C_RDWR) transactions
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -25,6 +26,8 @@
 #include <wiringPi.h>
 #include "ShipLog.h"
 #include "IMU.h"
+#include "SampleBus.h"
+#include "OrientationSlot.h"
 #include "Util.h"
 #include "filedata.h"
 
@@ -37,15 +40,61 @@ extern ShipLog g_shiplog;//used for logging data and to assist in debugging
  * @param i2c_mutex mutex controlling access to the i2c bus
  */
 IMU::IMU(pthread_mutex_t *i2c_mutex) {//constructor
+	m_dInitStartTime = GetMonotonicTimeSec();
+	memset(&m_initTiming, 0, sizeof(IMU_INIT_TIMING));
 	m_i2c_mutex = i2c_mutex;
-	m_quat = nullptr;
+	FusionKernel::Reset(&m_fusion);
+	memset(&m_fusionHealth, 0, sizeof(FUSION_HEALTH));
+	m_bGyroHighPass = true;
+	m_bLazyAngles = false;
+	m_dVelocityLeakSec = IMU_DEFAULT_VELOCITY_LEAK_SEC;
+	memset(m_velocity, 0, 3*sizeof(double));
+	m_dLastVelocityTime = 0.0;
 	m_bLoadedMagCal = false;
-	m_dLastSampleTime=0.0;
+	m_bMagCalParsed = false;
+	memset(m_magCalOffsets, 0, 3*sizeof(double));
 	memset(m_szErrMsg, 0, 256);
-	m_nGyroAxisOrder = 0;
 	m_dBaseAccGyroTimestamp=0.0;
 	m_dAccumulatedTimeSeconds=0.0;
 	m_uiAccGyroSampleCount=0;
+	m_pSampleBus = nullptr;
+	m_pOrientationSlot = nullptr;
+	m_bDutyCycleMode = false;
+	m_bSkipNextGapCheck = false;
+	m_bMotionSleep = false;
+	m_bFifoAveraging = false;
+	m_nNumFifoRates = 0;
+	m_dMagODRHz = MAG_ODR_HZ;
+	m_dLastMagTemperature = 0.0;
+	m_bHaveMagTemperature = false;
+	m_bMagFastRead = false;
+	m_bAccStream = false;
+	m_nAccStreamHead = 0;
+	m_nAccStreamCount = 0;
+	m_bAccStreamOverrun = false;
+	memset(m_accStreamSum, 0, 3 * sizeof(double));
+	m_nAccStreamSumCount = 0;
+	m_readingTap = nullptr;
+	m_pReadingTapData = nullptr;
+	m_nAccFullScaleG = 2;
+	m_ucAccFullScaleBits = 0x00;
+	m_dAccGain = ACC_GAIN;
+	m_nPressureNumToAvg = PRESS_DEFAULT_NUM_TO_AVG;
+	m_dSeaLevelPressureHPa = STD_SEA_LEVEL_PRESSURE_HPA;
+	m_dLastPressureCheckTime = 0.0;
+	m_bHaveLastPressure = false;
+	memset(&m_lastPressure, 0, sizeof(IMU_PRESSURE_SAMPLE));
+	m_bAcquiring = false;
+	m_bLastSampleOK = false;
+	m_ulSampleGeneration = 0;
+	memset(&m_lastSample, 0, sizeof(IMU_DATASAMPLE));
+	memset(&m_acqSample, 0, sizeof(IMU_DATASAMPLE));
+	pthread_mutex_init(&m_sampleMutex, nullptr);
+	pthread_cond_init(&m_sampleCond, nullptr);
+	m_dLastAccGyroSampleTime=0.0;
+	m_ucLastStatus=0;
+	m_nLastStatusPolls=0;
+	memset(&m_sampleStats, 0, sizeof(IMU_SAMPLE_STATS));
 	memset(m_acc_counts,0,3*sizeof(double));
 	memset(m_mag_counts,0,3*sizeof(double));
 	memset(m_gyro_counts,0,3*sizeof(double));
@@ -60,6 +109,8 @@ IMU::IMU(pthread_mutex_t *i2c_mutex) {//constructor
 	pthread_mutex_lock(m_i2c_mutex);
 	m_file_i2c = open(i2c_filename, O_RDWR);
 	pthread_mutex_unlock(m_i2c_mutex);
+	double dPhaseStart = GetMonotonicTimeSec();
+	m_initTiming.open_ms = (dPhaseStart - m_dInitStartTime)*1000;
 	if (m_file_i2c<0) {
 		//error opening I2C
 		sprintf(m_szErrMsg,"Error: %s opening I2C.\n",strerror(errno));
@@ -68,15 +119,40 @@ IMU::IMU(pthread_mutex_t *i2c_mutex) {//constructor
 		m_bInitError=true;
 	}
 	else {
-		m_bMagInitialized_OK = InitializeMagDevice();//initialize LIS3MDL for sample rate, filtering, etc.
-		if (!m_bMagInitialized_OK) {
-			m_bInitError=true;
+		//parse the magnetometer calibration file in a separate thread, so that the file I/O overlaps with configuring the other sensors over the bus
+		pthread_t calThread;
+		bool bCalThread = (pthread_create(&calThread, nullptr, MagCalParseThread, this)==0);
+		if (!bCalThread) {
+			ParseMagCal();
 		}
 		m_bAccGyroInitialized_OK = InitializeAccGyroDevice();//initialize LSM6DS33 for sample rate, filtering, etc.
 		if (!m_bAccGyroInitialized_OK) {
 			m_bInitError=true;
 		}
+		double dNow = GetMonotonicTimeSec();
+		m_initTiming.acc_gyro_config_ms = (dNow - dPhaseStart)*1000;
+		dPhaseStart = dNow;
+		//the pressure sensor is optional for orientation, so a failure here is logged but does not set m_bInitError
+		m_bPressureInitialized_OK = InitializePressureDevice();//initialize LPS25H for sample rate and FIFO mean mode
+		dNow = GetMonotonicTimeSec();
+		m_initTiming.pressure_config_ms = (dNow - dPhaseStart)*1000;
+		dPhaseStart = dNow;
+		if (bCalThread) {
+			pthread_join(calThread, nullptr);
+		}
+		dNow = GetMonotonicTimeSec();
+		m_initTiming.cal_wait_ms = (dNow - dPhaseStart)*1000;
+		dPhaseStart = dNow;
+		m_bMagInitialized_OK = InitializeMagDevice();//initialize LIS3MDL for sample rate, filtering, etc. (and write the calibration offsets parsed above)
+		if (!m_bMagInitialized_OK) {
+			m_bInitError=true;
+		}
+		m_initTiming.mag_config_ms = (GetMonotonicTimeSec() - dPhaseStart)*1000;
 	}
+	m_initTiming.total_ms = (GetMonotonicTimeSec() - m_dInitStartTime)*1000;
+	sprintf(m_szErrMsg, "IMU init: %.2f ms total (open %.2f, acc/gyro %.2f, pressure %.2f, cal parse %.2f overlapped with %.2f wait, mag %.2f)\n", m_initTiming.total_ms, m_initTiming.open_ms,
+		m_initTiming.acc_gyro_config_ms, m_initTiming.pressure_config_ms, m_initTiming.cal_parse_ms, m_initTiming.cal_wait_ms, m_initTiming.mag_config_ms);
+	g_shiplog.LogEntry(m_szErrMsg, false);
 }
 
 /**
@@ -84,10 +160,8 @@ IMU::IMU(pthread_mutex_t *i2c_mutex) {//constructor
  * 
  */
 IMU::~IMU() {//destructor
-	if (m_quat!=nullptr) {
-		delete m_quat;
-		m_quat = nullptr;
-	}
+	pthread_cond_destroy(&m_sampleCond);
+	pthread_mutex_destroy(&m_sampleMutex);
 }
 
 /**
@@ -119,6 +193,7 @@ bool IMU::GetMagSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//collect mag
 	if (ioctl(m_file_i2c, I2C_SLAVE, MAG_I2C_ADDRESS)<0) {
 		sprintf(m_szErrMsg,"Failed (error = %s) to acquire bus access and/or talk to slave magnetometer.\n",strerror(errno));
 		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_sampleStats.mag_failed++;
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
@@ -130,25 +205,40 @@ bool IMU::GetMagSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//collect mag
 		return false;
 	}
 	
+	pIMUSample->quality_flags &= ~(IMU_QUALITY_MAG_OVERRUN|IMU_QUALITY_MAG_LATE);
 	for (int i=0;i<nNumToAvg;i++) {
 		if (!WaitForMagDataReady(MAG_STATUS_REG)) {
 			strcpy(m_szErrMsg,(char *)"Timed out waiting for magnetometer data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.mag_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
+		//check for overruns (new data overwrote unread data) and for data that was already waiting before the status register was first checked
+		if ((m_ucLastStatus&MAG_STATUS_ZYXOR)>0) {
+			m_sampleStats.mag_missed++;
+			pIMUSample->quality_flags|=IMU_QUALITY_MAG_OVERRUN;
+		}
+		if (m_nLastStatusPolls<=1) {
+			m_sampleStats.mag_late++;
+			pIMUSample->quality_flags|=IMU_QUALITY_MAG_LATE;
+		}
 		if (!GetMagnetometerData(mag_data)) {
 			strcpy(m_szErrMsg,(char *)"Error trying to get magnetometer data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.mag_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
-		if (!GetMagTemperatureData(dTemperatureData)) {
+		//in the reduced-precision profile the temperature is only read once per sample (dTemperatureData keeps the first reading)
+		if ((i==0||!m_bMagFastRead)&&!GetMagTemperatureData(dTemperatureData)) {
 			strcpy(m_szErrMsg, (char *)"Error trying to get temperature data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.mag_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
+		m_sampleStats.mag_reads++;
 		//adjust for linear temperature coefficients
 		double dTempDif = dTemperatureData - m_tempCal.mag_cal_temp;
 		mag_data[0] -= dTempDif * m_tempCal.magx_vs_temp;
@@ -167,12 +257,13 @@ bool IMU::GetMagSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//collect mag
 	}
 	//copy data to IMU_DATASAMPLE structure
 	pIMUSample->mag_temperature = dTemperatureData;
+	m_dLastMagTemperature = dTemperatureData;
+	m_bHaveMagTemperature = true;
 	memcpy(pIMUSample->mag_data,mag_data,3*sizeof(double));
 	return true;
 }
 
 bool IMU::InitializeMagDevice() {//initialize LIS3MDL for sample rate, full-scale range, etc.
-	unsigned char out_buf[2];
 	if (!m_bOpenedI2C_OK)
 	{
 		RetryOpening();
@@ -187,48 +278,32 @@ bool IMU::InitializeMagDevice() {//initialize LIS3MDL for sample rate, full-scal
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}	
-	//set MAG_CTRL_REG1 (0x20) for temperature enable, ultra-high-performance mode (for X & Y), not the highest possible data rate (80 Hz only) and disable self-test
-	out_buf[0] = MAG_CTRL_REG1;
-	out_buf[1] = 0xfc;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg,(char *)"Failed to write to the I2C bus for MAG_CTRL_REG1.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
+	//write MAG_CTRL_REG1 to MAG_CTRL_REG5 (0x20 to 0x24) in one burst:
+	//MAG_CTRL_REG1 for temperature enable, ultra-high-performance mode (for X & Y), not the highest possible data rate (80 Hz only) and disable self-test
+	//MAG_CTRL_REG2 for full-scale range of mags of +/- 4 gauss
+	//MAG_CTRL_REG3 for continuous conversion, normal power mode
+	//MAG_CTRL_REG4 for ultra-high-performance mode on the z-axis
+	//MAG_CTRL_REG5 for the current sampling profile (see SetMagFastRead)
+	unsigned char ctrlRegs[MAG_NUM_CTRL_REGS] = {MAG_CTRL_REG1_UHP_80HZ, 0x00, MAG_CTRL_REG3_CONTINUOUS, MAG_CTRL_REG4_UHP, 0x00};
+	if (m_bMagFastRead) {
+		ctrlRegs[4] = MAG_CTRL_REG5_FAST_READ|MAG_CTRL_REG5_BDU;
+	}
+	if (!BusWrite(MAG_I2C_ADDRESS, MAG_CTRL_REG1|MAG_AUTO_INCREMENT, ctrlRegs, MAG_NUM_CTRL_REGS)) {
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
-	//set MAG_CTRL_REG2 (0x21) for full-scale range of mags of +/- 4 gauss
-	out_buf[0] = MAG_CTRL_REG2;
-	out_buf[1] = 0x00;
-	if (write(m_file_i2c,  out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg,(char *)"Failed to write to the I2C bus for MAG_CTRL_REG2.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
+	m_dMagODRHz = MAG_ODR_HZ;
+	bool bFirstLoad = !m_bLoadedMagCal;
+	m_bLoadedMagCal = LoadMagCal();//load magnetometer offset calibration (if available) from mag_cal.txt file
+	if (bFirstLoad) {
+		ReadMagOffsets();//read in and print out mag offsets stored in offset registers (only the first time, re-initializing writes the same offsets)
 	}
-	//set MAG_CTRL_REG3 (0x22) for continuous conversion, normal power mode 
-	out_buf[0] = MAG_CTRL_REG3;
-	out_buf[1] = 0x00;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_CTRL_REG3.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
+	//seed the temperature used for compensating the high-rate magnetometer readings (see ReadMagFast), so that they are not compensated against 0 deg C until the first GetMagSample
+	double dTemperatureData = 0.0;
+	if (WaitForMagDataReady(MAG_STATUS_REG)&&GetMagTemperatureData(dTemperatureData)) {
+		m_dLastMagTemperature = dTemperatureData;
+		m_bHaveMagTemperature = true;
 	}
-	//set MAG_CTRL_REG4 (0x23) for ultra-high-performance mode on the z-axis
-	out_buf[0] = MAG_CTRL_REG4;
-	out_buf[1] = 0x0C;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_CTRL_REG4.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	} 
-	m_bLoadedMagCal = LoadMagCal();//load magnetometer offset calibration (if available) from mag_cal.txt file
-	ReadMagOffsets();//read in and print out mag offsets stored in offset registers
 	pthread_mutex_unlock(m_i2c_mutex);
 	return true;
 }
@@ -237,8 +312,6 @@ bool IMU::GetMagTemperatureData(double &dTemperatureData) {//get temperature dat
 	//dTemperatureData = the returned temperature in degrees C 
 	//function returns true if successful, false otherwise
 	//and least significant bytes are not in sync
-	const double DEG_C_PER_BIT = .125;//output of temperature sensor in deg C per bit
-	const double ROOM_TEMP = 25.0;//room temperature in deg C 
 	unsigned char outBuf[1];//buffer for requesting data over I2C
 	unsigned char inBuf[2];//buffer for receiving data over I2C
 	//least significant byte (8 bits) of temperature
@@ -269,11 +342,15 @@ bool IMU::GetMagTemperatureData(double &dTemperatureData) {//get temperature dat
 		return false;
 	}
 
-	int nTemperatureCounts = ((inBuf[1]&0x0f)<<8) + inBuf[0];
-	
-	bool bLessThanRoomTemp = false;
+	dTemperatureData = ConvertMagTemperature(inBuf[1], inBuf[0]);
+	return true;
+}
+
+double IMU::ConvertMagTemperature(unsigned char highByte, unsigned char lowByte) {//convert the two LIS3MDL temperature bytes into a temperature in deg C
+	const double ROOM_TEMP = 25.0;//room temperature in deg C 
+	double dTemperatureData = 0.0;
+	int nTemperatureCounts = ((highByte&0x0f)<<8) + lowByte;
 	if (nTemperatureCounts>=0x800) {//temperature is less than 25 deg C (room temperature)
-		bLessThanRoomTemp = true;
 		nTemperatureCounts = 4096 - nTemperatureCounts;
 		dTemperatureData = ROOM_TEMP - ((double)nTemperatureCounts)/8;
 	}
@@ -281,10 +358,19 @@ bool IMU::GetMagTemperatureData(double &dTemperatureData) {//get temperature dat
 		dTemperatureData = ROOM_TEMP + ((double)nTemperatureCounts)/8;
 	}
 	dTemperatureData-=MAG_SENSOR_TEMPOFFSET;//subtract magnetometer temperature sensor offset
-	return true;
+	return dTemperatureData;
 }
 
 bool IMU::GetMagnetometerData(double *mag_data) {//get magnetometer data from the LIS3MDL
+	if (m_bMagFastRead) {//3-byte frame, ReadMagFrame negates the x and y axes and copies to m_mag_counts
+		if (!ReadMagFrame(mag_data)) {
+			strcpy(m_szErrMsg, (char *)"Error getting magnetometer data.\n");
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			return false;
+		}
+		normalize(mag_data);
+		return true;
+	}
 	if (!Get6BytesRegData(mag_data, MAG_OUTX_L)) {
 		strcpy(m_szErrMsg, (char *)"Error getting magnetometer data.\n");
 		g_shiplog.LogEntry(m_szErrMsg, true);
@@ -420,6 +506,7 @@ bool IMU::WaitForMagDataReady(unsigned char ucStatusReg) {//check 3 least sig bi
 	long int timeoutVal = ((long int)TIMEOUT)*1000000;//convert timeout value from ms to ns
 	struct timespec gettime_now;
 
+	m_nLastStatusPolls = 0;
 	clock_gettime(CLOCK_REALTIME, &gettime_now);
 	start_time = gettime_now.tv_nsec;		//Get nS value
 	while (!bDataReady)
@@ -437,8 +524,10 @@ bool IMU::WaitForMagDataReady(unsigned char ucStatusReg) {//check 3 least sig bi
 			g_shiplog.LogEntry(m_szErrMsg, true);
 			return false;
 		}
+		m_nLastStatusPolls++;
 		if ((inBuf[0]&0x07)==0x07) {//3 least significant bytes of status register are set, indicating that X, Y, Z data is ready
 			bDataReady = true;
+			m_ucLastStatus = inBuf[0];
 			return true;
 		}
 		clock_gettime(CLOCK_REALTIME, &gettime_now);
@@ -479,79 +568,24 @@ bool IMU::InitializeAccGyroDevice() {//initialize LSM6DS33 for sample rate, full
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}	
-	//set ACC_CTRL1_XL 0x10, for output data rate (ODR) of 104 Hz, +/- 2 G full-scale,  accelerometer full-scale selection, anti-aliasing filter bandwidth of 50 Hz
-	out_buf[0] = ACC_CTRL1_XL;
-	out_buf[1] = 0x43;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for ACC_CTRL1_XL.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set GYRO_CTRL2_G 0x11 for ODR of 104 Hz, full-scale of 245 deg/sec
-	out_buf[0] = GYRO_CTRL2_G;
-	out_buf[1] = 0x40;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for GYRO_CTRL2_G.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set ACC_GYRO_CTRL3_C 0x12 for block data update (BDU) and automatic incrementing of register address when reading multiple bytes using I2C
-	out_buf[0] = ACC_GYRO_CTRL3_C;
-	out_buf[1] = 0x44;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for ACC_GYRO_CTRL3_C.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set ACC_GYRO_CTRL4_C 0x13 for accelerometer bandwidth setting
-	out_buf[0] = ACC_GYRO_CTRL4_C;
-	out_buf[1] = 0x80;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char*)"Failed to write to the I2C bus for ACC_GYRO_CTRL4_C.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set ACC_GYRO_CTRL6_C 0x15 for accelerometer high performance mode
-	out_buf[0] = ACC_GYRO_CTRL6_C;
-	out_buf[1] = 0x00;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for ACC_GYRO_CTRL6_C.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set GYRO_CTRL7_G, 0x16 for gyro high performance mode, enable gyro high pass filter, set gyro high pass filter for 0.0324 Hz
-	out_buf[0] = GYRO_CTRL7_G;
-	out_buf[1] = 0x50;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for GYRO_CTRL7_G.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
-		return false;
-	}
-	//set ACC_CTRL8_XL to enable low pass acc filter
-	out_buf[0] = ACC_CTRL8_XL;
-	out_buf[1] = 0x80;
-	if (write(m_file_i2c, out_buf, 2)!=2) {
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for ACC_CTRL8_XL.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
+	//write ACC_CTRL1_XL to ACC_CTRL8_XL (0x10 to 0x17) in one burst (register address auto-increment is on by default, and stays on with the ACC_GYRO_CTRL3_C value below):
+	//ACC_CTRL1_XL for output data rate (ODR) of 104 Hz, +/- 2 G full-scale (unless changed with SetAccFullScale),  accelerometer full-scale selection, anti-aliasing filter bandwidth of 50 Hz
+	//GYRO_CTRL2_G for ODR of 104 Hz, full-scale of 245 deg/sec
+	//ACC_GYRO_CTRL3_C for block data update (BDU) and automatic incrementing of register address when reading multiple bytes using I2C
+	//ACC_GYRO_CTRL4_C for accelerometer bandwidth setting
+	//ACC_GYRO_CTRL5_C for no output rounding and no self-test (its default value)
+	//ACC_GYRO_CTRL6_C for accelerometer high performance mode
+	//GYRO_CTRL7_G for gyro high performance mode, enable gyro high pass filter, set gyro high pass filter for 0.0324 Hz (or high pass filter off, if the fusion engine estimates the gyro bias)
+	//ACC_CTRL8_XL to enable low pass acc filter
+	unsigned char ucGyroCtrl7 = m_bGyroHighPass ? GYRO_CTRL7_G_HPF : GYRO_CTRL7_G_NO_HPF;
+	unsigned char ctrlRegs[ACC_GYRO_NUM_CTRL_REGS] = {(unsigned char)(ACC_CTRL1_XL_104HZ|m_ucAccFullScaleBits), GYRO_CTRL2_G_104HZ, 0x44, 0x80, 0x00, 0x00, ucGyroCtrl7, 0x80};
+	if (!BusWrite(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ctrlRegs, ACC_GYRO_NUM_CTRL_REGS)) {
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
 	//set WAKE_UP_DUR, 0x5C for timer resolution of 25 usec per bit
 	out_buf[0] = WAKE_UP_DUR;
-	out_buf[1] = 0x10;
+	out_buf[1] = WAKE_UP_DUR_TIMER_HR;
 	if (write(m_file_i2c, out_buf, 2)!=2) {
 		//error, I2C transaction failed
 		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for WAKE_UP_DUR.\n");
@@ -584,6 +618,7 @@ bool IMU::InitializeAccGyroDevice() {//initialize LSM6DS33 for sample rate, full
 bool IMU::GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
 	double dTemperatureSum = 0.0;//the sum of all temperature samples received
 	double acc_data_sum[3];//the sum of all accelerometer samples received
+	double acc_counts_sum[3];//the sum of the raw counts of all accelerometer samples received
 	double gyro_data_sum[3];//the sum of all gyro samples received
 	double acc_data[3];//an individual sample of accelerometer data
 	double gyro_data[3];//an individual sample of gyro data
@@ -598,8 +633,15 @@ bool IMU::GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
 			return false;//failed to initialize mag again
 		}
 	}
+	if (m_bMotionSleep) {
+		return GetAccGyroSleepSample(pIMUSample);
+	}
+	if (m_bFifoAveraging) {
+		return GetAccGyroFifoSample(pIMUSample, nNumToAvg);
+	}
 	
 	memset(acc_data_sum,0,3*sizeof(double));
+	memset(acc_counts_sum,0,3*sizeof(double));
 	memset(gyro_data_sum,0,3*sizeof(double));
 	memset(acc_data,0,3*sizeof(double));
 	memset(gyro_data,0,3*sizeof(double));
@@ -610,6 +652,7 @@ bool IMU::GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
 	if (ioctl(m_file_i2c, I2C_SLAVE, ACC_GYRO_I2C_ADDRESS)<0) {
 		sprintf(m_szErrMsg,"Failed (error = %s) to acquire bus access and/or talk to slave acc/gyro device.\n",strerror(errno));
 		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_sampleStats.acc_gyro_failed++;
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
@@ -619,56 +662,76 @@ bool IMU::GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
+	pIMUSample->quality_flags &= ~(IMU_QUALITY_ACCGYRO_GAP|IMU_QUALITY_ACCGYRO_LATE);
 	for (int i=0;i<nNumToAvg;i++) {
 		if (!WaitForAccDataReady(ACC_GYRO_STATUS_REG)) {
 			strcpy(m_szErrMsg, (char *)"Timed out waiting for accelerometer data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
+		if (m_nLastStatusPolls<=1) {//data was already waiting before the status register was first checked
+			m_sampleStats.acc_gyro_late++;
+			pIMUSample->quality_flags|=IMU_QUALITY_ACCGYRO_LATE;
+		}
 		if (!GetAccData(acc_data)) {
 			strcpy(m_szErrMsg, (char *)"Error trying to get accelerometer data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
 		if (!WaitForGyroDataReady(ACC_GYRO_STATUS_REG)) {
 			strcpy(m_szErrMsg, (char *)"Timed out waiting for gyro data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
 		if (!GetGyroData(gyro_data)) {
 			strcpy(m_szErrMsg, (char *)"Error trying to get gyro data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
 		if (!WaitForAccTemperatureData(ACC_GYRO_STATUS_REG)) {
 			strcpy(m_szErrMsg, (char *)"Timed out waiting for temperature data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
 		if (!GetAccTemperatureData(dTemperature)) {
 			strcpy(m_szErrMsg, (char *)"Error trying to get temperature data.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
 			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
+		m_sampleStats.acc_gyro_reads++;
+		TapReading(m_acc_counts, gyro_data, GetMonotonicTimeSec());
 		//sum results for later computation of average
 		dTemperatureSum+=dTemperature;
 		for (int j=0;j<3;j++) {
 			acc_data_sum[j]+=acc_data[j];
+			acc_counts_sum[j]+=m_acc_counts[j];
 			gyro_data_sum[j]+=gyro_data[j];
 		}
 	}
+	if (m_bAccStream&&DrainAccStream(ACC_STREAM_MAX_SETS)<0) {
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
 	//get sample timestamp
 	outBuf[0] = TIMESTAMP0_REG;
 	if (write(m_file_i2c,outBuf,1)!=1) {
 		//error, I2C transaction failed
 		sprintf(m_szErrMsg,"Failed to write to the I2C bus register %d.\n",(int)outBuf[0]);
 		g_shiplog.LogEntry(m_szErrMsg,true);
+		m_sampleStats.acc_gyro_failed++;
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
@@ -676,37 +739,224 @@ bool IMU::GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
 		//ERROR HANDLING: i2c transaction failed
 		strcpy(m_szErrMsg, (char *)"Failed to read timestamp bytes.\n");
 		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	if (!ProcessAccGyroTimestamp(inBuf, pIMUSample, nNumToAvg)) {
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+
+	//divide by number of samples to get averaged results
+	pIMUSample->acc_gyro_temperature = dTemperatureSum / nNumToAvg;
+	for (int i=0;i<3;i++) {
+		pIMUSample->acc_data[i] = acc_data_sum[i] / nNumToAvg;
+		pIMUSample->angular_rate[i] = gyro_data_sum[i] / nNumToAvg;
+		acc_counts_sum[i]/=nNumToAvg;
+	}
+	SetSpecificForce(pIMUSample, acc_counts_sum);
+	if (m_bAccStream) {
+		SetStreamAccData(pIMUSample);
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	return true;
+}
+
+bool IMU::GetAccGyroFifoSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//average the most recent nNumToAvg acc/gyro readings from the LSM6DS33 FIFO
+	//waits (without holding the I2C bus) until the FIFO has at least nNumToAvg complete readings, then reads all of the unread FIFO contents in a single burst
+	//readings older than the most recent nNumToAvg are discarded and counted as missed
+	const double TIMEOUT_SEC = 0.5;//extra time to wait beyond the time it should take to collect nNumToAvg readings
+	unsigned char statusBuf[4];
+	unsigned char tsBuf[3];
+	unsigned char tempBuf[2];
+	if (nNumToAvg<1||nNumToAvg>FIFO_MAX_SETS) {
+		sprintf(m_szErrMsg, "Invalid number of samples to average (must be between 1 and %d in FIFO averaging mode).\n", FIFO_MAX_SETS);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	pIMUSample->quality_flags &= ~(IMU_QUALITY_ACCGYRO_GAP|IMU_QUALITY_ACCGYRO_LATE);
+	m_nNumFifoRates = 0;
+	double dDeadline = GetMonotonicTimeSec() + nNumToAvg / ACC_GYRO_ODR_HZ + TIMEOUT_SEC;
+	int nNumWords = 0;//number of unread words in the FIFO
+	int nSkipWords = 0;//number of words to skip to get to the start of the next complete reading
+	int nNumPolls = 0;
+	pthread_mutex_lock(m_i2c_mutex);
+	for (;;) {
+		if (!BusRead(ACC_GYRO_I2C_ADDRESS, FIFO_STATUS1, statusBuf, 4)) {
+			m_sampleStats.acc_gyro_failed++;
+			pthread_mutex_unlock(m_i2c_mutex);
+			return false;
+		}
+		nNumPolls++;
+		nNumWords = statusBuf[0] + ((statusBuf[1]&FIFO_STATUS2_DIFF_MASK)<<8);
+		if ((statusBuf[1]&FIFO_STATUS2_OVER_RUN)>0) {
+			pIMUSample->quality_flags|=IMU_QUALITY_ACCGYRO_GAP;
+		}
+		int nPattern = statusBuf[2] + ((statusBuf[3]&0x03)<<8);
+		nSkipWords = (FIFO_WORDS_PER_SET - nPattern%FIFO_WORDS_PER_SET)%FIFO_WORDS_PER_SET;
+		if (nNumWords>=nSkipWords+nNumToAvg*FIFO_WORDS_PER_SET) break;
+		double dNow = GetMonotonicTimeSec();
+		if (dNow>dDeadline) {
+			strcpy(m_szErrMsg, (char *)"Timed out waiting for the acc/gyro FIFO to fill.\n");
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			m_sampleStats.acc_gyro_failed++;
+			pthread_mutex_unlock(m_i2c_mutex);
+			return false;
+		}
+		//let go of the bus while the remaining readings arrive
+		pthread_mutex_unlock(m_i2c_mutex);
+		int nNumSetsNeeded = nNumToAvg - (nNumWords - nSkipWords)/FIFO_WORDS_PER_SET;
+		usleep((useconds_t)(nNumSetsNeeded * 1000000 / ACC_GYRO_ODR_HZ));
+		pthread_mutex_lock(m_i2c_mutex);
+	}
+	if (nNumPolls<=1) {//readings were already waiting before the FIFO status was first checked
+		m_sampleStats.acc_gyro_late++;
+		pIMUSample->quality_flags|=IMU_QUALITY_ACCGYRO_LATE;
+	}
+	int nNumSets = (nNumWords - nSkipWords)/FIFO_WORDS_PER_SET;
+	int nNumReadWords = nSkipWords + nNumSets*FIFO_WORDS_PER_SET;
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, FIFO_DATA_OUT_L, m_fifoBuf, nNumReadWords*2) ||
+		!BusRead(ACC_GYRO_I2C_ADDRESS, OUT_TEMP_L, tempBuf, 2) ||
+		!BusRead(ACC_GYRO_I2C_ADDRESS, TIMESTAMP0_REG, tsBuf, 3)) {
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	if (!ProcessAccGyroTimestamp(tsBuf, pIMUSample, nNumSets)) {
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	if (nNumSets>nNumToAvg) {
+		m_sampleStats.acc_gyro_missed+=(nNumSets - nNumToAvg);
+	}
+	m_sampleStats.acc_gyro_reads+=nNumToAvg;
+	if (m_readingTap.load(std::memory_order_relaxed)!=nullptr) {
+		//every reading in the FIFO goes to the tap, including the ones that are too old to be averaged, with times counted back from now at the ODR
+		double dNow = GetMonotonicTimeSec();
+		for (int i=0;i<nNumSets;i++) {
+			unsigned char *pSet = &m_fifoBuf[(nSkipWords + i*FIFO_WORDS_PER_SET)*2];
+			double acc_counts[3], gyro_data[3];
+			for (int j=0;j<3;j++) {
+				gyro_data[j] = Get16BitTwosComplement(pSet[2*j+1], pSet[2*j]) * GYRO_GAIN;
+				acc_counts[j] = Get16BitTwosComplement(pSet[2*j+7], pSet[2*j+6]);
+			}
+			TapReading(acc_counts, gyro_data, dNow - (nNumSets - 1 - i) / ACC_GYRO_ODR_HZ);
+		}
+	}
+
+	//keep the angular rate of every reading, with times counted back from the sample time at the ODR, so that ComputeOrientation can propagate the orientation through each one of them
+	//the specific force is averaged over every reading of the run as well (not just the most recent nNumToAvg), so that integrating it over the sample interval does not drop the older readings
+	double run_acc_counts[3] = {0.0, 0.0, 0.0};
+	for (int i=0;i<nNumSets;i++) {
+		unsigned char *pSet = &m_fifoBuf[(nSkipWords + i*FIFO_WORDS_PER_SET)*2];
+		for (int j=0;j<3;j++) {
+			m_fifoRates[3*i+j] = Get16BitTwosComplement(pSet[2*j+1], pSet[2*j]) * GYRO_GAIN;
+			run_acc_counts[j]+=Get16BitTwosComplement(pSet[2*j+7], pSet[2*j+6]);
+		}
+		m_fifoRateTimes[i] = pIMUSample->sample_time_sec - (nNumSets - 1 - i) / ACC_GYRO_ODR_HZ;
+	}
+	m_nNumFifoRates = nNumSets;
+
+	//average the most recent nNumToAvg readings (gyro X, Y, Z followed by acc X, Y, Z in each reading)
+	double gyro_counts_sum[3] = {0.0, 0.0, 0.0};
+	double acc_counts_sum[3] = {0.0, 0.0, 0.0};
+	for (int i=nNumSets-nNumToAvg;i<nNumSets;i++) {
+		unsigned char *pSet = &m_fifoBuf[(nSkipWords + i*FIFO_WORDS_PER_SET)*2];
+		for (int j=0;j<3;j++) {
+			gyro_counts_sum[j]+=Get16BitTwosComplement(pSet[2*j+1], pSet[2*j]);
+			acc_counts_sum[j]+=Get16BitTwosComplement(pSet[2*j+7], pSet[2*j+6]);
+		}
+	}
+	double acc_data[3];
+	for (int j=0;j<3;j++) {
+		m_gyro_counts[j] = gyro_counts_sum[j] / nNumToAvg;
+		m_acc_counts[j] = acc_counts_sum[j] / nNumToAvg;
+		pIMUSample->angular_rate[j] = m_gyro_counts[j] * GYRO_GAIN;
+		acc_data[j] = m_acc_counts[j];
+	}
+	normalize(acc_data);
+	//change sign of accZ (to match previously used LM303D compass module)
+	acc_data[2] = -acc_data[2];
+	memcpy(pIMUSample->acc_data, acc_data, 3*sizeof(double));
+	pIMUSample->acc_gyro_temperature = 25.0 + Get16BitTwosComplement(tempBuf[1], tempBuf[0]) / 16.0;
+	for (int j=0;j<3;j++) {
+		run_acc_counts[j]/=nNumSets;
+	}
+	SetSpecificForce(pIMUSample, run_acc_counts);
+	return true;
+}
+
+bool IMU::GetAccGyroSleepSample(IMU_DATASAMPLE *pIMUSample) {//read the latest accelerometer reading (plus temperature and timestamp) while the LSM6DS33 is asleep, without waiting for new data
+	//the accelerometer only samples at 12.5 Hz and the gyro is off while the LSM6DS33 is asleep (see GetMotionState), so the angular rate is set to zero and the orientation of the sample comes from its acc/mag data alone
+	unsigned char inBuf[14];
+	unsigned char tsBuf[3];
+	pthread_mutex_lock(m_i2c_mutex);
+	//OUT_TEMP_L through OUTZ_H_XL (register address auto-increment is enabled in ACC_GYRO_CTRL3_C)
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, OUT_TEMP_L, inBuf, 14)||!BusRead(ACC_GYRO_I2C_ADDRESS, TIMESTAMP0_REG, tsBuf, 3)) {
+		m_sampleStats.acc_gyro_failed++;
 		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
-	double dTimestampCounts = (double)(inBuf[0]+(inBuf[1]<<8)+(inBuf[2]<<16));
+	m_sampleStats.acc_gyro_reads++;
+	pIMUSample->quality_flags &= ~(IMU_QUALITY_ACCGYRO_GAP|IMU_QUALITY_ACCGYRO_LATE);
+	pIMUSample->acc_gyro_temperature = 25.0 + Get16BitTwosComplement(inBuf[1], inBuf[0]) / 16.0;
+	double acc_data[3];
+	for (int i=0;i<3;i++) {
+		m_acc_counts[i] = Get16BitTwosComplement(inBuf[9+2*i], inBuf[8+2*i]);
+		acc_data[i] = m_acc_counts[i];
+		pIMUSample->angular_rate[i] = 0.0;
+	}
+	normalize(acc_data);
+	//change sign of accZ (to match previously used LM303D compass module)
+	acc_data[2] = -acc_data[2];
+	memcpy(pIMUSample->acc_data, acc_data, 3 * sizeof(double));
+	SetSpecificForce(pIMUSample, m_acc_counts);
+	m_bSkipNextGapCheck = true;
+	m_fusion.last_sample_time_sec = 0.0;//don't integrate the (zero) angular rate, start over from the acc/mag orientation
+	bool bTimestampOK = ProcessAccGyroTimestamp(tsBuf, pIMUSample, 1);
+	if (!bTimestampOK) {
+		m_sampleStats.acc_gyro_failed++;
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	return bTimestampOK;
+}
+
+bool IMU::ProcessAccGyroTimestamp(unsigned char *tsBytes, IMU_DATASAMPLE *pIMUSample, int nNumReadings) {//convert the 3 timestamp bytes of the LSM6DS33 into the sample time, resetting the timestamp counter if it is close to overflowing, and check for missed ODR ticks
+	//tsBytes = the TIMESTAMP0_REG, TIMESTAMP1_REG, and TIMESTAMP2_REG bytes
+	//pIMUSample = the sample whose sample_time_sec (and IMU_QUALITY_ACCGYRO_GAP flag) gets set
+	//nNumReadings = the number of acc/gyro readings collected since the previous sample
+	//function assumes that the caller has the I2C bus mutex, returns false if the timestamp counter could not be reset
+	double dTimestampCounts = (double)(tsBytes[0]+(tsBytes[1]<<8)+(tsBytes[2]<<16));
 	if (dTimestampCounts>=16000000) {//the timestamp counter will reach the end soon and needs to be manually reset since it does not automatically roll over.
-		outBuf[0] = TIMESTAMP2_REG;
-		outBuf[1] = 0xAA;
-		if (write(m_file_i2c, outBuf,2)!=2) {
-			//error, I2C transaction failed
+		unsigned char ucResetVal = 0xAA;
+		if (!BusWrite(ACC_GYRO_I2C_ADDRESS, TIMESTAMP2_REG, &ucResetVal, 1)) {
 			strcpy(m_szErrMsg, (char *)"Error, failed to send bytes to reset timer.\n");
 			g_shiplog.LogEntry(m_szErrMsg, true);
-			pthread_mutex_unlock(m_i2c_mutex);
 			return false;
 		}
 		m_dAccumulatedTimeSeconds+=(dTimestampCounts*ACC_GYRO_TIMER_RESOLUTION);
 		dTimestampCounts=0;
 	}
-	pthread_mutex_unlock(m_i2c_mutex);
 	if (m_uiAccGyroSampleCount==0) { 
 		m_dBaseAccGyroTimestamp = dTimestampCounts;
 		m_dAccumulatedTimeSeconds=0.0;
 	}
 	pIMUSample->sample_time_sec = (dTimestampCounts - m_dBaseAccGyroTimestamp)*ACC_GYRO_TIMER_RESOLUTION + m_dAccumulatedTimeSeconds;
-	m_uiAccGyroSampleCount++;
-
-	//divide by number of samples to get averaged results
-	pIMUSample->acc_gyro_temperature = dTemperatureSum / nNumToAvg;
-	for (int i=0;i<3;i++) {
-		pIMUSample->acc_data[i] = acc_data_sum[i] / nNumToAvg;
-		pIMUSample->angular_rate[i] = gyro_data_sum[i] / nNumToAvg;
+	if (m_uiAccGyroSampleCount>0&&!m_bDutyCycleMode&&!m_bSkipNextGapCheck) {
+		//compare the number of ODR ticks since the previous sample with the number of readings that were actually collected
+		int nNumTicks = (int)floor((pIMUSample->sample_time_sec - m_dLastAccGyroSampleTime)*ACC_GYRO_ODR_HZ + 0.5);
+		if (nNumTicks>nNumReadings) {
+			m_sampleStats.acc_gyro_missed+=(nNumTicks - nNumReadings);
+			pIMUSample->quality_flags|=IMU_QUALITY_ACCGYRO_GAP;
+		}
 	}
+	m_dLastAccGyroSampleTime = pIMUSample->sample_time_sec;
+	m_uiAccGyroSampleCount++;
+	m_bSkipNextGapCheck = false;
 	return true;
 }
 
@@ -722,6 +972,7 @@ bool IMU::WaitForAccDataReady(unsigned char ucStatusReg) {//check XLDA bit of LS
 	long int timeoutVal = ((long int)TIMEOUT)*1000000;//convert timeout value from ms to ns
 	struct timespec gettime_now;
 
+	m_nLastStatusPolls = 0;
 	clock_gettime(CLOCK_REALTIME, &gettime_now);
 	start_time = gettime_now.tv_nsec;		//Get nS value
 	while (!bDataReady)
@@ -739,8 +990,10 @@ bool IMU::WaitForAccDataReady(unsigned char ucStatusReg) {//check XLDA bit of LS
 			g_shiplog.LogEntry(m_szErrMsg, true);
 			return false;
 		}
+		m_nLastStatusPolls++;
 		if ((inBuf[0]&0x01)>0) {//the XLDA bit of the status register is set, indicating that a new set of accelerometer data is available
 			bDataReady = true;
+			m_ucLastStatus = inBuf[0];
 			return true;
 		}
 		clock_gettime(CLOCK_REALTIME, &gettime_now);
@@ -768,6 +1021,7 @@ bool IMU::WaitForGyroDataReady(unsigned char ucStatusReg) {//check GDA bit of LS
 	long int timeoutVal = ((long int)TIMEOUT)*1000000;//convert timeout value from ms to ns
 	struct timespec gettime_now;
 
+	m_nLastStatusPolls = 0;
 	clock_gettime(CLOCK_REALTIME, &gettime_now);
 	start_time = gettime_now.tv_nsec;		//Get nS value
 	while (!bDataReady)
@@ -785,8 +1039,10 @@ bool IMU::WaitForGyroDataReady(unsigned char ucStatusReg) {//check GDA bit of LS
 			g_shiplog.LogEntry(m_szErrMsg, true);
 			return false;
 		}
+		m_nLastStatusPolls++;
 		if ((inBuf[0]&0x02)>0) {//the GDA bit of the status register is set, indicating that a new set of gyro data is available
 			bDataReady = true;
+			m_ucLastStatus = inBuf[0];
 			return true;
 		}
 		clock_gettime(CLOCK_REALTIME, &gettime_now);
@@ -814,6 +1070,7 @@ bool IMU::WaitForAccTemperatureData(unsigned char ucStatusReg) {//check TDA bit
 	long int timeoutVal = ((long int)TIMEOUT)*1000000;//convert timeout value from ms to ns
 	struct timespec gettime_now;
 
+	m_nLastStatusPolls = 0;
 	clock_gettime(CLOCK_REALTIME, &gettime_now);
 	start_time = gettime_now.tv_nsec;		//Get nS value
 	while (!bDataReady)
@@ -831,8 +1088,10 @@ bool IMU::WaitForAccTemperatureData(unsigned char ucStatusReg) {//check TDA bit
 			g_shiplog.LogEntry(m_szErrMsg, true);
 			return false;
 		}
+		m_nLastStatusPolls++;
 		if ((inBuf[0]&0x04)>0) {//the TDA bit of the status register is set, indicating that a new set of temperature data is available
 			bDataReady = true;
+			m_ucLastStatus = inBuf[0];
 			return true;
 		}
 		clock_gettime(CLOCK_REALTIME, &gettime_now);
@@ -971,95 +1230,1249 @@ void IMU::ResetAccGyro() {
 	m_dAccumulatedTimeSeconds=0.0;
 }
 
-void IMU::ReadMagOffsets() {//read in and print out mag offsets stored in offset registers
-	unsigned char outBuf[1];
-	unsigned char inBuf[6];
-	outBuf[0] = MAG_OFFSET_X_L;
-	if (write(m_file_i2c,outBuf,1)!=1) {
-		//error, I2C transaction failed
-		sprintf(m_szErrMsg, "Failed to write to the I2C bus register %d.\n",(int)outBuf[0]);
+/**
+ * @brief write a single register of the magnetometer or acc/gyro device
+ * 
+ * @param nSlaveAddr the I2C slave address of the device (MAG_I2C_ADDRESS or ACC_GYRO_I2C_ADDRESS)
+ * @param ucReg the address of the register to write
+ * @param ucVal the value to write to the register
+ * @return true if the register was written successfully
+ * @return false if bus access could not be obtained or the I2C transaction failed
+ */
+bool IMU::WriteRegister(int nSlaveAddr, unsigned char ucReg, unsigned char ucVal) {
+	unsigned char out_buf[2];
+	pthread_mutex_lock(m_i2c_mutex);
+	if (ioctl(m_file_i2c, I2C_SLAVE, nSlaveAddr)<0) {
+		sprintf(m_szErrMsg, "Failed (error = %s) to acquire bus access and/or talk to slave device 0x%02x.\n",strerror(errno),nSlaveAddr);
 		g_shiplog.LogEntry(m_szErrMsg, true);
-		return;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
 	}
-	//read in 6 bytes for mag offsets
-	int nNumRead = read(m_file_i2c,inBuf,6);
-	if (nNumRead!=6) {
+	out_buf[0] = ucReg;
+	out_buf[1] = ucVal;
+	if (write(m_file_i2c, out_buf, 2)!=2) {
 		//error, I2C transaction failed
-		sprintf(m_szErrMsg, "Error, only %d of 6 bytes of mag offset data read.\n",nNumRead);
+		sprintf(m_szErrMsg, "Failed to write to the I2C bus register 0x%02x of slave device 0x%02x.\n",(int)ucReg,nSlaveAddr);
 		g_shiplog.LogEntry(m_szErrMsg, true);
-		return;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
 	}
-	//mag_offsets expressed in counts
-	double mag_offsets[3];
-	mag_offsets[0] = Get16BitTwosComplement(inBuf[1], inBuf[0]);
-	mag_offsets[1] = Get16BitTwosComplement(inBuf[3], inBuf[2]);
-	mag_offsets[2] = Get16BitTwosComplement(inBuf[5], inBuf[4]);
-	sprintf(m_szErrMsg, "mag_offsets = %.0f, %.0f, %.0f\n",mag_offsets[0],mag_offsets[1],mag_offsets[2]);
-	g_shiplog.LogEntry(m_szErrMsg, true);
+	pthread_mutex_unlock(m_i2c_mutex);
+	return true;
+}
+
+double IMU::GetMonotonicTimeSec() {//returns the time (in seconds) from a monotonic clock, for measuring elapsed times
+	struct timespec gettime_now;
+	clock_gettime(CLOCK_MONOTONIC, &gettime_now);
+	return gettime_now.tv_sec + gettime_now.tv_nsec/1.0e9;
 }
 
 /**
- * @brief perform a calibration procedure on the magnetometers to get the zero-field offsets for each of the sensors. Saves the results to the offset registers.
+ * @brief power down the magnetometer and acc/gyro sensors so that they draw minimal current between duty-cycled fixes. While in this mode, use GetDutyCycledFix to get orientation data; GetSample, GetMagSample, and GetAccGyroSample will time out since the sensors are not producing data.
  * 
- * @return true if the calibration was completed successfully
- * @return false if there was some sort of error in completing the calibration
+ * @return true if both sensors were powered down successfully
+ * @return false if there was a problem writing to either of the sensors
  */
-bool IMU::DoMagCal() {//perform a calibration procedure on the magnetometers to get the zero-field offsets for each of the sensors. Saves the results to the offset registers.
-	printf("Press \'q\' to quit or \'c\' to calibrate...\n");
-	double mag_data[NUM_MAGCAL_AVG][3];//do running average of 50 mag samples
-	double avg_mag[3];//averaged magnetometer values
-	unsigned char out_buf[2];
-	memset(mag_data,0,NUM_MAGCAL_AVG*3*sizeof(double));	
-	memset(avg_mag,0,3*sizeof(double));//averaged magnetometer values
-	//initialize min and max sensor outputs to large and small values respectively
-	double dMinMagX = 32767.0, dMaxMagX = -32767.0;
-	double dMinMagY = 32767.0, dMaxMagY = -32767.0;
-	double dMinMagZ = 32767.0, dMaxMagZ = -32767.0;
-	int nKeyPressed = Util::getch_noblock();
-	if (!m_bMagInitialized_OK) {
-		strcpy(m_szErrMsg, (char *)"Error, magnetometer was not properly initialized. Cannot do calibration.\n");
+bool IMU::EnterDutyCycleMode() {
+	if (!m_bMagInitialized_OK||!m_bAccGyroInitialized_OK) {
+		strcpy(m_szErrMsg, (char*)"Error, sensors were not properly initialized, cannot enter duty cycle mode.\n");
 		g_shiplog.LogEntry(m_szErrMsg, true);
 		return false;
 	}
-	pthread_mutex_lock(m_i2c_mutex);
-	if (ioctl(m_file_i2c, I2C_SLAVE, MAG_I2C_ADDRESS)<0) {
-		sprintf(m_szErrMsg, "Failed (error = %s) to acquire bus access and/or talk to slave magnetometer.\n",strerror(errno));
+	if (m_bAccStream) {
+		strcpy(m_szErrMsg, (char*)"Error, cannot enter duty cycle mode while the accelerometer stream is on.\n");
 		g_shiplog.LogEntry(m_szErrMsg, true);
-		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
-	//zero mag offset registers
-	for (int i=0;i<6;i++) {
-		out_buf[0] = (unsigned char)(MAG_OFFSET_X_L+i);
-		out_buf[1] = 0x00;
-		if (write(m_file_i2c, out_buf, 2)!=2) {
-			//error, I2C transaction failed
-			strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for zeroing mag offsets.\n");
-			g_shiplog.LogEntry(m_szErrMsg, true);
-			pthread_mutex_unlock(m_i2c_mutex);
-			return false;
-		}
+	if (!WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG3, MAG_CTRL_REG3_POWER_DOWN)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, GYRO_CTRL2_G, ACC_GYRO_POWER_DOWN)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_GYRO_POWER_DOWN)) {
+		return false;
 	}
+	m_bDutyCycleMode = true;
+	return true;
+}
 
-	int nSampleNum=0;
-	while (nKeyPressed!=113&&nKeyPressed!=99) {//keep looping, looking for new max or min values until the 'c' for calibrate or 'q' for quit keys are pressed
-		if (WaitForMagDataReady(MAG_STATUS_REG)) {
-			if (Get6BytesRegData(mag_data[nSampleNum%NUM_MAGCAL_AVG], MAG_OUTX_L)) {
-				nSampleNum++;
-				if (GetAvgMagVals(mag_data, avg_mag, nSampleNum))
-				{
-					//check to see if there are new min or max values
-					if (avg_mag[0] < dMinMagX)
-					{
-						dMinMagX = avg_mag[0];
-					}
-					if (avg_mag[0] > dMaxMagX)
-					{
-						dMaxMagX = avg_mag[0];
-					}
-					if (avg_mag[1] < dMinMagY)
-					{
-						dMinMagY = avg_mag[1];
+/**
+ * @brief return the magnetometer and acc/gyro sensors to continuous sampling at their normal output data rates
+ * 
+ * @return true if both sensors were returned to continuous sampling
+ * @return false if there was a problem writing to either of the sensors
+ */
+bool IMU::ExitDutyCycleMode() {
+	if (!WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG3, MAG_CTRL_REG3_CONTINUOUS)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_CTRL1_XL_104HZ|m_ucAccFullScaleBits)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, GYRO_CTRL2_G, GYRO_CTRL2_G_104HZ)) {
+		return false;
+	}
+	m_bDutyCycleMode = false;
+	m_fusion.last_sample_time_sec = 0.0;//don't integrate gyro data across the time that the sensors were powered down
+	return true;
+}
+
+/**
+ * @brief wake up the sensors just long enough to get one fused orientation fix, and then power them back down. The acc/gyro device is woken up at its normal ODR and its first few samples are discarded while it settles, the magnetometer is triggered for nNumToAvg single conversions, and the orientation is computed from the averaged acc/mag data (gyro data is not integrated across the time between fixes). Call EnterDutyCycleMode before using this function.
+ * 
+ * @param pIMUSample pointer to the structure that receives the sensor data and computed orientation
+ * @param nNumToAvg the number of individual samples to collect and average for the fix (use 1 for no averaging)
+ * @param pTiming pointer to a structure that receives the bus time and active time of the fix (can be nullptr if not needed)
+ * @return true if a fix was obtained and the sensors were powered back down
+ * @return false if there was a problem getting the fix or powering down the sensors
+ */
+bool IMU::GetDutyCycledFix(IMU_DATASAMPLE *pIMUSample, int nNumToAvg, IMU_FIX_TIMING *pTiming) {
+	IMU_DATASAMPLE magSample;//individual single conversion magnetometer sample
+	double mag_data_sum[3];//sum of all single conversion magnetometer samples
+	double dTemperatureSum = 0.0;//sum of all magnetometer temperature samples
+	double dBusTime = 0.0;//time spent using the I2C bus
+	double dStartTime=0.0, dEndTime=0.0;
+	if (!m_bDutyCycleMode) {
+		strcpy(m_szErrMsg, (char*)"Error, call EnterDutyCycleMode before getting duty-cycled fixes.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (nNumToAvg<1) {
+		strcpy(m_szErrMsg, (char *)"Invalid number of samples to average.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	memset(mag_data_sum, 0, 3*sizeof(double));
+	memset(&magSample, 0, sizeof(IMU_DATASAMPLE));
+	double dActiveStartTime = GetMonotonicTimeSec();
+	//wake up acc/gyro device
+	dStartTime = GetMonotonicTimeSec();
+	bool bWokeUp = WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_CTRL1_XL_104HZ|m_ucAccFullScaleBits) && WriteRegister(ACC_GYRO_I2C_ADDRESS, GYRO_CTRL2_G, GYRO_CTRL2_G_104HZ);
+	//discard the first few samples while the acc/gyro device settles, and then collect the samples to use
+	bool bGotData = bWokeUp && GetAccGyroSample(pIMUSample, DUTY_CYCLE_SETTLE_SAMPLES) && GetAccGyroSample(pIMUSample, nNumToAvg);
+	dBusTime += (GetMonotonicTimeSec() - dStartTime);
+	//the magnetometer only needs to be awake for its conversions, so trigger them now that the acc/gyro samples are done
+	for (int i=0;i<nNumToAvg&&bGotData;i++) {
+		dStartTime = GetMonotonicTimeSec();
+		bGotData = WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG3, MAG_CTRL_REG3_SINGLE) && GetMagSample(&magSample, 1);
+		dBusTime += (GetMonotonicTimeSec() - dStartTime);
+		for (int j=0;j<3;j++) {
+			mag_data_sum[j]+=magSample.mag_data[j];
+		}
+		dTemperatureSum+=magSample.mag_temperature;
+	}
+	//power the sensors back down, even if there was a problem getting the fix
+	dStartTime = GetMonotonicTimeSec();
+	bool bPoweredDown = WriteRegister(ACC_GYRO_I2C_ADDRESS, GYRO_CTRL2_G, ACC_GYRO_POWER_DOWN);
+	bPoweredDown = WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_GYRO_POWER_DOWN) && bPoweredDown;
+	bPoweredDown = WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG3, MAG_CTRL_REG3_POWER_DOWN) && bPoweredDown;
+	dEndTime = GetMonotonicTimeSec();
+	dBusTime += (dEndTime - dStartTime);
+	if (pTiming!=nullptr) {
+		pTiming->bus_time_sec = dBusTime;
+		pTiming->active_time_sec = dEndTime - dActiveStartTime;
+	}
+	if (!bGotData||!bPoweredDown) {
+		return false;
+	}
+	for (int i=0;i<3;i++) {
+		pIMUSample->mag_data[i] = mag_data_sum[i] / nNumToAvg;
+	}
+	pIMUSample->mag_temperature = dTemperatureSum / nNumToAvg;
+	pIMUSample->quality_flags = (pIMUSample->quality_flags & ~(IMU_QUALITY_MAG_OVERRUN|IMU_QUALITY_MAG_LATE)) | (magSample.quality_flags & IMU_QUALITY_MAG_OVERRUN);
+	m_fusion.last_sample_time_sec = 0.0;//each fix is computed from its acc/mag data alone, since the gyros were off between fixes
+	this->ComputeOrientation(pIMUSample);
+	return true;
+}
+
+/**
+ * @brief collect a run of consecutive (unaveraged) samples of magnetometer, accelerometer, and gyro data, and then compute the orientation of each one. Compared with calling GetSample once per sample, the sensors are checked and the I2C bus is locked only once for the whole run, each sensor is read with a single burst transaction per sample, and the orientation calculations are all done together after the bus has been released. If a broadcast ring is attached (see AttachSampleBus), all of the samples are published to it.
+ *
+ * @param pIMUSamples pointer to an array of at least nNumSamples IMU_DATASAMPLE structures that receive the sensor data and computed orientation angles
+ * @param nNumSamples the number of samples to collect
+ * @param dTimeoutSec the maximum amount of time (in seconds) to spend collecting samples. Collection stops early if this time runs out.
+ * @return int the number of samples that were collected successfully (these are always the first samples of pIMUSamples). Fewer than nNumSamples are returned if the timeout expired or if there was a problem collecting a sample.
+ */
+int IMU::GetSamples(IMU_DATASAMPLE *pIMUSamples, int nNumSamples, double dTimeoutSec) {
+	if (nNumSamples<1) {
+		strcpy(m_szErrMsg,(char *)"Invalid number of samples.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return 0;
+	}
+	double dDeadline = GetMonotonicTimeSec() + dTimeoutSec;
+	//wait for any acquisition that is already in progress, then block other acquisitions until this run is done
+	pthread_mutex_lock(&m_sampleMutex);
+	while (m_bAcquiring) {
+		pthread_cond_wait(&m_sampleCond, &m_sampleMutex);
+	}
+	m_bAcquiring = true;
+	SampleBus *pBus = m_pSampleBus;
+	pthread_mutex_unlock(&m_sampleMutex);
+
+	if (!m_bMagInitialized_OK) {
+		m_bMagInitialized_OK = InitializeMagDevice();
+	}
+	if (!m_bAccGyroInitialized_OK) {
+		m_bAccGyroInitialized_OK = InitializeAccGyroDevice();
+	}
+	int nNumCollected = 0;
+	if (m_bMagInitialized_OK&&m_bAccGyroInitialized_OK) {
+		pthread_mutex_lock(m_i2c_mutex);
+		while (nNumCollected<nNumSamples) {
+			IMU_DATASAMPLE *pSample = &pIMUSamples[nNumCollected];
+			pSample->quality_flags = 0;
+			if (!ReadMagBurst(pSample, dDeadline)) {
+				m_sampleStats.mag_failed++;
+				break;
+			}
+			if (!ReadAccGyroBurst(pSample, dDeadline)) {
+				m_sampleStats.acc_gyro_failed++;
+				break;
+			}
+			pSample->fused_time_sec = GetMonotonicTimeSec();//the orientation is fused after the run, but stands for the time that this sample was read (see PredictOrientation)
+			nNumCollected++;
+			if (GetMonotonicTimeSec()>dDeadline) break;
+		}
+		pthread_mutex_unlock(m_i2c_mutex);
+	}
+
+	//the bus is free again, so compute orientations for the whole run in one go
+	for (int i=0;i<nNumCollected;i++) {
+		FuseSample(&pIMUSamples[i], pIMUSamples[i].fused_time_sec);
+	}
+	if (pBus!=nullptr) {
+		for (int i=0;i<nNumCollected;i++) {
+			pBus->Publish(&pIMUSamples[i]);
+		}
+	}
+
+	pthread_mutex_lock(&m_sampleMutex);
+	if (nNumCollected>0) {
+		memcpy(&m_lastSample, &pIMUSamples[nNumCollected-1], sizeof(IMU_DATASAMPLE));
+	}
+	m_bLastSampleOK = (nNumCollected>0);
+	m_ulSampleGeneration++;
+	m_bAcquiring = false;
+	pthread_cond_broadcast(&m_sampleCond);
+	pthread_mutex_unlock(&m_sampleMutex);
+	return nNumCollected;
+}
+
+bool IMU::ReadMagBurst(IMU_DATASAMPLE *pIMUSample, double dDeadline) {//wait for new magnetometer data and read it (plus temperature) in a single burst
+	//pIMUSample = the sample that receives the magnetometer data and temperature
+	//dDeadline = monotonic time (see GetMonotonicTimeSec) after which to stop waiting for data
+	//function assumes that the caller has the I2C bus mutex, returns false if the data could not be read
+	unsigned char ucStatus = 0;
+	unsigned char inBuf[8];
+	int nNumPolls = 0;
+	for (;;) {
+		if (!BusRead(MAG_I2C_ADDRESS, MAG_STATUS_REG, &ucStatus, 1)) return false;
+		nNumPolls++;
+		if ((ucStatus&0x07)==0x07) break;//X, Y, Z data is ready
+		if (GetMonotonicTimeSec()>dDeadline) {
+			strcpy(m_szErrMsg,(char *)"Timed out waiting for magnetometer data.\n");
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			return false;
+		}
+	}
+	if ((ucStatus&MAG_STATUS_ZYXOR)>0) {
+		m_sampleStats.mag_missed++;
+		pIMUSample->quality_flags|=IMU_QUALITY_MAG_OVERRUN;
+	}
+	if (nNumPolls<=1) {
+		m_sampleStats.mag_late++;
+		pIMUSample->quality_flags|=IMU_QUALITY_MAG_LATE;
+	}
+	double mag_data[3];
+	double dTemperatureData = m_dLastMagTemperature;
+	if (m_bMagFastRead) {//3-byte frame, the temperature from the last full-precision reading is used
+		if (!ReadMagFrame(mag_data)) return false;
+	}
+	else {
+		//MAG_OUTX_L through MAG_TEMP_OUT_H
+		if (!BusRead(MAG_I2C_ADDRESS, MAG_OUTX_L|MAG_AUTO_INCREMENT, inBuf, 8)) return false;
+		//negate x and y axes to match accelerometer data
+		mag_data[0] = -(double)Get16BitTwosComplement(inBuf[1], inBuf[0]);
+		mag_data[1] = -(double)Get16BitTwosComplement(inBuf[3], inBuf[2]);
+		mag_data[2] = (double)Get16BitTwosComplement(inBuf[5], inBuf[4]);
+		memcpy(m_mag_counts, mag_data, 3 * sizeof(double));
+		dTemperatureData = ConvertMagTemperature(inBuf[7], inBuf[6]);
+		m_bHaveMagTemperature = true;
+	}
+	m_sampleStats.mag_reads++;
+	normalize(mag_data);
+	//adjust for linear temperature coefficients (skipped until there is a real temperature reading)
+	double dTempDif = m_bHaveMagTemperature ? dTemperatureData - m_tempCal.mag_cal_temp : 0.0;
+	pIMUSample->mag_data[0] = mag_data[0] - dTempDif * m_tempCal.magx_vs_temp;
+	pIMUSample->mag_data[1] = mag_data[1] - dTempDif * m_tempCal.magy_vs_temp;
+	pIMUSample->mag_data[2] = mag_data[2] - dTempDif * m_tempCal.magz_vs_temp;
+	pIMUSample->mag_temperature = dTemperatureData;
+	m_dLastMagTemperature = dTemperatureData;
+	return true;
+}
+
+bool IMU::ReadAccGyroBurst(IMU_DATASAMPLE *pIMUSample, double dDeadline) {//wait for new acc/gyro data and read it (plus temperature and timestamp) in two bursts
+	//pIMUSample = the sample that receives the accelerometer, gyro, temperature, and timing data
+	//dDeadline = monotonic time (see GetMonotonicTimeSec) after which to stop waiting for data
+	//function assumes that the caller has the I2C bus mutex, returns false if the data could not be read
+	unsigned char ucStatus = 0;
+	unsigned char inBuf[14];
+	unsigned char tsBuf[3];
+	int nNumPolls = 0;
+	for (;;) {
+		if (!BusRead(ACC_GYRO_I2C_ADDRESS, ACC_GYRO_STATUS_REG, &ucStatus, 1)) return false;
+		nNumPolls++;
+		if ((ucStatus&ACC_GYRO_STATUS_XLDA_GDA)==ACC_GYRO_STATUS_XLDA_GDA) break;//accelerometer and gyro data are both ready
+		if (GetMonotonicTimeSec()>dDeadline) {
+			strcpy(m_szErrMsg,(char *)"Timed out waiting for accelerometer and gyro data.\n");
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			return false;
+		}
+	}
+	if (nNumPolls<=1) {//data was already waiting before the status register was first checked
+		m_sampleStats.acc_gyro_late++;
+		pIMUSample->quality_flags|=IMU_QUALITY_ACCGYRO_LATE;
+	}
+	//OUT_TEMP_L through OUTZ_H_XL (register address auto-increment is enabled in ACC_GYRO_CTRL3_C)
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, OUT_TEMP_L, inBuf, 14)) return false;
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, TIMESTAMP0_REG, tsBuf, 3)) return false;
+	m_sampleStats.acc_gyro_reads++;
+	pIMUSample->acc_gyro_temperature = 25.0 + Get16BitTwosComplement(inBuf[1], inBuf[0]) / 16.0;
+	for (int i=0;i<3;i++) {
+		m_gyro_counts[i] = Get16BitTwosComplement(inBuf[3+2*i], inBuf[2+2*i]);
+		m_acc_counts[i] = Get16BitTwosComplement(inBuf[9+2*i], inBuf[8+2*i]);
+		pIMUSample->angular_rate[i] = m_gyro_counts[i] * GYRO_GAIN;
+	}
+	TapReading(m_acc_counts, pIMUSample->angular_rate, GetMonotonicTimeSec());
+	double acc_data[3];
+	memcpy(acc_data, m_acc_counts, 3 * sizeof(double));
+	normalize(acc_data);
+	//change sign of accZ (to match previously used LM303D compass module)
+	acc_data[2] = -acc_data[2];
+	memcpy(pIMUSample->acc_data, acc_data, 3 * sizeof(double));
+	SetSpecificForce(pIMUSample, m_acc_counts);
+	if (m_bAccStream) {
+		if (DrainAccStream(ACC_STREAM_MAX_SETS)<0) return false;
+		SetStreamAccData(pIMUSample);
+	}
+	return ProcessAccGyroTimestamp(tsBuf, pIMUSample, 1);
+}
+
+bool IMU::BusRead(int nSlaveAddr, unsigned char ucReg, unsigned char *buf, int nNumBytes) {//read nNumBytes consecutive registers starting at ucReg in one combined I2C transaction (register address write + repeated start + read)
+	//function assumes that the caller has the I2C bus mutex, returns false if the I2C transaction failed
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data xfer;
+	msgs[0].addr = nSlaveAddr;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &ucReg;
+	msgs[1].addr = nSlaveAddr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = nNumBytes;
+	msgs[1].buf = buf;
+	xfer.msgs = msgs;
+	xfer.nmsgs = 2;
+	if (ioctl(m_file_i2c, I2C_RDWR, &xfer)<0) {
+		sprintf(m_szErrMsg, "Failed (error = %s) to read %d bytes from register 0x%02x of slave device 0x%02x.\n",strerror(errno),nNumBytes,(int)ucReg,nSlaveAddr);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	return true;
+}
+
+bool IMU::BusWrite(int nSlaveAddr, unsigned char ucReg, unsigned char *vals, int nNumBytes) {//write nNumBytes consecutive registers starting at ucReg in one I2C transaction
+	//function assumes that the caller has the I2C bus mutex, returns false if the I2C transaction failed
+	unsigned char outBuf[17];
+	if (nNumBytes<1||nNumBytes>16) {
+		sprintf(m_szErrMsg, "Invalid number of bytes (%d) to write to the I2C bus.\n",nNumBytes);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	outBuf[0] = ucReg;
+	memcpy(&outBuf[1], vals, nNumBytes);
+	struct i2c_msg msg;
+	struct i2c_rdwr_ioctl_data xfer;
+	msg.addr = nSlaveAddr;
+	msg.flags = 0;
+	msg.len = nNumBytes+1;
+	msg.buf = outBuf;
+	xfer.msgs = &msg;
+	xfer.nmsgs = 1;
+	if (ioctl(m_file_i2c, I2C_RDWR, &xfer)<0) {
+		sprintf(m_szErrMsg, "Failed (error = %s) to write to the I2C bus register 0x%02x of slave device 0x%02x.\n",strerror(errno),(int)ucReg,nSlaveAddr);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief program the activity / inactivity engine of the LSM6DS33. Once there has been no motion above the wake-up threshold for the sleep delay, the LSM6DS33 drops to 12.5 Hz accelerometer sampling by itself and reports the sleep state in WAKE_UP_SRC. As soon as motion exceeds the threshold again it returns to the normal ODR. Wake-up and inactivity events are also routed to INT1.
+ * 
+ * @param dWakeThresholdG the change in acceleration (in G) that counts as motion, rounded to the nearest WAKE_THS_G_PER_BIT (between 1 and 63 steps)
+ * @param dSleepDelaySec the time without motion (in seconds) before the LSM6DS33 goes to sleep, rounded up to the nearest SLEEP_DUR_ODR_TICKS accelerometer samples (about 4.9 sec, up to a maximum of about 74 sec)
+ * @return true if the activity / inactivity engine was programmed successfully
+ * @return false if there was a problem writing to the LSM6DS33
+ */
+bool IMU::EnableMotionWake(double dWakeThresholdG, double dSleepDelaySec) {
+	int nWakeThreshold = (int)floor(dWakeThresholdG / WAKE_THS_G_PER_BIT + 0.5);
+	if (nWakeThreshold<1) nWakeThreshold = 1;
+	else if (nWakeThreshold>63) nWakeThreshold = 63;
+	int nSleepDur = (int)ceil(dSleepDelaySec * ACC_GYRO_ODR_HZ / SLEEP_DUR_ODR_TICKS);
+	if (nSleepDur<1) nSleepDur = 1;
+	else if (nSleepDur>15) nSleepDur = 15;
+	//keep the 25 usec timestamp resolution, wake up after 1 ODR tick above the threshold
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, WAKE_UP_DUR, WAKE_UP_DUR_TIMER_HR | nSleepDur)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, WAKE_UP_THS, WAKE_UP_THS_INACTIVITY | nWakeThreshold)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, MD1_CFG, MD1_CFG_INT1_WU_INACT)) {
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief turn off the activity / inactivity engine of the LSM6DS33, so that it samples continuously at its normal ODR
+ * 
+ * @return true if the activity / inactivity engine was turned off
+ * @return false if there was a problem writing to the LSM6DS33
+ */
+bool IMU::DisableMotionWake() {
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, MD1_CFG, 0x00)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, WAKE_UP_THS, 0x00)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, WAKE_UP_DUR, WAKE_UP_DUR_TIMER_HR)) {
+		return false;
+	}
+	pthread_mutex_lock(&m_sampleMutex);
+	m_bMotionSleep = false;
+	pthread_mutex_unlock(&m_sampleMutex);
+	return true;
+}
+
+/**
+ * @brief check whether or not the LSM6DS33 is in its inactivity (sleep) state (see EnableMotionWake). While it is asleep, gyro data is not integrated into the orientation and the acc/gyro timestamps are not checked for missed ODR ticks, so every sample collected while it is asleep, and the first sample after it wakes up, starts over from the acc/mag orientation. Samples collected while it is asleep take the latest accelerometer reading without waiting for new data, since the accelerometer only samples at 12.5 Hz and the gyro is off.
+ * 
+ * @param bSleeping set to true if the LSM6DS33 is asleep, or false if it is sampling at its normal ODR
+ * @return true if the state was read successfully
+ * @return false if there was a problem reading the WAKE_UP_SRC register
+ */
+bool IMU::GetMotionState(bool &bSleeping) {
+	unsigned char ucWakeUpSrc = 0;
+	pthread_mutex_lock(m_i2c_mutex);
+	bool bReadOK = BusRead(ACC_GYRO_I2C_ADDRESS, WAKE_UP_SRC, &ucWakeUpSrc, 1);
+	pthread_mutex_unlock(m_i2c_mutex);
+	if (!bReadOK) {
+		return false;
+	}
+	bSleeping = ((ucWakeUpSrc&WAKE_UP_SRC_SLEEP_STATE)>0);
+	//the gap check flag and the orientation state belong to whichever thread is collecting a sample, so wait for any acquisition in progress to finish before changing them
+	pthread_mutex_lock(&m_sampleMutex);
+	while (m_bAcquiring) {
+		pthread_cond_wait(&m_sampleCond, &m_sampleMutex);
+	}
+	m_bMotionSleep = bSleeping;
+	if (bSleeping) {
+		m_bSkipNextGapCheck = true;
+		m_fusion.last_sample_time_sec = 0.0;//don't integrate gyro data across the time that the LSM6DS33 was asleep
+	}
+	pthread_mutex_unlock(&m_sampleMutex);
+	return true;
+}
+
+/**
+ * @brief switch the magnetometer between its normal 80 Hz ultra-high-performance mode and its FAST_ODR modes (155, 300, 560, or 1000 Hz). The LIS3MDL only reaches the higher rates by using less oversampling, so each step up in rate also means more noise per reading. The Z-axis operating mode is switched together with the X & Y axes.
+ * 
+ * @param nMagRate one of the MAG_RATE_... values
+ * @return true if the magnetometer was switched to the new rate
+ * @return false if nMagRate is invalid or there was a problem writing to the LIS3MDL
+ */
+bool IMU::SetMagRate(int nMagRate) {
+	//MAG_CTRL_REG1 and MAG_CTRL_REG4 values and output data rates for each of the MAG_RATE_... modes
+	const unsigned char CTRL_REG1_VALS[NUM_MAG_RATES] = {MAG_CTRL_REG1_UHP_80HZ, 0xE2, 0xC2, 0xA2, 0x82};//temperature enabled, operating mode for X & Y, FAST_ODR bit
+	const unsigned char CTRL_REG4_VALS[NUM_MAG_RATES] = {MAG_CTRL_REG4_UHP, 0x0C, 0x08, 0x04, 0x00};//matching operating mode for Z
+	const double ODR_VALS[NUM_MAG_RATES] = {MAG_ODR_HZ, 155.0, 300.0, 560.0, 1000.0};
+	if (nMagRate<0||nMagRate>=NUM_MAG_RATES) {
+		sprintf(m_szErrMsg, "Invalid magnetometer rate mode (%d).\n", nMagRate);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (!WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG1, CTRL_REG1_VALS[nMagRate])) {
+		return false;
+	}
+	if (!WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG4, CTRL_REG4_VALS[nMagRate])) {
+		return false;
+	}
+	m_dMagODRHz = ODR_VALS[nMagRate];
+	return true;
+}
+
+double IMU::GetMagODR() {//returns the current output data rate of the magnetometer in Hz
+	return m_dMagODRHz;
+}
+
+/**
+ * @brief check for a new magnetometer reading, and read it if there is one. The status register and X, Y, Z data are read together in one 7-byte burst, and the bus is not held while waiting for data, so a high-rate magnetometer stream calling this function leaves the bus free for acc/gyro reads in between. Temperature is not read; the most recent temperature from GetMagSample / GetSamples is used for temperature compensation.
+ * 
+ * @param pMagSample pointer to the structure that receives the reading (only filled in if bNewData is true)
+ * @param bNewData set to true if a new reading was available and copied into pMagSample
+ * @return true if the magnetometer was checked successfully
+ * @return false if there was a problem reading from the LIS3MDL
+ */
+bool IMU::ReadMagFast(IMU_MAG_SAMPLE *pMagSample, bool &bNewData) {
+	unsigned char inBuf[7];
+	double mag_data[3];
+	bNewData = false;
+	if (!m_bMagInitialized_OK) {
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	bool bReadOK = false;
+	if (m_bMagFastRead) {//status byte, then a 3-byte frame only if there is new data
+		bReadOK = BusRead(MAG_I2C_ADDRESS, MAG_STATUS_REG, inBuf, 1);
+		if (bReadOK&&(inBuf[0]&0x07)==0x07) {
+			bReadOK = ReadMagFrame(mag_data);
+		}
+	}
+	else {
+		bReadOK = BusRead(MAG_I2C_ADDRESS, MAG_STATUS_REG|MAG_AUTO_INCREMENT, inBuf, 7);//MAG_STATUS_REG through MAG_OUTZ_H
+		//negate x and y axes to match accelerometer data
+		mag_data[0] = -(double)Get16BitTwosComplement(inBuf[2], inBuf[1]);
+		mag_data[1] = -(double)Get16BitTwosComplement(inBuf[4], inBuf[3]);
+		mag_data[2] = (double)Get16BitTwosComplement(inBuf[6], inBuf[5]);
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	if (!bReadOK) {
+		m_sampleStats.mag_failed++;
+		return false;
+	}
+	if ((inBuf[0]&0x07)!=0x07) {
+		return true;//no new data yet
+	}
+	bNewData = true;
+	m_sampleStats.mag_reads++;
+	pMagSample->sample_time_sec = GetMonotonicTimeSec();
+	pMagSample->quality_flags = 0;
+	if ((inBuf[0]&MAG_STATUS_ZYXOR)>0) {
+		m_sampleStats.mag_missed++;
+		pMagSample->quality_flags|=IMU_QUALITY_MAG_OVERRUN;
+	}
+	normalize(mag_data);
+	//adjust for linear temperature coefficients (skipped until there is a real temperature reading)
+	double dTempDif = m_bHaveMagTemperature ? m_dLastMagTemperature - m_tempCal.mag_cal_temp : 0.0;
+	pMagSample->mag_data[0] = mag_data[0] - dTempDif * m_tempCal.magx_vs_temp;
+	pMagSample->mag_data[1] = mag_data[1] - dTempDif * m_tempCal.magy_vs_temp;
+	pMagSample->mag_data[2] = mag_data[2] - dTempDif * m_tempCal.magz_vs_temp;
+	return true;
+}
+
+/**
+ * @brief turn the reduced-precision magnetometer sampling profile on or off. With the profile on, the LIS3MDL FAST_READ and block data update bits are set and only the high byte of each axis is read (3-byte frames instead of 6, and the temperature is only read once per GetSample), i.e. 8-bit magnetometer resolution (about 37 milligauss per bit at +/- 4 gauss, i.e. 256 / 6842 gauss) for about half the bus traffic. This is meant for coarse heading-hold loops on a busy bus; use IMUTest -fastread to see the heading noise vs. bus load for a particular installation.
+ * 
+ * @param bFastRead true to read only the high bytes of the magnetometer data, false for full 16-bit readings
+ * @return true if the profile was changed
+ * @return false if there was a problem writing to the LIS3MDL
+ */
+bool IMU::SetMagFastRead(bool bFastRead) {
+	unsigned char ucCtrlReg5 = bFastRead ? (MAG_CTRL_REG5_FAST_READ|MAG_CTRL_REG5_BDU) : 0x00;
+	if (!WriteRegister(MAG_I2C_ADDRESS, MAG_CTRL_REG5, ucCtrlReg5)) {
+		return false;
+	}
+	m_bMagFastRead = bFastRead;
+	return true;
+}
+
+bool IMU::IsMagFastRead() {//returns true if the reduced-precision magnetometer sampling profile is on
+	return m_bMagFastRead;
+}
+
+bool IMU::ReadMagFrame(double *mag_counts) {//read the X, Y, Z magnetometer counts in one burst, using 3-byte frames in fast-read mode
+	//mag_counts = the returned counts (x and y negated to match the accelerometer axes), also copied to m_mag_counts
+	//function assumes that the caller has the I2C bus mutex, returns false if the I2C transaction failed
+	unsigned char inBuf[MAG_FRAME_BYTES];
+	if (m_bMagFastRead) {
+		//with FAST_READ set, the register address skips over the low bytes: MAG_OUTX_H, MAG_OUTY_H, MAG_OUTZ_H
+		if (!BusRead(MAG_I2C_ADDRESS, MAG_OUTX_H|MAG_AUTO_INCREMENT, inBuf, MAG_FAST_READ_FRAME_BYTES)) return false;
+		mag_counts[0] = -(double)Get16BitTwosComplement(inBuf[0], 0);
+		mag_counts[1] = -(double)Get16BitTwosComplement(inBuf[1], 0);
+		mag_counts[2] = (double)Get16BitTwosComplement(inBuf[2], 0);
+	}
+	else {
+		if (!BusRead(MAG_I2C_ADDRESS, MAG_OUTX_L|MAG_AUTO_INCREMENT, inBuf, MAG_FRAME_BYTES)) return false;
+		mag_counts[0] = -(double)Get16BitTwosComplement(inBuf[1], inBuf[0]);
+		mag_counts[1] = -(double)Get16BitTwosComplement(inBuf[3], inBuf[2]);
+		mag_counts[2] = (double)Get16BitTwosComplement(inBuf[5], inBuf[4]);
+	}
+	memcpy(m_mag_counts, mag_counts, 3 * sizeof(double));
+	return true;
+}
+
+/**
+ * @brief buffer every acc/gyro sample in the LSM6DS33 FIFO (at the 104 Hz ODR), so that GetAccGyroSample (and GetSample) read all of the readings to be averaged in a single burst transaction instead of polling and reading each reading separately. The magnetometer is read once per sample in this mode, relying on the oversampling of its ultra-high-performance operating mode. The FIFO decimation factors are left at 1, because the LSM6DS33 decimates by dropping samples rather than by averaging them.
+ * 
+ * @return true if the FIFO was set up successfully
+ * @return false if there was a problem writing to the LSM6DS33
+ */
+bool IMU::EnableFifoAveraging() {
+	if (m_bAccStream) {
+		strcpy(m_szErrMsg, (char*)"Error, the LSM6DS33 FIFO is already being used for the accelerometer stream.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	//go through bypass mode first to empty the FIFO, so that reading starts at the beginning of the data pattern
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_BYPASS)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL3, FIFO_CTRL3_NO_DECIMATION)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_CONTINUOUS_104HZ)) {
+		return false;
+	}
+	m_bFifoAveraging = true;
+	m_bSkipNextGapCheck = true;
+	return true;
+}
+
+/**
+ * @brief turn off the LSM6DS33 FIFO and go back to polling and reading each acc/gyro reading separately
+ * 
+ * @return true if the FIFO was turned off
+ * @return false if there was a problem writing to the LSM6DS33
+ */
+bool IMU::DisableFifoAveraging() {
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_BYPASS)) {
+		return false;
+	}
+	m_bFifoAveraging = false;
+	m_nNumFifoRates = 0;
+	m_bSkipNextGapCheck = true;
+	return true;
+}
+
+bool IMU::InitializePressureDevice() {//initialize LPS25H for sample rate and FIFO mean mode
+	unsigned char ucVal = 0;
+	if (!m_bOpenedI2C_OK) {
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	if (!BusRead(PRESSURE_I2C_ADDRESS, PRESS_WHO_AM_I, &ucVal, 1)) {
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	if (ucVal!=PRESS_WHO_AM_I_VALUE) {
+		sprintf(m_szErrMsg, "Unexpected pressure sensor WHO_AM_I value (0x%02x).\n", (int)ucVal);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	//set PRESS_RES_CONF (0x10) for the internal averaging recommended with FIFO mean mode
+	ucVal = PRESS_RES_CONF_FIFO_MEAN;
+	if (!BusWrite(PRESSURE_I2C_ADDRESS, PRESS_RES_CONF, &ucVal, 1)) {
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	//set PRESS_CTRL_REG1 (0x20) for active mode, 25 Hz ODR, and block data update
+	ucVal = PRESS_CTRL_REG1_25HZ;
+	if (!BusWrite(PRESSURE_I2C_ADDRESS, PRESS_CTRL_REG1, &ucVal, 1)) {
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	return SetPressureAveraging(m_nPressureNumToAvg);
+}
+
+/**
+ * @brief set the number of pressure readings that the LPS25H averages on-chip with its FIFO mean mode. The output registers then hold the running mean of the most recent nNumToAvg readings (still updated at the 25 Hz ODR), so each pressure sample costs a single burst read no matter how many readings are averaged.
+ * 
+ * @param nNumToAvg the number of readings to average: 2, 4, 8, 16, or 32 (or 1 to turn the FIFO off and use individual readings)
+ * @return true if the averaging was set successfully
+ * @return false if nNumToAvg is not a valid value, or if there was a problem writing to the LPS25H
+ */
+bool IMU::SetPressureAveraging(int nNumToAvg) {
+	unsigned char ucFifoCtrl = PRESS_FIFO_MODE_BYPASS;
+	unsigned char ucCtrlReg2 = 0x00;
+	if (nNumToAvg>1) {
+		if (nNumToAvg>32||(nNumToAvg&(nNumToAvg-1))!=0) {
+			sprintf(m_szErrMsg, "Invalid number of pressure readings to average (%d).\n", nNumToAvg);
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			return false;
+		}
+		ucFifoCtrl = PRESS_FIFO_MODE_MEAN | (unsigned char)(nNumToAvg - 1);//WTM_POINT = number of readings - 1
+		ucCtrlReg2 = PRESS_CTRL_REG2_FIFO_EN;
+	}
+	else if (nNumToAvg!=1) {
+		sprintf(m_szErrMsg, "Invalid number of pressure readings to average (%d).\n", nNumToAvg);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	if (!BusWrite(PRESSURE_I2C_ADDRESS, PRESS_FIFO_CTRL, &ucFifoCtrl, 1)||!BusWrite(PRESSURE_I2C_ADDRESS, PRESS_CTRL_REG2, &ucCtrlReg2, 1)) {
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	m_nPressureNumToAvg = nNumToAvg;
+	return true;
+}
+
+/**
+ * @brief set the sea level pressure that pressure altitudes are computed from (e.g. the local altimeter setting). The default is the standard atmosphere value of 1013.25 hPa.
+ * 
+ * @param dSeaLevelPressureHPa the sea level pressure in hPa
+ */
+void IMU::SetSeaLevelPressure(double dSeaLevelPressureHPa) {
+	m_dSeaLevelPressureHPa = dSeaLevelPressureHPa;
+}
+
+/**
+ * @brief check for a new pressure / temperature reading from the LPS25H, and read it if there is one. The status, pressure, and temperature registers are read together in a single 6-byte burst.
+ * 
+ * @param pPressureSample pointer to the structure that receives the reading (only filled in if bNewData is true)
+ * @param bNewData set to true if a new reading was available and copied into pPressureSample
+ * @return true if the pressure sensor was checked successfully
+ * @return false if the pressure sensor is not initialized, or if there was a problem reading from it
+ */
+bool IMU::GetPressureSample(IMU_PRESSURE_SAMPLE *pPressureSample, bool &bNewData) {
+	bNewData = false;
+	if (!m_bPressureInitialized_OK) {
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	bool bReadOK = ReadPressureBurst(pPressureSample, bNewData);
+	pthread_mutex_unlock(m_i2c_mutex);
+	return bReadOK;
+}
+
+/**
+ * @brief get the most recent pressure reading that was collected along with GetSample / PublishSample (e.g. by an IMUAcquisition thread or an IMUReactor), so that barometric data is available without polling the pressure sensor separately.
+ * 
+ * @param pPressureSample pointer to the structure that receives a copy of the reading
+ * @return true if a reading was copied into pPressureSample
+ * @return false if no pressure reading has been collected yet
+ */
+bool IMU::GetLastPressureSample(IMU_PRESSURE_SAMPLE *pPressureSample) {
+	pthread_mutex_lock(&m_sampleMutex);
+	bool bHaveLastPressure = m_bHaveLastPressure;
+	if (bHaveLastPressure) {
+		memcpy(pPressureSample, &m_lastPressure, sizeof(IMU_PRESSURE_SAMPLE));
+	}
+	pthread_mutex_unlock(&m_sampleMutex);
+	return bHaveLastPressure;
+}
+
+bool IMU::ReadPressureBurst(IMU_PRESSURE_SAMPLE *pPressureSample, bool &bNewData) {//read the status, pressure, and temperature registers of the LPS25H in one burst
+	//function assumes that the caller has the I2C bus mutex, returns false if the I2C transaction failed
+	unsigned char inBuf[6];
+	bNewData = false;
+	//PRESS_STATUS_REG through PRESS_TEMP_OUT_H
+	if (!BusRead(PRESSURE_I2C_ADDRESS, PRESS_STATUS_REG|PRESS_AUTO_INCREMENT, inBuf, 6)) {
+		m_sampleStats.pressure_failed++;
+		return false;
+	}
+	if ((inBuf[0]&PRESS_STATUS_P_DA)==0) {
+		return true;//no new data yet
+	}
+	bNewData = true;
+	m_sampleStats.pressure_reads++;
+	pPressureSample->sample_time_sec = GetMonotonicTimeSec();
+	pPressureSample->quality_flags = 0;
+	if ((inBuf[0]&PRESS_STATUS_P_OR)>0) {
+		m_sampleStats.pressure_missed++;
+		pPressureSample->quality_flags|=IMU_QUALITY_PRESS_OVERRUN;
+	}
+	//24-bit two's complement pressure, 16-bit two's complement temperature
+	int nPressureCounts = (inBuf[3]<<16) + (inBuf[2]<<8) + inBuf[1];
+	if ((nPressureCounts&0x800000)>0) {//negative value
+		nPressureCounts = -(0x1000000 - nPressureCounts);
+	}
+	pPressureSample->pressure = nPressureCounts / PRESS_COUNTS_PER_HPA;
+	pPressureSample->temperature = PRESS_TEMP_OFFSET + Get16BitTwosComplement(inBuf[5], inBuf[4]) / PRESS_TEMP_COUNTS_PER_DEG;
+	//standard atmosphere pressure altitude
+	pPressureSample->altitude = 44330.8 * (1.0 - pow(pPressureSample->pressure / m_dSeaLevelPressureHPa, 0.190263));
+	return true;
+}
+
+/**
+ * @brief switch the accelerometer to its 1.66 kHz ODR and store every accelerometer reading (but not the 104 Hz gyro readings) in the LSM6DS33 FIFO, so that the readings can be collected in bursts with ReadAccStream. GetSample keeps working, and uses the average of the stream readings since the previous sample as its acceleration, so that vibration does not alias into pitch and roll.
+ * 
+ * @return true if the accelerometer stream was started (it needs about 10 kbytes/sec of bus bandwidth, so the I2C bus should be run at 400 kHz)
+ * @return false if FIFO averaging or duty-cycle mode is on, or if there was a problem writing to the LSM6DS33
+ */
+bool IMU::EnableAccStream() {
+	if (m_bFifoAveraging||m_bDutyCycleMode) {
+		strcpy(m_szErrMsg, (char*)"Error, cannot start the accelerometer stream while FIFO averaging or duty cycle mode is on.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	//go through bypass mode first to empty the FIFO, so that reading starts at the beginning of the data pattern
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_BYPASS)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_CTRL1_XL_1660HZ|m_ucAccFullScaleBits)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL3, FIFO_CTRL3_ACC_ONLY)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_CONTINUOUS_1660HZ)) {
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	m_nAccStreamHead = 0;
+	m_nAccStreamCount = 0;
+	m_bAccStreamOverrun = false;
+	memset(m_accStreamSum, 0, 3 * sizeof(double));
+	m_nAccStreamSumCount = 0;
+	pthread_mutex_unlock(m_i2c_mutex);
+	m_bAccStream = true;
+	return true;
+}
+
+/**
+ * @brief turn off the LSM6DS33 FIFO and return the accelerometer to its normal 104 Hz ODR
+ * 
+ * @return true if the accelerometer stream was stopped
+ * @return false if there was a problem writing to the LSM6DS33
+ */
+bool IMU::DisableAccStream() {
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, FIFO_CTRL5, FIFO_CTRL5_BYPASS)) {
+		return false;
+	}
+	if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ACC_CTRL1_XL_104HZ|m_ucAccFullScaleBits)) {
+		return false;
+	}
+	m_bAccStream = false;
+	return true;
+}
+
+/**
+ * @brief read the accelerometer readings that have been buffered since the last call (see EnableAccStream). Readings that GetSample has already taken out of the FIFO are returned first; the rest are topped up from the FIFO in a single burst of at most nMaxReadings readings, and any others are left in the FIFO for the next call, so the bus is never held for longer than one burst of nMaxReadings readings.
+ * 
+ * @param acc_data pointer to an array of at least 3 * nMaxReadings values that receives the X, Y, Z acceleration (in G, with the same axis signs as IMU_DATASAMPLE::acc_data) of each reading, oldest first
+ * @param nMaxReadings the maximum number of readings to read
+ * @param bOverrun set to true if unread readings were overwritten (because the FIFO or the buffer of readings taken out of it by GetSample filled up) since the last call
+ * @return int the number of readings copied into acc_data (0 if there were none), or -1 if the stream is not on or there was a problem reading from the LSM6DS33
+ */
+int IMU::ReadAccStream(double *acc_data, int nMaxReadings, bool &bOverrun) {
+	bOverrun = false;
+	if (!m_bAccStream) {
+		strcpy(m_szErrMsg, (char*)"Error, the accelerometer stream is not on.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return -1;
+	}
+	if (nMaxReadings>ACC_STREAM_MAX_SETS) {
+		nMaxReadings = ACC_STREAM_MAX_SETS;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	if (nMaxReadings>m_nAccStreamCount&&DrainAccStream(nMaxReadings - m_nAccStreamCount)<0) {
+		m_sampleStats.acc_gyro_failed++;
+		pthread_mutex_unlock(m_i2c_mutex);
+		return -1;
+	}
+	int nNumRead = m_nAccStreamCount<nMaxReadings ? m_nAccStreamCount : nMaxReadings;
+	for (int i=0;i<nNumRead;i++) {
+		memcpy(&acc_data[3*i], &m_accStreamBuf[3*m_nAccStreamHead], 3 * sizeof(double));
+		m_nAccStreamHead = (m_nAccStreamHead + 1) % ACC_STREAM_MAX_SETS;
+	}
+	m_nAccStreamCount-=nNumRead;
+	bOverrun = m_bAccStreamOverrun;
+	m_bAccStreamOverrun = false;
+	pthread_mutex_unlock(m_i2c_mutex);
+	return nNumRead;
+}
+
+int IMU::DrainAccStream(int nMaxReadings) {//move up to nMaxReadings accelerometer stream readings out of the FIFO into m_accStreamBuf and m_accStreamSum
+	//function assumes that the caller has the I2C bus mutex, returns the number of readings moved, or -1 if there was a problem reading from the LSM6DS33
+	//if m_accStreamBuf is full, its oldest readings are overwritten and m_bAccStreamOverrun is set
+	unsigned char statusBuf[4];
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, FIFO_STATUS1, statusBuf, 4)) {
+		return -1;
+	}
+	int nNumWords = statusBuf[0] + ((statusBuf[1]&FIFO_STATUS2_DIFF_MASK)<<8);
+	if ((statusBuf[1]&FIFO_STATUS2_OVER_RUN)>0) {
+		m_bAccStreamOverrun = true;
+	}
+	int nPattern = statusBuf[2] + ((statusBuf[3]&0x03)<<8);
+	int nSkipWords = (ACC_STREAM_WORDS_PER_SET - nPattern%ACC_STREAM_WORDS_PER_SET)%ACC_STREAM_WORDS_PER_SET;//words to skip to get to the start of the next complete reading
+	int nNumSets = (nNumWords - nSkipWords)/ACC_STREAM_WORDS_PER_SET;
+	if (nNumSets<=0) {
+		return 0;
+	}
+	if (nNumSets>nMaxReadings) {
+		nNumSets = nMaxReadings;
+	}
+	int nNumReadWords = nSkipWords + nNumSets*ACC_STREAM_WORDS_PER_SET;
+	if (!BusRead(ACC_GYRO_I2C_ADDRESS, FIFO_DATA_OUT_L, m_fifoBuf, nNumReadWords*2)) {
+		return -1;
+	}
+	for (int i=0;i<nNumSets;i++) {
+		unsigned char *pSet = &m_fifoBuf[(nSkipWords + i*ACC_STREAM_WORDS_PER_SET)*2];
+		if (m_nAccStreamCount==ACC_STREAM_MAX_SETS) {//buffer is full, drop the oldest reading
+			m_nAccStreamHead = (m_nAccStreamHead + 1) % ACC_STREAM_MAX_SETS;
+			m_nAccStreamCount--;
+			m_bAccStreamOverrun = true;
+		}
+		double *pReading = &m_accStreamBuf[3*((m_nAccStreamHead + m_nAccStreamCount) % ACC_STREAM_MAX_SETS)];
+		for (int j=0;j<3;j++) {
+			double dCounts = Get16BitTwosComplement(pSet[2*j+1], pSet[2*j]);
+			m_accStreamSum[j]+=dCounts;
+			pReading[j] = dCounts * m_dAccGain;
+		}
+		//change sign of accZ (to match previously used LM303D compass module)
+		pReading[2] = -pReading[2];
+		m_nAccStreamCount++;
+	}
+	m_nAccStreamSumCount+=nNumSets;
+	return nNumSets;
+}
+
+bool IMU::SetStreamAccData(IMU_DATASAMPLE *pIMUSample) {//replace the acceleration of a sample with the average of the stream readings since the previous sample
+	//function assumes that the caller has the I2C bus mutex
+	//returns false (leaving the sample as it is) if no stream readings have been taken out of the FIFO since the previous sample
+	if (m_nAccStreamSumCount<=0) {
+		return false;
+	}
+	double acc_counts[3];
+	for (int i=0;i<3;i++) {
+		acc_counts[i] = m_accStreamSum[i] / m_nAccStreamSumCount;
+	}
+	memset(m_accStreamSum, 0, 3 * sizeof(double));
+	m_nAccStreamSumCount = 0;
+	double acc_data[3];
+	memcpy(acc_data, acc_counts, 3 * sizeof(double));
+	normalize(acc_data);
+	//change sign of accZ (to match previously used LM303D compass module)
+	acc_data[2] = -acc_data[2];
+	memcpy(pIMUSample->acc_data, acc_data, 3 * sizeof(double));
+	SetSpecificForce(pIMUSample, acc_counts);
+	return true;
+}
+
+/**
+ * @brief set a function that gets called with every individual (unaveraged) acc/gyro reading that GetAccGyroSample, GetSample, or GetSamples collects, e.g. for event detection at the full 104 Hz rate while samples are averaged. In FIFO averaging mode (see EnableFifoAveraging) every reading that the LSM6DS33 produces is passed to the tap, even when the samples themselves are averaged over fewer readings. The callback runs in the sampling thread (sometimes while the I2C bus is held), so it must return quickly and must not call any IMU functions. Set the tap before sampling starts, or after it has stopped.
+ * 
+ * @param callback the function to call for each reading, or nullptr to remove the tap
+ * @param pUserData pointer that gets passed back to callback
+ */
+void IMU::SetReadingTap(IMU_READING_CALLBACK callback, void *pUserData) {
+	//the old callback is removed before the new user data is stored, and the new callback is only stored after it, so the sampling thread never pairs a callback with the wrong user data
+	m_readingTap.store(nullptr, std::memory_order_release);
+	m_pReadingTapData.store(pUserData, std::memory_order_release);
+	m_readingTap.store(callback, std::memory_order_release);
+}
+
+void IMU::TapReading(double *acc_counts, double *gyro_data, double dSampleTime) {//pass one acc/gyro reading to the reading tap (if there is one)
+	//acc_counts = raw accelerometer counts, gyro_data = angular rates in deg/sec, dSampleTime = monotonic time of the reading
+	IMU_READING_CALLBACK readingTap = m_readingTap.load(std::memory_order_acquire);
+	if (readingTap==nullptr) {
+		return;
+	}
+	IMU_RAW_READING reading;
+	reading.sample_time_sec = dSampleTime;
+	for (int i=0;i<3;i++) {
+		reading.acc[i] = acc_counts[i] * m_dAccGain;
+		reading.angular_rate[i] = gyro_data[i];
+	}
+	//change sign of accZ (to match previously used LM303D compass module)
+	reading.acc[2] = -reading.acc[2];
+	readingTap(&reading, m_pReadingTapData.load(std::memory_order_acquire));
+}
+
+/**
+ * @brief set the full-scale range of the accelerometer, e.g. +/- 16 G for capturing wave slams and groundings that would clip at the default +/- 2 G. The sensitivity used for specific force, the reading tap, and the accelerometer stream follows the range; acc_data is normalized, so the attitude path is not affected (apart from the coarser resolution). Set the range before sampling starts, or after it has stopped.
+ * 
+ * @param nFullScaleG the full-scale range in G: 2, 4, 8, or 16
+ * @return true if the range was set
+ * @return false if nFullScaleG is not one of the supported ranges, or there was a problem writing to the LSM6DS33
+ */
+bool IMU::SetAccFullScale(int nFullScaleG) {
+	unsigned char ucBits = 0x00;
+	if (nFullScaleG==4) ucBits = ACC_CTRL1_XL_FS_4G;
+	else if (nFullScaleG==8) ucBits = ACC_CTRL1_XL_FS_8G;
+	else if (nFullScaleG==16) ucBits = ACC_CTRL1_XL_FS_16G;
+	else if (nFullScaleG!=2) {
+		sprintf(m_szErrMsg, "Error, invalid accelerometer full-scale range (%d G).\n", nFullScaleG);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	//the sensors are powered down in duty cycle mode, so the new range is only written when they are woken up again
+	if (!m_bDutyCycleMode) {
+		unsigned char ucCtrl1 = (m_bAccStream ? ACC_CTRL1_XL_1660HZ : ACC_CTRL1_XL_104HZ) | ucBits;
+		if (!WriteRegister(ACC_GYRO_I2C_ADDRESS, ACC_CTRL1_XL, ucCtrl1)) {
+			return false;
+		}
+	}
+	m_nAccFullScaleG = nFullScaleG;
+	m_ucAccFullScaleBits = ucBits;
+	m_dAccGain = ACC_GAIN * nFullScaleG / 2;
+	return true;
+}
+
+/**
+ * @brief get the full-scale range of the accelerometer (see SetAccFullScale)
+ * 
+ * @return int the full-scale range in G (2, 4, 8, or 16)
+ */
+int IMU::GetAccFullScale() {
+	return m_nAccFullScaleG;
+}
+
+void IMU::SetSpecificForce(IMU_DATASAMPLE *pIMUSample, const double *acc_counts) {//convert averaged accelerometer counts into the specific force of a sample
+	//acc_counts = raw accelerometer counts (averaged over the readings of the sample)
+	//unlike acc_data, the result keeps its magnitude, so that FusionKernel::GetLinearAcceleration can tell dynamic acceleration from gravity
+	//no temperature correction is applied, since the accelerometer temperature coefficients in IMU_TEMP_CAL are not calibrated
+	pIMUSample->specific_force[0] = acc_counts[0] * m_dAccGain;
+	pIMUSample->specific_force[1] = acc_counts[1] * m_dAccGain;
+	//change sign of accZ (to match previously used LM303D compass module)
+	pIMUSample->specific_force[2] = -acc_counts[2] * m_dAccGain;
+}
+
+void IMU::UpdateVelocity(IMU_DATASAMPLE *pSample, bool bRestart) {//integrate the linear acceleration of a fused sample into its velocity
+	//pSample = sample whose linear_acc has been computed, its velocity gets filled in
+	//bRestart = true if the orientation was started again for this sample (e.g. after the sensors were powered down), in which case the velocity starts again from zero
+	//the integral leaks back towards zero with time constant m_dVelocityLeakSec (backward Euler step, so no exp is needed), which keeps accelerometer bias and attitude errors from making it drift without bound
+	double dt = pSample->sample_time_sec - m_dLastVelocityTime;
+	if (bRestart||m_dLastVelocityTime<=0.0||dt<=0.0||dt>m_dVelocityLeakSec) {
+		//no usable previous velocity (a gap longer than the time constant leaves almost nothing of it anyway)
+		memset(m_velocity, 0, 3*sizeof(double));
+	}
+	else {
+		double dLeak = m_dVelocityLeakSec / (m_dVelocityLeakSec + dt);
+		for (int i=0;i<3;i++) {
+			m_velocity[i] = (m_velocity[i] + pSample->linear_acc[i] * STD_GRAVITY_MPS2 * dt) * dLeak;
+		}
+	}
+	m_dLastVelocityTime = pSample->sample_time_sec;
+	memcpy(pSample->velocity, m_velocity, 3*sizeof(double));
+}
+
+/**
+ * @brief get the overrun, late read, and failed read counters for each sensor. These can be used to check whether or not a given sampling configuration keeps up with the output data rates of the sensors.
+ * 
+ * @param pStats pointer to a structure that receives a copy of the counters
+ */
+void IMU::GetSampleStats(IMU_SAMPLE_STATS *pStats) {
+	memcpy(pStats, &m_sampleStats, sizeof(IMU_SAMPLE_STATS));
+}
+
+/**
+ * @brief set all of the overrun, late read, and failed read counters back to zero
+ * 
+ */
+void IMU::ResetSampleStats() {
+	memset(&m_sampleStats, 0, sizeof(IMU_SAMPLE_STATS));
+}
+
+/**
+ * @brief get the time taken by each phase of construction (opening the I2C port, configuring each sensor, and parsing the magnetometer calibration), and the time from the start of construction until the first successful sample.
+ *
+ * @param pTiming pointer to the structure that receives the timing. first_sample_ms is 0 if no sample has been collected yet.
+ */
+void IMU::GetInitTiming(IMU_INIT_TIMING *pTiming) {
+	pthread_mutex_lock(&m_sampleMutex);
+	memcpy(pTiming, &m_initTiming, sizeof(IMU_INIT_TIMING));
+	pthread_mutex_unlock(&m_sampleMutex);
+}
+
+/**
+ * @brief select the engine that ComputeOrientation uses to fuse the acc, mag, and gyro data (FUSION_ENGINE_SLERP by default); the angles have the same conventions with every engine. Call this before sampling starts, since the orientation restarts from the next acc/mag sample.
+ *
+ * @param nEngine one of FUSION_ENGINE_SLERP, FUSION_ENGINE_MADGWICK, FUSION_ENGINE_MAHONY (which work directly on the acc, mag, and gyro vectors and can estimate the gyro bias), or FUSION_ENGINE_EKF (an error-state Kalman filter that also estimates its uncertainty, see GetFusionHealth). For engines that estimate the gyro bias, the LSM6DS33 gyro high pass filter is turned off, so that slow real turns are not attenuated.
+ * @param dGain the Madgwick beta or Mahony Kp in rad/sec (e.g. FUSION_MADGWICK_DEFAULT_BETA or FUSION_MAHONY_DEFAULT_KP), or the Kalman filter gyro noise density in rad/sec/sqrt(Hz) (e.g. FUSION_EKF_DEFAULT_GYRO_NOISE), not used by FUSION_ENGINE_SLERP
+ * @param dBiasGain the Madgwick zeta or Mahony Ki in rad/sec^2 (e.g. FUSION_MADGWICK_DEFAULT_ZETA or FUSION_MAHONY_DEFAULT_KI) or 0 to turn off gyro bias estimation, or the Kalman filter gyro bias random walk in rad/sec^2/sqrt(Hz) (e.g. FUSION_EKF_DEFAULT_BIAS_NOISE), not used by FUSION_ENGINE_SLERP
+ * @return true if the engine was selected
+ * @return false if nEngine is not a valid engine or a gain is negative, or if the gyro high pass filter setting could not be changed (the previous engine is then kept)
+ */
+bool IMU::SetFusionEngine(int nEngine, double dGain, double dBiasGain) {
+	FUSION_STATE newFusion = m_fusion;//the engine is only switched once the gyro high pass filter matches it
+	if (!FusionKernel::SetEngine(&newFusion, nEngine, dGain, dBiasGain)) {
+		sprintf(m_szErrMsg, "Invalid fusion engine (%d) or gains (%f, %f).\n", nEngine, dGain, dBiasGain);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	bool bGyroHighPass = !FusionKernel::EstimatesGyroBias(&newFusion);
+	if (bGyroHighPass!=m_bGyroHighPass&&m_bAccGyroInitialized_OK) {//otherwise it gets set when the LSM6DS33 is initialized
+		unsigned char ucCtrl7 = bGyroHighPass ? GYRO_CTRL7_G_HPF : GYRO_CTRL7_G_NO_HPF;
+		pthread_mutex_lock(m_i2c_mutex);
+		bool bOK = BusWrite(ACC_GYRO_I2C_ADDRESS, GYRO_CTRL7_G, &ucCtrl7, 1);
+		pthread_mutex_unlock(m_i2c_mutex);
+		if (!bOK) {
+			return false;
+		}
+	}
+	m_bGyroHighPass = bGyroHighPass;
+	m_fusion = newFusion;
+	pthread_mutex_lock(&m_sampleMutex);
+	memset(&m_fusionHealth, 0, sizeof(FUSION_HEALTH));
+	pthread_mutex_unlock(&m_sampleMutex);
+	return true;
+}
+
+/**
+ * @brief get the orientation uncertainty and gyro bias estimate of the fusion engine, as of the most recent sample. The uncertainty (standard deviations and normalized innovations) is only available with FUSION_ENGINE_EKF, and can be used to tell when the orientation should not be trusted, e.g. when the heading uncertainty grows because of magnetic disturbances.
+ *
+ * @param pHealth pointer to the structure that receives the uncertainty and gyro bias estimate
+ */
+void IMU::GetFusionHealth(FUSION_HEALTH *pHealth) {
+	pthread_mutex_lock(&m_sampleMutex);
+	memcpy(pHealth, &m_fusionHealth, sizeof(FUSION_HEALTH));
+	pthread_mutex_unlock(&m_sampleMutex);
+}
+
+/**
+ * @brief choose whether ComputeOrientation (and so GetSample, GetSamples, etc.) computes the heading, pitch, and roll angles of every sample, or only its orientation quaternion. The quaternion is always filled in; with lazy angles, the angles are only computed when a consumer calls GetAngles for a sample, which saves the inverse trig functions for consumers that only use the quaternion. Lazy angles are off by default, so that the angles are always filled in.
+ *
+ * @param bLazyAngles true to leave the angles for GetAngles to compute, false to compute them for every sample
+ */
+void IMU::SetLazyAngles(bool bLazyAngles) {
+	m_bLazyAngles = bLazyAngles;
+}
+
+/**
+ * @brief set the time constant of the leaky integration that ComputeOrientation uses to turn the linear acceleration of each sample (see IMU_DATASAMPLE::linear_acc) into its velocity (see IMU_DATASAMPLE::velocity). The velocity follows changes in motion that are short compared with the time constant, and decays back towards zero over longer times, so that accelerometer bias and attitude errors cannot make it drift without bound. The default is IMU_DEFAULT_VELOCITY_LEAK_SEC.
+ *
+ * @param dLeakTimeSec the time constant in seconds (must be greater than zero)
+ */
+void IMU::SetVelocityLeakTime(double dLeakTimeSec) {
+	if (dLeakTimeSec>0.0) {
+		m_dVelocityLeakSec = dLeakTimeSec;
+	}
+}
+
+/**
+ * @brief compute the heading, pitch, and roll angles of a sample from its orientation quaternion, if they have not been computed yet (i.e. if the sample was collected with lazy angles turned on, see SetLazyAngles). The angles are the same (to within a few millionths of a degree) as the ones ComputeOrientation would have filled in, and are stored in the sample so that later calls cost nothing.
+ *
+ * @param pSample pointer to a sample whose orientation was computed by ComputeOrientation
+ */
+void IMU::GetAngles(IMU_DATASAMPLE *pSample) {
+	if (pSample->have_angles) {
+		return;
+	}
+	FusionKernel::ToNEDAngles(pSample->orientation, pSample->roll, pSample->pitch, pSample->heading);
+	pSample->have_angles = true;
+}
+
+/**
+ * @brief extrapolate the orientation of a sample to a given time (e.g. the time that a camera frame was exposed, or that a control output takes effect), by rotating its orientation quaternion at its bias-corrected angular rate for the time from when the orientation was computed until the query time. This is cheap enough to call for every frame or control step, and it does not change the sample or the orientation state, so it can be used on a copy of the sample from any thread (see also OrientationSlot::PredictOrientation). The time that it took to read the sample from the sensors is not accounted for, so the prediction lags by about one bus read.
+ *
+ * @param pSample pointer to a sample whose orientation was computed by ComputeOrientation
+ * @param dQueryTimeSec the time to predict the orientation at, from the same monotonic clock as GetMonotonicTimeSec
+ * @param q the returned orientation quaternion (forward-right-down sensor axes to north-east-down world axes, see FusionKernel::GetQuaternion)
+ * @return true if the orientation was extrapolated by the whole time from when it was computed until dQueryTimeSec
+ * @return false if that time was longer than IMU_MAX_PREDICTION_SEC (in either direction), in which case the orientation is only extrapolated by IMU_MAX_PREDICTION_SEC
+ */
+bool IMU::PredictOrientation(const IMU_DATASAMPLE *pSample, double dQueryTimeSec, FUSION_QUAT &q) {
+	double dt = dQueryTimeSec - pSample->fused_time_sec;
+	bool bInRange = true;
+	if (dt>IMU_MAX_PREDICTION_SEC) {
+		dt = IMU_MAX_PREDICTION_SEC;
+		bInRange = false;
+	}
+	else if (dt<-IMU_MAX_PREDICTION_SEC) {
+		dt = -IMU_MAX_PREDICTION_SEC;
+		bInRange = false;
+	}
+	FusionKernel::PredictQuaternion(pSample->orientation, pSample->corrected_rate, dt, q);
+	return bInRange;
+}
+
+void IMU::ReadMagOffsets() {//read in and print out mag offsets stored in offset registers
+	unsigned char outBuf[1];
+	unsigned char inBuf[6];
+	outBuf[0] = MAG_OFFSET_X_L;
+	if (write(m_file_i2c,outBuf,1)!=1) {
+		//error, I2C transaction failed
+		sprintf(m_szErrMsg, "Failed to write to the I2C bus register %d.\n",(int)outBuf[0]);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return;
+	}
+	//read in 6 bytes for mag offsets
+	int nNumRead = read(m_file_i2c,inBuf,6);
+	if (nNumRead!=6) {
+		//error, I2C transaction failed
+		sprintf(m_szErrMsg, "Error, only %d of 6 bytes of mag offset data read.\n",nNumRead);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return;
+	}
+	//mag_offsets expressed in counts
+	double mag_offsets[3];
+	mag_offsets[0] = Get16BitTwosComplement(inBuf[1], inBuf[0]);
+	mag_offsets[1] = Get16BitTwosComplement(inBuf[3], inBuf[2]);
+	mag_offsets[2] = Get16BitTwosComplement(inBuf[5], inBuf[4]);
+	sprintf(m_szErrMsg, "mag_offsets = %.0f, %.0f, %.0f\n",mag_offsets[0],mag_offsets[1],mag_offsets[2]);
+	g_shiplog.LogEntry(m_szErrMsg, true);
+}
+
+/**
+ * @brief perform a calibration procedure on the magnetometers to get the zero-field offsets for each of the sensors. Saves the results to the offset registers.
+ * 
+ * @return true if the calibration was completed successfully
+ * @return false if there was some sort of error in completing the calibration
+ */
+bool IMU::DoMagCal() {//perform a calibration procedure on the magnetometers to get the zero-field offsets for each of the sensors. Saves the results to the offset registers.
+	printf("Press \'q\' to quit or \'c\' to calibrate...\n");
+	double mag_data[NUM_MAGCAL_AVG][3];//do running average of 50 mag samples
+	double avg_mag[3];//averaged magnetometer values
+	unsigned char out_buf[2];
+	memset(mag_data,0,NUM_MAGCAL_AVG*3*sizeof(double));	
+	memset(avg_mag,0,3*sizeof(double));//averaged magnetometer values
+	//initialize min and max sensor outputs to large and small values respectively
+	double dMinMagX = 32767.0, dMaxMagX = -32767.0;
+	double dMinMagY = 32767.0, dMaxMagY = -32767.0;
+	double dMinMagZ = 32767.0, dMaxMagZ = -32767.0;
+	int nKeyPressed = Util::getch_noblock();
+	if (!m_bMagInitialized_OK) {
+		strcpy(m_szErrMsg, (char *)"Error, magnetometer was not properly initialized. Cannot do calibration.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	pthread_mutex_lock(m_i2c_mutex);
+	if (ioctl(m_file_i2c, I2C_SLAVE, MAG_I2C_ADDRESS)<0) {
+		sprintf(m_szErrMsg, "Failed (error = %s) to acquire bus access and/or talk to slave magnetometer.\n",strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		pthread_mutex_unlock(m_i2c_mutex);
+		return false;
+	}
+	//zero mag offset registers
+	for (int i=0;i<6;i++) {
+		out_buf[0] = (unsigned char)(MAG_OFFSET_X_L+i);
+		out_buf[1] = 0x00;
+		if (write(m_file_i2c, out_buf, 2)!=2) {
+			//error, I2C transaction failed
+			strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for zeroing mag offsets.\n");
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			pthread_mutex_unlock(m_i2c_mutex);
+			return false;
+		}
+	}
+
+	int nSampleNum=0;
+	while (nKeyPressed!=113&&nKeyPressed!=99) {//keep looping, looking for new max or min values until the 'c' for calibrate or 'q' for quit keys are pressed
+		if (WaitForMagDataReady(MAG_STATUS_REG)) {
+			if (Get6BytesRegData(mag_data[nSampleNum%NUM_MAGCAL_AVG], MAG_OUTX_L)) {
+				nSampleNum++;
+				if (GetAvgMagVals(mag_data, avg_mag, nSampleNum))
+				{
+					//check to see if there are new min or max values
+					if (avg_mag[0] < dMinMagX)
+					{
+						dMinMagX = avg_mag[0];
+					}
+					if (avg_mag[0] > dMaxMagX)
+					{
+						dMaxMagX = avg_mag[0];
+					}
+					if (avg_mag[1] < dMinMagY)
+					{
+						dMinMagY = avg_mag[1];
 					}
 					if (avg_mag[1] > dMaxMagY)
 					{
@@ -1123,20 +2536,37 @@ bool IMU::GetAvgMagVals(double mag_data[NUM_MAGCAL_AVG][3], double avg_mag[3], i
 }
 
 bool IMU::LoadMagCal() {//load magnetometer offset calibration (if available) from mag_cal.txt file
+	if (!m_bMagCalParsed) {
+		ParseMagCal();
+	}
+	return SaveMagOffsets(m_magCalOffsets[0],m_magCalOffsets[1],m_magCalOffsets[2]);
+}
+
+void IMU::ParseMagCal() {//parse mag_cal.txt into m_magCalOffsets and m_tempCal
+	double dStartTime = GetMonotonicTimeSec();
 	filedata magCal((char *)"./mag_cal.txt");
-	double mag_offsets[3];
-	double mag_vs_temp[3];//temperature coefficients
-	magCal.getDouble((char *)"[calibration]",(char *)"mag_offsets",3,mag_offsets);
+	double mag_vs_temp[3] = {0.0, 0.0, 0.0};//temperature coefficients
+	magCal.getDouble((char *)"[calibration]",(char *)"mag_offsets",3,m_magCalOffsets);
 	magCal.getDouble((char*)"[calibration]", (char*)"mag_vs_temp", 3, mag_vs_temp);
 	m_tempCal.mag_cal_temp = magCal.getDouble((char*)"[calibration]", (char*)"mag_cal_temp");
 	m_tempCal.magx_vs_temp = mag_vs_temp[0];
 	m_tempCal.magy_vs_temp = mag_vs_temp[1];
 	m_tempCal.magz_vs_temp = mag_vs_temp[2];
-	return SaveMagOffsets(mag_offsets[0],mag_offsets[1],mag_offsets[2]);
+	m_bMagCalParsed = true;
+	m_initTiming.cal_parse_ms = (GetMonotonicTimeSec() - dStartTime)*1000;
+}
+
+void *IMU::MagCalParseThread(void *pParam) {//thread function for parsing mag_cal.txt while the other sensors are being configured
+	IMU *pIMU = (IMU *)pParam;
+	pIMU->ParseMagCal();
+	return nullptr;
 }
 
 bool IMU::SaveMagOffsets(double dMagOffsetX, double dMagOffsetY, double dMagOffsetZ) {//store magnetometer offsets to mag offsets registers
-	unsigned char out_buf[2] = {0,0};
+	//keep the offsets, so that re-initializing the magnetometer restores them without parsing mag_cal.txt again
+	m_magCalOffsets[0] = dMagOffsetX;
+	m_magCalOffsets[1] = dMagOffsetY;
+	m_magCalOffsets[2] = dMagOffsetZ;
 	int nMagOffsetX = (int)(dMagOffsetX);
 	int nMagOffsetY = (int)(dMagOffsetY);
 	int nMagOffsetZ = (int)(dMagOffsetZ);
@@ -1145,9 +2575,6 @@ bool IMU::SaveMagOffsets(double dMagOffsetX, double dMagOffsetY, double dMagOffs
 	int nOriginalOffZ = nMagOffsetZ;
 
 	//convert to 2's complement values
-	unsigned char magOffX[2];
-	unsigned char magOffY[2];
-	unsigned char magOffZ[2];
 	if (nMagOffsetX < 0)
 	{
 		nMagOffsetX = 65536 + nMagOffsetX;
@@ -1160,155 +2587,252 @@ bool IMU::SaveMagOffsets(double dMagOffsetX, double dMagOffsetY, double dMagOffs
 	{
 		nMagOffsetZ = 65536 + nMagOffsetZ;
 	}
-	magOffX[0] = (unsigned char)(nMagOffsetX & 0x00ff);		   //x-axis low-order byte
-	magOffX[1] = (unsigned char)((nMagOffsetX & 0xff00) >> 8); //x-axis high-order byte
-	magOffY[0] = (unsigned char)(nMagOffsetY & 0x00ff);		   //y-axis low-order byte
-	magOffY[1] = (unsigned char)((nMagOffsetY & 0xff00) >> 8); //y-axis high-order byte
-	magOffZ[0] = (unsigned char)(nMagOffsetZ & 0x00ff);		   //z-axis low-order byte
-	magOffZ[1] = (unsigned char)((nMagOffsetZ & 0xff00) >> 8); //z-axis high-order byte
-	out_buf[0] = (unsigned char)(MAG_OFFSET_X_L);
-	out_buf[1] = magOffX[0];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		sprintf(m_szErrMsg, "Failed to write to the I2C bus for MAG_OFFSET_X_L calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		return false;
-	}
-	out_buf[0] = (unsigned char)(MAG_OFFSET_X_H);
-	out_buf[1] = magOffX[1];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_OFFSET_X_H calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		return false;
-	}
-	out_buf[0] = (unsigned char)(MAG_OFFSET_Y_L);
-	out_buf[1] = magOffY[0];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_OFFSET_Y_L calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		return false;
-	}
-	out_buf[0] = (unsigned char)(MAG_OFFSET_Y_H);
-	out_buf[1] = magOffY[1];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_OFFSET_Y_H calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		return false;
-	}
-	out_buf[0] = (unsigned char)(MAG_OFFSET_Z_L);
-	out_buf[1] = magOffZ[0];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_OFFSET_Z_L calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
-		return false;
-	}
-	out_buf[0] = (unsigned char)(MAG_OFFSET_Z_H);
-	out_buf[1] = magOffZ[1];
-	if (write(m_file_i2c, out_buf, 2) != 2)
-	{
-		//error, I2C transaction failed
-		strcpy(m_szErrMsg, (char *)"Failed to write to the I2C bus for MAG_OFFSET_Z_H calibration byte.\n");
-		g_shiplog.LogEntry(m_szErrMsg, true);
+	unsigned char magOffsets[6];
+	magOffsets[0] = (unsigned char)(nMagOffsetX & 0x00ff);		   //x-axis low-order byte
+	magOffsets[1] = (unsigned char)((nMagOffsetX & 0xff00) >> 8); //x-axis high-order byte
+	magOffsets[2] = (unsigned char)(nMagOffsetY & 0x00ff);		   //y-axis low-order byte
+	magOffsets[3] = (unsigned char)((nMagOffsetY & 0xff00) >> 8); //y-axis high-order byte
+	magOffsets[4] = (unsigned char)(nMagOffsetZ & 0x00ff);		   //z-axis low-order byte
+	magOffsets[5] = (unsigned char)((nMagOffsetZ & 0xff00) >> 8); //z-axis high-order byte
+	//write MAG_OFFSET_X_L to MAG_OFFSET_Z_H (0x05 to 0x0A) in one burst
+	if (!BusWrite(MAG_I2C_ADDRESS, MAG_OFFSET_X_L|MAG_AUTO_INCREMENT, magOffsets, 6)) {
 		return false;
 	}
 	return true;//offsets stored successfully
 }
 
 /**
- * @brief compute orientation (pitch, roll, and heading angles) of the AltIMU-10, using acc/mag data plus gyros. The orientation angles are saved in the IMU_DATASAMPLE structure that is passed to the function.
+ * @brief compute orientation (orientation quaternion, and pitch, roll, and heading angles) of the AltIMU-10, using acc/mag data plus gyros, and save it in the IMU_DATASAMPLE structure that is passed to the function. The linear acceleration and leaky velocity estimate of the sample are filled in too (see SetVelocityLeakTime), and the sample is published to an attached orientation slot (see AttachOrientationSlot).
  * 
- * @param pSample pointer to a structure that holds the computed heading, pitch, roll angles. This structure should contain valid acceleration acceleration (X,Y,Z, in G), magnetometer (X,Y,Z, normalized units), and angular rate (RX,RY,RZ, deg/s) data prior to calling this function.
+ * @param pSample pointer to a structure that holds the computed heading, pitch, roll angles. This structure should contain valid acceleration acceleration (X,Y,Z, in G, plus the unnormalized specific force), magnetometer (X,Y,Z, normalized units), and angular rate (RX,RY,RZ, deg/s) data prior to calling this function. With lazy angles (see SetLazyAngles), only the quaternion is filled in, and the angles are left for GetAngles.
  */
 void IMU::ComputeOrientation(IMU_DATASAMPLE *pSample) {
-	const double RAD_TO_DEG = 57.29578;
-	const double DEG_TO_RAD = 0.01745329251994;
-	const double SLERP_FACTOR = 0.97;
-	double mag_data[3];
-	double acc_data[3];
-	double gyro_data[3];
-	//copy data from IMU_DATASAMPLE structure
-	memcpy(mag_data,pSample->mag_data,3*sizeof(double));
-	memcpy(acc_data,pSample->acc_data,3*sizeof(double));
-	memcpy(gyro_data,pSample->angular_rate,3*sizeof(double));
-	double dPitchAngleRad = asin(-acc_data[0]);//pitch angle in radians
-	double dCosFactor = cos(dPitchAngleRad);
-	double dRollAngleRad = 0.0;//roll angle in radians
-	if (dCosFactor!=0.0) {
-		dRollAngleRad = asin(acc_data[1] / dCosFactor);
-	}
-	double mx2 = mag_data[0]*cos(dPitchAngleRad) - mag_data[2]*sin(dPitchAngleRad);
-	double my2 = mag_data[0]*sin(dPitchAngleRad)*sin(dRollAngleRad) + mag_data[1]*cos(dRollAngleRad) + mag_data[2]*cos(dPitchAngleRad)*sin(dRollAngleRad);
-	double dHeadingAngleRad = atan2(my2,mx2);//heading angle in radians
-	//copy to pSample (and convert angles to degrees)
-	double dPitch = dPitchAngleRad*RAD_TO_DEG;
-	double dRoll = dRollAngleRad*RAD_TO_DEG;
-	double dHeading = dHeadingAngleRad*RAD_TO_DEG;
-	//make sure heading is between 0 and 360
-	if (dHeading<0) dHeading+=360;
-	else if (dHeading>360) dHeading-=360;
-	quaternion2 accMagQuat(-dRoll,-dPitch,-dHeading);
-	if (m_quat==nullptr) {
-		m_quat = new quaternion2(accMagQuat);
-	}
-	else if (m_dLastSampleTime==0.0) {
-		*m_quat = accMagQuat;
-	}
-	else {//combine gyro and acc/mag results together using spherical linear interpolation
-		vector3d vx(1,0,0);
-		vector3d vy(0,1,0);
-		vector3d vz(0,0,1);
-		double dTimeElapsedSec = pSample->sample_time_sec - this->m_dLastSampleTime;
-		double dIncRoll = -gyro_data[0]*dTimeElapsedSec;//incremental roll change
-		double dIncPitch = -gyro_data[1]*dTimeElapsedSec;//incremental pitch change
-		double dIncYaw = gyro_data[2]*dTimeElapsedSec;//incremental yaw change
-		quaternion2 qx(vx, dIncRoll * DEG_TO_RAD);
-		quaternion2 qz(vz, dIncPitch * DEG_TO_RAD);
-		quaternion2 qy(vy, dIncYaw * DEG_TO_RAD);
-		quaternion2 incQuat;
-		if (m_nGyroAxisOrder==0) {
-			incQuat = (qx*qy)*qz;
-		}
-		else if (m_nGyroAxisOrder==1) {
-			incQuat = (qy*qz)*qx;
+	FuseSample(pSample, 0.0);
+}
+
+void IMU::FuseSample(IMU_DATASAMPLE *pSample, double dFusedTimeSec) {//compute the orientation of a sample (see ComputeOrientation) and stamp it with a given fused time
+	//dFusedTimeSec = monotonic time to stamp the sample with (e.g. when its data was read, for samples that are fused after a burst), or 0 to use the time when fusion finishes
+	bool bRestart = m_fusion.last_sample_time_sec<=0.0;//true if the orientation starts again from this sample
+	if (m_nNumFifoRates>0) {
+		//in FIFO averaging mode, rotate through every gyro reading of the run first, so that the update only has to apply the acc/mag correction
+		FusionKernel::Propagate(&m_fusion, m_fifoRates, m_fifoRateTimes, m_nNumFifoRates);
+		m_nNumFifoRates = 0;
+	}
+	if (m_bLazyAngles) {
+		FusionKernel::UpdateQuaternion(&m_fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec);
+		FusionKernel::GetQuaternion(&m_fusion, pSample->orientation);
+		pSample->have_angles = false;
+	}
+	else {
+		FusionKernel::Update(&m_fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec, pSample->roll, pSample->pitch, pSample->heading);
+		if (m_fusion.engine==FUSION_ENGINE_SLERP) {
+			//GetQuaternion would compute these same angles again from the AMOS quaternion
+			FusionKernel::FromNEDAngles(pSample->roll, pSample->pitch, pSample->heading, pSample->orientation);
 		}
 		else {
-			incQuat = (qz*qz)*qy;
+			FusionKernel::GetQuaternion(&m_fusion, pSample->orientation);
 		}
-		quaternion2 rotatedQuat = *m_quat * incQuat;
-		rotatedQuat.slerp(accMagQuat,1.0-SLERP_FACTOR);
-		*m_quat = rotatedQuat;
-		m_nGyroAxisOrder = (m_nGyroAxisOrder+1)%3;
+		pSample->have_angles = true;
+	}
+	FusionKernel::GetCorrectedRate(&m_fusion, pSample->angular_rate, pSample->corrected_rate);
+	FusionKernel::GetLinearAcceleration(pSample->orientation, pSample->specific_force, pSample->linear_acc);
+	UpdateVelocity(pSample, bRestart);
+	pSample->fused_time_sec = dFusedTimeSec>0.0 ? dFusedTimeSec : GetMonotonicTimeSec();
+	FUSION_HEALTH health;
+	bool bHaveHealth = m_fusion.engine!=FUSION_ENGINE_SLERP;
+	if (bHaveHealth) {
+		FusionKernel::GetHealth(&m_fusion, &health);
+	}
+	pthread_mutex_lock(&m_sampleMutex);
+	if (bHaveHealth) {
+		memcpy(&m_fusionHealth, &health, sizeof(FUSION_HEALTH));
 	}
-	m_dLastSampleTime = pSample->sample_time_sec;
-	double dCurrentHeading=0.0, dCurrentPitch=0.0, dCurrentRoll=0.0;
-	tmatrix mat = m_quat->getRotMatrix();
-	mat.getAMOSRPY(dCurrentRoll,dCurrentPitch,dCurrentHeading);
-	//copy orientation angles to IMU_DATASAMPLE structure
-	pSample->heading = dCurrentHeading;
-	pSample->pitch = dCurrentPitch;
-	pSample->roll = dCurrentRoll;
+	OrientationSlot *pSlot = m_pOrientationSlot;
+	pthread_mutex_unlock(&m_sampleMutex);
+	if (pSlot!=nullptr) {
+		pSlot->Publish(pSample);
+	}
+}
+
+/**
+ * @brief compute the orientation of a block of samples held as one array per component (e.g. samples loaded from a log file), batching the per-sample work that does not depend on the previous sample (see FusionKernel::UpdateBatch). This continues from, and updates, the orientation state and fusion health used by ComputeOrientation, so do not call it while samples are being collected.
+ *
+ * @param pSamples the sample arrays: sample times (in seconds), acceleration (X,Y,Z, in G), magnetometer (X,Y,Z, normalized units), and angular rate (RX,RY,RZ, deg/s), each holding nNumSamples values
+ * @param nNumSamples the number of samples
+ * @param pAngles the arrays that receive the orientation quaternion and the roll, pitch, and heading angles (in degrees) of each sample, the same as ComputeOrientation would give; any of them can be nullptr if they are not needed. The bias-corrected rate, linear acceleration, and velocity are not computed, and nothing is published to an attached OrientationSlot.
+ */
+void IMU::ComputeOrientationBatch(const FUSION_SAMPLE_SPANS *pSamples, int nNumSamples, FUSION_ORIENTATION_SPANS *pAngles) {
+	FusionKernel::UpdateBatch(&m_fusion, pSamples, nNumSamples, pAngles);
+	if (m_fusion.engine!=FUSION_ENGINE_SLERP) {
+		FUSION_HEALTH health;
+		FusionKernel::GetHealth(&m_fusion, &health);
+		pthread_mutex_lock(&m_sampleMutex);
+		memcpy(&m_fusionHealth, &health, sizeof(FUSION_HEALTH));
+		pthread_mutex_unlock(&m_sampleMutex);
+	}
+}
+
+/**
+ * @brief collect magnetometer, accelerometer, and gyro data, and then call ComputeOrientation to determine orientation angles. This function can be called from multiple threads: callers that arrive while another thread is already collecting a sample wait for that sample and receive a copy of it, instead of starting another acquisition, so the orientation state is updated exactly once per sample. If a broadcast ring is attached (see AttachSampleBus), the sample is also published to it.
+ *
+ * @param pIMUSample pointer to a IMU_DATASAMPLE structure that receives the sensor data and computed orientation angles
+ * @param nNumToAvg the number of individual samples to collect and average (use 1 for no averaging). Callers that share an acquisition already in progress get the sample with whatever averaging it was started with.
+ * @return true if the sample was collected successfully
+ * @return false if there was a problem collecting the sample
+ */
+bool IMU::GetSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {
+	return GetCoalescedSample(pIMUSample, nNumToAvg);
 }
 
-bool IMU::GetSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//collect magnetometer, accelerometer, and gyro data, and then call ComputeOrientation to determine orientation angles
-	if (!GetMagSample(pIMUSample, nNumToAvg)) {//collect magnetometer data from the LIS3MDL 3-axis magnetometer device and process it to get the magnetic vector and temperature
+/**
+ * @brief check, with one short status read per sensor and without waiting, whether the magnetometer and acc/gyro sensors already have the new data that GetSample needs. An event loop can use this to call GetSample only once the data is there, so that GetSample does not poll the status registers while the loop has other work to do. In FIFO averaging mode (see EnableFifoAveraging) the FIFO must hold nNumToAvg readings; otherwise only the first reading is checked, so averaging more than one reading without FIFO averaging still waits for the remaining readings.
+ *
+ * @param nNumToAvg the number of individual readings that will be averaged by GetSample
+ * @param bReady set to true if GetSample can collect its (first) readings without waiting for new data
+ * @return true if the status registers were read successfully
+ * @return false if the sensors were not properly initialized, or if there was a problem reading from them
+ */
+bool IMU::IsSampleReady(int nNumToAvg, bool &bReady) {
+	unsigned char ucMagStatus = 0;
+	unsigned char statusBuf[4];
+	bReady = false;
+	if (!m_bMagInitialized_OK||!m_bAccGyroInitialized_OK) {
 		return false;
 	}
-	if (!GetAccGyroSample(pIMUSample, nNumToAvg)) {//collect accelerometer & gyro data from the LSM6DS33 and process it to get the acceleration vector, rotation rate vector, and temperature
+	pthread_mutex_lock(&m_sampleMutex);
+	bool bMotionSleep = m_bMotionSleep;
+	pthread_mutex_unlock(&m_sampleMutex);
+	pthread_mutex_lock(m_i2c_mutex);
+	if (!BusRead(MAG_I2C_ADDRESS, MAG_STATUS_REG, &ucMagStatus, 1)) {
+		pthread_mutex_unlock(m_i2c_mutex);
 		return false;
 	}
-	this->ComputeOrientation(pIMUSample);
+	bool bAccGyroReady = bMotionSleep;//while the LSM6DS33 is asleep, GetSample takes the latest accelerometer reading without waiting
+	if (!bAccGyroReady&&m_bFifoAveraging) {
+		if (!BusRead(ACC_GYRO_I2C_ADDRESS, FIFO_STATUS1, statusBuf, 4)) {
+			pthread_mutex_unlock(m_i2c_mutex);
+			return false;
+		}
+		int nNumWords = statusBuf[0] + ((statusBuf[1]&FIFO_STATUS2_DIFF_MASK)<<8);
+		int nPattern = statusBuf[2] + ((statusBuf[3]&0x03)<<8);
+		int nSkipWords = (FIFO_WORDS_PER_SET - nPattern%FIFO_WORDS_PER_SET)%FIFO_WORDS_PER_SET;
+		bAccGyroReady = nNumWords>=nSkipWords+nNumToAvg*FIFO_WORDS_PER_SET;
+	}
+	else if (!bAccGyroReady) {
+		if (!BusRead(ACC_GYRO_I2C_ADDRESS, ACC_GYRO_STATUS_REG, statusBuf, 1)) {
+			pthread_mutex_unlock(m_i2c_mutex);
+			return false;
+		}
+		bAccGyroReady = (statusBuf[0]&ACC_GYRO_STATUS_XLDA_GDA_TDA)==ACC_GYRO_STATUS_XLDA_GDA_TDA;
+	}
+	pthread_mutex_unlock(m_i2c_mutex);
+	bReady = (ucMagStatus&0x07)==0x07&&bAccGyroReady;
 	return true;
 }
 
+/**
+ * @brief attach a broadcast ring that every sample collected by GetSample gets published to, so that any number of consumers can share the same stream of samples without each of them talking to the IMU.
+ *
+ * @param pBus the broadcast ring to publish samples to, or nullptr to stop publishing samples. The IMU object does not take ownership of the ring.
+ */
+void IMU::AttachSampleBus(SampleBus *pBus) {
+	pthread_mutex_lock(&m_sampleMutex);
+	m_pSampleBus = pBus;
+	pthread_mutex_unlock(&m_sampleMutex);
+}
+
+/**
+ * @brief attach a slot that every fused sample (from GetSample, GetSamples, PublishSample, GetDutyCycledFix, or any other caller of ComputeOrientation) gets published to, so that any number of threads can read the latest orientation at their own rates without calling into the IMU object (see OrientationSlot::Read).
+ *
+ * @param pSlot the slot to publish fused samples to, or nullptr to stop publishing them. The IMU object does not take ownership of the slot.
+ */
+void IMU::AttachOrientationSlot(OrientationSlot *pSlot) {
+	pthread_mutex_lock(&m_sampleMutex);
+	m_pOrientationSlot = pSlot;
+	pthread_mutex_unlock(&m_sampleMutex);
+}
+
+/**
+ * @brief acquire a sample (magnetometer, accelerometer, gyro, and orientation data) and publish it to all of the readers of the attached broadcast ring. The sample is collected into a working copy and only copied into the ring once it is complete, so a failed acquisition leaves the ring (including the oldest sample, whose slot the new sample would have reused) untouched. If another thread is already collecting a sample, this function waits for that sample (which gets published by that thread) instead of starting another acquisition.
+ *
+ * @param nNumToAvg the number of individual samples to collect and average (use 1 for no averaging)
+ * @return true if a new sample was published to the ring
+ * @return false if no ring is attached, or if there was a problem getting the sample (nothing is published in that case)
+ */
+bool IMU::PublishSample(int nNumToAvg) {
+	if (m_pSampleBus==nullptr) {
+		strcpy(m_szErrMsg, (char *)"Error, no sample bus is attached.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	return GetCoalescedSample(nullptr, nNumToAvg);
+}
+
+bool IMU::GetCoalescedSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg) {//collect a new sample, or wait for the sample that another thread is already collecting
+	//pIMUSample = the structure that receives a copy of the sample (can be nullptr if the sample only needs to be published to the attached broadcast ring)
+	//nNumToAvg = the number of individual samples to collect and average
+	pthread_mutex_lock(&m_sampleMutex);
+	if (m_bAcquiring) {
+		//another thread is already talking to the sensors, so wait for its sample instead of doing another acquisition
+		unsigned long ulGeneration = m_ulSampleGeneration;
+		m_sampleStats.coalesced_requests++;
+		while (m_bAcquiring&&ulGeneration==m_ulSampleGeneration) {
+			pthread_cond_wait(&m_sampleCond, &m_sampleMutex);
+		}
+		bool bSampleOK = m_bLastSampleOK;
+		if (bSampleOK&&pIMUSample!=nullptr) {
+			memcpy(pIMUSample, &m_lastSample, sizeof(IMU_DATASAMPLE));
+		}
+		pthread_mutex_unlock(&m_sampleMutex);
+		return bSampleOK;
+	}
+	m_bAcquiring = true;
+	SampleBus *pBus = m_pSampleBus;
+	pthread_mutex_unlock(&m_sampleMutex);
+
+	//only this thread touches the sensors and the orientation state until m_bAcquiring is cleared
+	//the sample is collected into a working copy, so that a failed acquisition does not destroy the sample in the ring slot that it would have gone into
+	IMU_DATASAMPLE *pDest = &m_acqSample;
+	//in FIFO averaging mode the magnetometer relies on its own ultra-high-performance oversampling, so that it also costs one read per averaged sample
+	int nNumMagToAvg = m_bFifoAveraging ? 1 : nNumToAvg;
+	bool bSampleOK = GetMagSample(pDest, nNumMagToAvg) && GetAccGyroSample(pDest, nNumToAvg);//collect magnetometer data from the LIS3MDL, then accelerometer & gyro data from the LSM6DS33
+	if (bSampleOK) {
+		this->ComputeOrientation(pDest);
+		if (pBus!=nullptr) {
+			pBus->Publish(pDest);
+		}
+	}
+	//pick up a new pressure reading (if there is one) on the same pass, checking no more often than the pressure sensor ODR
+	IMU_PRESSURE_SAMPLE pressureSample;
+	bool bNewPressure = false;
+	double dNow = GetMonotonicTimeSec();
+	if (m_bPressureInitialized_OK&&dNow - m_dLastPressureCheckTime>=1.0/PRESS_ODR_HZ) {
+		m_dLastPressureCheckTime = dNow;
+		GetPressureSample(&pressureSample, bNewPressure);
+	}
+
+	pthread_mutex_lock(&m_sampleMutex);
+	if (bNewPressure) {
+		memcpy(&m_lastPressure, &pressureSample, sizeof(IMU_PRESSURE_SAMPLE));
+		m_bHaveLastPressure = true;
+	}
+	if (bSampleOK) {
+		memcpy(&m_lastSample, pDest, sizeof(IMU_DATASAMPLE));
+		if (pIMUSample!=nullptr) {
+			memcpy(pIMUSample, &m_lastSample, sizeof(IMU_DATASAMPLE));
+		}
+		if (m_initTiming.first_sample_ms==0.0) {
+			m_initTiming.first_sample_ms = (dNow - m_dInitStartTime)*1000;
+		}
+	}
+	m_bLastSampleOK = bSampleOK;
+	m_ulSampleGeneration++;
+	m_bAcquiring = false;
+	pthread_cond_broadcast(&m_sampleCond);
+	pthread_mutex_unlock(&m_sampleMutex);
+	return bSampleOK;
+}
+
 /**
  * @brief perform a calibration procedure on the magnetometers to get the zero-field offsets for the X and Y magnetometers. Saves the results to the offset registers.
  *
@@ -1512,6 +3036,8 @@ bool IMU::RetryOpening() {//try re-opening the I2C port, return true if successf
 bool IMU::SaveIMUDataToFile(char* szFilename, int nNumSecs) {
 	IMU_DATASAMPLE dataSample;
 	char lineText[256];
+	int nNumFailedSamples = 0;//number of calls to GetSamples that did not return a full batch of samples while recording data
+	memset(&dataSample, 0, sizeof(IMU_DATASAMPLE));
 	if (!m_bMagInitialized_OK) {
 		strcpy(m_szErrMsg, (char*)"Error, magnetometer was not properly initialized.\n");
 		g_shiplog.LogEntry(m_szErrMsg, true);
@@ -1538,23 +3064,33 @@ bool IMU::SaveIMUDataToFile(char* szFilename, int nNumSecs) {
 		return false;
 	}
 	//print header to file
-	sprintf(lineText, "Time(s), AccX(G), AccY(G), AccZ(G), MagX(Gauss), MagY(Gauss), MagZ(Gauss), GyroX(deg/s), GyroY(deg/s), GyroZ(deg/s), Temp(degC)\n");
+	sprintf(lineText, "Time(s), AccX(G), AccY(G), AccZ(G), MagX(Gauss), MagY(Gauss), MagZ(Gauss), GyroX(deg/s), GyroY(deg/s), GyroZ(deg/s), Temp(degC), QualityFlags\n");
 	dataFile->write(lineText, strlen(lineText));
 	//print 1st sample to file
-	sprintf(lineText, "0.000, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f, %.3f, %.3f, %.3f, %.1f",dataSample.acc_data[0],dataSample.acc_data[1],dataSample.acc_data[2],dataSample.mag_data[0],
-		dataSample.mag_data[1], dataSample.mag_data[2], dataSample.angular_rate[0], dataSample.angular_rate[1], dataSample.angular_rate[2], (dataSample.acc_gyro_temperature+dataSample.mag_temperature)/2);
+	sprintf(lineText, "0.000, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f, %.3f, %.3f, %.3f, %.1f, 0x%02x\n",dataSample.acc_data[0],dataSample.acc_data[1],dataSample.acc_data[2],dataSample.mag_data[0],
+		dataSample.mag_data[1], dataSample.mag_data[2], dataSample.angular_rate[0], dataSample.angular_rate[1], dataSample.angular_rate[2], (dataSample.acc_gyro_temperature+dataSample.mag_temperature)/2, dataSample.quality_flags);
 	dataFile->write(lineText, strlen(lineText));
 	double dFirstSampleTime = dataSample.sample_time_sec;
 	double dSampleTime = 0.0;
+	const int BATCH_SIZE = 16;//number of consecutive samples collected with each call to GetSamples
+	IMU_DATASAMPLE batchSamples[BATCH_SIZE];
 	while (dSampleTime< nNumSecs) {
-		if (GetSample(&dataSample, 1)) {
-			dSampleTime = dataSample.sample_time_sec - dFirstSampleTime;
-			sprintf(lineText,"%.3f, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f, %.3f, %.3f, %.3f, %.1f", dSampleTime, dataSample.acc_data[0], dataSample.acc_data[1], dataSample.acc_data[2], dataSample.mag_data[0],
-				dataSample.mag_data[1], dataSample.mag_data[2], dataSample.angular_rate[0], dataSample.angular_rate[1], dataSample.angular_rate[2], (dataSample.acc_gyro_temperature + dataSample.mag_temperature) / 2);
+		int nNumCollected = GetSamples(batchSamples, BATCH_SIZE, 1.0);
+		if (nNumCollected<BATCH_SIZE) {
+			nNumFailedSamples++;
+		}
+		for (int i=0;i<nNumCollected;i++) {
+			IMU_DATASAMPLE *pSample = &batchSamples[i];
+			dSampleTime = pSample->sample_time_sec - dFirstSampleTime;
+			sprintf(lineText,"%.3f, %.6f, %.6f, %.6f, %.6f, %.6f, %.6f, %.3f, %.3f, %.3f, %.1f, 0x%02x\n", dSampleTime, pSample->acc_data[0], pSample->acc_data[1], pSample->acc_data[2], pSample->mag_data[0],
+				pSample->mag_data[1], pSample->mag_data[2], pSample->angular_rate[0], pSample->angular_rate[1], pSample->angular_rate[2], (pSample->acc_gyro_temperature + pSample->mag_temperature) / 2, pSample->quality_flags);
 			dataFile->write(lineText, strlen(lineText));
 		}
 	}
 	dataFile->close();
+	sprintf(m_szErrMsg, "Recorded %.1f sec of IMU data, %d incomplete sample batches, %u mag overruns, %u missed acc/gyro ticks, %u late mag reads, %u late acc/gyro reads.\n", dSampleTime, nNumFailedSamples,
+		m_sampleStats.mag_missed, m_sampleStats.acc_gyro_missed, m_sampleStats.mag_late, m_sampleStats.acc_gyro_late);
+	g_shiplog.LogEntry(m_szErrMsg, true);
 	return true;
 }
 
@@ -1,14 +1,18 @@
+#pragma once
 using namespace std;
-#include "3DMATH.H"
+#include "FusionKernel.h"
 #ifndef _WIN32
 #include <pthread.h>
+#include <atomic>
 #else
 typedef int pthread_mutex_t;
+typedef int pthread_cond_t;
 #endif
 //class file for use with the AltIMU-10 v5 Gyro, Accelerometer, Compass, and Altimeter from Pololu Electronics (www.pololu.com)
 
 #define MAG_I2C_ADDRESS 0x1E //I2C slave address for the 3-axis magnetometer chip on the AltIMU-10 v5
 #define ACC_GYRO_I2C_ADDRESS 0x6B //I2C slave address for the 3-axis accelerometer / gyro chip on the AltIMU-10 v5
+#define PRESSURE_I2C_ADDRESS 0x5D //I2C slave address for the pressure sensor chip on the AltIMU-10 v5
 #define MAX_IMU_COUNTS 32767 //maximum # of counts for IMU data values (16-bit 2's complement)
 #define NUM_MAGCAL_AVG 50 //# of samples to average for magnetometer calibration
 
@@ -34,15 +38,24 @@ typedef int pthread_mutex_t;
 #define MAG_OUTZ_H 0x2D//high-order byte of z-axis mag data
 #define MAG_TEMP_OUT_L 0x2e//low-order byte of magnetometer temperature 
 #define MAG_TEMP_OUT_H 0x2f//high-order byte of magnetometer temperature
+#define MAG_AUTO_INCREMENT 0x80//OR this with a register address to read multiple consecutive magnetometer registers in a single I2C transaction
 
 //acc/gyro control registers (see LSM6DS33 datasheet)
 #define ACC_GYRO_WHO_AM_I 0x0f//who am I register, should be equal to 0x69
+#define FIFO_CTRL1 0x06//FIFO threshold level (low byte)
+#define FIFO_CTRL2 0x07//FIFO threshold level (high bits) and timestamp / pedometer data in FIFO
+#define FIFO_CTRL3 0x08//FIFO decimation factors for gyro and accelerometer data
+#define FIFO_CTRL4 0x09//FIFO decimation factors for the third and fourth data sets
+#define FIFO_CTRL5 0x0A//FIFO output data rate and FIFO mode
 #define ACC_CTRL1_XL 0x10//linear acceleration sensor control register 1, controls output data rate (ODR), accelerometer full-scale selection, and anti-aliasing filter bandwidth selection
 #define GYRO_CTRL2_G 0x11//angular rate sensor control register 2, controls output data rate (ODR), and full-scale selection for gyros
 #define ACC_GYRO_CTRL3_C 0x12//control register 3 controls block data update
 #define ACC_GYRO_CTRL4_C 0x13//control register 4 controls accel bandwidth selection
+#define ACC_GYRO_CTRL5_C 0x14//control register 5 controls output rounding and self-test
 #define ACC_GYRO_CTRL6_C 0x15//control register 6 controls high performance mode for accelerometer
 #define GYRO_CTRL7_G 0x16//control register 7 controls high performance mode for gyros and high-pass filter settings for gyros
+#define GYRO_CTRL7_G_HPF 0x50//GYRO_CTRL7_G value for gyro high performance mode with the gyro high pass filter on (0.0324 Hz)
+#define GYRO_CTRL7_G_NO_HPF 0x00//GYRO_CTRL7_G value for gyro high performance mode with the gyro high pass filter off (for fusion engines that estimate the gyro bias)
 #define ACC_CTRL8_XL 0x17//control register 8 controls filter settings for accelerometers
 #define ACC_CTRL9_XL 0x18//control register 9 enables individual accelerometers
 #define GYRO_CTRL10_C 0x19//control register 10 enables individual gyros
@@ -61,11 +74,19 @@ typedef int pthread_mutex_t;
 #define OUTY_H_XL 0x2B//high byte of y-axis acceleration
 #define OUTZ_L_XL 0x2C//low byte of z-axis acceleration
 #define OUTZ_H_XL 0x2D//high byte of z-axis acceleration
+#define FIFO_STATUS1 0x3A//number of unread words in the FIFO (low byte)
+#define FIFO_STATUS2 0x3B//FIFO watermark / overrun / full / empty flags, and number of unread words in the FIFO (high bits)
+#define FIFO_STATUS3 0x3C//position of the next word to be read in the FIFO data pattern (low byte)
+#define FIFO_STATUS4 0x3D//position of the next word to be read in the FIFO data pattern (high bits)
+#define FIFO_DATA_OUT_L 0x3E//FIFO data output (low byte), reading continues through FIFO_DATA_OUT_H and then wraps around to the next FIFO word
 #define TIMESTAMP0_REG 0x40//timestamp low byte output register
 #define TIMESTAMP1_REG 0x41//timestamp mid byte output register
 #define TIMESTAMP2_REG 0x42//timestamp high byte output register
+#define WAKE_UP_SRC 0x1B//wake-up source register, indicates wake-up events and whether or not the inactivity (sleep) state is active
 #define TAP_CFG 0x58//register for enabling timestamps
-#define WAKE_UP_DUR 0x5C//register for setting the timestamp resolution
+#define WAKE_UP_THS 0x5B//register for setting the wake-up threshold and enabling the inactivity function
+#define WAKE_UP_DUR 0x5C//register for setting the timestamp resolution, wake-up duration, and time before going to sleep
+#define MD1_CFG 0x5E//register for routing wake-up and inactivity events to the INT1 pin
 
 
 #define MAX_NUM_TO_AVG 1000 //maximum number of samples that can be averaged (will take ~ 12.5 seconds at 80 Hz)
@@ -81,6 +102,108 @@ typedef int pthread_mutex_t;
 //acc/gyro timer resolution in seconds per bit
 #define ACC_GYRO_TIMER_RESOLUTION 0.000025
 
+//output data rates that InitializeMagDevice and InitializeAccGyroDevice configure the sensors for
+#define MAG_ODR_HZ 80.0 //magnetometer output data rate in Hz (in the default MAG_RATE_80HZ mode)
+#define ACC_GYRO_ODR_HZ 104.0 //accelerometer / gyro output data rate in Hz
+
+//magnetometer rate modes (see IMU::SetMagRate), the FAST_ODR modes trade operating mode (noise) for output data rate
+#define MAG_RATE_80HZ 0 //80 Hz, ultra-high-performance mode on all axes (default)
+#define MAG_RATE_155HZ 1 //155 Hz FAST_ODR, ultra-high-performance mode
+#define MAG_RATE_300HZ 2 //300 Hz FAST_ODR, high-performance mode
+#define MAG_RATE_560HZ 3 //560 Hz FAST_ODR, medium-performance mode
+#define MAG_RATE_1000HZ 4 //1000 Hz FAST_ODR, low-power mode
+#define NUM_MAG_RATES 5 //number of magnetometer rate modes
+#define MAG_CTRL_REG1_UHP_80HZ 0xFC //MAG_CTRL_REG1 value for temperature enabled, ultra-high-performance X & Y, 80 Hz ODR, FAST_ODR off
+#define MAG_CTRL_REG4_UHP 0x0C //MAG_CTRL_REG4 value for ultra-high-performance mode on the Z axis
+#define MAG_CTRL_REG5_FAST_READ 0x80 //FAST_READ bit of MAG_CTRL_REG5, multi-byte reads of the output registers only return the high bytes
+#define MAG_CTRL_REG5_BDU 0x40 //BDU bit of MAG_CTRL_REG5, output registers are not updated until both bytes of the previous reading have been read
+#define MAG_FRAME_BYTES 6 //number of bytes per magnetometer X, Y, Z reading
+#define MAG_FAST_READ_FRAME_BYTES 3 //number of bytes per magnetometer X, Y, Z reading in fast-read mode (high bytes only)
+#define MAG_NUM_CTRL_REGS 5 //number of consecutive magnetometer control registers (MAG_CTRL_REG1 to MAG_CTRL_REG5), written in one burst at initialization
+#define ACC_GYRO_NUM_CTRL_REGS 8 //number of consecutive acc/gyro control registers (ACC_CTRL1_XL to ACC_CTRL8_XL), written in one burst at initialization
+
+//register values used for switching between continuous sampling and low-power (duty-cycled) sampling
+#define MAG_CTRL_REG3_CONTINUOUS 0x00 //MAG_CTRL_REG3 value for continuous conversion mode
+#define MAG_CTRL_REG3_SINGLE 0x01 //MAG_CTRL_REG3 value for single conversion mode (the LIS3MDL does one conversion and then goes idle)
+#define MAG_CTRL_REG3_POWER_DOWN 0x03 //MAG_CTRL_REG3 value for power-down mode
+#define ACC_CTRL1_XL_104HZ 0x43 //ACC_CTRL1_XL value for 104 Hz ODR, +/- 2 G full-scale, 50 Hz anti-aliasing filter bandwidth
+#define ACC_CTRL1_XL_FS_4G 0x08 //FS_XL bits of ACC_CTRL1_XL for +/- 4 G full-scale (OR-ed into the ACC_CTRL1_XL_... values, which are +/- 2 G)
+#define ACC_CTRL1_XL_FS_8G 0x0C //FS_XL bits of ACC_CTRL1_XL for +/- 8 G full-scale
+#define ACC_CTRL1_XL_FS_16G 0x04 //FS_XL bits of ACC_CTRL1_XL for +/- 16 G full-scale
+#define GYRO_CTRL2_G_104HZ 0x40 //GYRO_CTRL2_G value for 104 Hz ODR, 245 deg/sec full-scale
+#define ACC_GYRO_POWER_DOWN 0x00 //ACC_CTRL1_XL or GYRO_CTRL2_G value for putting the accelerometer or gyro into power-down mode
+#define DUTY_CYCLE_SETTLE_SAMPLES 2 //number of acc/gyro samples discarded after waking up the LSM6DS33, while its output settles
+
+//status register bits used for overrun detection
+#define MAG_STATUS_ZYXOR 0x80 //LIS3MDL STATUS_REG bit indicating that X, Y, Z data was overwritten before it was read
+
+//register values and sizes used for averaging acc/gyro data out of the LSM6DS33 FIFO
+#define FIFO_CTRL3_NO_DECIMATION 0x09 //FIFO_CTRL3 value that stores every gyro and accelerometer sample in the FIFO
+#define FIFO_CTRL5_CONTINUOUS_104HZ 0x26 //FIFO_CTRL5 value for continuous mode (oldest data gets overwritten) with a FIFO ODR of 104 Hz
+#define FIFO_CTRL5_BYPASS 0x00 //FIFO_CTRL5 value for bypass mode (FIFO turned off and emptied)
+#define FIFO_STATUS2_OVER_RUN 0x40 //FIFO_STATUS2 bit indicating that the FIFO filled up and unread data was overwritten
+#define FIFO_STATUS2_DIFF_MASK 0x0F //FIFO_STATUS2 bits holding the high bits of the number of unread FIFO words
+#define FIFO_NUM_WORDS 4096 //size of the LSM6DS33 FIFO in 16-bit words
+#define FIFO_WORDS_PER_SET 6 //number of FIFO words per sample (gyro X, Y, Z followed by accelerometer X, Y, Z)
+#define FIFO_MAX_SETS (FIFO_NUM_WORDS / FIFO_WORDS_PER_SET) //maximum number of complete acc/gyro samples that the FIFO can hold
+
+//register values and sizes used for streaming accelerometer data at 1.66 kHz through the LSM6DS33 FIFO (see IMU::EnableAccStream)
+#define ACC_CTRL1_XL_1660HZ 0x80 //ACC_CTRL1_XL value for 1.66 kHz ODR, +/- 2 G full-scale, 400 Hz anti-aliasing filter bandwidth
+#define FIFO_CTRL3_ACC_ONLY 0x01 //FIFO_CTRL3 value that stores every accelerometer sample (and no gyro samples) in the FIFO
+#define FIFO_CTRL5_CONTINUOUS_1660HZ 0x46 //FIFO_CTRL5 value for continuous mode (oldest data gets overwritten) with a FIFO ODR of 1.66 kHz
+#define ACC_STREAM_ODR_HZ 1666.0 //accelerometer output data rate in Hz while the accelerometer stream is on
+#define ACC_STREAM_WORDS_PER_SET 3 //number of FIFO words per accelerometer stream reading (X, Y, Z)
+#define ACC_STREAM_MAX_SETS (FIFO_NUM_WORDS / ACC_STREAM_WORDS_PER_SET) //maximum number of accelerometer readings that the FIFO can hold
+
+//register values used for motion-triggered wake-up (activity / inactivity engine of the LSM6DS33)
+#define WAKE_UP_DUR_TIMER_HR 0x10 //TIMER_HR bit of WAKE_UP_DUR, sets the timestamp resolution to 25 usec per bit
+#define WAKE_UP_THS_INACTIVITY 0x40 //INACTIVITY bit of WAKE_UP_THS, lets the LSM6DS33 drop to 12.5 Hz sampling when no motion is detected for the sleep duration
+#define WAKE_UP_SRC_SLEEP_STATE 0x10 //SLEEP_STATE_IA bit of WAKE_UP_SRC, set while the LSM6DS33 is in the inactivity (sleep) state
+#define MD1_CFG_INT1_WU_INACT 0xA0 //MD1_CFG value that routes wake-up events and the inactivity state to INT1 (for boards that have INT1 wired)
+#define WAKE_THS_G_PER_BIT 0.03125 //wake-up threshold resolution in G (full-scale of 2 G divided by 64)
+#define SLEEP_DUR_ODR_TICKS 512 //number of accelerometer ODR ticks per bit of the SLEEP_DUR field in WAKE_UP_DUR
+#define ACC_GYRO_STATUS_XLDA_GDA 0x03 //LSM6DS33 STATUS_REG bits indicating that new accelerometer (XLDA) and gyro (GDA) data are both available
+#define ACC_GYRO_STATUS_XLDA_GDA_TDA 0x07 //LSM6DS33 STATUS_REG bits indicating that new accelerometer, gyro, and temperature (TDA) data are all available
+
+//pressure sensor registers (see LPS25H datasheet)
+#define PRESS_WHO_AM_I 0x0F//who am I register, should be equal to PRESS_WHO_AM_I_VALUE
+#define PRESS_RES_CONF 0x10//resolution register for the number of internal pressure and temperature averages
+#define PRESS_CTRL_REG1 0x20//control register 1 for power-down, output data rate, and block data update
+#define PRESS_CTRL_REG2 0x21//control register 2 for FIFO enable, FIFO mean decimation, and reboot / software reset
+#define PRESS_STATUS_REG 0x27//pressure sensor status register determines whether or not data is available
+#define PRESS_OUT_XL 0x28//lowest-order byte of pressure data (followed by PRESS_OUT_L, PRESS_OUT_H, PRESS_TEMP_OUT_L, and PRESS_TEMP_OUT_H)
+#define PRESS_FIFO_CTRL 0x2E//FIFO control register for FIFO mode and number of samples averaged in FIFO mean mode
+#define PRESS_AUTO_INCREMENT 0x80 //bit that must be ORed into the register address for multi-byte reads from the LPS25H to auto-increment the register address
+
+//register values used for the LPS25H pressure sensor
+#define PRESS_WHO_AM_I_VALUE 0xBD //value of PRESS_WHO_AM_I for the LPS25H
+#define PRESS_RES_CONF_FIFO_MEAN 0x05 //PRESS_RES_CONF value recommended for FIFO mean mode (16 internal temperature averages, 32 internal pressure averages)
+#define PRESS_CTRL_REG1_25HZ 0xC4 //PRESS_CTRL_REG1 value for active mode, 25 Hz ODR, block data update
+#define PRESS_CTRL_REG1_POWER_DOWN 0x00 //PRESS_CTRL_REG1 value for power-down mode
+#define PRESS_CTRL_REG2_FIFO_EN 0x40 //PRESS_CTRL_REG2 value that enables the FIFO
+#define PRESS_FIFO_MODE_MEAN 0xC0 //F_MODE bits of PRESS_FIFO_CTRL for FIFO mean mode (output registers hold the running mean of the last WTM_POINT+1 readings)
+#define PRESS_FIFO_MODE_BYPASS 0x00 //F_MODE bits of PRESS_FIFO_CTRL for bypass mode (no averaging)
+#define PRESS_STATUS_T_DA 0x01 //PRESS_STATUS_REG bit indicating that new temperature data is available
+#define PRESS_STATUS_P_DA 0x02 //PRESS_STATUS_REG bit indicating that new pressure data is available
+#define PRESS_STATUS_P_OR 0x20 //PRESS_STATUS_REG bit indicating that pressure data was overwritten before it was read
+#define PRESS_ODR_HZ 25.0 //pressure sensor output data rate in Hz
+#define PRESS_DEFAULT_NUM_TO_AVG 32 //default number of pressure readings averaged by the FIFO mean mode (2, 4, 8, 16, or 32)
+#define PRESS_COUNTS_PER_HPA 4096.0 //pressure sensitivity (counts per hPa)
+#define PRESS_TEMP_COUNTS_PER_DEG 480.0 //temperature sensitivity of the pressure sensor (counts per deg C)
+#define PRESS_TEMP_OFFSET 42.5 //temperature of the pressure sensor (in deg C) at zero counts
+#define STD_SEA_LEVEL_PRESSURE_HPA 1013.25 //standard atmosphere pressure at sea level in hPa, used for pressure altitude
+
+//sample quality flags (see IMU_DATASAMPLE::quality_flags)
+#define IMU_QUALITY_MAG_OVERRUN 0x01 //the magnetometer overwrote at least one sample before it was read (ZYXOR bit was set)
+#define IMU_QUALITY_MAG_LATE 0x02 //magnetometer data was already waiting when it was read, i.e. acquisition is not keeping ahead of the magnetometer ODR
+#define IMU_QUALITY_ACCGYRO_GAP 0x04 //the acc/gyro timestamps show that one or more ODR ticks were missed since the previous sample
+#define IMU_QUALITY_ACCGYRO_LATE 0x08 //acc/gyro data was already waiting when it was read, i.e. acquisition is not keeping ahead of the acc/gyro ODR
+#define IMU_QUALITY_PRESS_OVERRUN 0x10 //the pressure sensor overwrote at least one reading before it was read (P_OR bit was set)
+
+#define IMU_MAX_PREDICTION_SEC 0.1 //longest time (in seconds) that IMU::PredictOrientation extrapolates the orientation of a sample by, in either direction
+#define IMU_DEFAULT_VELOCITY_LEAK_SEC 2.0 //default time constant (in seconds) of the leaky integration of linear acceleration into IMU_DATASAMPLE::velocity (see IMU::SetVelocityLeakTime)
+#define STD_GRAVITY_MPS2 9.80665 //standard acceleration of gravity in m/s^2 (1 G)
+
 #define CAL_SAMPLE_PIN 16 //GPIO pin used to toggle the collection of data for calibration or control the heater and fan for temperature calibration
 
 
@@ -94,8 +217,72 @@ struct IMU_DATASAMPLE {//full data sample from inertial measurement unit
 	double heading;//computed heading value in degrees (direction that the +X axis of the IMU is pointed) 0 to 360
 	double pitch;//computed pitch angle in degrees (direction above horizontal that the +X axis of the IMU is pointed -90 to 90
 	double roll;//computed roll angle in degrees (direction around +X axis that the +Y axis of the IMU is pointed -180 to +180
+	bool have_angles;//true if heading, pitch, and roll have been computed, false if they were left for IMU::GetAngles to compute from orientation (see IMU::SetLazyAngles)
+	FUSION_QUAT orientation;//computed orientation quaternion, from the forward-right-down sensor axes to north-east-down (see FusionKernel::GetQuaternion)
+	double corrected_rate[3];//angular rate with the estimated gyro bias removed, in rad/sec about the forward-right-down sensor axes (see FusionKernel::GetCorrectedRate), used by IMU::PredictOrientation
+	double specific_force[3];//acceleration in G measured by the accelerometer (not normalized, and averaged over every reading since the previous sample in FIFO averaging mode), with the same axis signs as acc_data
+	double linear_acc[3];//acceleration in G with gravity removed, about the north-east-down world axes (see FusionKernel::GetLinearAcceleration)
+	double velocity[3];//leaky integral of linear_acc in m/s, about the north-east-down world axes, for short-horizon motion only since it decays back towards zero (see IMU::SetVelocityLeakTime)
+	double fused_time_sec;//monotonic time (in seconds) when the orientation was computed (for samples from GetSamples, when the sample was read, since the run is fused afterwards), same clock as IMU_MAG_SAMPLE::sample_time_sec (sample_time_sec comes from the LSM6DS33 timer instead)
+	unsigned int quality_flags;//combination of IMU_QUALITY_... flags describing any overruns or late reads that occurred while collecting this sample (0 if the sample is clean)
+};
+
+struct IMU_MAG_SAMPLE {//single magnetometer reading from the high-rate magnetometer stream (see MagStream)
+	double sample_time_sec;//monotonic time (in seconds) when the reading was collected
+	double mag_data[3];//magnetometer data (normalized, temperature compensated)
+	unsigned int quality_flags;//IMU_QUALITY_MAG_OVERRUN if the magnetometer overwrote at least one reading before this one was read
 };
 
+struct IMU_PRESSURE_SAMPLE {//single reading from the LPS25H pressure sensor
+	double sample_time_sec;//monotonic time (in seconds) when the reading was collected, same clock as IMU_MAG_SAMPLE::sample_time_sec
+	double pressure;//pressure in hPa (the mean of the last few readings in FIFO mean mode)
+	double temperature;//temperature of the LPS25H chip in degrees C
+	double altitude;//pressure altitude in meters, relative to the sea level pressure set with IMU::SetSeaLevelPressure
+	unsigned int quality_flags;//IMU_QUALITY_PRESS_OVERRUN if the pressure sensor overwrote at least one reading before this one was read
+};
+
+struct IMU_RAW_READING {//single full-rate (unaveraged) acc/gyro reading, passed to the reading tap (see IMU::SetReadingTap)
+	double sample_time_sec;//monotonic time (in seconds) of the reading, same clock as IMU_MAG_SAMPLE::sample_time_sec
+	double acc[3];//acceleration in G (not normalized, with the same axis signs as IMU_DATASAMPLE::acc_data)
+	double angular_rate[3];//angular rate (deg/sec)
+};
+
+typedef void (*IMU_READING_CALLBACK)(const IMU_RAW_READING *pReading, void *pUserData);//function called for every individual acc/gyro reading (must return quickly, and must not call any IMU functions)
+
+struct IMU_FIX_TIMING {//timing of a single duty-cycled fix (see IMU::GetDutyCycledFix)
+	double bus_time_sec;//total time (in seconds) that the I2C bus was in use for the fix
+	double active_time_sec;//time (in seconds) from when the sensors were woken up until they were powered back down
+};
+
+struct IMU_INIT_TIMING {//time taken by each phase of IMU construction (see IMU::GetInitTiming), all times in milliseconds
+	double open_ms;//opening the I2C port
+	double acc_gyro_config_ms;//configuring the LSM6DS33
+	double pressure_config_ms;//configuring the LPS25H
+	double cal_parse_ms;//parsing mag_cal.txt (done in a separate thread while the LSM6DS33 and LPS25H are being configured)
+	double cal_wait_ms;//time spent waiting for the calibration parse to finish after the LSM6DS33 and LPS25H were configured
+	double mag_config_ms;//configuring the LIS3MDL and writing its calibration offsets
+	double total_ms;//the whole constructor
+	double first_sample_ms;//time from the start of the constructor until the first successful GetSample / PublishSample (0 if there has not been one yet)
+};
+
+struct IMU_SAMPLE_STATS {//counters used for checking whether or not sample acquisition is keeping up with the output data rates of the sensors
+	unsigned int mag_reads;//number of individual magnetometer readings collected
+	unsigned int mag_missed;//number of magnetometer samples that were lost to overruns
+	unsigned int mag_late;//number of magnetometer readings where the data was already waiting in the output registers
+	unsigned int mag_failed;//number of failed attempts to get magnetometer data
+	unsigned int acc_gyro_reads;//number of individual acc/gyro readings collected
+	unsigned int acc_gyro_missed;//number of acc/gyro ODR ticks that were skipped, based on the sample timestamps
+	unsigned int acc_gyro_late;//number of acc/gyro readings where the data was already waiting in the output registers
+	unsigned int acc_gyro_failed;//number of failed attempts to get acc/gyro data
+	unsigned int pressure_reads;//number of pressure readings collected
+	unsigned int pressure_missed;//number of pressure readings where the pressure sensor had overwritten unread data
+	unsigned int pressure_failed;//number of failed attempts to get pressure data
+	unsigned int coalesced_requests;//number of GetSample / PublishSample calls that were served by an acquisition that another thread already had in progress
+};
+
+class SampleBus;//broadcast ring used for sharing samples with multiple consumers (see SampleBus.h)
+class OrientationSlot;//latest fused sample, readable from any number of threads (see OrientationSlot.h)
+
 struct IMU_TEMP_CAL {
 	double accx_vs_temp;//offset change in x-axis acceleration vs. temperature (counts per deg C)
 	double accy_vs_temp;//offset change in y-axis acceleration vs. temperature (counts per deg C)
@@ -107,7 +294,7 @@ struct IMU_TEMP_CAL {
 	double mag_cal_temp;//temperature from the magnetometer temperature sensor where offsets and gains were determined
 };
 
-class IMU {//class used for communicating with and getting tilt, angular rate, and magnetic data from an IMU (AltIMU-10 v5 by Polulu Robotics & Electronics)
+class IMU {//class used for communicating with and getting tilt, angular rate, magnetic, and pressure data from an IMU (AltIMU-10 v5 by Polulu Robotics & Electronics)
 //functions are also provided for computing heading angle based on available sensor data
 public:
 	IMU(pthread_mutex_t *i2c_mutex);//constructor
@@ -120,14 +307,53 @@ public:
 	bool DoTempCal();//does a factory temperature calibration of the IMU sensors
 	bool GetMagSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//collect magnetometer data from the LIS3MDL 3-axis magnetometer device and process it to get the magnetic vector and temperature
 	bool GetAccGyroSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//collect accelerometer & gyro data from the LSM6DS33 and process it to get the acceleration vector, rotation rate vector, and temperature
-	bool GetSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//collect magnetometer, accelerometer, and gyro data, and then call ComputeOrientation to determine orientation angles
+	bool GetSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//collect magnetometer, accelerometer, and gyro data, and then call ComputeOrientation to determine orientation angles (thread-safe, concurrent callers share a single acquisition)
+	bool IsSampleReady(int nNumToAvg, bool &bReady);//check (without waiting) whether the sensors have the new data that GetSample needs, so that an event loop can call GetSample without polling for data
+	int GetSamples(IMU_DATASAMPLE *pIMUSamples, int nNumSamples, double dTimeoutSec);//collect a run of consecutive (unaveraged) samples with a single bus setup and lock session, then compute the orientation of each one
 	void ResetAccGyro();//reset the timestamps for the acc/gyro measurements back to zero seconds
 	bool DoMagCal();//perform a calibration procedure on the magnetometers to get the zero-field offsets for each of the sensors. Saves the results to the offset registers.
 	bool DoXYMagCal();//perform a calibration procedure on the magnetometers to get the zero-field offsets for the X and Y magnetometers. Saves the results to the offset registers.
 	bool DoXYMagCalWithToggledSampling();//perform a factory XY calibration procedure on the magnetometers to get the zero-field offsets for the X and Y magnetometers. Saves the results to the offset registers.
 	bool DoXZMagCalWithToggledSampling();//perform a factory XZ calibration procedure on the magnetometers to get the zero-field offsets for the X and Z magnetometers. Saves the results to the offset registers. 
 	void ComputeOrientation(IMU_DATASAMPLE *pSample);//compute orientation (pitch, roll, and heading angles) of the AltIMU-10, using acc/mag data plus gyros
+	void ComputeOrientationBatch(const FUSION_SAMPLE_SPANS *pSamples, int nNumSamples, FUSION_ORIENTATION_SPANS *pAngles);//compute the orientation quaternions and angles (only) of a block of samples held as one array per component (e.g. a recorded log), continuing from the current orientation state
 	bool SaveIMUDataToFile(char* szFilename, int nNumSecs);//save data from all sensors to a text data file for a period of time
+	bool EnterDutyCycleMode();//power down the magnetometer and acc/gyro sensors between duty-cycled fixes (see GetDutyCycledFix)
+	bool ExitDutyCycleMode();//return the magnetometer and acc/gyro sensors to continuous sampling
+	bool GetDutyCycledFix(IMU_DATASAMPLE *pIMUSample, int nNumToAvg, IMU_FIX_TIMING *pTiming);//wake up the sensors just long enough to get one fused orientation fix, and then power them back down
+	void GetSampleStats(IMU_SAMPLE_STATS *pStats);//get the overrun, late read, and failed read counters for each sensor
+	void ResetSampleStats();//set all of the overrun, late read, and failed read counters back to zero
+	void AttachSampleBus(SampleBus *pBus);//attach a broadcast ring that every sample from GetSample gets published to (use nullptr to detach)
+	bool PublishSample(int nNumToAvg);//acquire a sample and publish it to all of the readers of the attached broadcast ring
+	void AttachOrientationSlot(OrientationSlot *pSlot);//attach a slot that every fused sample gets published to, for lock-free reads of the latest orientation (use nullptr to detach)
+	bool EnableMotionWake(double dWakeThresholdG, double dSleepDelaySec);//program the LSM6DS33 activity / inactivity engine so that it goes to sleep when there is no motion and wakes up when there is
+	bool DisableMotionWake();//turn off the LSM6DS33 activity / inactivity engine
+	bool GetMotionState(bool &bSleeping);//check whether or not the LSM6DS33 is in its inactivity (sleep) state
+	bool SetMagRate(int nMagRate);//switch the magnetometer to one of the MAG_RATE_... modes (80 Hz up to 1000 Hz with FAST_ODR)
+	double GetMagODR();//returns the current output data rate of the magnetometer in Hz
+	bool ReadMagFast(IMU_MAG_SAMPLE *pMagSample, bool &bNewData);//check for and read a new magnetometer reading in a single short bus transaction (used for high-rate magnetometer streams)
+	bool SetMagFastRead(bool bFastRead);//turn the reduced-precision (high bytes only, 8-bit) magnetometer sampling profile on or off
+	bool IsMagFastRead();//returns true if the reduced-precision magnetometer sampling profile is on
+	bool GetPressureSample(IMU_PRESSURE_SAMPLE *pPressureSample, bool &bNewData);//check for and read a new pressure / temperature reading from the LPS25H in a single burst transaction
+	bool GetLastPressureSample(IMU_PRESSURE_SAMPLE *pPressureSample);//get the most recent pressure reading collected along with GetSample / PublishSample
+	bool SetPressureAveraging(int nNumToAvg);//set the number of pressure readings averaged on-chip by the LPS25H FIFO mean mode (1 to turn averaging off)
+	void SetSeaLevelPressure(double dSeaLevelPressureHPa);//set the sea level pressure used for computing pressure altitude
+	bool EnableAccStream();//run the accelerometer at 1.66 kHz and buffer every reading in the LSM6DS33 FIFO, for high-rate (e.g. vibration) analysis
+	bool DisableAccStream();//return the accelerometer to 104 Hz and turn off the LSM6DS33 FIFO
+	int ReadAccStream(double *acc_data, int nMaxReadings, bool &bOverrun);//read up to nMaxReadings buffered accelerometer readings (in G), topping up from the FIFO in a single burst
+	void SetReadingTap(IMU_READING_CALLBACK callback, void *pUserData);//call callback for every individual acc/gyro reading that gets collected (use nullptr to remove the tap)
+	bool SetAccFullScale(int nFullScaleG);//set the accelerometer full-scale range to +/- 2, 4, 8, or 16 G
+	int GetAccFullScale();//returns the accelerometer full-scale range in G
+	bool EnableFifoAveraging();//buffer acc/gyro samples in the LSM6DS33 FIFO so that each averaged sample costs one burst read instead of one read per reading
+	bool DisableFifoAveraging();//turn off the LSM6DS33 FIFO and go back to reading individual acc/gyro readings
+	void GetInitTiming(IMU_INIT_TIMING *pTiming);//get the time taken by each phase of construction, and the time until the first sample
+	bool SetFusionEngine(int nEngine, double dGain, double dBiasGain);//select the orientation fusion engine (one of the FUSION_ENGINE_... values) and its gains (call before sampling starts)
+	void GetFusionHealth(FUSION_HEALTH *pHealth);//get the orientation uncertainty and gyro bias estimate of the fusion engine, as of the most recent sample
+	void SetLazyAngles(bool bLazyAngles);//choose whether ComputeOrientation leaves the heading, pitch, and roll angles for GetAngles to compute, and only fills in the orientation quaternion
+	void SetVelocityLeakTime(double dLeakTimeSec);//set the time constant of the leaky integration of linear acceleration into velocity
+	static void GetAngles(IMU_DATASAMPLE *pSample);//compute the heading, pitch, and roll angles of a sample from its orientation quaternion, if they have not been computed yet
+	static bool PredictOrientation(const IMU_DATASAMPLE *pSample, double dQueryTimeSec, FUSION_QUAT &q);//extrapolate the orientation of a sample to a given monotonic time (see GetMonotonicTimeSec), using its bias-corrected angular rate
+	static double GetMonotonicTimeSec();//returns the time (in seconds) from a monotonic clock, for measuring elapsed times
 
 		
 private:
@@ -137,15 +363,65 @@ private:
 	double m_mag_counts[3];//used for storing magnetometer raw count values
 	double m_gyro_counts[3];//used for storing gyro raw count values
 	bool m_bLoadedMagCal;//flag is true after magnetometer calibration has been successfully loaded
+	bool m_bMagCalParsed;//flag is true once mag_cal.txt has been parsed into m_magCalOffsets and m_tempCal (the file is only parsed once)
+	double m_magCalOffsets[3];//magnetometer offsets (in counts) from mag_cal.txt, or from the most recent calibration
+	double m_dInitStartTime;//monotonic time (in seconds) when the constructor started
+	IMU_INIT_TIMING m_initTiming;//time taken by each phase of construction (first_sample_ms is protected by m_sampleMutex)
 	char m_szErrMsg[256];//buffer space used for outputting error messages
 	pthread_mutex_t *m_i2c_mutex;
-	double m_dLastSampleTime;//time of last orientation sample (in seconds)
-	int m_nGyroAxisOrder;//cycles continuously from 0, 1, 2, 0, 1, 2, etc. for each sample and defines the order used to form the orientation matrix calculated from the gyros
-	quaternion2 *m_quat;//the quaternion used for determining the orientation of the IMU
+	FUSION_STATE m_fusion;//orientation state of the fusion kernel (selected engine, quaternion, time of last orientation sample, previous gyro step, gyro bias estimate, and covariance)
+	FUSION_HEALTH m_fusionHealth;//orientation uncertainty and gyro bias estimate as of the most recent sample (protected by m_sampleMutex)
+	bool m_bLazyAngles;//true if ComputeOrientation leaves the angles for GetAngles to compute
+	double m_dVelocityLeakSec;//time constant (in seconds) of the leaky integration of linear acceleration into velocity
+	double m_velocity[3];//velocity (m/s, north-east-down) of the most recent fused sample
+	double m_dLastVelocityTime;//sample time (in seconds) of m_velocity, 0 if the velocity needs to start again from zero
+	bool m_bGyroHighPass;//true if the LSM6DS33 gyro high pass filter is used (it is turned off for fusion engines that estimate the gyro bias themselves)
 	int m_file_i2c;//handle to I2C port for the IMU
 	double m_dBaseAccGyroTimestamp;//the base timestamp for the first sample 
 	double m_dAccumulatedTimeSeconds;//the accumulated time in seconds from previous rollovers of the timer
 	unsigned int m_uiAccGyroSampleCount;//the number of acc/gyro samples successfully collected
+	IMU_SAMPLE_STATS m_sampleStats;//overrun, late read, and failed read counters for each sensor
+	double m_dLastAccGyroSampleTime;//time (in seconds) of the previous acc/gyro sample, used for detecting timestamp gaps
+	unsigned char m_ucLastStatus;//value of the status register the last time that one of the WaitFor... functions found data ready
+	int m_nLastStatusPolls;//number of times that the status register was polled the last time that one of the WaitFor... functions was called
+	bool m_bDutyCycleMode;//true while the sensors are powered down between duty-cycled fixes
+	double m_dMagODRHz;//current output data rate of the magnetometer in Hz
+	bool m_bMagFastRead;//true if only the high bytes of the magnetometer output registers are read (see SetMagFastRead)
+	double m_dLastMagTemperature;//most recent magnetometer temperature, used for temperature compensation of the high-rate magnetometer readings
+	bool m_bHaveMagTemperature;//true once m_dLastMagTemperature holds a real temperature reading
+	bool m_bFifoAveraging;//true if acc/gyro samples are averaged from the LSM6DS33 FIFO (see EnableFifoAveraging)
+	unsigned char m_fifoBuf[FIFO_NUM_WORDS*2];//buffer space for reading the contents of the LSM6DS33 FIFO
+	double m_fifoRates[FIFO_MAX_SETS*3];//angular rates (deg/sec) of every reading in the last FIFO run, for propagating the orientation reading by reading
+	double m_fifoRateTimes[FIFO_MAX_SETS];//sample times of the readings in m_fifoRates
+	int m_nNumFifoRates;//number of readings in m_fifoRates that have not been passed to the fusion kernel yet
+	int m_nPressureNumToAvg;//number of pressure readings averaged by the LPS25H FIFO mean mode (1 if averaging is off)
+	double m_dSeaLevelPressureHPa;//sea level pressure used for computing pressure altitude
+	double m_dLastPressureCheckTime;//monotonic time (in seconds) when the pressure sensor was last checked for new data
+	bool m_bHaveLastPressure;//true once m_lastPressure holds a valid reading
+	IMU_PRESSURE_SAMPLE m_lastPressure;//most recent pressure reading collected along with GetSample / PublishSample (protected by m_sampleMutex)
+	bool m_bAccStream;//true while the accelerometer is streaming at 1.66 kHz through the LSM6DS33 FIFO (see EnableAccStream)
+	double m_accStreamBuf[ACC_STREAM_MAX_SETS*3];//ring of accelerometer stream readings (in G) that have been read out of the FIFO but not yet returned by ReadAccStream (protected by the I2C bus mutex)
+	int m_nAccStreamHead;//index of the oldest reading in m_accStreamBuf
+	int m_nAccStreamCount;//number of readings in m_accStreamBuf
+	bool m_bAccStreamOverrun;//true if stream readings were lost (in the FIFO or in m_accStreamBuf) since the last call to ReadAccStream
+	double m_accStreamSum[3];//sum of the raw counts of the stream readings read out of the FIFO since the last acc/gyro sample (protected by the I2C bus mutex)
+	int m_nAccStreamSumCount;//number of readings summed in m_accStreamSum
+	std::atomic<IMU_READING_CALLBACK> m_readingTap;//function called for every individual acc/gyro reading (nullptr if not used)
+	std::atomic<void *> m_pReadingTapData;//user data passed to m_readingTap (stored before m_readingTap, so that the sampling thread never sees a new callback with old user data)
+	int m_nAccFullScaleG;//accelerometer full-scale range in G (see SetAccFullScale)
+	unsigned char m_ucAccFullScaleBits;//FS_XL bits that get OR-ed into every ACC_CTRL1_XL value that turns the accelerometer on
+	double m_dAccGain;//accelerometer sensitivity in G per count at the current full-scale range (ACC_GAIN at +/- 2 G)
+	bool m_bMotionSleep;//true while the LSM6DS33 was found to be asleep by the last call to GetMotionState (protected by m_sampleMutex)
+	bool m_bSkipNextGapCheck;//true if the next acc/gyro timestamp should not be checked for missed ODR ticks (e.g. after the LSM6DS33 has been asleep)
+	pthread_mutex_t m_sampleMutex;//protects the coalescing state below (separate from the I2C bus mutex)
+	pthread_cond_t m_sampleCond;//signalled each time that an acquisition finishes
+	bool m_bAcquiring;//true while one thread is collecting a sample on behalf of all GetSample / PublishSample callers
+	unsigned long m_ulSampleGeneration;//incremented each time that an acquisition finishes
+	bool m_bLastSampleOK;//true if the most recent acquisition was successful
+	IMU_DATASAMPLE m_lastSample;//most recent sample collected by GetSample / PublishSample
+	IMU_DATASAMPLE m_acqSample;//working copy of the sample being collected (only copied into the broadcast ring once it is complete)
+	SampleBus *m_pSampleBus;//broadcast ring that samples get published to (nullptr if not used)
+	OrientationSlot *m_pOrientationSlot;//slot that every fused sample gets published to (nullptr if not used)
 	
 	//functions
 	bool GetTempCalSample(char* lineText, unsigned int baseSampleTime, double& dTempDegC);//gets raw IMU data to use for coming up with a device temperature calibration
@@ -162,12 +438,33 @@ private:
 	int Get16BitTwosComplement(unsigned char highByte, unsigned char lowByte);//convert two-byte value into a 16-bit twos-complement number (between -32767 and +32767)
 	bool InitializeMagDevice();//initialize LIS3MDL for sample rate, full-scale range, etc.
 	bool InitializeAccGyroDevice();//initialize LSM6DS33 for sample rate, full-scale range, etc.
+	bool InitializePressureDevice();//initialize LPS25H for sample rate and FIFO mean mode
+	bool ReadPressureBurst(IMU_PRESSURE_SAMPLE *pPressureSample, bool &bNewData);//read the status, pressure, and temperature registers of the LPS25H in one burst (caller must have the I2C bus mutex)
+	bool GetCoalescedSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//collect a new sample, or wait for the sample that another thread is already collecting
+	bool BusRead(int nSlaveAddr, unsigned char ucReg, unsigned char *buf, int nNumBytes);//read nNumBytes consecutive registers starting at ucReg in one combined I2C transaction (caller must have the I2C bus mutex)
+	bool BusWrite(int nSlaveAddr, unsigned char ucReg, unsigned char *vals, int nNumBytes);//write nNumBytes consecutive registers starting at ucReg in one I2C transaction (caller must have the I2C bus mutex)
+	bool ReadMagBurst(IMU_DATASAMPLE *pIMUSample, double dDeadline);//wait for new magnetometer data and read it (plus temperature) in a single burst (caller must have the I2C bus mutex)
+	bool ReadAccGyroBurst(IMU_DATASAMPLE *pIMUSample, double dDeadline);//wait for new acc/gyro data and read it (plus temperature and timestamp) in two bursts (caller must have the I2C bus mutex)
+	bool GetAccGyroSleepSample(IMU_DATASAMPLE *pIMUSample);//read the latest accelerometer reading (plus temperature and timestamp) while the LSM6DS33 is asleep, without waiting for new data
+	bool GetAccGyroFifoSample(IMU_DATASAMPLE *pIMUSample, int nNumToAvg);//average the most recent nNumToAvg acc/gyro readings from the LSM6DS33 FIFO
+	bool ProcessAccGyroTimestamp(unsigned char *tsBytes, IMU_DATASAMPLE *pIMUSample, int nNumReadings);//convert the 3 timestamp bytes of the LSM6DS33 into the sample time, and check for missed ODR ticks
+	bool ReadMagFrame(double *mag_counts);//read the X, Y, Z magnetometer counts in one burst, using 3-byte frames in fast-read mode (caller must have the I2C bus mutex)
+	void TapReading(double *acc_counts, double *gyro_data, double dSampleTime);//pass one acc/gyro reading to the reading tap (if there is one)
+	void SetSpecificForce(IMU_DATASAMPLE *pIMUSample, const double *acc_counts);//convert averaged accelerometer counts into the specific force of a sample
+	int DrainAccStream(int nMaxReadings);//move up to nMaxReadings accelerometer stream readings out of the FIFO into m_accStreamBuf and m_accStreamSum
+	bool SetStreamAccData(IMU_DATASAMPLE *pIMUSample);//replace the acceleration of a sample with the average of the stream readings since the previous sample
+	void UpdateVelocity(IMU_DATASAMPLE *pSample, bool bRestart);//integrate the linear acceleration of a fused sample into its velocity
+	void FuseSample(IMU_DATASAMPLE *pSample, double dFusedTimeSec);//compute the orientation of a sample (see ComputeOrientation) and stamp it with a given fused time
+	static double ConvertMagTemperature(unsigned char highByte, unsigned char lowByte);//convert the two LIS3MDL temperature bytes into a temperature in deg C
+	bool WriteRegister(int nSlaveAddr, unsigned char ucReg, unsigned char ucVal);//write a single register of the magnetometer or acc/gyro device (gets bus access and selects the slave device first)
 	bool Get6BytesRegData(double *data, int nBaseRegAddr);//request 6 bytes of register data starting at nBaseRegAddr
 	bool WaitForMagDataReady(unsigned char ucStatusReg);//check 3 least sig bits of status register to verify that they are all set (indicating that X, Y, Z data is ready to read
 	bool WaitForAccDataReady(unsigned char ucStatusReg);//check XLDA bit of LSM6DS33 status register to see if the accelerometer data is ready
 	bool WaitForGyroDataReady(unsigned char ucStatusReg);//check GDA bit of LSM6DS33 status register to see if the gyro data is ready
 	bool WaitForAccTemperatureData(unsigned char ucStatusReg);//check TDA bit of LSM6DS33 status register to see if the temperature data is ready
 	bool LoadMagCal();//load magnetometer offset calibration (if available) from mag_cal.txt file
+	void ParseMagCal();//parse mag_cal.txt into m_magCalOffsets and m_tempCal
+	static void *MagCalParseThread(void *pParam);//thread function for parsing mag_cal.txt while the other sensors are being configured
 	static void normalize(double *vec);//normalizes vec (if it is not a null vector)
 };
 	
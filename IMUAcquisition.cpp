@@ -0,0 +1,404 @@
+/**
+ * @file IMUAcquisition.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the IMUAcquisition class (periodic IMU sampling thread with an optional real-time mode and jitter reporting)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //needed for CPU affinity functions
+#endif
+#include <sched.h>
+#include <alloca.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <algorithm>
+#include "ShipLog.h"
+#include "IMUAcquisition.h"
+#include "SampleBus.h"
+
+extern ShipLog g_shiplog;//used for logging data and to assist in debugging
+
+/**
+ * @brief Construct a new IMUAcquisition object. The acquisition thread is not started until Start is called.
+ *
+ * @param pIMU the IMU that samples are collected from
+ * @param pBus broadcast ring that samples get published to, or nullptr if the samples only need to be collected (e.g. for timing tests)
+ * @param uiPeriodUs the time between samples in microseconds
+ * @param nNumToAvg the number of individual readings to average for each sample (use 1 for no averaging)
+ */
+IMUAcquisition::IMUAcquisition(IMU *pIMU, SampleBus *pBus, unsigned int uiPeriodUs, int nNumToAvg) {
+	m_pIMU = pIMU;
+	m_pBus = pBus;
+	m_uiPeriodUs = uiPeriodUs;
+	m_nNumToAvg = nNumToAvg;
+	memset(&m_config, 0, sizeof(IMU_RT_CONFIG));
+	m_config.nCPU = -1;
+	m_bRunning = false;
+	m_bThreadStarted = false;
+	memset(&m_lastSample, 0, sizeof(IMU_DATASAMPLE));
+	memset(m_szErrMsg, 0, 256);
+	pthread_mutex_init(&m_timingMutex, nullptr);
+	m_wakeupLatency = new double[ACQ_NUM_TIMING_VALS];
+	m_intervalJitter = new double[ACQ_NUM_TIMING_VALS];
+	m_sortBuf = new double[ACQ_NUM_TIMING_VALS];
+	m_uiNumTimingVals = 0;
+	m_uiNumOverruns = 0;
+	m_uiNumFailed = 0;
+	m_uiIdlePeriodUs = 0;
+	memset(&m_idleReport, 0, sizeof(IMU_IDLE_REPORT));
+	m_dIdleStartSec = 0.0;
+}
+
+/**
+ * @brief Destroy the IMUAcquisition object (stops the acquisition thread if it is still running)
+ *
+ */
+IMUAcquisition::~IMUAcquisition() {
+	Stop();
+	pthread_mutex_destroy(&m_timingMutex);
+	delete []m_wakeupLatency;
+	delete []m_intervalJitter;
+	delete []m_sortBuf;
+}
+
+/**
+ * @brief fill pConfig with the default real-time settings: SCHED_FIFO at priority ACQ_DEFAULT_RT_PRIORITY, no CPU pinning, memory locked, and ACQ_DEFAULT_STACK_PREFAULT bytes of pre-faulted stack.
+ *
+ * @param pConfig pointer to the settings structure to fill
+ */
+void IMUAcquisition::GetDefaultRTConfig(IMU_RT_CONFIG *pConfig) {
+	pConfig->bRealTime = true;
+	pConfig->nPriority = ACQ_DEFAULT_RT_PRIORITY;
+	pConfig->nCPU = -1;
+	pConfig->bLockMemory = true;
+	pConfig->uiStackPrefaultBytes = ACQ_DEFAULT_STACK_PREFAULT;
+}
+
+/**
+ * @brief initialize an I2C bus mutex with the priority inheritance protocol. Use this instead of PTHREAD_MUTEX_INITIALIZER for the mutex passed to the IMU constructor when running in real-time mode, so that a low priority thread holding the bus gets boosted instead of holding up the acquisition thread.
+ *
+ * @param pMutex the mutex to initialize
+ * @return true if the mutex was initialized with priority inheritance
+ * @return false if the mutex could not be initialized
+ */
+bool IMUAcquisition::InitPriorityInheritanceMutex(pthread_mutex_t *pMutex) {
+	pthread_mutexattr_t attr;
+	if (pthread_mutexattr_init(&attr)!=0) {
+		return false;
+	}
+	bool bRetval = (pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT)==0 && pthread_mutex_init(pMutex, &attr)==0);
+	pthread_mutexattr_destroy(&attr);
+	return bRetval;
+}
+
+/**
+ * @brief start the acquisition thread
+ *
+ * @param pConfig the real-time settings to use for the thread, or nullptr to run the acquisition loop as an ordinary thread
+ * @return true if the acquisition thread was started successfully
+ * @return false if the thread is already running, or if the real-time settings could not be applied (typically because the process lacks the CAP_SYS_NICE / CAP_IPC_LOCK privileges)
+ */
+bool IMUAcquisition::Start(IMU_RT_CONFIG *pConfig) {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, acquisition thread is already running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (pConfig!=nullptr) {
+		memcpy(&m_config, pConfig, sizeof(IMU_RT_CONFIG));
+	}
+	else {
+		memset(&m_config, 0, sizeof(IMU_RT_CONFIG));
+		m_config.nCPU = -1;
+	}
+	if (m_config.bLockMemory) {
+		if (mlockall(MCL_CURRENT|MCL_FUTURE)!=0) {
+			sprintf(m_szErrMsg, "Error (%s) trying to lock memory for real-time acquisition.\n", strerror(errno));
+			g_shiplog.LogEntry(m_szErrMsg, true);
+			return false;
+		}
+	}
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (m_config.uiStackPrefaultBytes>0) {//make sure that the stack is comfortably larger than the part of it that gets pre-faulted
+		pthread_attr_setstacksize(&attr, m_config.uiStackPrefaultBytes + PTHREAD_STACK_MIN + 65536);
+	}
+	if (m_config.bRealTime) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = m_config.nPriority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	m_bRunning = true;
+	int nRetval = pthread_create(&m_thread, &attr, AcquisitionThread, this);
+	pthread_attr_destroy(&attr);
+	if (nRetval!=0) {
+		sprintf(m_szErrMsg, "Error (%s) trying to start acquisition thread.\n", strerror(nRetval));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bRunning = false;
+		return false;
+	}
+	m_bThreadStarted = true;
+	return true;
+}
+
+/**
+ * @brief stop the acquisition thread and wait for it to finish
+ *
+ */
+void IMUAcquisition::Stop() {
+	m_bRunning = false;
+	if (m_bThreadStarted) {
+		pthread_join(m_thread, nullptr);
+		m_bThreadStarted = false;
+	}
+}
+
+bool IMUAcquisition::IsRunning() {//returns true if the acquisition thread is running
+	return m_bThreadStarted && m_bRunning;
+}
+
+void *IMUAcquisition::AcquisitionThread(void *pParam) {//thread function for collecting samples
+	IMUAcquisition *pAcq = (IMUAcquisition *)pParam;
+	pAcq->ApplyThreadSettings();
+	pAcq->AcquisitionLoop();
+	return nullptr;
+}
+
+void IMUAcquisition::ApplyThreadSettings() {//pin the current thread to a CPU and pre-fault its stack, according to m_config
+	if (m_config.nCPU>=0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(m_config.nCPU, &cpuset);
+		int nRetval = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+		if (nRetval!=0) {
+			sprintf(m_szErrMsg, "Error (%s) trying to pin acquisition thread to CPU %d.\n", strerror(nRetval), m_config.nCPU);
+			g_shiplog.LogEntry(m_szErrMsg, true);
+		}
+	}
+	if (m_config.uiStackPrefaultBytes>0) {
+		//touch each page of the stack now, so that the acquisition loop never needs to fault in a new stack page
+		volatile unsigned char *stackBuf = (volatile unsigned char *)alloca(m_config.uiStackPrefaultBytes);
+		for (unsigned int i=0;i<m_config.uiStackPrefaultBytes;i+=1024) {
+			stackBuf[i] = 0;
+		}
+	}
+}
+
+void IMUAcquisition::AcquisitionLoop() {//loop that runs in the acquisition thread until Stop is called
+	const long NSEC_PER_SEC = 1000000000L;
+	struct timespec nextWakeup, now;
+	struct timespec lastSampleDone = {0, 0};//time when the previous full-rate sample was finished (valid if bHaveLastSample is true)
+	bool bHaveLastSample = false;
+	bool bIdle = false;//true while the IMU is asleep and samples are only collected at the idle rate
+	bool bWaking = false;//true from when a wake-up is detected until its first sample is available
+	double dWakeDetectedSec = 0.0;//monotonic time when the most recent wake-up was detected
+	unsigned int uiNumSinceMotionCheck = 0;//number of full-rate samples since the IMU was last checked for sleep
+	clock_gettime(CLOCK_MONOTONIC, &nextWakeup);
+	while (m_bRunning) {
+		long lPeriodNs = ((long)(bIdle ? m_uiIdlePeriodUs : m_uiPeriodUs))*1000L;
+		//wake up at absolute times, so that time spent sampling does not accumulate as drift
+		nextWakeup.tv_nsec += lPeriodNs;
+		while (nextWakeup.tv_nsec>=NSEC_PER_SEC) {
+			nextWakeup.tv_nsec -= NSEC_PER_SEC;
+			nextWakeup.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextWakeup, nullptr);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double dWakeupLatencyUs = (now.tv_sec - nextWakeup.tv_sec)*1000000.0 + (now.tv_nsec - nextWakeup.tv_nsec)/1000.0;
+
+		if (m_uiIdlePeriodUs>0&&(bIdle||++uiNumSinceMotionCheck>=ACQ_MOTION_CHECK_SAMPLES)) {
+			//idle mode: sample at the full rate while the IMU is awake, and only at the idle rate (checking for motion each time) while it is asleep
+			uiNumSinceMotionCheck = 0;
+			bool bSleeping = false;
+			if (!m_pIMU->GetMotionState(bSleeping)) {
+				bSleeping = bIdle;//keep the current state if the IMU could not be checked
+			}
+			double dNowSec = now.tv_sec + now.tv_nsec/1.0e9;
+			if (bSleeping&&!bIdle) {
+				bIdle = true;
+				bHaveLastSample = false;
+				pthread_mutex_lock(&m_timingMutex);
+				m_dIdleStartSec = dNowSec;
+				m_idleReport.idle = true;
+				m_idleReport.num_sleeps++;
+				pthread_mutex_unlock(&m_timingMutex);
+			}
+			else if (!bSleeping&&bIdle) {
+				bIdle = false;
+				bWaking = true;
+				dWakeDetectedSec = dNowSec;
+				pthread_mutex_lock(&m_timingMutex);
+				m_idleReport.idle = false;
+				m_idleReport.num_wakes++;
+				m_idleReport.idle_time_sec+=(dNowSec - m_dIdleStartSec);
+				pthread_mutex_unlock(&m_timingMutex);
+			}
+		}
+
+		bool bSampleOK = false;
+		if (m_pBus!=nullptr) {
+			bSampleOK = m_pIMU->PublishSample(m_nNumToAvg);
+		}
+		else {
+			bSampleOK = m_pIMU->GetSample(&m_lastSample, m_nNumToAvg);
+		}
+		struct timespec sampleDone;
+		clock_gettime(CLOCK_MONOTONIC, &sampleDone);
+		if (bWaking&&bSampleOK) {
+			double dWakeLatencyUs = (sampleDone.tv_sec + sampleDone.tv_nsec/1.0e9 - dWakeDetectedSec)*1000000.0;
+			pthread_mutex_lock(&m_timingMutex);
+			m_idleReport.last_wake_latency_us = dWakeLatencyUs;
+			if (dWakeLatencyUs>m_idleReport.max_wake_latency_us) {
+				m_idleReport.max_wake_latency_us = dWakeLatencyUs;
+			}
+			pthread_mutex_unlock(&m_timingMutex);
+			bWaking = false;
+		}
+		double dIntervalJitterUs = 0.0;
+		if (bHaveLastSample&&!bIdle) {
+			double dIntervalUs = (sampleDone.tv_sec - lastSampleDone.tv_sec)*1000000.0 + (sampleDone.tv_nsec - lastSampleDone.tv_nsec)/1000.0;
+			dIntervalJitterUs = fabs(dIntervalUs - m_uiPeriodUs);
+		}
+		RecordTiming(dWakeupLatencyUs, dIntervalJitterUs, bHaveLastSample && bSampleOK && !bIdle);
+		if (!bSampleOK) {
+			pthread_mutex_lock(&m_timingMutex);
+			m_uiNumFailed++;
+			pthread_mutex_unlock(&m_timingMutex);
+			bHaveLastSample = false;
+		}
+		else if (!bIdle) {//(samples at the idle rate are not used for the full-rate interval jitter)
+			lastSampleDone = sampleDone;
+			bHaveLastSample = true;
+		}
+		//if sampling ran past the next wake-up time, skip ahead instead of trying to catch up with a burst of samples
+		double dElapsedUs = (sampleDone.tv_sec - nextWakeup.tv_sec)*1000000.0 + (sampleDone.tv_nsec - nextWakeup.tv_nsec)/1000.0;
+		if (dElapsedUs>lPeriodNs/1000.0) {
+			pthread_mutex_lock(&m_timingMutex);
+			m_uiNumOverruns++;
+			pthread_mutex_unlock(&m_timingMutex);
+			nextWakeup = sampleDone;
+		}
+	}
+}
+
+void IMUAcquisition::RecordTiming(double dWakeupLatencyUs, double dIntervalJitterUs, bool bIncludeInterval) {//store one set of timing measurements
+	pthread_mutex_lock(&m_timingMutex);
+	unsigned int uiIndex = m_uiNumTimingVals % ACQ_NUM_TIMING_VALS;
+	m_wakeupLatency[uiIndex] = dWakeupLatencyUs;
+	m_intervalJitter[uiIndex] = bIncludeInterval ? dIntervalJitterUs : -1.0;//negative values mark samples that have no valid interval
+	m_uiNumTimingVals++;
+	pthread_mutex_unlock(&m_timingMutex);
+}
+
+/**
+ * @brief get wake-up latency and sample interval jitter percentiles for the most recent ACQ_NUM_TIMING_VALS samples
+ *
+ * @param pReport pointer to the structure that receives the timing summary
+ */
+void IMUAcquisition::GetJitterReport(IMU_JITTER_REPORT *pReport) {
+	memset(pReport, 0, sizeof(IMU_JITTER_REPORT));
+	pthread_mutex_lock(&m_timingMutex);
+	unsigned int uiNumVals = std::min(m_uiNumTimingVals, (unsigned int)ACQ_NUM_TIMING_VALS);
+	pReport->num_samples = uiNumVals;
+	pReport->num_overruns = m_uiNumOverruns;
+	pReport->num_failed = m_uiNumFailed;
+	memcpy(m_sortBuf, m_wakeupLatency, uiNumVals*sizeof(double));
+	GetPercentiles(m_sortBuf, uiNumVals, pReport->wakeup_p50, pReport->wakeup_p99, pReport->wakeup_p999, pReport->wakeup_max);
+	unsigned int uiNumIntervals = 0;
+	for (unsigned int i=0;i<uiNumVals;i++) {
+		if (m_intervalJitter[i]>=0.0) {
+			m_sortBuf[uiNumIntervals++] = m_intervalJitter[i];
+		}
+	}
+	GetPercentiles(m_sortBuf, uiNumIntervals, pReport->jitter_p50, pReport->jitter_p99, pReport->jitter_p999, pReport->jitter_max);
+	pthread_mutex_unlock(&m_timingMutex);
+}
+
+/**
+ * @brief clear all timing measurements
+ *
+ */
+void IMUAcquisition::ResetJitterStats() {
+	pthread_mutex_lock(&m_timingMutex);
+	m_uiNumTimingVals = 0;
+	m_uiNumOverruns = 0;
+	m_uiNumFailed = 0;
+	pthread_mutex_unlock(&m_timingMutex);
+}
+
+/**
+ * @brief turn on idle mode, where the acquisition thread drops to a trickle of samples while the IMU is still and resumes full-rate sampling as soon as it moves. The LSM6DS33 activity / inactivity engine decides when the IMU is still (see IMU::EnableMotionWake), and the acquisition thread checks its state every ACQ_MOTION_CHECK_SAMPLES samples while awake, and every uiIdlePeriodUs while idle. While idle, one sample is collected (and published to the sample bus, if there is one) every uiIdlePeriodUs, with its orientation computed from the acc/mag data alone since the gyro is asleep (see IMU::GetMotionState).
+ *
+ * @param dWakeThresholdG the change in acceleration (in G) that counts as motion
+ * @param dSleepDelaySec the time without motion (in seconds) before the IMU goes to sleep
+ * @param uiIdlePeriodUs the time between samples (and checks for motion) while idle in microseconds. This is the worst-case delay in detecting a wake-up, on top of the latency reported by GetIdleReport.
+ * @return true if idle mode was turned on
+ * @return false if the acquisition thread is already running, or if the IMU could not be programmed
+ */
+bool IMUAcquisition::EnableIdleMode(double dWakeThresholdG, double dSleepDelaySec, unsigned int uiIdlePeriodUs) {
+	if (m_bThreadStarted||uiIdlePeriodUs==0) {
+		strcpy(m_szErrMsg, (char *)"Error, idle mode must be set up with a non-zero idle period before the acquisition thread is started.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (!m_pIMU->EnableMotionWake(dWakeThresholdG, dSleepDelaySec)) {
+		return false;
+	}
+	m_uiIdlePeriodUs = uiIdlePeriodUs;
+	return true;
+}
+
+/**
+ * @brief turn off idle mode, so that samples are always collected at the full rate
+ *
+ * @return true if idle mode was turned off
+ * @return false if the acquisition thread is already running, or if the IMU could not be programmed
+ */
+bool IMUAcquisition::DisableIdleMode() {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, cannot change idle mode while the acquisition thread is running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	m_uiIdlePeriodUs = 0;
+	return m_pIMU->DisableMotionWake();
+}
+
+/**
+ * @brief get the number of sleep / wake transitions, the time spent idle, and the time taken to get the first full-rate sample after each wake-up
+ *
+ * @param pReport pointer to the structure that receives the idle mode summary
+ */
+void IMUAcquisition::GetIdleReport(IMU_IDLE_REPORT *pReport) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&m_timingMutex);
+	memcpy(pReport, &m_idleReport, sizeof(IMU_IDLE_REPORT));
+	if (m_idleReport.idle) {//include the current idle period
+		pReport->idle_time_sec+=(now.tv_sec + now.tv_nsec/1.0e9 - m_dIdleStartSec);
+	}
+	pthread_mutex_unlock(&m_timingMutex);
+}
+
+void IMUAcquisition::GetPercentiles(double *vals, unsigned int uiNumVals, double &dP50, double &dP99, double &dP999, double &dMax) {//compute percentiles of uiNumVals values (vals gets re-ordered)
+	dP50 = dP99 = dP999 = dMax = 0.0;
+	if (uiNumVals==0) return;
+	std::sort(vals, vals + uiNumVals);
+	dP50 = vals[(unsigned int)(0.5*(uiNumVals-1))];
+	dP99 = vals[(unsigned int)(0.99*(uiNumVals-1))];
+	dP999 = vals[(unsigned int)(0.999*(uiNumVals-1))];
+	dMax = vals[uiNumVals-1];
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <pthread.h>
+#include "IMU.h"
+//periodic sample acquisition thread for the IMU, with an optional real-time mode (SCHED_FIFO priority, CPU pinning, locked memory, pre-faulted stack) and built-in measurement of wake-up latency and sample interval jitter
+
+#define ACQ_NUM_TIMING_VALS 4096 //number of most recent timing measurements kept for computing latency and jitter percentiles
+#define ACQ_DEFAULT_RT_PRIORITY 80 //default SCHED_FIFO priority used for the acquisition thread in real-time mode
+#define ACQ_DEFAULT_STACK_PREFAULT 65536 //default number of bytes of stack to touch at thread startup so that the acquisition loop never takes a page fault on its stack
+#define ACQ_MOTION_CHECK_SAMPLES 16 //in idle mode, number of full-rate samples between checks of whether or not the IMU has gone to sleep
+
+class SampleBus;
+
+struct IMU_RT_CONFIG {//settings for the real-time acquisition mode
+	bool bRealTime;//true to run the acquisition thread with the SCHED_FIFO real-time scheduling policy
+	int nPriority;//SCHED_FIFO priority of the acquisition thread (1 to 99, ignored if bRealTime is false)
+	int nCPU;//index of the CPU core that the acquisition thread is pinned to, or -1 to let it run on any core
+	bool bLockMemory;//true to lock all current and future pages of the process into RAM (mlockall) so that the acquisition thread is never delayed by paging
+	unsigned int uiStackPrefaultBytes;//number of bytes of stack to pre-fault when the acquisition thread starts (0 to skip)
+};
+
+struct IMU_JITTER_REPORT {//summary of the timing of the acquisition thread, all times are in microseconds
+	unsigned int num_samples;//number of timing measurements that the percentiles are based on
+	unsigned int num_overruns;//number of sample periods where the acquisition took longer than the sample period
+	unsigned int num_failed;//number of samples that could not be acquired
+	double wakeup_p50;//median wake-up latency (time from scheduled wake-up to when the thread actually ran)
+	double wakeup_p99;//99th percentile wake-up latency
+	double wakeup_p999;//99.9th percentile wake-up latency
+	double wakeup_max;//maximum wake-up latency
+	double jitter_p50;//median absolute deviation of the time between consecutive samples from the sample period
+	double jitter_p99;//99th percentile absolute deviation of the time between consecutive samples from the sample period
+	double jitter_p999;//99.9th percentile absolute deviation of the time between consecutive samples from the sample period
+	double jitter_max;//maximum absolute deviation of the time between consecutive samples from the sample period
+};
+
+struct IMU_IDLE_REPORT {//summary of the idle (motion-triggered wake-up) mode of the acquisition thread
+	bool idle;//true if the acquisition thread is currently idle (IMU asleep, samples only collected at the idle rate)
+	unsigned int num_sleeps;//number of transitions from full-rate sampling to idle
+	unsigned int num_wakes;//number of transitions from idle back to full-rate sampling
+	double idle_time_sec;//total time spent idle (including the current idle period)
+	double last_wake_latency_us;//time from detecting the most recent wake-up until its first full-rate sample was available (usec)
+	double max_wake_latency_us;//maximum time from detecting a wake-up until the first full-rate sample was available (usec)
+};
+
+class IMUAcquisition {//runs a thread that collects IMU samples at a fixed interval, optionally publishing them to a SampleBus
+public:
+	IMUAcquisition(IMU *pIMU, SampleBus *pBus, unsigned int uiPeriodUs, int nNumToAvg);//constructor
+	~IMUAcquisition();//destructor
+	static void GetDefaultRTConfig(IMU_RT_CONFIG *pConfig);//fill pConfig with the default real-time settings
+	static bool InitPriorityInheritanceMutex(pthread_mutex_t *pMutex);//initialize an I2C bus mutex with the priority inheritance protocol, so that a low priority thread holding the bus cannot hold up the real-time acquisition thread
+	bool Start(IMU_RT_CONFIG *pConfig);//start the acquisition thread (pass nullptr for an ordinary thread)
+	void Stop();//stop the acquisition thread and wait for it to finish
+	bool IsRunning();//returns true if the acquisition thread is running
+	void GetJitterReport(IMU_JITTER_REPORT *pReport);//get wake-up latency and sample interval jitter percentiles for the most recent samples
+	void ResetJitterStats();//clear all timing measurements
+	bool EnableIdleMode(double dWakeThresholdG, double dSleepDelaySec, unsigned int uiIdlePeriodUs);//drop to a trickle of samples while the IMU is still, and resume full-rate sampling when it wakes up on motion (call before Start)
+	bool DisableIdleMode();//always sample at the full rate (call before Start)
+	void GetIdleReport(IMU_IDLE_REPORT *pReport);//get the number of sleep / wake transitions, the time spent idle, and the wake-up latency
+
+private:
+	//data
+	IMU *m_pIMU;//the IMU that samples are collected from
+	SampleBus *m_pBus;//broadcast ring that samples get published to (nullptr to use IMU::GetSample instead)
+	unsigned int m_uiPeriodUs;//time between samples in microseconds
+	int m_nNumToAvg;//number of individual readings to average for each sample
+	IMU_RT_CONFIG m_config;//settings used for the acquisition thread
+	pthread_t m_thread;//handle to the acquisition thread
+	std::atomic<bool> m_bRunning;//true while the acquisition thread should keep running
+	bool m_bThreadStarted;//true if m_thread was successfully created and has not been joined yet
+	IMU_DATASAMPLE m_lastSample;//most recent sample (used when no SampleBus is attached)
+	pthread_mutex_t m_timingMutex;//protects the timing measurements below
+	double *m_wakeupLatency;//ring of the most recent wake-up latencies (usec)
+	double *m_intervalJitter;//ring of the most recent absolute sample interval deviations (usec)
+	double *m_sortBuf;//scratch space used for computing percentiles
+	unsigned int m_uiNumTimingVals;//total number of timing values recorded
+	unsigned int m_uiNumOverruns;//number of sample periods where the acquisition took longer than the sample period
+	unsigned int m_uiNumFailed;//number of samples that could not be acquired
+	unsigned int m_uiIdlePeriodUs;//time between samples (and checks for motion) while idle in microseconds (0 if idle mode is off)
+	IMU_IDLE_REPORT m_idleReport;//sleep / wake transition counters and latencies (protected by m_timingMutex)
+	double m_dIdleStartSec;//monotonic time when the current idle period started
+	char m_szErrMsg[256];//buffer space used for outputting error messages
+
+	//functions
+	static void *AcquisitionThread(void *pParam);//thread function for collecting samples
+	void AcquisitionLoop();//loop that runs in the acquisition thread until Stop is called
+	void ApplyThreadSettings();//pin the current thread to a CPU and pre-fault its stack, according to m_config
+	void RecordTiming(double dWakeupLatencyUs, double dIntervalJitterUs, bool bIncludeInterval);//store one set of timing measurements
+	void GetPercentiles(double *vals, unsigned int uiNumVals, double &dP50, double &dP99, double &dP999, double &dMax);//compute percentiles of uiNumVals values
+};
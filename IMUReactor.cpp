@@ -0,0 +1,374 @@
+/**
+ * @file IMUReactor.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the IMUReactor class (epoll-based event loop that samples IMUs and delivers the samples to callbacks or coroutines)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "ShipLog.h"
+#include "IMUReactor.h"
+
+extern ShipLog g_shiplog;//used for logging data and to assist in debugging
+
+#define IMU_REACTOR_STOP_TAG IMU_REACTOR_MAX_SOURCES //epoll tag used for the stop event (timers are tagged with their source id)
+
+/**
+ * @brief Construct a new IMUReactor object. Check m_bInitError afterwards to make sure that the reactor was created successfully.
+ *
+ */
+IMUReactor::IMUReactor() {
+	m_bInitError = false;
+	m_bRunning = false;
+	memset(m_szErrMsg, 0, 256);
+	memset(m_sources, 0, sizeof(m_sources));
+	for (int i=0;i<IMU_REACTOR_MAX_SOURCES;i++) {
+		m_sources[i].nTimerFd = -1;
+	}
+	m_nStopFd = -1;
+	m_nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_nEpollFd<0) {
+		sprintf(m_szErrMsg, "Error (%s) creating epoll descriptor for IMU reactor.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bInitError = true;
+		return;
+	}
+	m_nStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_nStopFd<0) {
+		sprintf(m_szErrMsg, "Error (%s) creating stop event for IMU reactor.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bInitError = true;
+		return;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = IMU_REACTOR_STOP_TAG;
+	if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, m_nStopFd, &ev)<0) {
+		sprintf(m_szErrMsg, "Error (%s) registering stop event for IMU reactor.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bInitError = true;
+	}
+}
+
+/**
+ * @brief Destroy the IMUReactor object. Any one-shot requests that are still pending are completed with bSampleOK = false.
+ *
+ */
+IMUReactor::~IMUReactor() {
+	for (int i=0;i<IMU_REACTOR_MAX_SOURCES;i++) {
+		if (m_sources[i].pIMU!=nullptr) {
+			RemoveIMU(i);
+		}
+	}
+	if (m_nStopFd>=0) {
+		close(m_nStopFd);
+		m_nStopFd = -1;
+	}
+	if (m_nEpollFd>=0) {
+		close(m_nEpollFd);
+		m_nEpollFd = -1;
+	}
+}
+
+/**
+ * @brief start sampling an IMU at a fixed interval. A sample is only collected when it is due and at least one client (subscriber or one-shot request) is waiting for it, so an IMU with no clients does not use the I2C bus. Once a sample is due, the sensor status registers are checked every IMU_REACTOR_RETRY_US until new data is ready, and only then is the sample read, so the reactor thread is free for other sources and events while the sensors are converting.
+ *
+ * @param pIMU the IMU to collect samples from. The reactor does not take ownership of the IMU. If another thread also samples the IMU, GetSample may still wait for that thread's acquisition.
+ * @param uiPeriodUs the time between samples in microseconds. This should not be shorter than the output data rate of the sensors (see MAG_ODR_HZ and ACC_GYRO_ODR_HZ), since each sample needs new sensor data.
+ * @param nNumToAvg the number of individual readings to average for each sample (use 1 for no averaging). Averaging more than one reading only avoids waiting on the reactor thread if FIFO averaging is on (see IMU::EnableFifoAveraging).
+ * @return int the id of the new source, used for subscribing to its samples, or -1 if the IMU could not be added
+ */
+int IMUReactor::AddIMU(IMU *pIMU, unsigned int uiPeriodUs, int nNumToAvg) {
+	if (m_bInitError||pIMU==nullptr||uiPeriodUs==0||nNumToAvg<1) {
+		strcpy(m_szErrMsg, (char *)"Error, invalid IMU reactor source.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return -1;
+	}
+	int nSourceId = -1;
+	for (int i=0;i<IMU_REACTOR_MAX_SOURCES;i++) {
+		if (m_sources[i].pIMU==nullptr) {
+			nSourceId = i;
+			break;
+		}
+	}
+	if (nSourceId<0) {
+		strcpy(m_szErrMsg, (char *)"Error, too many IMUs have been added to the reactor.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return -1;
+	}
+	int nTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (nTimerFd<0) {
+		sprintf(m_szErrMsg, "Error (%s) creating sample timer.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return -1;
+	}
+	IMU_REACTOR_SOURCE source;
+	memset(&source, 0, sizeof(IMU_REACTOR_SOURCE));
+	source.pIMU = pIMU;
+	source.nTimerFd = nTimerFd;
+	source.nNumToAvg = nNumToAvg;
+	source.dPeriodSec = uiPeriodUs / 1.0e6;
+	source.dNextDueSec = IMU::GetMonotonicTimeSec() + source.dPeriodSec;
+	if (!ArmTimer(&source, source.dNextDueSec)) {
+		close(nTimerFd);
+		return -1;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = (unsigned int)nSourceId;
+	if (epoll_ctl(m_nEpollFd, EPOLL_CTL_ADD, nTimerFd, &ev)<0) {
+		sprintf(m_szErrMsg, "Error (%s) registering sample timer.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		close(nTimerFd);
+		return -1;
+	}
+	memcpy(&m_sources[nSourceId], &source, sizeof(IMU_REACTOR_SOURCE));
+	return nSourceId;
+}
+
+/**
+ * @brief stop sampling an IMU and release its timer. Any one-shot requests that are still pending for the IMU are completed with bSampleOK = false.
+ *
+ * @param nSourceId the id returned by AddIMU
+ * @return true if the IMU was removed
+ * @return false if nSourceId does not refer to an IMU of this reactor
+ */
+bool IMUReactor::RemoveIMU(int nSourceId) {
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr) return false;
+	epoll_ctl(m_nEpollFd, EPOLL_CTL_DEL, pSource->nTimerFd, nullptr);
+	close(pSource->nTimerFd);
+	pSource->nTimerFd = -1;
+	pSource->nNumSubscribers = 0;
+	//complete any pending requests before the source is released, so that awaiting coroutines are not left suspended
+	IMU_REACTOR_CLIENT waiters[IMU_REACTOR_MAX_WAITERS];
+	int nNumWaiters = pSource->nNumWaiters;
+	memcpy(waiters, pSource->waiters, nNumWaiters * sizeof(IMU_REACTOR_CLIENT));
+	pSource->nNumWaiters = 0;
+	pSource->pIMU = nullptr;
+	for (int i=0;i<nNumWaiters;i++) {
+		waiters[i].callback(&pSource->sample, false, waiters[i].pUserData);
+	}
+	return true;
+}
+
+/**
+ * @brief call a function for every sample that is collected from an IMU, until Unsubscribe is called
+ *
+ * @param nSourceId the id returned by AddIMU
+ * @param callback the function to call for each sample
+ * @param pUserData pointer that gets passed back to callback
+ * @return true if the subscription was added
+ * @return false if nSourceId is invalid or the IMU already has IMU_REACTOR_MAX_SUBSCRIBERS subscribers
+ */
+bool IMUReactor::Subscribe(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData) {
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr||callback==nullptr||pSource->nNumSubscribers>=IMU_REACTOR_MAX_SUBSCRIBERS) {
+		strcpy(m_szErrMsg, (char *)"Error, unable to subscribe to IMU samples.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	pSource->subscribers[pSource->nNumSubscribers].callback = callback;
+	pSource->subscribers[pSource->nNumSubscribers].pUserData = pUserData;
+	pSource->nNumSubscribers++;
+	return true;
+}
+
+/**
+ * @brief stop calling a function that was passed to Subscribe
+ *
+ * @param nSourceId the id returned by AddIMU
+ * @param callback the function that was passed to Subscribe
+ * @param pUserData the user data that was passed to Subscribe
+ * @return true if the subscription was removed
+ * @return false if no matching subscription was found
+ */
+bool IMUReactor::Unsubscribe(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData) {
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr) return false;
+	for (int i=0;i<pSource->nNumSubscribers;i++) {
+		if (pSource->subscribers[i].callback==callback&&pSource->subscribers[i].pUserData==pUserData) {
+			for (int j=i+1;j<pSource->nNumSubscribers;j++) {
+				pSource->subscribers[j-1] = pSource->subscribers[j];
+			}
+			pSource->nNumSubscribers--;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief call a function once, for the next sample that is collected from an IMU. This is the callback form of NextSample, and can be called again from inside the callback to get the sample after that.
+ *
+ * @param nSourceId the id returned by AddIMU
+ * @param callback the function to call with the next sample
+ * @param pUserData pointer that gets passed back to callback
+ * @return true if the request was queued
+ * @return false if nSourceId is invalid or the IMU already has IMU_REACTOR_MAX_WAITERS pending requests (callback will not be called)
+ */
+bool IMUReactor::RequestSample(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData) {
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr||callback==nullptr||pSource->nNumWaiters>=IMU_REACTOR_MAX_WAITERS) {
+		strcpy(m_szErrMsg, (char *)"Error, unable to request IMU sample.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	pSource->waiters[pSource->nNumWaiters].callback = callback;
+	pSource->waiters[pSource->nNumWaiters].pUserData = pUserData;
+	pSource->nNumWaiters++;
+	return true;
+}
+
+/**
+ * @brief get the epoll descriptor of the reactor. The descriptor becomes readable whenever a timer has expired, so it can be added to another epoll (or poll/select) loop, which then calls RunOnce(0) each time the descriptor is readable.
+ *
+ * @return int the epoll descriptor of the reactor
+ */
+int IMUReactor::GetFd() {
+	return m_nEpollFd;
+}
+
+/**
+ * @brief wait for timer events and handle them, collecting and delivering samples for each IMU whose sample is due and whose sensor data is ready
+ *
+ * @param nTimeoutMs the maximum time to wait for an event in milliseconds (0 to return immediately, -1 to wait indefinitely)
+ * @return int the number of events handled, or -1 if there was an error waiting for events
+ */
+int IMUReactor::RunOnce(int nTimeoutMs) {
+	struct epoll_event events[IMU_REACTOR_MAX_SOURCES+1];
+	int nNumEvents = epoll_wait(m_nEpollFd, events, IMU_REACTOR_MAX_SOURCES+1, nTimeoutMs);
+	if (nNumEvents<0) {
+		if (errno==EINTR) return 0;
+		sprintf(m_szErrMsg, "Error (%s) waiting for IMU reactor events.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return -1;
+	}
+	for (int i=0;i<nNumEvents;i++) {
+		unsigned int uiTag = events[i].data.u32;
+		if (uiTag==IMU_REACTOR_STOP_TAG) {
+			unsigned long long ullCount = 0;
+			if (read(m_nStopFd, &ullCount, sizeof(ullCount))==sizeof(ullCount)) {
+				m_bRunning = false;
+			}
+		}
+		else {
+			HandleTimer((int)uiTag);
+		}
+	}
+	return nNumEvents;
+}
+
+/**
+ * @brief handle events until Stop is called (or an error occurs)
+ *
+ */
+void IMUReactor::Run() {
+	m_bRunning = true;
+	while (m_bRunning) {
+		if (RunOnce(-1)<0) break;
+	}
+	m_bRunning = false;
+}
+
+/**
+ * @brief make Run return after it finishes handling the current events. This is the only function that can be called from a thread other than the one running the reactor.
+ *
+ */
+void IMUReactor::Stop() {
+	unsigned long long ullOne = 1;
+	if (write(m_nStopFd, &ullOne, sizeof(ullOne))!=sizeof(ullOne)) {
+		sprintf(m_szErrMsg, "Error (%s) signalling IMU reactor to stop.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+	}
+}
+
+unsigned int IMUReactor::GetNumOverruns(int nSourceId) {//returns the number of sample intervals of an IMU that were missed because the reactor was busy or the sensor data was late
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr) return 0;
+	return pSource->uiNumOverruns;
+}
+
+IMU_REACTOR_SOURCE * IMUReactor::GetSource(int nSourceId) {//returns the source with id nSourceId, or nullptr if it is not in use
+	if (nSourceId<0||nSourceId>=IMU_REACTOR_MAX_SOURCES) return nullptr;
+	if (m_sources[nSourceId].pIMU==nullptr) return nullptr;
+	return &m_sources[nSourceId];
+}
+
+void IMUReactor::HandleTimer(int nSourceId) {//start or continue a due sample of an IMU whose timer expired, and deliver it to its clients once the sensor data is ready
+	IMU_REACTOR_SOURCE *pSource = GetSource(nSourceId);
+	if (pSource==nullptr) return;//source was removed while handling an earlier event
+	unsigned long long ullExpirations = 0;
+	if (read(pSource->nTimerFd, &ullExpirations, sizeof(ullExpirations))!=sizeof(ullExpirations)) {
+		return;//spurious wake-up, timer has not actually expired
+	}
+	double dNow = IMU::GetMonotonicTimeSec();
+	if (dNow>=pSource->dNextDueSec) {//a new sample interval has started
+		//intervals that went by while the reactor was busy (or while an earlier sample was still waiting for data) are counted as overruns
+		unsigned int uiNumDue = 1 + (unsigned int)((dNow - pSource->dNextDueSec) / pSource->dPeriodSec);
+		pSource->dNextDueSec+=uiNumDue*pSource->dPeriodSec;
+		pSource->uiNumOverruns+=pSource->bWaitingForData ? uiNumDue : uiNumDue - 1;
+		if (!pSource->bWaitingForData&&(pSource->nNumSubscribers>0||pSource->nNumWaiters>0)) {//nobody wants this sample if there are no clients, so leave the bus alone
+			pSource->bWaitingForData = true;
+			pSource->dWaitDeadlineSec = dNow + IMU_REACTOR_DATA_TIMEOUT_SEC;
+		}
+	}
+	if (pSource->bWaitingForData) {
+		bool bReady = false;
+		bool bStatusOK = pSource->pIMU->IsSampleReady(pSource->nNumToAvg, bReady);
+		if (!bStatusOK||bReady||dNow>pSource->dWaitDeadlineSec) {
+			pSource->bWaitingForData = false;
+			bool bSampleOK = bStatusOK&&bReady&&pSource->pIMU->GetSample(&pSource->sample, pSource->nNumToAvg);
+			Dispatch(pSource, bSampleOK);
+			if (GetSource(nSourceId)!=pSource) return;//a client removed the source
+		}
+	}
+	double dWhenSec = pSource->dNextDueSec;
+	if (pSource->bWaitingForData&&dNow + IMU_REACTOR_RETRY_US / 1.0e6<dWhenSec) {
+		dWhenSec = dNow + IMU_REACTOR_RETRY_US / 1.0e6;
+	}
+	ArmTimer(pSource, dWhenSec);
+}
+
+bool IMUReactor::ArmTimer(IMU_REACTOR_SOURCE *pSource, double dWhenSec) {//set the timer of a source to fire once, at a monotonic time
+	//pSource = the source whose timer is set, dWhenSec = monotonic time (see IMU::GetMonotonicTimeSec) at which the timer should fire
+	struct itimerspec timerSpec;
+	memset(&timerSpec, 0, sizeof(timerSpec));
+	timerSpec.it_value.tv_sec = (time_t)dWhenSec;
+	timerSpec.it_value.tv_nsec = (long)((dWhenSec - timerSpec.it_value.tv_sec) * 1.0e9);
+	if (timerfd_settime(pSource->nTimerFd, TFD_TIMER_ABSTIME, &timerSpec, nullptr)<0) {
+		sprintf(m_szErrMsg, "Error (%s) setting sample timer.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	return true;
+}
+
+void IMUReactor::Dispatch(IMU_REACTOR_SOURCE *pSource, bool bSampleOK) {//call the subscribers and one-shot waiters of a source
+	//work from copies of the client lists, since callbacks (and resumed coroutines) are allowed to subscribe, unsubscribe, or request the following sample
+	IMU_REACTOR_CLIENT subscribers[IMU_REACTOR_MAX_SUBSCRIBERS];
+	IMU_REACTOR_CLIENT waiters[IMU_REACTOR_MAX_WAITERS];
+	int nNumSubscribers = pSource->nNumSubscribers;
+	int nNumWaiters = pSource->nNumWaiters;
+	memcpy(subscribers, pSource->subscribers, nNumSubscribers * sizeof(IMU_REACTOR_CLIENT));
+	memcpy(waiters, pSource->waiters, nNumWaiters * sizeof(IMU_REACTOR_CLIENT));
+	pSource->nNumWaiters = 0;
+	for (int i=0;i<nNumSubscribers;i++) {
+		subscribers[i].callback(&pSource->sample, bSampleOK, subscribers[i].pUserData);
+	}
+	for (int i=0;i<nNumWaiters;i++) {
+		waiters[i].callback(&pSource->sample, bSampleOK, waiters[i].pUserData);
+	}
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <string.h>
+#include "IMU.h"
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define IMU_REACTOR_COROUTINES 1 //defined when the compiler supports C++20 coroutines, enables IMUReactor::NextSample
+#endif
+//single-threaded, epoll-based event loop for collecting IMU samples without blocking a thread per IMU. Samples are delivered to callbacks, or (with C++20) to coroutines that co_await IMUReactor::NextSample.
+//The loop never waits for sensor data: when a sample is due it checks the sensor status registers (see IMU::IsSampleReady), and if the data is not there yet it re-arms the timer to check again shortly.
+
+#define IMU_REACTOR_MAX_SOURCES 8 //maximum number of IMUs that can be added to one reactor
+#define IMU_REACTOR_MAX_SUBSCRIBERS 8 //maximum number of persistent subscribers for each IMU
+#define IMU_REACTOR_MAX_WAITERS 16 //maximum number of one-shot requests for the next sample of each IMU
+#define IMU_REACTOR_RETRY_US 1000 //time in microseconds between checks for new sensor data once a sample is due
+#define IMU_REACTOR_DATA_TIMEOUT_SEC 0.5 //time in seconds to keep checking for new sensor data before a sample is delivered as failed
+
+typedef void (*IMU_SAMPLE_CALLBACK)(IMU_DATASAMPLE *pSample, bool bSampleOK, void *pUserData);//function called by the reactor when a sample is ready (pSample is only valid for the duration of the call)
+
+struct IMU_REACTOR_CLIENT {//a callback function together with its user data
+	IMU_SAMPLE_CALLBACK callback;//function to call when a sample is ready
+	void *pUserData;//pointer that gets passed back to callback
+};
+
+struct IMU_REACTOR_SOURCE {//an IMU that is sampled by the reactor
+	IMU *pIMU;//the IMU that samples are collected from (nullptr if this source is not in use)
+	int nTimerFd;//one-shot timerfd that fires when the next sample is due, or when it is time to check again for new sensor data
+	int nNumToAvg;//number of individual readings to average for each sample
+	double dPeriodSec;//time between samples in seconds
+	double dNextDueSec;//monotonic time (see IMU::GetMonotonicTimeSec) when the next sample interval starts
+	bool bWaitingForData;//true while a sample is due but the sensors do not have new data for it yet
+	double dWaitDeadlineSec;//monotonic time at which to stop checking for new data and deliver the due sample as failed
+	unsigned int uiNumOverruns;//number of sample intervals that were missed because the reactor was busy or the sensor data was late
+	IMU_REACTOR_CLIENT subscribers[IMU_REACTOR_MAX_SUBSCRIBERS];//callbacks that get every sample
+	int nNumSubscribers;//number of entries in subscribers
+	IMU_REACTOR_CLIENT waiters[IMU_REACTOR_MAX_WAITERS];//callbacks that only get the next sample
+	int nNumWaiters;//number of entries in waiters
+	IMU_DATASAMPLE sample;//the most recent sample from this IMU
+};
+
+class IMUReactor {//event loop that samples any number of IMUs from a single thread. All functions except Stop must be called from the thread that runs the loop (e.g. from inside a callback).
+public:
+	IMUReactor();//constructor
+	~IMUReactor();//destructor
+	bool m_bInitError;//flag is true if the epoll or eventfd descriptors could not be created
+	int AddIMU(IMU *pIMU, unsigned int uiPeriodUs, int nNumToAvg);//start sampling an IMU at a fixed interval, returns a source id (or -1 if there was an error)
+	bool RemoveIMU(int nSourceId);//stop sampling an IMU (pending one-shot requests are completed with bSampleOK = false)
+	bool Subscribe(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData);//call callback for every sample of an IMU
+	bool Unsubscribe(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData);//stop calling callback for the samples of an IMU
+	bool RequestSample(int nSourceId, IMU_SAMPLE_CALLBACK callback, void *pUserData);//call callback once, for the next sample of an IMU
+	int GetFd();//returns the epoll descriptor of the reactor, which becomes readable whenever RunOnce has work to do (so the reactor can be nested in another event loop)
+	int RunOnce(int nTimeoutMs);//wait up to nTimeoutMs for events and handle them, returns the number of events handled (or -1 if there was an error)
+	void Run();//handle events until Stop is called
+	void Stop();//make Run return (can be called from any thread)
+	unsigned int GetNumOverruns(int nSourceId);//returns the number of sample intervals of an IMU that were missed because the reactor was busy or the sensor data was late
+#ifdef IMU_REACTOR_COROUTINES
+	struct SampleAwaiter {//awaitable returned by NextSample
+		IMUReactor *pReactor;//the reactor that delivers the sample
+		int nSourceId;//the IMU that the sample comes from
+		IMU_DATASAMPLE *pSample;//structure that receives a copy of the sample (can be nullptr)
+		bool bSampleOK;//result of the sample
+		std::coroutine_handle<> handle;//the suspended coroutine
+		bool await_ready() { return false; }
+		bool await_suspend(std::coroutine_handle<> h) {//returns false (resume immediately with bSampleOK = false) if the request could not be queued
+			handle = h;
+			bSampleOK = false;
+			return pReactor->RequestSample(nSourceId, OnSample, this);
+		}
+		bool await_resume() { return bSampleOK; }
+		static void OnSample(IMU_DATASAMPLE *pDataSample, bool bOK, void *pUserData) {
+			SampleAwaiter *pAwaiter = (SampleAwaiter *)pUserData;
+			pAwaiter->bSampleOK = bOK;
+			if (bOK&&pAwaiter->pSample!=nullptr) {
+				memcpy(pAwaiter->pSample, pDataSample, sizeof(IMU_DATASAMPLE));
+			}
+			pAwaiter->handle.resume();
+		}
+	};
+	SampleAwaiter NextSample(int nSourceId, IMU_DATASAMPLE *pSample) {//co_await the next sample of an IMU, evaluates to true if the sample was collected successfully
+		return SampleAwaiter{this, nSourceId, pSample, false, nullptr};
+	}
+#endif
+
+private:
+	//data
+	int m_nEpollFd;//epoll descriptor that all timers (and the stop event) are registered with
+	int m_nStopFd;//eventfd used for waking up the loop when Stop is called
+	bool m_bRunning;//true while Run should keep handling events
+	IMU_REACTOR_SOURCE m_sources[IMU_REACTOR_MAX_SOURCES];//the IMUs being sampled
+	char m_szErrMsg[256];//buffer space used for outputting error messages
+
+	//functions
+	IMU_REACTOR_SOURCE * GetSource(int nSourceId);//returns the source with id nSourceId, or nullptr if it is not in use
+	void HandleTimer(int nSourceId);//start or continue a due sample of an IMU whose timer expired, and deliver it to its clients once the sensor data is ready
+	bool ArmTimer(IMU_REACTOR_SOURCE *pSource, double dWhenSec);//set the timer of a source to fire once, at a monotonic time
+	void Dispatch(IMU_REACTOR_SOURCE *pSource, bool bSampleOK);//call the subscribers and one-shot waiters of a source
+};
@@ -1,11 +1,21 @@
 #define IMUTEST_BUILD 1
 
 #include "../RemoteControlTest/IMU.h"
+#include "../RemoteControlTest/IMUAcquisition.h"
+#include "../RemoteControlTest/IMUReactor.h"
+#include "../RemoteControlTest/MagStream.h"
+#include "../RemoteControlTest/VibrationMonitor.h"
+#include "../RemoteControlTest/ShockDetector.h"
+#include "../RemoteControlTest/OrientationSlot.h"
+#include "../RemoteControlTest/SampleBus.h"
+#include "../RemoteControlTest/3DMATH.H"
 #include <pthread.h>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include <unistd.h>
 #include <wiringPi.h>
 #include <memory>
@@ -106,9 +116,1611 @@ bool isHelpFlagPresent(int argc, char* argv[]) {
     return false;
 }
 
+/**
+ * @brief return true if an acquisition timing test flag (-jitter) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if an acquisition timing test flag (-jitter) is present in the array of program arguments
+ * @return false if no acquisition timing test flag is present in the array of program arguments.
+ */
+bool isJitterFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 7) continue;
+        if (strncmp(argv[i], "-jitter", 7) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief return true if a real-time acquisition flag (-rt) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a real-time acquisition flag (-rt) is present in the array of program arguments
+ * @return false if no real-time acquisition flag is present in the array of program arguments.
+ */
+bool isRealTimeFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) != 3) continue;
+        if (strncmp(argv[i], "-rt", 3) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect samples with an IMUAcquisition thread for a period of time, and then print out its wake-up latency and sample interval jitter
+ *
+ * @param pIMU the IMU to collect samples from
+ * @param bRealTime true to run the acquisition thread in real-time mode (SCHED_FIFO, locked memory, pre-faulted stack)
+ * @param nNumSecs the number of seconds to collect samples for
+ * @return true if the timing test ran successfully
+ * @return false if the acquisition thread could not be started
+ */
+bool DoJitterTest(IMU *pIMU, bool bRealTime, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect samples at 50 Hz
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, 1);
+    IMU_RT_CONFIG rtConfig;
+    IMUAcquisition::GetDefaultRTConfig(&rtConfig);
+    if (!acq.Start(bRealTime ? &rtConfig : nullptr)) {
+        return false;
+    }
+    sleep(nNumSecs);
+    acq.Stop();
+    IMU_JITTER_REPORT report;
+    acq.GetJitterReport(&report);
+    printf("%s acquisition, %u samples, %u overruns, %u failed\n", bRealTime ? "Real-time" : "Normal", report.num_samples, report.num_overruns, report.num_failed);
+    printf("wake-up latency (usec): p50 = %.1f, p99 = %.1f, p99.9 = %.1f, max = %.1f\n", report.wakeup_p50, report.wakeup_p99, report.wakeup_p999, report.wakeup_max);
+    printf("interval jitter (usec): p50 = %.1f, p99 = %.1f, p99.9 = %.1f, max = %.1f\n", report.jitter_p50, report.jitter_p99, report.jitter_p999, report.jitter_max);
+    return true;
+}
+
+/**
+ * @brief return true if a duty-cycled sampling flag (-dutycycle) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a duty-cycled sampling flag (-dutycycle) is present in the array of program arguments
+ * @return false if no duty-cycled sampling flag is present in the array of program arguments.
+ */
+bool isDutyCycleFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 10) continue;
+        if (strncmp(argv[i], "-dutycycle", 10) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief get a series of low-power duty-cycled fixes, powering down the sensors between fixes, and print out the orientation and timing of each fix
+ *
+ * @param pIMU the IMU to get fixes from
+ * @param nNumFixes the number of fixes to get
+ * @param nSecsBetweenFixes the time in seconds between fixes
+ * @return true if all of the fixes were obtained successfully
+ * @return false if there was a problem getting one of the fixes
+ */
+bool DoDutyCycleTest(IMU *pIMU, int nNumFixes, int nSecsBetweenFixes) {
+    const int NUM_TO_AVG = 4;//number of samples to average for each fix
+    IMU_DATASAMPLE imu_sample;
+    IMU_FIX_TIMING fixTiming;
+    memset(&imu_sample, 0, sizeof(IMU_DATASAMPLE));
+    if (!pIMU->EnterDutyCycleMode()) {
+        return false;
+    }
+    bool bRetval = true;
+    for (int i = 0; i < nNumFixes; i++) {
+        if (!pIMU->GetDutyCycledFix(&imu_sample, NUM_TO_AVG, &fixTiming)) {
+            printf("Error getting duty-cycled fix #%d.\n", i + 1);
+            bRetval = false;
+            break;
+        }
+        printf("fix %d: roll = %.1f deg, pitch = %.1f deg, heading = %.1f deg, bus time = %.1f ms, active time = %.1f ms\n", i + 1, imu_sample.roll, imu_sample.pitch, imu_sample.heading,
+            fixTiming.bus_time_sec * 1000, fixTiming.active_time_sec * 1000);
+        sleep(nSecsBetweenFixes);
+    }
+    if (!pIMU->ExitDutyCycleMode()) {
+        return false;
+    }
+    return bRetval;
+}
+
+/**
+ * @brief return true if an idle mode flag (-idle) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if an idle mode flag (-idle) is present in the array of program arguments
+ * @return false if no idle mode flag is present in the array of program arguments.
+ */
+bool isIdleFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 5) continue;
+        if (strncmp(argv[i], "-idle", 5) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief run the acquisition thread in idle mode (sampling drops to the idle rate while the IMU is still and returns to the full rate when it moves), and print out the sleep / wake transitions and the number of acc/gyro readings every few seconds
+ *
+ * @param pIMU the IMU to get samples from
+ * @param nNumSecs the number of seconds to run the test for
+ * @return true if the test ran successfully
+ * @return false if idle mode could not be set up or the acquisition thread could not be started
+ */
+bool DoIdleTest(IMU *pIMU, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect samples at 50 Hz while awake
+    const unsigned int IDLE_PERIOD_US = 500000;//sample (and check for motion) at 2 Hz while idle
+    const int REPORT_INTERVAL_SECS = 5;//time between printouts
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, 1);
+    if (!acq.EnableIdleMode(0.0625, 5.0, IDLE_PERIOD_US)) {
+        return false;
+    }
+    if (!acq.Start(nullptr)) {
+        acq.DisableIdleMode();
+        return false;
+    }
+    IMU_IDLE_REPORT report;
+    IMU_SAMPLE_STATS stats;
+    pIMU->GetSampleStats(&stats);
+    unsigned int uiLastNumReads = stats.acc_gyro_reads;
+    for (int i = 0; i < nNumSecs; i += REPORT_INTERVAL_SECS) {
+        sleep(REPORT_INTERVAL_SECS);
+        acq.GetIdleReport(&report);
+        pIMU->GetSampleStats(&stats);
+        printf("%d sec: %s, %u acc/gyro readings, %u sleeps, %u wakes, %.1f sec idle, wake latency = %.1f usec (max = %.1f usec)\n", i + REPORT_INTERVAL_SECS,
+            report.idle ? "idle" : "sampling", stats.acc_gyro_reads - uiLastNumReads, report.num_sleeps, report.num_wakes, report.idle_time_sec, report.last_wake_latency_us, report.max_wake_latency_us);
+        uiLastNumReads = stats.acc_gyro_reads;
+    }
+    acq.Stop();
+    IMU_JITTER_REPORT jitterReport;
+    acq.GetJitterReport(&jitterReport);
+    printf("%u samples collected, %u failed\n", jitterReport.num_samples, jitterReport.num_failed);
+    return acq.DisableIdleMode();
+}
+
+/**
+ * @brief return true if a high-rate magnetometer flag (-fastmag) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a high-rate magnetometer flag (-fastmag) is present in the array of program arguments
+ * @return false if no high-rate magnetometer flag is present in the array of program arguments.
+ */
+bool isFastMagFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 8) continue;
+        if (strncmp(argv[i], "-fastmag", 8) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect magnetometer readings at 1 kHz from a high-rate magnetometer stream, while fused samples are collected at 50 Hz on the same bus, and print out the achieved rates
+ *
+ * @param pIMU the IMU to get readings from
+ * @param nNumSecs the number of seconds to collect readings for
+ * @return true if the stream ran successfully
+ * @return false if the stream could not be started
+ */
+bool DoFastMagTest(IMU *pIMU, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect fused samples at 50 Hz alongside the magnetometer stream
+    MagStream magStream(pIMU, MAGSTREAM_DEFAULT_CAPACITY);
+    if (!magStream.Start(MAG_RATE_1000HZ)) {
+        return false;
+    }
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, 1);
+    bool bAcqStarted = acq.Start(nullptr);
+    IMU_MAG_SAMPLE magSample;
+    unsigned int uiNumReadings = 0;
+    double dFirstTime = 0.0, dLastTime = 0.0;
+    for (int i = 0; i < nNumSecs; i++) {
+        sleep(1);
+        while (magStream.GetNext(&magSample)) {
+            if (uiNumReadings == 0) dFirstTime = magSample.sample_time_sec;
+            dLastTime = magSample.sample_time_sec;
+            uiNumReadings++;
+        }
+    }
+    if (bAcqStarted) acq.Stop();
+    magStream.Stop();
+    double dRate = (dLastTime > dFirstTime) ? (uiNumReadings - 1) / (dLastTime - dFirstTime) : 0.0;
+    printf("%u magnetometer readings (%.1f Hz), %llu overruns, %llu dropped\n", uiNumReadings, dRate, magStream.GetNumOverruns(), magStream.GetNumDropped());
+    if (bAcqStarted) {
+        IMU_JITTER_REPORT report;
+        acq.GetJitterReport(&report);
+        printf("fused samples: %u collected, %u failed, %u overruns\n", report.num_samples, report.num_failed, report.num_overruns);
+    }
+    return true;
+}
+
+/**
+ * @brief return true if a magnetometer fast-read flag (-fastread) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a magnetometer fast-read flag (-fastread) is present in the array of program arguments
+ * @return false if no magnetometer fast-read flag is present in the array of program arguments.
+ */
+bool isFastReadFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 9) continue;
+        if (strncmp(argv[i], "-fastread", 9) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MeasureMagProfile(IMU *pIMU, IMU_DATASAMPLE *pSamples, int nNumSamples, bool bFastRead) {//collect nNumSamples samples with the full or reduced-precision magnetometer profile, and print out the heading noise and magnetometer bus load
+    const int BATCH_SIZE = 16;//number of samples to collect with each call to IMU::GetSamples
+    const double BATCH_TIMEOUT_SEC = 1.0;
+    const double RAD_TO_DEG = 57.29577951308232;
+    if (!pIMU->SetMagFastRead(bFastRead)) {
+        return false;
+    }
+    struct timespec startTime, endTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    int nNumCollected = 0;
+    while (nNumCollected < nNumSamples) {
+        int nBatch = (nNumSamples - nNumCollected < BATCH_SIZE) ? nNumSamples - nNumCollected : BATCH_SIZE;
+        int nNumOK = pIMU->GetSamples(&pSamples[nNumCollected], nBatch, BATCH_TIMEOUT_SEC);
+        if (nNumOK <= 0) {
+            break;
+        }
+        nNumCollected += nNumOK;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    if (nNumCollected < 2) {
+        printf("Error, only %d samples were collected.\n", nNumCollected);
+        return false;
+    }
+    //circular standard deviation of the heading, and standard deviation of each magnetometer axis
+    double dSumSin = 0.0, dSumCos = 0.0;
+    double dMagSum[3] = {0.0, 0.0, 0.0}, dMagSumSq[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < nNumCollected; i++) {
+        dSumSin += sin(pSamples[i].heading / RAD_TO_DEG);
+        dSumCos += cos(pSamples[i].heading / RAD_TO_DEG);
+        for (int j = 0; j < 3; j++) {
+            dMagSum[j] += pSamples[i].mag_data[j];
+            dMagSumSq[j] += pSamples[i].mag_data[j] * pSamples[i].mag_data[j];
+        }
+    }
+    double dR = sqrt(dSumSin * dSumSin + dSumCos * dSumCos) / nNumCollected;
+    double dHeadingNoise = (dR < 1.0) ? sqrt(-2.0 * log(dR)) * RAD_TO_DEG : 0.0;
+    double dMagNoise[3];
+    for (int j = 0; j < 3; j++) {
+        double dMean = dMagSum[j] / nNumCollected;
+        double dVar = dMagSumSq[j] / nNumCollected - dMean * dMean;
+        dMagNoise[j] = (dVar > 0.0) ? sqrt(dVar) : 0.0;
+    }
+    double dElapsedSec = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1.0e9;
+    int nMagBytes = bFastRead ? MAG_FAST_READ_FRAME_BYTES : MAG_FRAME_BYTES + 2;//GetSamples reads the temperature along with each full-precision reading
+    printf("%s: %d samples in %.3f sec, %d magnetometer bytes per reading, heading noise = %.3f deg, mag noise (x, y, z) = %.5f, %.5f, %.5f\n",
+        bFastRead ? "fast read (8-bit)" : "full precision (16-bit)", nNumCollected, dElapsedSec, nMagBytes, dHeadingNoise, dMagNoise[0], dMagNoise[1], dMagNoise[2]);
+    return true;
+}
+
+/**
+ * @brief collect samples with the full-precision magnetometer profile and then with the reduced-precision (FAST_READ) profile, and print out the heading noise vs. bus load of each. The IMU should be kept still during the test.
+ *
+ * @param pIMU the IMU to get samples from
+ * @param nNumSamples the number of samples to collect with each profile
+ * @return true if both profiles were measured successfully
+ * @return false if there was a problem collecting samples or switching profiles
+ */
+bool DoFastReadTest(IMU *pIMU, int nNumSamples) {
+    std::unique_ptr<IMU_DATASAMPLE[]> samples(new IMU_DATASAMPLE[nNumSamples]);
+    memset(samples.get(), 0, nNumSamples * sizeof(IMU_DATASAMPLE));
+    bool bFullOK = MeasureMagProfile(pIMU, samples.get(), nNumSamples, false);
+    bool bFastOK = bFullOK && MeasureMagProfile(pIMU, samples.get(), nNumSamples, true);
+    pIMU->SetMagFastRead(false);
+    return bFullOK && bFastOK;
+}
+
+/**
+ * @brief return true if a barometer flag (-baro) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a barometer flag (-baro) is present in the array of program arguments
+ * @return false if no barometer flag is present in the array of program arguments.
+ */
+bool isBaroFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 5) continue;
+        if (strncmp(argv[i], "-baro", 5) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect samples at 50 Hz with an IMUAcquisition thread, and print out the pressure, temperature, and pressure altitude that get collected along with them once per second
+ *
+ * @param pIMU the IMU to collect samples from
+ * @param nNumSecs the number of seconds to collect samples for
+ * @return true if pressure readings were collected
+ * @return false if the pressure sensor is not available, the acquisition thread could not be started, or no pressure readings were collected
+ */
+bool DoBaroTest(IMU *pIMU, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect samples at 50 Hz
+    if (!pIMU->m_bPressureInitialized_OK) {
+        printf("The pressure sensor was not initialized.\n");
+        return false;
+    }
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, 1);
+    if (!acq.Start(nullptr)) {
+        return false;
+    }
+    IMU_PRESSURE_SAMPLE pressureSample;
+    bool bGotPressure = false;
+    for (int i = 0; i < nNumSecs; i++) {
+        sleep(1);
+        if (pIMU->GetLastPressureSample(&pressureSample)) {
+            bGotPressure = true;
+            printf("t = %.3f sec, pressure = %.2f hPa, temperature = %.2f deg C, altitude = %.2f m%s\n", pressureSample.sample_time_sec, pressureSample.pressure,
+                pressureSample.temperature, pressureSample.altitude, (pressureSample.quality_flags&IMU_QUALITY_PRESS_OVERRUN)>0 ? " (overrun)" : "");
+        }
+    }
+    acq.Stop();
+    IMU_SAMPLE_STATS stats;
+    pIMU->GetSampleStats(&stats);
+    printf("%u pressure readings, %u overruns, %u failed\n", stats.pressure_reads, stats.pressure_missed, stats.pressure_failed);
+    return bGotPressure;
+}
+
+/**
+ * @brief return true if a vibration analysis flag (-vibration) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a vibration analysis flag (-vibration) is present in the array of program arguments
+ * @return false if no vibration analysis flag is present in the array of program arguments.
+ */
+bool isVibrationFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 10) continue;
+        if (strncmp(argv[i], "-vibration", 10) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect acc/gyro samples and measure how much the pitch and roll computed from their accelerometer data wander
+ *
+ * @param pIMU the IMU to get samples from
+ * @param nNumSamples the number of samples to collect
+ * @return double the combined standard deviation of pitch and roll in degrees, or -1 if samples could not be collected
+ */
+double GetTiltNoise(IMU *pIMU, int nNumSamples) {
+    IMU_DATASAMPLE sample;
+    double dSum[2] = {0.0, 0.0};
+    double dSumSq[2] = {0.0, 0.0};
+    memset(&sample, 0, sizeof(IMU_DATASAMPLE));
+    for (int i = 0; i < nNumSamples; i++) {
+        if (!pIMU->GetAccGyroSample(&sample, 1)) {
+            return -1.0;
+        }
+        double dAccYZ = sqrt(sample.acc_data[1] * sample.acc_data[1] + sample.acc_data[2] * sample.acc_data[2]);
+        double dTilt[2];
+        dTilt[0] = atan2(sample.acc_data[0], dAccYZ) * 180.0 / M_PI;//pitch
+        dTilt[1] = atan2(sample.acc_data[1], sample.acc_data[2]) * 180.0 / M_PI;//roll
+        for (int j = 0; j < 2; j++) {
+            dSum[j] += dTilt[j];
+            dSumSq[j] += dTilt[j] * dTilt[j];
+        }
+    }
+    double dVariance = 0.0;
+    for (int j = 0; j < 2; j++) {
+        double dMean = dSum[j] / nNumSamples;
+        dVariance += dSumSq[j] / nNumSamples - dMean * dMean;
+    }
+    return dVariance > 0.0 ? sqrt(dVariance) : 0.0;
+}
+
+/**
+ * @brief check that turning on the accelerometer stream does not make the pitch and roll of GetSample noisier (each sample should get the average of the 1.66 kHz readings since the previous sample, not a single wide-bandwidth reading), then run the vibration monitor (1.66 kHz accelerometer stream and FFT band energies) while fused samples are collected at 50 Hz, and print out each published spectrum
+ *
+ * @param pIMU the IMU to get readings from
+ * @param nNumSecs the number of seconds to run the vibration monitor for
+ * @return true if the tilt noise check passed and spectra were published
+ * @return false if the tilt noise check failed, the vibration monitor could not be started, or no spectra were published
+ */
+bool DoVibrationTest(IMU *pIMU, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect fused samples at 50 Hz alongside the vibration monitor
+    const int NUM_TILT_SAMPLES = 200;//number of acc/gyro samples used for measuring tilt noise with the stream off and on
+    const double MAX_TILT_NOISE_RATIO = 2.0;//single 400 Hz bandwidth readings would be about 2.8 times noisier than the 50 Hz bandwidth readings of the normal 104 Hz mode
+    double dNoiseOff = GetTiltNoise(pIMU, NUM_TILT_SAMPLES);
+    if (dNoiseOff < 0.0 || !pIMU->EnableAccStream()) {
+        return false;
+    }
+    double dNoiseOn = GetTiltNoise(pIMU, NUM_TILT_SAMPLES);
+    pIMU->DisableAccStream();
+    if (dNoiseOn < 0.0) {
+        return false;
+    }
+    printf("tilt noise: %.4f deg with the stream off, %.4f deg with the stream on\n", dNoiseOff, dNoiseOn);
+    if (dNoiseOn > MAX_TILT_NOISE_RATIO * dNoiseOff && dNoiseOn > 0.01) {
+        printf("Error, the accelerometer stream is leaking into pitch and roll.\n");
+        return false;
+    }
+    VibrationMonitor vibMonitor(pIMU, 1.0);
+    if (!vibMonitor.Start()) {
+        return false;
+    }
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, 1);
+    bool bAcqStarted = acq.Start(nullptr);
+    VIB_SPECTRUM spectrum;
+    unsigned int uiLastSpectrum = 0;
+    for (int i = 0; i < nNumSecs; i++) {
+        sleep(1);
+        unsigned int uiNumSpectra = vibMonitor.GetNumSpectra();
+        if (uiNumSpectra == uiLastSpectrum || !vibMonitor.GetSpectrum(&spectrum)) continue;
+        uiLastSpectrum = uiNumSpectra;
+        printf("%u FFTs, %u overruns, total = %.4f G rms, peak at %.1f Hz\n", spectrum.num_ffts, spectrum.num_overruns, spectrum.total_rms, spectrum.peak_hz);
+        for (unsigned int j = 0; j < spectrum.num_bands; j++) {
+            printf("  %6.1f - %6.1f Hz: %.4f G rms\n", spectrum.band_low_hz[j], spectrum.band_high_hz[j], spectrum.band_rms[j]);
+        }
+    }
+    if (bAcqStarted) acq.Stop();
+    vibMonitor.Stop();
+    if (bAcqStarted) {
+        IMU_JITTER_REPORT report;
+        acq.GetJitterReport(&report);
+        printf("fused samples: %u collected, %u failed, %u overruns\n", report.num_samples, report.num_failed, report.num_overruns);
+    }
+    return uiLastSpectrum > 0;
+}
+
+/**
+ * @brief return true if a shock detection flag (-shock) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a shock detection flag (-shock) is present in the array of program arguments
+ * @return false if no shock detection flag is present in the array of program arguments.
+ */
+bool isShockFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 6) continue;
+        if (strncmp(argv[i], "-shock", 6) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect 10 Hz samples (each averaged from the LSM6DS33 FIFO, so that every 104 Hz reading gets checked) with the shock detector attached, and print out each shock event as it is written to a file in the current directory
+ *
+ * @param pIMU the IMU to collect samples from
+ * @param nNumSecs the number of seconds to watch for shock events
+ * @return true if the shock detector ran successfully
+ * @return false if FIFO averaging, the shock detector, or the acquisition thread could not be started
+ */
+bool DoShockTest(IMU *pIMU, int nNumSecs) {
+    const unsigned int SAMPLE_PERIOD_US = 100000;//collect samples at 10 Hz
+    const int NUM_TO_AVG = 10;//average about 10 readings per sample at the 104 Hz acc/gyro rate
+    SHOCK_CONFIG shockConfig;
+    ShockDetector::GetDefaultConfig(&shockConfig);
+    ShockDetector shockDetector(pIMU, &shockConfig, ".");
+    if (!pIMU->EnableFifoAveraging()) {
+        return false;
+    }
+    if (!shockDetector.Start()) {
+        pIMU->DisableFifoAveraging();
+        return false;
+    }
+    IMUAcquisition acq(pIMU, nullptr, SAMPLE_PERIOD_US, NUM_TO_AVG);
+    if (!acq.Start(nullptr)) {
+        shockDetector.Stop();
+        pIMU->DisableFifoAveraging();
+        return false;
+    }
+    printf("Watching for shock events for %d seconds...\n", nNumSecs);
+    unsigned int uiLastEvent = 0;
+    SHOCK_EVENT_INFO eventInfo;
+    for (int i = 0; i < nNumSecs; i++) {
+        sleep(1);
+        if (shockDetector.GetLastEvent(&eventInfo) && eventInfo.event_num != uiLastEvent) {
+            uiLastEvent = eventInfo.event_num;
+            printf("event %u: peak acc = %.2f G, peak jerk = %.1f G/sec, peak rate = %.1f deg/sec, %u clipped readings, %u readings\n", eventInfo.event_num, eventInfo.peak_acc_g,
+                eventInfo.peak_jerk_g_per_sec, eventInfo.peak_gyro_dps, eventInfo.num_saturated, eventInfo.num_readings);
+        }
+    }
+    acq.Stop();
+    shockDetector.Stop();
+    pIMU->DisableFifoAveraging();
+    printf("%u events, %u written, %u dropped\n", shockDetector.GetNumEvents(), shockDetector.GetNumWritten(), shockDetector.GetNumDropped());
+    return true;
+}
+
+/**
+ * @brief return true if an initialization timing flag (-inittime) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if an initialization timing flag (-inittime) is present in the array of program arguments
+ * @return false if no initialization timing flag is present in the array of program arguments.
+ */
+bool isInitTimeFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 9) continue;
+        if (strncmp(argv[i], "-inittime", 9) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief collect the first sample from a newly constructed IMU, and print out the time taken by each phase of construction and the time until the first sample
+ *
+ * @param pIMU the IMU to collect the sample from (should not have been sampled yet)
+ * @return true if a sample was collected
+ * @return false if no sample could be collected
+ */
+bool DoInitTimeTest(IMU *pIMU) {
+    const int MAX_ATTEMPTS = 10;//number of times to try getting the first sample
+    IMU_DATASAMPLE sample;
+    bool bSampleOK = false;
+    for (int i = 0; i < MAX_ATTEMPTS && !bSampleOK; i++) {
+        bSampleOK = pIMU->GetSample(&sample, 1);
+    }
+    if (!bSampleOK) {
+        return false;
+    }
+    IMU_INIT_TIMING timing;
+    pIMU->GetInitTiming(&timing);
+    printf("open I2C:           %8.2f ms\n", timing.open_ms);
+    printf("acc/gyro config:    %8.2f ms\n", timing.acc_gyro_config_ms);
+    printf("pressure config:    %8.2f ms\n", timing.pressure_config_ms);
+    printf("calibration parse:  %8.2f ms (in parallel, %.2f ms spent waiting for it)\n", timing.cal_parse_ms, timing.cal_wait_ms);
+    printf("mag config + cal:   %8.2f ms\n", timing.mag_config_ms);
+    printf("constructor total:  %8.2f ms\n", timing.total_ms);
+    printf("first sample:       %8.2f ms after construction started (%.1f acc/gyro ODR periods)\n", timing.first_sample_ms, timing.first_sample_ms * ACC_GYRO_ODR_HZ / 1000);
+    return true;
+}
+
+/**
+ * @brief return true if a fusion benchmark flag (-fusionbench) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a fusion benchmark flag (-fusionbench) is present in the array of program arguments
+ * @return false if no fusion benchmark flag is present in the array of program arguments.
+ */
+bool isFusionBenchFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 12) continue;
+        if (strncmp(argv[i], "-fusionbench", 12) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct LEGACY_FUSION_STATE {//state of the quaternion2 based fusion calculation that FusionKernel replaced
+    quaternion2 *pQuat;//current orientation (allocated on the first update)
+    double dLastSampleTime;//time of the last update in seconds
+    int nGyroAxisOrder;//order that the gyro rotations are applied in
+};
+
+void LegacyComputeOrientation(LEGACY_FUSION_STATE *pState, IMU_DATASAMPLE *pSample) {//the quaternion2 based fusion calculation that FusionKernel replaced, used as the reference for the fusion benchmark
+    const double RAD_TO_DEG = 57.29578;
+    const double DEG_TO_RAD = 0.01745329251994;
+    const double SLERP_FACTOR = 0.97;
+    double dPitchAngleRad = asin(-pSample->acc_data[0]);
+    double dCosFactor = cos(dPitchAngleRad);
+    double dRollAngleRad = 0.0;
+    if (dCosFactor != 0.0) {
+        dRollAngleRad = asin(pSample->acc_data[1] / dCosFactor);
+    }
+    double *mag_data = pSample->mag_data;
+    double mx2 = mag_data[0]*cos(dPitchAngleRad) - mag_data[2]*sin(dPitchAngleRad);
+    double my2 = mag_data[0]*sin(dPitchAngleRad)*sin(dRollAngleRad) + mag_data[1]*cos(dRollAngleRad) + mag_data[2]*cos(dPitchAngleRad)*sin(dRollAngleRad);
+    double dHeading = atan2(my2, mx2)*RAD_TO_DEG;
+    if (dHeading < 0) dHeading += 360;
+    else if (dHeading > 360) dHeading -= 360;
+    quaternion2 accMagQuat(-dRollAngleRad*RAD_TO_DEG, -dPitchAngleRad*RAD_TO_DEG, -dHeading);
+    if (pState->pQuat == nullptr) {
+        pState->pQuat = new quaternion2(accMagQuat);
+    }
+    else if (pState->dLastSampleTime == 0.0) {
+        *pState->pQuat = accMagQuat;
+    }
+    else {
+        vector3d vx(1,0,0);
+        vector3d vy(0,1,0);
+        vector3d vz(0,0,1);
+        double dTimeElapsedSec = pSample->sample_time_sec - pState->dLastSampleTime;
+        quaternion2 qx(vx, -pSample->angular_rate[0]*dTimeElapsedSec*DEG_TO_RAD);
+        quaternion2 qz(vz, -pSample->angular_rate[1]*dTimeElapsedSec*DEG_TO_RAD);
+        quaternion2 qy(vy, pSample->angular_rate[2]*dTimeElapsedSec*DEG_TO_RAD);
+        quaternion2 incQuat;
+        if (pState->nGyroAxisOrder == 0) {
+            incQuat = (qx*qy)*qz;
+        }
+        else if (pState->nGyroAxisOrder == 1) {
+            incQuat = (qy*qz)*qx;
+        }
+        else {
+            incQuat = (qz*qz)*qy;
+        }
+        quaternion2 rotatedQuat = *pState->pQuat * incQuat;
+        rotatedQuat.slerp(accMagQuat, 1.0 - SLERP_FACTOR);
+        *pState->pQuat = rotatedQuat;
+        pState->nGyroAxisOrder = (pState->nGyroAxisOrder + 1) % 3;
+    }
+    pState->dLastSampleTime = pSample->sample_time_sec;
+    tmatrix mat = pState->pQuat->getRotMatrix();
+    mat.getAMOSRPY(pSample->roll, pSample->pitch, pSample->heading);
+}
+
+double GaussianNoise(double dStdDev) {//normally distributed random number with a mean of 0 and a standard deviation of dStdDev
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return dStdDev * sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+void MakeTruthSamples(IMU_DATASAMPLE *pSamples, IMU_DATASAMPLE *pTruth, int nNumSamples, bool bNoisy) {//fill pSamples with a synthetic 104 Hz run of acc/mag/gyro data from a swaying and turning IMU, and pTruth (if it is not nullptr) with its true roll, pitch, and heading
+    //bNoisy = true to add sensor noise and a constant gyro bias to the data
+    const double DEG_TO_RAD = 0.01745329251994;
+    const double DIP_ANGLE = 60.0;//magnetic dip angle in degrees
+    const double ACC_NOISE = bNoisy ? 0.005 : 0.0;//acc noise in G
+    const double MAG_NOISE = bNoisy ? 0.005 : 0.0;//mag noise in normalized units
+    const double GYRO_NOISE = bNoisy ? 0.1 : 0.0;//gyro noise in deg/sec
+    const double GYRO_BIAS[3] = {bNoisy ? 0.5 : 0.0, bNoisy ? -0.3 : 0.0, bNoisy ? 0.4 : 0.0};//gyro bias in deg/sec
+    memset(pSamples, 0, nNumSamples * sizeof(IMU_DATASAMPLE));
+    srand(1);
+    double magNED[3] = {cos(DIP_ANGLE * DEG_TO_RAD), 0.0, sin(DIP_ANGLE * DEG_TO_RAD)};//earth field in north, east, down axes
+    for (int i = 0; i < nNumSamples; i++) {
+        double t = (i + 1) / ACC_GYRO_ODR_HZ;
+        //true yaw, pitch, and roll (standard right-side-down roll) in radians, and their rates
+        double psi = 30.0 * t * DEG_TO_RAD;
+        double theta = 10.0 * sin(2 * M_PI * 0.13 * t) * DEG_TO_RAD;
+        double phi = 20.0 * sin(2 * M_PI * 0.2 * t) * DEG_TO_RAD;
+        double psiDot = 30.0 * DEG_TO_RAD;
+        double thetaDot = 10.0 * 2 * M_PI * 0.13 * cos(2 * M_PI * 0.13 * t) * DEG_TO_RAD;
+        double phiDot = 20.0 * 2 * M_PI * 0.2 * cos(2 * M_PI * 0.2 * t) * DEG_TO_RAD;
+        double cps = cos(psi), sps = sin(psi), cth = cos(theta), sth = sin(theta), cph = cos(phi), sph = sin(phi);
+        //rows of the world (north, east, down) to body (forward, right, down) rotation matrix
+        double R[3][3] = {{cth * cps, cth * sps, -sth},
+            {sph * sth * cps - cph * sps, sph * sth * sps + cph * cps, sph * cth},
+            {cph * sth * cps + sph * sps, cph * sth * sps - sph * cps, cph * cth}};
+        double magBody[3];
+        for (int j = 0; j < 3; j++) {
+            magBody[j] = R[j][0] * magNED[0] + R[j][1] * magNED[1] + R[j][2] * magNED[2];
+        }
+        double p = phiDot - psiDot * sth;//body rates in rad/sec
+        double q = thetaDot * cph + psiDot * cth * sph;
+        double r = -thetaDot * sph + psiDot * cth * cph;
+        //map forward-right-down axes onto the sensor axes of the IMU_DATASAMPLE vectors
+        IMU_DATASAMPLE *pSample = &pSamples[i];
+        pSample->sample_time_sec = t;
+        pSample->acc_data[0] = -sth + GaussianNoise(ACC_NOISE);
+        pSample->acc_data[1] = -sph * cth + GaussianNoise(ACC_NOISE);
+        pSample->acc_data[2] = cph * cth + GaussianNoise(ACC_NOISE);
+        memcpy(pSample->specific_force, pSample->acc_data, 3 * sizeof(double));//(the IMU only turns and sways in place, so the specific force is just gravity)
+        pSample->mag_data[0] = magBody[0] + GaussianNoise(MAG_NOISE);
+        pSample->mag_data[1] = -magBody[1] + GaussianNoise(MAG_NOISE);
+        pSample->mag_data[2] = -magBody[2] + GaussianNoise(MAG_NOISE);
+        pSample->angular_rate[0] = -p / DEG_TO_RAD + GYRO_BIAS[0] + GaussianNoise(GYRO_NOISE);
+        pSample->angular_rate[1] = q / DEG_TO_RAD + GYRO_BIAS[1] + GaussianNoise(GYRO_NOISE);
+        pSample->angular_rate[2] = -r / DEG_TO_RAD + GYRO_BIAS[2] + GaussianNoise(GYRO_NOISE);
+        if (pTruth != nullptr) {
+            memset(&pTruth[i], 0, sizeof(IMU_DATASAMPLE));
+            pTruth[i].sample_time_sec = t;
+            pTruth[i].roll = -phi / DEG_TO_RAD;
+            pTruth[i].pitch = theta / DEG_TO_RAD;
+            pTruth[i].heading = fmod(psi / DEG_TO_RAD, 360.0);
+        }
+    }
+}
+
+double AngleDiff(double dAngle1, double dAngle2) {//absolute difference between two angles in degrees, allowing for wrap-around
+    double dDiff = fabs(dAngle1 - dAngle2);
+    if (dDiff > 180) dDiff = 360 - dDiff;
+    return dDiff;
+}
+
+double QuatAngleDiff(const FUSION_QUAT &q1, const FUSION_QUAT &q2) {//angle in degrees of the rotation between two orientation quaternions
+    //(from the vector and scalar parts of conj(q1) * q2, which keeps its precision for tiny angles, unlike the acos of the dot product)
+    FUSION_QUAT conj1 = {q1.w, -q1.x, -q1.y, -q1.z};
+    FUSION_QUAT diff;
+    FusionKernel::Multiply(conj1, q2, diff);
+    return 2.0 * atan2(sqrt(diff.x * diff.x + diff.y * diff.y + diff.z * diff.z), fabs(diff.w)) * 57.295779513082;
+}
+
+void LegacyAMOSRPY(const FUSION_QUAT &q, double &roll, double &pitch, double &yaw) {//AMOS roll, pitch, yaw angles of a quaternion the way ComputeOrientation used to get them (quaternion2 rotation matrix, then OrientationMath::MatrixToEuler), used as the reference for the fusion benchmark
+    quaternion2 quat(q.w, q.x, q.y, q.z);
+    tmatrix mat = quat.getRotMatrix();
+    mat.getAMOSRPY(roll, pitch, yaw);
+}
+
+double GyroIntegrationError(int nReadingsPerCall) {//angle in degrees between the orientation from FusionKernel::Propagate and the exact orientation, after 10 seconds of constant rotation about a skewed axis at 104 Hz
+    //nReadingsPerCall = number of gyro readings passed to each Propagate call
+    const int NUM_READINGS = 1040;
+    const double RATE[3] = {40.0, -25.0, 60.0};//angular rate in deg/sec (angular_rate axes)
+    const double DEG_TO_RAD = 0.01745329251994;
+    FUSION_STATE fusion;
+    FusionKernel::Reset(&fusion);
+    double acc_data[3] = {0.0, 0.0, 1.0};
+    double mag_data[3] = {0.8, 0.0, 0.6};
+    double zero_rate[3] = {0.0, 0.0, 0.0};
+    double roll, pitch, heading;
+    FusionKernel::Update(&fusion, acc_data, mag_data, zero_rate, 1.0, roll, pitch, heading);
+    FUSION_QUAT startQuat = fusion.q;
+    double rates[3 * NUM_READINGS];
+    double times[NUM_READINGS];
+    for (int i = 0; i < NUM_READINGS; i++) {
+        memcpy(&rates[3 * i], RATE, 3 * sizeof(double));
+        times[i] = 1.0 + (i + 1) / ACC_GYRO_ODR_HZ;
+    }
+    for (int i = 0; i < NUM_READINGS; i += nReadingsPerCall) {
+        FusionKernel::Propagate(&fusion, &rates[3 * i], &times[i], nReadingsPerCall < NUM_READINGS - i ? nReadingsPerCall : NUM_READINGS - i);
+    }
+    //exact result: the start orientation rotated about the fixed axis by the total angle (AMOS x, y, z rotation vector, as used by FUSION_ENGINE_SLERP)
+    double dTime = NUM_READINGS / ACC_GYRO_ODR_HZ;
+    double rot_vec[3] = {-RATE[0] * DEG_TO_RAD * dTime, RATE[2] * DEG_TO_RAD * dTime, -RATE[1] * DEG_TO_RAD * dTime};
+    double dAngle = sqrt(rot_vec[0] * rot_vec[0] + rot_vec[1] * rot_vec[1] + rot_vec[2] * rot_vec[2]);
+    FUSION_QUAT rotQuat = {cos(dAngle / 2), sin(dAngle / 2) * rot_vec[0] / dAngle, sin(dAngle / 2) * rot_vec[1] / dAngle, sin(dAngle / 2) * rot_vec[2] / dAngle};
+    FUSION_QUAT exactQuat, diffQuat;
+    FusionKernel::Multiply(startQuat, rotQuat, exactQuat);
+    exactQuat.x = -exactQuat.x;//(conjugate)
+    exactQuat.y = -exactQuat.y;
+    exactQuat.z = -exactQuat.z;
+    FusionKernel::Multiply(exactQuat, fusion.q, diffQuat);
+    double dSinHalfAngle = sqrt(diffQuat.x * diffQuat.x + diffQuat.y * diffQuat.y + diffQuat.z * diffQuat.z);
+    return 2 * asin(fmin(dSinHalfAngle, 1.0)) / DEG_TO_RAD;
+}
+
+/**
+ * @brief time the fusion kernel used by IMU::ComputeOrientation against the quaternion2 based calculation that it replaced, on synthetic data (no IMU is needed), and print out the time per update of each and the largest difference between their results (which differ by design in the gyro step: the kernel integrates the whole rotation vector exactly, while quaternion2 applied three single-axis rotations in a cycling order). Also checks the kernel gyro integration against the exact rotation, one reading at a time and in batches of 8 readings per FusionKernel::Propagate call, and times the batched propagation. Finally, times the angles computed straight from the quaternion components against the rotation matrix and Euler angle calculation that they replaced, and the updates that only keep the quaternion.
+ *
+ * @param nNumUpdates the number of updates to time for each calculation
+ * @return true if the kernel gyro integration is exact, and the angles from the quaternion components match the rotation matrix calculation
+ * @return false if the kernel gyro integration differs from the exact rotation, or the angles differ from the rotation matrix calculation, by more than a tiny fraction of a degree
+ */
+bool DoFusionBenchmark(int nNumUpdates) {
+    const int NUM_SAMPLES = 4096;//length of the synthetic data run (about 39 seconds at 104 Hz), repeated as needed
+    const int READINGS_PER_BATCH = 8;//gyro readings propagated for each acc/mag correction in the batched timing
+    const double MAX_GYRO_ERROR = 1e-6;//largest allowed difference from the exact rotation in degrees
+    const double MAX_ANGLE_DIFF = 1e-5;//largest allowed difference between the angles from the quaternion components and from the rotation matrix in degrees
+    std::unique_ptr<IMU_DATASAMPLE[]> samples(new IMU_DATASAMPLE[NUM_SAMPLES]);
+    std::unique_ptr<IMU_DATASAMPLE[]> legacySamples(new IMU_DATASAMPLE[NUM_SAMPLES]);
+    MakeTruthSamples(samples.get(), nullptr, NUM_SAMPLES, false);
+    memcpy(legacySamples.get(), samples.get(), NUM_SAMPLES * sizeof(IMU_DATASAMPLE));
+    //compare the results over one pass of the data
+    FUSION_STATE fusion;
+    FusionKernel::Reset(&fusion);
+    LEGACY_FUSION_STATE legacy;
+    memset(&legacy, 0, sizeof(LEGACY_FUSION_STATE));
+    double dMaxDiff = 0.0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        IMU_DATASAMPLE *pSample = &samples[i];
+        FusionKernel::Update(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec, pSample->roll, pSample->pitch, pSample->heading);
+        LegacyComputeOrientation(&legacy, &legacySamples[i]);
+        dMaxDiff = fmax(dMaxDiff, AngleDiff(pSample->roll, legacySamples[i].roll));
+        dMaxDiff = fmax(dMaxDiff, AngleDiff(pSample->pitch, legacySamples[i].pitch));
+        dMaxDiff = fmax(dMaxDiff, AngleDiff(pSample->heading, legacySamples[i].heading));
+    }
+    //time each calculation (the sample times keep increasing from one pass of the data to the next, so that the gyro integration sees a steady 104 Hz)
+    struct timespec startTime, endTime;
+    double dTimeOffset = 0.0;
+    FusionKernel::Reset(&fusion);
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumUpdates; i++) {
+        IMU_DATASAMPLE *pSample = &samples[i % NUM_SAMPLES];
+        if (i > 0 && i % NUM_SAMPLES == 0) dTimeOffset += NUM_SAMPLES / ACC_GYRO_ODR_HZ;
+        FusionKernel::Update(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec + dTimeOffset, pSample->roll, pSample->pitch, pSample->heading);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dKernelNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / nNumUpdates;
+    volatile double dSink = samples[0].heading;//keeps the compiler from dropping the timed loops
+    dTimeOffset = 0.0;
+    legacy.dLastSampleTime = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumUpdates; i++) {
+        IMU_DATASAMPLE *pSample = &legacySamples[i % NUM_SAMPLES];
+        if (i > 0 && i % NUM_SAMPLES == 0) dTimeOffset += NUM_SAMPLES / ACC_GYRO_ODR_HZ;
+        pSample->sample_time_sec = samples[i % NUM_SAMPLES].sample_time_sec + dTimeOffset;
+        LegacyComputeOrientation(&legacy, pSample);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dLegacyNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / nNumUpdates;
+    dSink = legacySamples[0].heading;
+    delete legacy.pQuat;
+    printf("%d updates: fusion kernel %.0f ns/update, quaternion2 calculation %.0f ns/update (%.1fx), max difference %.2f deg\n", nNumUpdates, dKernelNs, dLegacyNs, dLegacyNs / dKernelNs, dMaxDiff);
+    //time batched propagation: READINGS_PER_BATCH gyro readings per Propagate call, each followed by one acc/mag correction
+    std::unique_ptr<double[]> rates(new double[3 * NUM_SAMPLES]);
+    std::unique_ptr<double[]> times(new double[NUM_SAMPLES]);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        memcpy(&rates[3 * i], samples[i].angular_rate, 3 * sizeof(double));
+    }
+    int nNumBatches = nNumUpdates / READINGS_PER_BATCH;
+    dTimeOffset = 0.0;
+    FusionKernel::Reset(&fusion);
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumBatches; i++) {
+        int nFirst = (i * READINGS_PER_BATCH) % NUM_SAMPLES;
+        if (i > 0 && nFirst == 0) dTimeOffset += NUM_SAMPLES / ACC_GYRO_ODR_HZ;
+        for (int j = 0; j < READINGS_PER_BATCH; j++) {
+            times[nFirst + j] = samples[nFirst + j].sample_time_sec + dTimeOffset;
+        }
+        IMU_DATASAMPLE *pSample = &samples[nFirst + READINGS_PER_BATCH - 1];
+        FusionKernel::Propagate(&fusion, &rates[3 * nFirst], &times[nFirst], READINGS_PER_BATCH);
+        FusionKernel::Update(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, times[nFirst + READINGS_PER_BATCH - 1], pSample->roll, pSample->pitch, pSample->heading);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dBatchNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / (nNumBatches * READINGS_PER_BATCH);
+    dSink = samples[0].heading;
+    printf("batched: %d gyro readings per acc/mag correction, %.0f ns/gyro reading\n", READINGS_PER_BATCH, dBatchNs);
+    double dSingleErr = GyroIntegrationError(1);
+    double dBatchErr = GyroIntegrationError(READINGS_PER_BATCH);
+    printf("gyro integration error after 10 seconds of constant rotation: %.2e deg (one reading per call), %.2e deg (%d readings per call)\n", dSingleErr, dBatchErr, READINGS_PER_BATCH);
+    //angles from quaternions spread over every roll and heading, and pitch up to 85 deg either way (the rotation matrix calculation splits roll and yaw differently right at straight up or down)
+    std::unique_ptr<FUSION_QUAT[]> quats(new FUSION_QUAT[NUM_SAMPLES]);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        FusionKernel::FromAMOSEuler(fmod(i * 37.3, 360.0) - 180.0, 85.0 * sin(i * 0.7), fmod(i * 91.7, 360.0), quats[i]);
+    }
+    double dMaxAngleDiff = 0.0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        double roll, pitch, yaw, legacyRoll, legacyPitch, legacyYaw;
+        FusionKernel::ToAMOSRPY(quats[i], roll, pitch, yaw);
+        LegacyAMOSRPY(quats[i], legacyRoll, legacyPitch, legacyYaw);
+        dMaxAngleDiff = fmax(dMaxAngleDiff, fmax(AngleDiff(roll, legacyRoll), fmax(AngleDiff(pitch, legacyPitch), AngleDiff(yaw, legacyYaw))));
+    }
+    double dSum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumUpdates; i++) {
+        double roll, pitch, yaw;
+        FusionKernel::ToAMOSRPY(quats[i % NUM_SAMPLES], roll, pitch, yaw);
+        dSum += roll + pitch + yaw;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dDirectNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / nNumUpdates;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumUpdates; i++) {
+        double roll, pitch, yaw;
+        LegacyAMOSRPY(quats[i % NUM_SAMPLES], roll, pitch, yaw);
+        dSum += roll + pitch + yaw;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dMatrixNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / nNumUpdates;
+    //updates that only keep the quaternion (IMU::SetLazyAngles)
+    dTimeOffset = 0.0;
+    FusionKernel::Reset(&fusion);
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    for (int i = 0; i < nNumUpdates; i++) {
+        IMU_DATASAMPLE *pSample = &samples[i % NUM_SAMPLES];
+        if (i > 0 && i % NUM_SAMPLES == 0) dTimeOffset += NUM_SAMPLES / ACC_GYRO_ODR_HZ;
+        FusionKernel::UpdateQuaternion(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec + dTimeOffset);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    double dQuatOnlyNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / nNumUpdates;
+    dSink = dSum + fusion.q.w;
+    printf("angles from quaternion: %.0f ns direct, %.0f ns through the rotation matrix (%.1fx), max difference %.2e deg; quaternion-only update %.0f ns/update (checksum %.3f)\n", dDirectNs, dMatrixNs, dMatrixNs / dDirectNs,
+        dMaxAngleDiff, dQuatOnlyNs, (double)dSink);
+    return dSingleErr <= MAX_GYRO_ERROR && dBatchErr <= MAX_GYRO_ERROR && dMaxAngleDiff <= MAX_ANGLE_DIFF;
+}
+
+/**
+ * @brief return true if a fusion engine comparison flag (-fusioncompare) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a fusion engine comparison flag (-fusioncompare) is present in the array of program arguments
+ * @return false if no fusion engine comparison flag is present in the array of program arguments.
+ */
+bool isFusionCompareFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 14) continue;
+        if (strncmp(argv[i], "-fusioncompare", 14) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief get the name of the recorded data file that follows the -fusioncompare flag
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return const char* the name of the file, or nullptr if no file name follows the -fusioncompare flag
+ */
+const char *GetFusionCompareFile(int argc, char* argv[]) {
+    for (int i = 0; i < argc - 1; i++) {
+        if (strncmp(argv[i], "-fusioncompare", 14) == 0 && argv[i + 1][0] != '-') {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+int LoadRecordedSamples(const char *szFilename, IMU_DATASAMPLE *pSamples, int nMaxSamples) {//read acc/mag/gyro samples from a file written by IMU::SaveIMUDataToFile, returns the number of samples read (-1 if the file could not be opened)
+    FILE *inFile = fopen(szFilename, "r");
+    if (inFile == nullptr) {
+        return -1;
+    }
+    char lineText[512];
+    int nNumSamples = 0;
+    memset(pSamples, 0, nMaxSamples * sizeof(IMU_DATASAMPLE));
+    while (nNumSamples < nMaxSamples && fgets(lineText, 512, inFile) != nullptr) {
+        IMU_DATASAMPLE *pSample = &pSamples[nNumSamples];
+        if (sscanf(lineText, "%lf, %lf, %lf, %lf, %lf, %lf, %lf, %lf, %lf, %lf", &pSample->sample_time_sec, &pSample->acc_data[0], &pSample->acc_data[1], &pSample->acc_data[2],
+            &pSample->mag_data[0], &pSample->mag_data[1], &pSample->mag_data[2], &pSample->angular_rate[0], &pSample->angular_rate[1], &pSample->angular_rate[2]) == 10) {
+            nNumSamples++;//(the header line does not scan)
+        }
+    }
+    fclose(inFile);
+    return nNumSamples;
+}
+
+/**
+ * @brief run each fusion engine over the same synthetic or recorded acc/mag/gyro data (no IMU is needed), and print out the speed, accuracy, and gyro bias estimate of each
+ *
+ * @param szFilename the name of a file recorded by IMU::SaveIMUDataToFile, or nullptr to use synthetic data
+ * @return true if the engines were compared
+ * @return false if the recorded data could not be read, or the batched, single-precision, or linear acceleration check failed
+ */
+bool DoFusionCompare(const char *szFilename) {
+    const int MAX_SAMPLES = 65536;//most samples used from a recorded file
+    const int NUM_SYNTHETIC_SAMPLES = 6240;//length of the synthetic data run (60 seconds at 104 Hz)
+    const int NUM_WARMUP_SAMPLES = 1040;//samples skipped (10 seconds) before accuracy is measured, to let the gyro bias estimates settle
+    const int NUM_TIMED_UPDATES = 1000000;//number of updates timed for each engine
+    const int NUM_TIMED_PREDICTIONS = 1000000;//number of orientation predictions timed for each engine
+    const double MAX_BATCH_DIFF = 1e-9;//largest allowed difference between the batched and per-sample angles in degrees
+    const double MAX_FLOAT_DIFF = 0.05;//largest allowed difference between the single and double-precision orientations in degrees
+    const double MAX_LINEAR_ACC_RMS = 0.015;//largest allowed rms linear acceleration in G of the synthetic data with its true orientations, which should only leave the sensor noise (about 0.009 G)
+    const int NUM_ENGINES = 4;
+    const char *ENGINE_NAMES[NUM_ENGINES] = {"slerp", "madgwick", "mahony", "ekf"};
+    const double ENGINE_GAINS[NUM_ENGINES][2] = {{0.0, 0.0}, {FUSION_MADGWICK_DEFAULT_BETA, FUSION_MADGWICK_DEFAULT_ZETA}, {FUSION_MAHONY_DEFAULT_KP, FUSION_MAHONY_DEFAULT_KI},
+        {FUSION_EKF_DEFAULT_GYRO_NOISE, FUSION_EKF_DEFAULT_BIAS_NOISE}};
+    std::unique_ptr<IMU_DATASAMPLE[]> samples(new IMU_DATASAMPLE[MAX_SAMPLES]);
+    std::unique_ptr<IMU_DATASAMPLE[]> reference(new IMU_DATASAMPLE[MAX_SAMPLES]);
+    int nNumSamples = 0;
+    if (szFilename != nullptr) {
+        nNumSamples = LoadRecordedSamples(szFilename, samples.get(), MAX_SAMPLES);
+        if (nNumSamples < 2) {
+            printf("Unable to read recorded samples from %s.\n", szFilename);
+            return false;
+        }
+        printf("%d recorded samples from %s, errors are relative to the slerp engine\n", nNumSamples, szFilename);
+    }
+    else {
+        nNumSamples = NUM_SYNTHETIC_SAMPLES;
+        MakeTruthSamples(samples.get(), reference.get(), nNumSamples, true);
+        printf("%d synthetic samples, errors are relative to the true angles\n", nNumSamples);
+        //the IMU does not move, so gravity should be all that is removed from the specific force with the true orientations
+        double dTrueLinearSumSq = 0.0;
+        for (int i = 0; i < nNumSamples; i++) {
+            FUSION_QUAT q;
+            double linearAcc[3];
+            FusionKernel::FromNEDAngles(reference[i].roll, reference[i].pitch, reference[i].heading, q);
+            FusionKernel::GetLinearAcceleration(q, samples[i].specific_force, linearAcc);
+            dTrueLinearSumSq += linearAcc[0] * linearAcc[0] + linearAcc[1] * linearAcc[1] + linearAcc[2] * linearAcc[2];
+        }
+        double dTrueLinearRms = sqrt(dTrueLinearSumSq / nNumSamples);
+        printf("rms linear acceleration with the true orientations = %.1f mG\n", 1000 * dTrueLinearRms);
+        if (dTrueLinearRms > MAX_LINEAR_ACC_RMS) {
+            printf("The linear acceleration of the stationary synthetic data is more than the sensor noise.\n");
+            return false;
+        }
+    }
+    int nFirstScored = szFilename != nullptr ? 0 : NUM_WARMUP_SAMPLES;
+    double dRunTime = samples[nNumSamples - 1].sample_time_sec - samples[0].sample_time_sec + 1 / ACC_GYRO_ODR_HZ;//time shift from one pass of the data to the next while timing
+    //the same samples as one array per component, for FusionKernel::UpdateBatch, and the angles that it returns
+    std::unique_ptr<double[]> spanData(new double[17 * nNumSamples]);
+    double *t = &spanData[0];
+    FUSION_SAMPLE_SPANS spans = {t, &spanData[nNumSamples], &spanData[2 * nNumSamples], &spanData[3 * nNumSamples], &spanData[4 * nNumSamples], &spanData[5 * nNumSamples],
+        &spanData[6 * nNumSamples], &spanData[7 * nNumSamples], &spanData[8 * nNumSamples], &spanData[9 * nNumSamples]};
+    FUSION_ORIENTATION_SPANS batchAngles = {&spanData[10 * nNumSamples], &spanData[11 * nNumSamples], &spanData[12 * nNumSamples], &spanData[13 * nNumSamples],
+        &spanData[14 * nNumSamples], &spanData[15 * nNumSamples], &spanData[16 * nNumSamples]};
+    FUSION_ORIENTATION_SPANS timedAngles = batchAngles;//(angles only, like the per-sample updates)
+    timedAngles.qw = timedAngles.qx = timedAngles.qy = timedAngles.qz = nullptr;
+    for (int i = 0; i < nNumSamples; i++) {
+        t[i] = samples[i].sample_time_sec;
+        spanData[nNumSamples + i] = samples[i].acc_data[0];
+        spanData[2 * nNumSamples + i] = samples[i].acc_data[1];
+        spanData[3 * nNumSamples + i] = samples[i].acc_data[2];
+        spanData[4 * nNumSamples + i] = samples[i].mag_data[0];
+        spanData[5 * nNumSamples + i] = samples[i].mag_data[1];
+        spanData[6 * nNumSamples + i] = samples[i].mag_data[2];
+        spanData[7 * nNumSamples + i] = samples[i].angular_rate[0];
+        spanData[8 * nNumSamples + i] = samples[i].angular_rate[1];
+        spanData[9 * nNumSamples + i] = samples[i].angular_rate[2];
+    }
+    //single-precision copies of the samples: acc, mag, and angular rate of each sample one after another (for FusionKernelF::Update), then the same as one array per component (for FusionKernelF::UpdateBatch), then the batched outputs
+    std::unique_ptr<float[]> floatData(new float[22 * nNumSamples]);
+    float *floatSamples = &floatData[0];
+    for (int i = 0; i < nNumSamples; i++) {
+        for (int j = 0; j < 3; j++) {
+            floatSamples[9 * i + j] = (float)samples[i].acc_data[j];
+            floatSamples[9 * i + 3 + j] = (float)samples[i].mag_data[j];
+            floatSamples[9 * i + 6 + j] = (float)samples[i].angular_rate[j];
+            floatData[(9 + j) * nNumSamples + i] = (float)samples[i].acc_data[j];
+            floatData[(12 + j) * nNumSamples + i] = (float)samples[i].mag_data[j];
+            floatData[(15 + j) * nNumSamples + i] = (float)samples[i].angular_rate[j];
+        }
+    }
+    FUSION_SAMPLE_SPANSF floatSpans = {t, &floatData[9 * nNumSamples], &floatData[10 * nNumSamples], &floatData[11 * nNumSamples], &floatData[12 * nNumSamples], &floatData[13 * nNumSamples],
+        &floatData[14 * nNumSamples], &floatData[15 * nNumSamples], &floatData[16 * nNumSamples], &floatData[17 * nNumSamples]};
+    FUSION_ORIENTATION_SPANSF floatAngles = {&floatData[18 * nNumSamples], &floatData[19 * nNumSamples], &floatData[20 * nNumSamples], &floatData[21 * nNumSamples], nullptr, nullptr, nullptr};
+    bool bBatchMatches = true;
+    bool bFloatMatches = true;
+    FUSION_STATE fusion;
+    for (int nEngine = 0; nEngine < NUM_ENGINES; nEngine++) {
+        //accuracy: rms and max error from the true angles (synthetic data), or from the slerp engine angles (recorded data)
+        FusionKernel::SetEngine(&fusion, nEngine, ENGINE_GAINS[nEngine][0], ENGINE_GAINS[nEngine][1]);
+        double dSumSq[3] = {0.0, 0.0, 0.0};//roll, pitch, heading
+        double dMax[3] = {0.0, 0.0, 0.0};
+        for (int i = 0; i < nNumSamples; i++) {
+            IMU_DATASAMPLE *pSample = &samples[i];
+            FusionKernel::Update(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec, pSample->roll, pSample->pitch, pSample->heading);
+            FusionKernel::GetQuaternion(&fusion, pSample->orientation);
+            FusionKernel::GetCorrectedRate(&fusion, pSample->angular_rate, pSample->corrected_rate);
+            pSample->fused_time_sec = pSample->sample_time_sec;//(predictions below are made on the sample clock)
+            if (nEngine == FUSION_ENGINE_SLERP && szFilename != nullptr) {
+                reference[i] = *pSample;
+            }
+            if (i < nFirstScored) continue;
+            double dErr[3] = {AngleDiff(pSample->roll, reference[i].roll), AngleDiff(pSample->pitch, reference[i].pitch), AngleDiff(pSample->heading, reference[i].heading)};
+            for (int j = 0; j < 3; j++) {
+                dSumSq[j] += dErr[j] * dErr[j];
+                dMax[j] = fmax(dMax[j], dErr[j]);
+            }
+        }
+        int nNumScored = nNumSamples - nFirstScored;
+        FUSION_HEALTH health;//final gyro bias estimate (and Kalman filter uncertainty) of the engines that estimate it
+        FusionKernel::GetHealth(&fusion, &health);
+        //extrapolate each orientation to the time of the next sample with IMU::PredictOrientation, and compare its error with the error of just using the last orientation
+        //(relative to the true orientation of the next sample, or to the engine's own orientation of the next sample for recorded data)
+        double dPredictSumSq = 0.0;
+        double dStaleSumSq = 0.0;
+        for (int i = nFirstScored; i < nNumSamples - 1; i++) {
+            FUSION_QUAT nextQuat = samples[i + 1].orientation;
+            if (szFilename == nullptr) {
+                FusionKernel::FromNEDAngles(reference[i + 1].roll, reference[i + 1].pitch, reference[i + 1].heading, nextQuat);
+            }
+            FUSION_QUAT predicted;
+            IMU::PredictOrientation(&samples[i], samples[i + 1].sample_time_sec, predicted);
+            double dPredictErr = QuatAngleDiff(predicted, nextQuat);
+            double dStaleErr = QuatAngleDiff(samples[i].orientation, nextQuat);
+            dPredictSumSq += dPredictErr * dPredictErr;
+            dStaleSumSq += dStaleErr * dStaleErr;
+        }
+        int nNumPredicted = nNumSamples - 1 - nFirstScored;
+        //linear acceleration of each sample with the engine's orientation (synthetic data only, since recorded files do not keep the specific force), which should only show the attitude error and sensor noise
+        double dLinearSumSq = 0.0;
+        if (szFilename == nullptr) {
+            for (int i = nFirstScored; i < nNumSamples; i++) {
+                FusionKernel::GetLinearAcceleration(samples[i].orientation, samples[i].specific_force, samples[i].linear_acc);
+                const double *a = samples[i].linear_acc;
+                dLinearSumSq += a[0] * a[0] + a[1] * a[1] + a[2] * a[2];
+            }
+        }
+        //time the predictions, 7.5 ms after each sample
+        double dPredictSum = 0.0;
+        struct timespec startTime, endTime;
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        for (int i = 0; i < NUM_TIMED_PREDICTIONS; i++) {
+            const IMU_DATASAMPLE *pSample = &samples[i % nNumSamples];
+            FUSION_QUAT predicted;
+            IMU::PredictOrientation(pSample, pSample->fused_time_sec + 0.0075, predicted);
+            dPredictSum += predicted.w;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        double dPredictNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / NUM_TIMED_PREDICTIONS;
+        volatile double dPredictSink = dPredictSum;//keeps the compiler from dropping the timed loop
+        (void)dPredictSink;
+        //check the batched results against the per-sample ones
+        FusionKernel::SetEngine(&fusion, nEngine, ENGINE_GAINS[nEngine][0], ENGINE_GAINS[nEngine][1]);
+        FusionKernel::UpdateBatch(&fusion, &spans, nNumSamples, &batchAngles);
+        double dMaxBatchDiff = 0.0;
+        for (int i = 0; i < nNumSamples; i++) {
+            dMaxBatchDiff = fmax(dMaxBatchDiff, AngleDiff(batchAngles.roll[i], samples[i].roll));
+            dMaxBatchDiff = fmax(dMaxBatchDiff, AngleDiff(batchAngles.pitch[i], samples[i].pitch));
+            dMaxBatchDiff = fmax(dMaxBatchDiff, AngleDiff(batchAngles.heading[i], samples[i].heading));
+            const FUSION_QUAT &q = samples[i].orientation;
+            double dQuatDiff = fmax(fmax(fabs(batchAngles.qw[i] - q.w), fabs(batchAngles.qx[i] - q.x)), fmax(fabs(batchAngles.qy[i] - q.y), fabs(batchAngles.qz[i] - q.z)));
+            dMaxBatchDiff = fmax(dMaxBatchDiff, dQuatDiff * 114.59156);//(twice the quaternion difference, in degrees, is about the angle between the orientations)
+        }
+        if (dMaxBatchDiff > MAX_BATCH_DIFF) {
+            bBatchMatches = false;
+        }
+        //time the engine (the sample times keep increasing from one pass of the data to the next)
+        double dTimeOffset = 0.0;
+        FusionKernel::SetEngine(&fusion, nEngine, ENGINE_GAINS[nEngine][0], ENGINE_GAINS[nEngine][1]);
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        for (int i = 0; i < NUM_TIMED_UPDATES; i++) {
+            IMU_DATASAMPLE *pSample = &samples[i % nNumSamples];
+            if (i > 0 && i % nNumSamples == 0) dTimeOffset += dRunTime;
+            FusionKernel::Update(&fusion, pSample->acc_data, pSample->mag_data, pSample->angular_rate, pSample->sample_time_sec + dTimeOffset, pSample->roll, pSample->pitch, pSample->heading);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        volatile double dSink = samples[0].heading;//keeps the compiler from dropping the timed loop
+        (void)dSink;
+        double dNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / NUM_TIMED_UPDATES;
+        //time the batched engine over whole passes of the data (shifting the sample times between passes is not timed)
+        double dBatchNs = 0.0;
+        int nNumBatched = 0;
+        FusionKernel::SetEngine(&fusion, nEngine, ENGINE_GAINS[nEngine][0], ENGINE_GAINS[nEngine][1]);
+        while (nNumBatched < NUM_TIMED_UPDATES) {
+            clock_gettime(CLOCK_MONOTONIC, &startTime);
+            FusionKernel::UpdateBatch(&fusion, &spans, nNumSamples, &timedAngles);
+            clock_gettime(CLOCK_MONOTONIC, &endTime);
+            dBatchNs += (endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec);
+            nNumBatched += nNumSamples;
+            for (int i = 0; i < nNumSamples; i++) {
+                t[i] += dRunTime;
+            }
+        }
+        for (int i = 0; i < nNumSamples; i++) {
+            t[i] = samples[i].sample_time_sec;
+        }
+        dBatchNs /= nNumBatched;
+        //run the single-precision kernel over the same samples, and compare its orientations with the double-precision ones (and its batched orientations with its per-sample ones)
+        FUSION_STATEF fusionF;
+        FusionKernelF::SetEngine(&fusionF, nEngine, (float)ENGINE_GAINS[nEngine][0], (float)ENGINE_GAINS[nEngine][1]);
+        std::unique_ptr<FUSION_QUATF[]> floatQuats(new FUSION_QUATF[nNumSamples]);
+        double dFloatSumSq = 0.0;
+        double dMaxFloatDiff = 0.0;
+        for (int i = 0; i < nNumSamples; i++) {
+            float *pFloatSample = &floatSamples[9 * i];
+            FusionKernelF::UpdateQuaternion(&fusionF, pFloatSample, pFloatSample + 3, pFloatSample + 6, samples[i].sample_time_sec);
+            FusionKernelF::GetQuaternion(&fusionF, floatQuats[i]);
+            FUSION_QUAT q = {floatQuats[i].w, floatQuats[i].x, floatQuats[i].y, floatQuats[i].z};
+            double dDiff = QuatAngleDiff(q, samples[i].orientation);
+            dFloatSumSq += dDiff * dDiff;
+            dMaxFloatDiff = fmax(dMaxFloatDiff, dDiff);
+        }
+        if (dMaxFloatDiff > MAX_FLOAT_DIFF) {
+            bFloatMatches = false;
+        }
+        FusionKernelF::SetEngine(&fusionF, nEngine, (float)ENGINE_GAINS[nEngine][0], (float)ENGINE_GAINS[nEngine][1]);
+        FusionKernelF::UpdateBatch(&fusionF, &floatSpans, nNumSamples, &floatAngles);
+        for (int i = 0; i < nNumSamples; i++) {
+            const FUSION_QUATF &q = floatQuats[i];
+            if (floatAngles.qw[i] != q.w || floatAngles.qx[i] != q.x || floatAngles.qy[i] != q.y || floatAngles.qz[i] != q.z) {
+                bBatchMatches = false;
+            }
+        }
+        //time the single-precision engine, one sample at a time and batched (angles included, like the double-precision timing)
+        dTimeOffset = 0.0;
+        float fRoll = 0.0f, fPitch = 0.0f, fHeading = 0.0f;
+        FusionKernelF::SetEngine(&fusionF, nEngine, (float)ENGINE_GAINS[nEngine][0], (float)ENGINE_GAINS[nEngine][1]);
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+        for (int i = 0; i < NUM_TIMED_UPDATES; i++) {
+            int nSample = i % nNumSamples;
+            float *pFloatSample = &floatSamples[9 * nSample];
+            if (i > 0 && nSample == 0) dTimeOffset += dRunTime;
+            FusionKernelF::Update(&fusionF, pFloatSample, pFloatSample + 3, pFloatSample + 6, samples[nSample].sample_time_sec + dTimeOffset, fRoll, fPitch, fHeading);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &endTime);
+        volatile float fSink = fHeading;//keeps the compiler from dropping the timed loop
+        (void)fSink;
+        double dFloatNs = ((endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec)) / NUM_TIMED_UPDATES;
+        FUSION_ORIENTATION_SPANSF timedFloatAngles = {nullptr, nullptr, nullptr, nullptr, &floatData[18 * nNumSamples], &floatData[19 * nNumSamples], &floatData[20 * nNumSamples]};
+        double dFloatBatchNs = 0.0;
+        nNumBatched = 0;
+        FusionKernelF::SetEngine(&fusionF, nEngine, (float)ENGINE_GAINS[nEngine][0], (float)ENGINE_GAINS[nEngine][1]);
+        while (nNumBatched < NUM_TIMED_UPDATES) {
+            clock_gettime(CLOCK_MONOTONIC, &startTime);
+            FusionKernelF::UpdateBatch(&fusionF, &floatSpans, nNumSamples, &timedFloatAngles);
+            clock_gettime(CLOCK_MONOTONIC, &endTime);
+            dFloatBatchNs += (endTime.tv_sec - startTime.tv_sec) * 1e9 + (endTime.tv_nsec - startTime.tv_nsec);
+            nNumBatched += nNumSamples;
+            for (int i = 0; i < nNumSamples; i++) {
+                t[i] += dRunTime;
+            }
+        }
+        for (int i = 0; i < nNumSamples; i++) {
+            t[i] = samples[i].sample_time_sec;
+        }
+        dFloatBatchNs /= nNumBatched;
+        printf("%-8s %5.0f ns/update, rms error: roll = %.2f, pitch = %.2f, heading = %.2f deg, max error: roll = %.2f, pitch = %.2f, heading = %.2f deg\n", ENGINE_NAMES[nEngine], dNs,
+            sqrt(dSumSq[0] / nNumScored), sqrt(dSumSq[1] / nNumScored), sqrt(dSumSq[2] / nNumScored), dMax[0], dMax[1], dMax[2]);
+        printf("         batched: %.0f ns/sample (%.2f million samples/sec), largest difference from per-sample updates = %.1e deg\n", dBatchNs, 1e3 / dBatchNs, dMaxBatchDiff);
+        printf("         float: %.0f ns/update, batched: %.0f ns/sample (%.2f million samples/sec), difference from double: rms = %.1e, max = %.1e deg\n", dFloatNs, dFloatBatchNs, 1e3 / dFloatBatchNs,
+            sqrt(dFloatSumSq / nNumSamples), dMaxFloatDiff);
+        printf("         predicted: %.0f ns/prediction, rms error one sample ahead = %.3f deg (%.3f deg without prediction)\n", dPredictNs, sqrt(dPredictSumSq / nNumPredicted),
+            sqrt(dStaleSumSq / nNumPredicted));
+        if (szFilename == nullptr) {
+            printf("         linear acceleration: rms = %.1f mG (stationary, so this is attitude error plus sensor noise)\n", 1000 * sqrt(dLinearSumSq / nNumScored));
+        }
+        if (nEngine != FUSION_ENGINE_SLERP) {
+            printf("         gyro bias estimate = (%.2f, %.2f, %.2f) deg/sec", health.gyro_bias_dps[0], health.gyro_bias_dps[1], health.gyro_bias_dps[2]);
+            if (health.have_covariance) {
+                printf(" +/- (%.2f, %.2f, %.2f), attitude sd = (%.2f, %.2f, %.2f) deg, heading sd = %.2f deg, acc nis = %.1f, mag nis = %.1f", health.gyro_bias_sd_dps[0], health.gyro_bias_sd_dps[1],
+                    health.gyro_bias_sd_dps[2], health.attitude_sd_deg[0], health.attitude_sd_deg[1], health.attitude_sd_deg[2], health.heading_sd_deg, health.acc_nis, health.mag_nis);
+            }
+            printf("\n");
+        }
+    }
+    if (!bBatchMatches) {
+        printf("The batched results differ from the per-sample results by more than %.0e deg.\n", MAX_BATCH_DIFF);
+        return false;
+    }
+    if (!bFloatMatches) {
+        printf("The single-precision orientations differ from the double-precision ones by more than %.2f deg.\n", MAX_FLOAT_DIFF);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief return true if an orientation slot benchmark flag (-slotbench) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if an orientation slot benchmark flag (-slotbench) is present in the array of program arguments
+ * @return false if no orientation slot benchmark flag is present in the array of program arguments.
+ */
+bool isSlotBenchFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 10) continue;
+        if (strncmp(argv[i], "-slotbench", 10) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct TEST_THREAD {//state of one writer or reader thread of the orientation slot benchmark or the broadcast ring test
+    OrientationSlot *pSlot;//the slot under test (orientation slot benchmark)
+    SampleBus *pBus;//the ring under test (broadcast ring test)
+    std::atomic<bool> *pRunning;//true while the threads should keep going
+    int nMode;//broadcast ring test reader only: 0 = GetNext, 1 = Peek / Release, 2 = GetNext with a pause after each sample (so that the writer laps it)
+    unsigned long long ullNumOps;//number of samples published (writer) or read (reader)
+    unsigned long long ullNumTorn;//number of samples whose fields did not all come from the same sample (reader)
+    unsigned long long ullNumBackwards;//number of samples that were older than the one read before (reader)
+    unsigned long long ullNumMissed;//number of samples that the ring reported as missed (broadcast ring test reader)
+    double dOpNs;//average time per publish or read in ns (orientation slot benchmark)
+};
+
+double ThreadTimeNs(struct timespec *pStartTime) {//ns since pStartTime
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    return (endTime.tv_sec - pStartTime->tv_sec) * 1e9 + (endTime.tv_nsec - pStartTime->tv_nsec);
+}
+
+void FillTestSample(IMU_DATASAMPLE *pSample, double n) {//set every field of a test sample that the readers check to n
+    pSample->sample_time_sec = n;
+    for (int i = 0; i < 3; i++) {
+        pSample->acc_data[i] = pSample->mag_data[i] = pSample->angular_rate[i] = n;
+    }
+    pSample->heading = pSample->pitch = pSample->roll = n;
+    pSample->orientation.w = pSample->orientation.x = pSample->orientation.y = pSample->orientation.z = n;
+}
+
+bool IsTestSampleConsistent(const IMU_DATASAMPLE *pSample, double n) {//true if every field of a test sample that FillTestSample sets is n
+    bool bConsistent = pSample->sample_time_sec == n && pSample->heading == n && pSample->pitch == n && pSample->roll == n && pSample->orientation.w == n && pSample->orientation.x == n &&
+        pSample->orientation.y == n && pSample->orientation.z == n;
+    for (int i = 0; i < 3; i++) {
+        bConsistent = bConsistent && pSample->acc_data[i] == n && pSample->mag_data[i] == n && pSample->angular_rate[i] == n;
+    }
+    return bConsistent;
+}
+
+/**
+ * @brief run one writer thread and several reader threads for 2 seconds, then stop them and wait for them to finish
+ *
+ * @param pThreads the state of the writer thread, followed by the state of each reader thread (set up by the caller, except for pRunning)
+ * @param nNumReaders the number of reader threads (up to 8)
+ * @param pWriter the writer thread function
+ * @param pReader the reader thread function
+ * @return true if every thread ran
+ * @return false if there are too many readers, or a thread could not be started
+ */
+bool RunTestThreads(TEST_THREAD *pThreads, int nNumReaders, void *(*pWriter)(void *), void *(*pReader)(void *)) {
+    const int MAX_THREADS = 9;
+    const unsigned int RUN_TIME_US = 2000000;
+    if (nNumReaders + 1 > MAX_THREADS) return false;
+    std::atomic<bool> bRunning(true);
+    pthread_t threadIds[MAX_THREADS];
+    int nNumStarted = 0;
+    for (int i = 0; i <= nNumReaders; i++) {
+        pThreads[i].pRunning = &bRunning;
+        if (pthread_create(&threadIds[i], nullptr, i == 0 ? pWriter : pReader, &pThreads[i]) != 0) {
+            break;
+        }
+        nNumStarted++;
+    }
+    if (nNumStarted == nNumReaders + 1) {
+        usleep(RUN_TIME_US);
+    }
+    bRunning.store(false);
+    for (int i = 0; i < nNumStarted; i++) {
+        pthread_join(threadIds[i], nullptr);
+    }
+    return nNumStarted == nNumReaders + 1;
+}
+
+void *SlotBenchWriter(void *pParam) {//publishes samples to the slot as fast as it can, with every field of sample #n set to n
+    TEST_THREAD *pThread = (TEST_THREAD *)pParam;
+    IMU_DATASAMPLE sample;
+    memset(&sample, 0, sizeof(IMU_DATASAMPLE));
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    while (pThread->pRunning->load(std::memory_order_relaxed)) {
+        FillTestSample(&sample, (double)pThread->ullNumOps);
+        pThread->pSlot->Publish(&sample);
+        pThread->ullNumOps++;
+    }
+    pThread->dOpNs = ThreadTimeNs(&startTime) / (pThread->ullNumOps > 0 ? pThread->ullNumOps : 1);
+    return nullptr;
+}
+
+void *SlotBenchReader(void *pParam) {//reads the slot as fast as it can, and checks that each snapshot is consistent and no older than the one before
+    TEST_THREAD *pThread = (TEST_THREAD *)pParam;
+    ORIENTATION_SNAPSHOT snapshot;
+    unsigned long long ullLastSampleNum = 0;
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    while (pThread->pRunning->load(std::memory_order_relaxed)) {
+        if (!pThread->pSlot->Read(&snapshot)) continue;
+        pThread->ullNumOps++;
+        if (!IsTestSampleConsistent(&snapshot.sample, (double)snapshot.sample_num)) pThread->ullNumTorn++;
+        if (snapshot.sample_num < ullLastSampleNum) pThread->ullNumBackwards++;
+        ullLastSampleNum = snapshot.sample_num;
+    }
+    pThread->dOpNs = ThreadTimeNs(&startTime) / (pThread->ullNumOps > 0 ? pThread->ullNumOps : 1);
+    return nullptr;
+}
+
+/**
+ * @brief stress test the orientation slot (no IMU is needed): one thread publishes synthetic samples as fast as it can (far faster than any real sample rate, to make collisions with the readers as likely as possible) while several reader threads read the latest sample as fast as they can for 2 seconds, and each snapshot is checked for fields that come from different samples. Prints out the publish and read times, and the number of reader retries.
+ *
+ * @param nNumReaders the number of reader threads
+ * @return true if every snapshot was consistent
+ * @return false if a torn or out of order snapshot was read, or a thread could not be started
+ */
+bool DoOrientationSlotBenchmark(int nNumReaders) {
+    const int MAX_READERS = 8;
+    if (nNumReaders > MAX_READERS) nNumReaders = MAX_READERS;
+    OrientationSlot slot;
+    TEST_THREAD threads[MAX_READERS + 1];//writer, then readers
+    memset(threads, 0, sizeof(threads));
+    for (int i = 0; i <= nNumReaders; i++) {
+        threads[i].pSlot = &slot;
+    }
+    if (!RunTestThreads(threads, nNumReaders, SlotBenchWriter, SlotBenchReader)) {
+        printf("Unable to start the orientation slot benchmark threads.\n");
+        return false;
+    }
+    printf("writer: %llu samples published, %.0f ns/publish\n", threads[0].ullNumOps, threads[0].dOpNs);
+    bool bOK = true;
+    for (int i = 1; i <= nNumReaders; i++) {
+        printf("reader %d: %llu snapshots read, %.0f ns/read, %llu torn, %llu out of order\n", i, threads[i].ullNumOps, threads[i].dOpNs, threads[i].ullNumTorn, threads[i].ullNumBackwards);
+        if (threads[i].ullNumTorn > 0 || threads[i].ullNumBackwards > 0) bOK = false;
+    }
+    printf("%llu reader retries\n", slot.GetNumRetries());
+    return bOK;
+}
+
+/**
+ * @brief return true if a broadcast ring test flag (-bustest) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if a broadcast ring test flag (-bustest) is present in the array of program arguments
+ * @return false if no broadcast ring test flag is present in the array of program arguments.
+ */
+bool isBusTestFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 8) continue;
+        if (strncmp(argv[i], "-bustest", 8) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void *BusTestWriter(void *pParam) {//publishes samples to the ring as fast as it can, with every field of sample #n set to n, alternating between writing in place (BeginWrite / CommitWrite) and Publish
+    TEST_THREAD *pThread = (TEST_THREAD *)pParam;
+    IMU_DATASAMPLE sample;
+    memset(&sample, 0, sizeof(IMU_DATASAMPLE));
+    while (pThread->pRunning->load(std::memory_order_relaxed)) {
+        double n = (double)(pThread->ullNumOps + 1);
+        if (pThread->ullNumOps % 2 == 0) {
+            FillTestSample(pThread->pBus->BeginWrite(), n);
+            pThread->pBus->CommitWrite();
+        }
+        else {
+            FillTestSample(&sample, n);
+            pThread->pBus->Publish(&sample);
+        }
+        pThread->ullNumOps++;
+    }
+    return nullptr;
+}
+
+void *BusTestReader(void *pParam) {//reads samples from the ring as fast as it can (or with a pause after each one), and checks that each one is consistent and newer than the one before
+    TEST_THREAD *pThread = (TEST_THREAD *)pParam;
+    SampleBusReader reader(pThread->pBus);
+    IMU_DATASAMPLE sample;
+    double dLastSampleNum = 0.0;
+    volatile double dDelaySink = 0.0;
+    while (pThread->pRunning->load(std::memory_order_relaxed)) {
+        if (pThread->nMode == 1) {
+            const IMU_DATASAMPLE *pRingSample = reader.Peek();
+            if (pRingSample == nullptr) continue;
+            double dSampleNum = pRingSample->sample_time_sec;
+            for (int i = 0; i < 1000; i++) {//hold on to the sample for a while, to give the writer a chance to overwrite it while it is being read
+                dDelaySink = dDelaySink + i;
+            }
+            bool bConsistent = IsTestSampleConsistent(pRingSample, dSampleNum);
+            if (!reader.Release()) continue;//overwritten while it was being read, so whatever was read does not count
+            memset(&sample, 0, sizeof(IMU_DATASAMPLE));
+            if (bConsistent) FillTestSample(&sample, dSampleNum);
+        }
+        else if (!reader.GetNext(&sample)) {
+            continue;
+        }
+        pThread->ullNumOps++;
+        if (!IsTestSampleConsistent(&sample, sample.sample_time_sec) || sample.sample_time_sec == 0.0) pThread->ullNumTorn++;
+        if (sample.sample_time_sec <= dLastSampleNum) pThread->ullNumBackwards++;
+        dLastSampleNum = sample.sample_time_sec;
+        if (pThread->nMode == 2) usleep(100);
+    }
+    pThread->ullNumMissed = reader.GetNumMissed();
+    return nullptr;
+}
+
+/**
+ * @brief test the broadcast ring (no IMU is needed). First, single-threaded checks that a reader finds out when the sample it is reading gets overwritten, and that it carries on from the oldest sample left after being lapped. Then a stress test: one thread publishes synthetic samples into a small ring as fast as it can (half of them written in place, half copied in) while 3 reader threads read them for 2 seconds, one with GetNext, one with Peek / Release, and one that pauses after each sample so that it keeps getting lapped. Every sample that a reader accepts is checked for fields that come from different samples, and for going backwards. Prints out the number of samples published, and the number read and missed by each reader.
+ *
+ * @return true if every sample that was read was consistent and in order, and every reader got samples
+ * @return false if a single-threaded check failed, a torn or out of order sample was read, a reader got no samples, or a thread could not be started
+ */
+bool DoSampleBusTest() {
+    const int NUM_READERS = 3;
+    const unsigned int RING_CAPACITY = 16;
+    const char *READER_NAMES[NUM_READERS] = {"GetNext", "Peek/Release", "slow GetNext"};
+    //first, single-threaded checks of the cases that the threads below can only hit by chance: a sample overwritten while it is being read, and a reader that gets lapped
+    {
+        SampleBus bus(RING_CAPACITY);
+        SampleBusReader reader(&bus);
+        IMU_DATASAMPLE sample;
+        memset(&sample, 0, sizeof(IMU_DATASAMPLE));
+        FillTestSample(&sample, 1.0);
+        bus.Publish(&sample);
+        const IMU_DATASAMPLE *pRingSample = reader.Peek();
+        bool bPeekOK = pRingSample != nullptr && pRingSample->sample_time_sec == 1.0;
+        for (unsigned int i = 2; i <= RING_CAPACITY; i++) {
+            FillTestSample(&sample, (double)i);
+            bus.Publish(&sample);
+        }
+        FillTestSample(bus.BeginWrite(), RING_CAPACITY + 1.0);//reuses the slot of the sample that the reader is looking at
+        bool bOverwriteSeen = !reader.Release();
+        bus.CommitWrite();
+        bool bNextOK = reader.GetNext(&sample) && sample.sample_time_sec == 2.0 && reader.GetNumMissed() == 1;//only the overwritten sample is lost, the reader carries on with the oldest one left
+        printf("single-threaded checks: peek %s, overwrite while reading %s, resume after being lapped %s\n", bPeekOK ? "OK" : "FAILED", bOverwriteSeen ? "detected" : "NOT DETECTED",
+            bNextOK ? "OK" : "FAILED");
+        if (!bPeekOK || !bOverwriteSeen || !bNextOK) {
+            return false;
+        }
+    }
+    SampleBus bus(RING_CAPACITY);
+    TEST_THREAD threads[NUM_READERS + 1];//writer, then readers
+    memset(threads, 0, sizeof(threads));
+    for (int i = 0; i <= NUM_READERS; i++) {
+        threads[i].pBus = &bus;
+        threads[i].nMode = i - 1;
+    }
+    if (!RunTestThreads(threads, NUM_READERS, BusTestWriter, BusTestReader)) {
+        printf("Unable to start the broadcast ring test threads.\n");
+        return false;
+    }
+    printf("writer: %llu samples published into a ring of %u\n", threads[0].ullNumOps, bus.GetCapacity());
+    bool bOK = true;
+    for (int i = 1; i <= NUM_READERS; i++) {
+        printf("reader %d (%s): %llu samples read, %llu missed, %llu torn, %llu out of order\n", i, READER_NAMES[i - 1], threads[i].ullNumOps, threads[i].ullNumMissed, threads[i].ullNumTorn,
+            threads[i].ullNumBackwards);
+        if (threads[i].ullNumOps == 0 || threads[i].ullNumTorn > 0 || threads[i].ullNumBackwards > 0) bOK = false;
+    }
+    return bOK;
+}
+
+/**
+ * @brief return true if an event loop flag (-reactor) was specified in the program arguments
+ *
+ * @param argc the number of program arguments
+ * @param argv an array of character pointers that corresponds to the program arguments
+ * @return true if an event loop flag (-reactor) is present in the array of program arguments
+ * @return false if no event loop flag is present in the array of program arguments.
+ */
+bool isReactorFlagPresent(int argc, char* argv[]) {
+    for (int i = 0; i < argc; i++) {
+        if (strlen(argv[i]) < 8) continue;
+        if (strncmp(argv[i], "-reactor", 8) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct REACTOR_TEST_STATE {//state shared by the callbacks of the event loop test
+    IMUReactor *pReactor;//the reactor that delivers the samples
+    int nSourceId;//source id of the IMU
+    int nNumSamples;//number of samples received by the subscriber
+    int nNumFailed;//number of failed samples
+    int nMaxSamples;//number of samples to collect before stopping the reactor
+    int nNumRequests;//number of samples received through one-shot requests
+    double dLastRequestTime;//sample time of the most recent sample received through a one-shot request
+};
+
+void OnReactorSample(IMU_DATASAMPLE *pSample, bool bSampleOK, void *pUserData) {//subscriber callback for the event loop test, prints out each sample and stops the reactor after enough samples
+    REACTOR_TEST_STATE *pState = (REACTOR_TEST_STATE *)pUserData;
+    if (!bSampleOK) {
+        pState->nNumFailed++;
+        return;
+    }
+    pState->nNumSamples++;
+    printf("%d (%.3f sec): roll = %.1f deg, pitch = %.1f deg, heading = %.1f deg\n", pState->nNumSamples, pSample->sample_time_sec, pSample->roll, pSample->pitch, pSample->heading);
+    if (pState->nNumSamples>=pState->nMaxSamples) {
+        pState->pReactor->Stop();
+    }
+}
+
+void OnReactorRequest(IMU_DATASAMPLE *pSample, bool bSampleOK, void *pUserData) {//one-shot callback for the event loop test, requests the following sample each time it is called
+    REACTOR_TEST_STATE *pState = (REACTOR_TEST_STATE *)pUserData;
+    if (!bSampleOK) return;
+    pState->nNumRequests++;
+    pState->dLastRequestTime = pSample->sample_time_sec;
+    pState->pReactor->RequestSample(pState->nSourceId, OnReactorRequest, pState);
+}
+
+/**
+ * @brief collect samples from an event loop (IMUReactor) instead of a dedicated thread, using both a persistent subscriber and a chain of one-shot requests, and print out the results
+ *
+ * @param pIMU the IMU to get samples from
+ * @param nNumSamples the number of samples to collect
+ * @return true if the samples were collected successfully
+ * @return false if the reactor could not be set up
+ */
+bool DoReactorTest(IMU *pIMU, int nNumSamples) {
+    const unsigned int SAMPLE_PERIOD_US = 20000;//collect samples at 50 Hz
+    IMUReactor reactor;
+    if (reactor.m_bInitError) {
+        return false;
+    }
+    REACTOR_TEST_STATE state;
+    memset(&state, 0, sizeof(REACTOR_TEST_STATE));
+    state.pReactor = &reactor;
+    state.nMaxSamples = nNumSamples;
+    state.nSourceId = reactor.AddIMU(pIMU, SAMPLE_PERIOD_US, 1);
+    if (state.nSourceId<0) {
+        return false;
+    }
+    if (!reactor.Subscribe(state.nSourceId, OnReactorSample, &state)||!reactor.RequestSample(state.nSourceId, OnReactorRequest, &state)) {
+        return false;
+    }
+    reactor.Run();
+    printf("%d samples, %d failed, %d one-shot requests completed (last at %.3f sec), %u overruns\n", state.nNumSamples, state.nNumFailed, state.nNumRequests, state.dLastRequestTime, reactor.GetNumOverruns(state.nSourceId));
+    return true;
+}
+
 void ShowIMUTestUsage() {
     printf("IMUTest\n");
-    printf("Usage: IMUTest [-h] [-magcal] [-fmxy] [-fmxz] [-ftempcal]\n");
+    printf("Usage: IMUTest [-h] [-magcal] [-fmxy] [-fmxz] [-ftempcal] [-jitter [-rt]] [-dutycycle] [-reactor] [-idle] [-fastmag] [-fastread] [-baro] [-vibration] [-shock] [-inittime] [-fusionbench] [-fusioncompare [file]] [-slotbench] [-bustest]\n");
     printf("If no arguements are specified, the program collects and prints out data from the IMU for about 5 seconds.\n");
     printf("Optional flags:\n");
     printf("-h: prints out this help message.\n");
@@ -116,6 +1728,21 @@ void ShowIMUTestUsage() {
     printf("-fmxy: does a factory calibration of the X and Y magnetometers (similar to that done with the -magcal flag) except that it requires the user to toggle calibration data sampling on and off with the press of a button.\n");
     printf("-fmxz: does a factory calibration of the X and Z magnetometers (requires IMU device to be aligned on edge with Y-axis pointed up or down) and requires the user to toggle calibration data sampling on and off with the press of a button.\n");
     printf("-ftempcal: does a factory temperature calibration.\n");
+    printf("-jitter: collects samples at 50 Hz in an acquisition thread for 10 seconds and prints out the wake-up latency and sample interval jitter.\n");
+    printf("-rt: used with -jitter, runs the acquisition thread in real-time mode (SCHED_FIFO priority, locked memory, priority inheritance bus mutex). Requires root privileges.\n");
+    printf("-dutycycle: gets 10 low-power fixes, 5 seconds apart, powering down the sensors between fixes, and prints out the bus time and active time of each fix.\n");
+    printf("-reactor: collects 100 samples at 50 Hz from a single-threaded event loop (no acquisition thread, and no waiting for sensor data on the loop thread) and prints out the orientation of each sample.\n");
+    printf("-idle: runs the acquisition thread for 60 seconds in idle mode, where sampling drops to 2 Hz while the IMU is still and returns to 50 Hz when it moves, and prints out the sleep / wake transitions and the number of acc/gyro readings.\n");
+    printf("-fastmag: collects magnetometer readings at 1 kHz (FAST_ODR low-power mode) for 5 seconds while fused samples are collected at 50 Hz, and prints out the achieved rates.\n");
+    printf("-fastread: collects 500 samples with full 16-bit magnetometer readings and then 500 samples with 8-bit (FAST_READ) readings, and prints out the heading noise and magnetometer bus load of each. Keep the IMU still during the test.\n");
+    printf("-baro: collects samples at 50 Hz for 10 seconds, and prints out the pressure, temperature, and pressure altitude from the LPS25H (averaged with its FIFO mean mode) once per second.\n");
+    printf("-vibration: compares the pitch and roll noise of acc/gyro samples with the accelerometer stream off and on (it should not get worse with the stream on), then streams the accelerometer at 1.66 kHz for 10 seconds while fused samples are collected at 50 Hz, and prints out the vibration band energies once per second. Needs the I2C bus to run at 400 kHz.\n");
+    printf("-shock: switches the accelerometer to +/- 16 G, watches every 104 Hz acc/gyro reading for 60 seconds for shock events (acceleration, jerk, or rotation rate thresholds), and writes 0.5 sec before and 1 sec after each event to a shock_*.csv file in the current directory.\n");
+    printf("-inittime: collects the first sample after the IMU is constructed, and prints out the time taken by each phase of initialization and the time until the first sample.\n");
+    printf("-fusionbench: times the orientation fusion kernel against the quaternion2 based calculation it replaced on 1,000,000 synthetic samples (no IMU needed), and prints out the time per update of each, the time per gyro reading of batched propagation, the error of the gyro integration, and the time to get the angles from the quaternion.\n");
+    printf("-fusioncompare: runs the slerp, Madgwick, Mahony, and error-state Kalman filter fusion engines over the same data (no IMU needed), and prints out the time per update and the accuracy of each. Uses the samples in file (written by the IMU data logging) if it is given, or else 60 seconds of synthetic data.\n");
+    printf("-slotbench: stress tests the latest-orientation slot (no IMU needed) with one thread publishing samples as fast as it can and 3 threads reading them for 2 seconds, and prints out the publish and read times and any inconsistent snapshots.\n");
+    printf("-bustest: tests the broadcast ring of samples (no IMU needed), first with single-threaded overwrite and lapping checks, then with one thread publishing samples as fast as it can and 3 threads reading them (one of them slowly enough to keep getting lapped) for 2 seconds, and prints out the number of samples read and missed by each reader and any inconsistent or out of order samples.\n");
 }
 
 
@@ -131,6 +1758,40 @@ int main(int argc, char * argv[])
   const int NUM_SAMPLES = 100;
   const int NUM_TO_AVG = 1;//number of individual samples to average for each call to IMU::GetSample
   pthread_mutex_t i2cMutex = PTHREAD_MUTEX_INITIALIZER;;//mutex for controlling access to i2c bus
+  if (isRealTimeFlagPresent(argc, argv)) {
+    if (!IMUAcquisition::InitPriorityInheritanceMutex(&i2cMutex)) {
+      printf("Error creating priority inheritance mutex for the i2c bus.\n");
+      return -7;
+    }
+  }
+  if (isFusionBenchFlagPresent(argc, argv)) {
+    if (!DoFusionBenchmark(1000000)) {
+      printf("Error, the fusion kernel gyro integration does not match the exact rotation, or its angles do not match the rotation matrix calculation.\n");
+      return -18;
+    }
+    return 0;
+  }
+  if (isFusionCompareFlagPresent(argc, argv)) {
+    if (!DoFusionCompare(GetFusionCompareFile(argc, argv))) {
+      printf("Error comparing the fusion engines.\n");
+      return -19;
+    }
+    return 0;
+  }
+  if (isSlotBenchFlagPresent(argc, argv)) {
+    if (!DoOrientationSlotBenchmark(3)) {
+      printf("Error, the orientation slot returned an inconsistent snapshot.\n");
+      return -20;
+    }
+    return 0;
+  }
+  if (isBusTestFlagPresent(argc, argv)) {
+    if (!DoSampleBusTest()) {
+      printf("Error, the broadcast ring returned an inconsistent sample.\n");
+      return -21;
+    }
+    return 0;
+  }
   IMU imu(&i2cMutex);
   if (imu.m_bInitError) {
 	  printf("An error occurred trying to initialize the IMU.\n");
@@ -171,7 +1832,78 @@ int main(int argc, char * argv[])
       }
       return 0;
   }
+  else if (isJitterFlagPresent(argc, argv)) {
+      if (!DoJitterTest(&imu, isRealTimeFlagPresent(argc, argv), 10)) {
+          printf("Error running acquisition timing test.\n");
+          return -8;
+      }
+      return 0;
+  }
+  else if (isDutyCycleFlagPresent(argc, argv)) {
+      if (!DoDutyCycleTest(&imu, 10, 5)) {
+          printf("Error doing duty-cycled sampling.\n");
+          return -9;
+      }
+      return 0;
+  }
+  else if (isReactorFlagPresent(argc, argv)) {
+      if (!DoReactorTest(&imu, NUM_SAMPLES)) {
+          printf("Error collecting samples from the event loop.\n");
+          return -10;
+      }
+      return 0;
+  }
+  else if (isIdleFlagPresent(argc, argv)) {
+      if (!DoIdleTest(&imu, 60)) {
+          printf("Error running idle mode test.\n");
+          return -11;
+      }
+      return 0;
+  }
+  else if (isFastMagFlagPresent(argc, argv)) {
+      if (!DoFastMagTest(&imu, 5)) {
+          printf("Error running high-rate magnetometer stream.\n");
+          return -12;
+      }
+      return 0;
+  }
+  else if (isFastReadFlagPresent(argc, argv)) {
+      if (!DoFastReadTest(&imu, 500)) {
+          printf("Error comparing magnetometer sampling profiles.\n");
+          return -13;
+      }
+      return 0;
+  }
+  else if (isBaroFlagPresent(argc, argv)) {
+      if (!DoBaroTest(&imu, 10)) {
+          printf("Error collecting pressure data.\n");
+          return -14;
+      }
+      return 0;
+  }
+  else if (isVibrationFlagPresent(argc, argv)) {
+      if (!DoVibrationTest(&imu, 10)) {
+          printf("Error running vibration monitor.\n");
+          return -15;
+      }
+      return 0;
+  }
+  else if (isShockFlagPresent(argc, argv)) {
+      if (!DoShockTest(&imu, 60)) {
+          printf("Error running shock detector.\n");
+          return -16;
+      }
+      return 0;
+  }
+  else if (isInitTimeFlagPresent(argc, argv)) {
+      if (!DoInitTimeTest(&imu)) {
+          printf("Error getting the first sample.\n");
+          return -17;
+      }
+      return 0;
+  }
   IMU_DATASAMPLE imu_sample;
+  memset(&imu_sample, 0, sizeof(IMU_DATASAMPLE));
   for (int i=0;i<NUM_SAMPLES;i++) {
 		if (!imu.GetMagSample(&imu_sample, NUM_TO_AVG)) {//collect raw magnetometer data from the LIS3MDL 3-axis magnetometer device and process it to get the magnetic vector and temperature
 			printf("Error getting magnetometer sample #%d.\n",i+1);
@@ -191,5 +1923,9 @@ int main(int argc, char * argv[])
     imu.ComputeOrientation(&imu_sample);
     printf("%d (%.3f sec): roll = %.1f deg, pitch = %.1f deg, heading = %.1f deg\n",i+1,imu_sample.sample_time_sec,imu_sample.roll,imu_sample.pitch,imu_sample.heading);
   }
+  IMU_SAMPLE_STATS stats;
+  imu.GetSampleStats(&stats);
+  printf("mag: %u reads, %u missed, %u late, %u failed\n",stats.mag_reads,stats.mag_missed,stats.mag_late,stats.mag_failed);
+  printf("acc/gyro: %u reads, %u missed, %u late, %u failed\n",stats.acc_gyro_reads,stats.acc_gyro_missed,stats.acc_gyro_late,stats.acc_gyro_failed);
   return 0 ;
 }
@@ -0,0 +1,163 @@
+/**
+ * @file MagStream.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the MagStream class (high-rate magnetometer stream using the LIS3MDL FAST_ODR modes)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ShipLog.h"
+#include "MagStream.h"
+
+extern ShipLog g_shiplog;//used for logging data and to assist in debugging
+
+/**
+ * @brief Construct a new MagStream object. The readings buffer is allocated up front, so the stream thread never allocates memory.
+ *
+ * @param pIMU the IMU that magnetometer readings are collected from
+ * @param uiCapacity the number of readings to buffer. This is rounded up to the next power of 2, and should cover the longest time that the consumer might go without reading (e.g. 4096 readings is about 4 seconds at 1 kHz).
+ */
+MagStream::MagStream(IMU *pIMU, unsigned int uiCapacity) {
+	m_pIMU = pIMU;
+	m_uiCapacity = 2;
+	while (m_uiCapacity<uiCapacity) {
+		m_uiCapacity<<=1;
+	}
+	m_uiMask = m_uiCapacity - 1;
+	m_ring = new IMU_MAG_SAMPLE[m_uiCapacity];
+	memset(m_ring, 0, m_uiCapacity*sizeof(IMU_MAG_SAMPLE));
+	m_ullHead = 0;
+	m_ullTail = 0;
+	m_ullNumDropped = 0;
+	m_ullNumOverruns = 0;
+	m_bRunning = false;
+	m_bThreadStarted = false;
+	memset(m_szErrMsg, 0, 256);
+}
+
+/**
+ * @brief Destroy the MagStream object (stops the stream thread if it is still running)
+ *
+ */
+MagStream::~MagStream() {
+	Stop();
+	if (m_ring!=nullptr) {
+		delete []m_ring;
+		m_ring = nullptr;
+	}
+}
+
+/**
+ * @brief switch the magnetometer to a high-rate mode and start the stream thread. While the stream is running, GetSample and GetMagSample still work, but get the lower-precision readings of the selected mode, and share the magnetometer data with the stream (whichever reads a reading first gets it).
+ *
+ * @param nMagRate one of the MAG_RATE_... values (e.g. MAG_RATE_1000HZ)
+ * @return true if the stream was started
+ * @return false if the stream is already running, the magnetometer could not be switched to the new rate, or the thread could not be created
+ */
+bool MagStream::Start(int nMagRate) {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, magnetometer stream is already running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (!m_pIMU->SetMagRate(nMagRate)) {
+		return false;
+	}
+	m_bRunning = true;
+	int nRetval = pthread_create(&m_thread, nullptr, StreamThread, this);
+	if (nRetval!=0) {
+		sprintf(m_szErrMsg, "Error (%s) trying to start magnetometer stream thread.\n", strerror(nRetval));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bRunning = false;
+		m_pIMU->SetMagRate(MAG_RATE_80HZ);
+		return false;
+	}
+	m_bThreadStarted = true;
+	return true;
+}
+
+/**
+ * @brief stop the stream thread and return the magnetometer to its normal 80 Hz ultra-high-performance mode. Readings that are still buffered can be read after the stream is stopped.
+ *
+ */
+void MagStream::Stop() {
+	m_bRunning = false;
+	if (m_bThreadStarted) {
+		pthread_join(m_thread, nullptr);
+		m_bThreadStarted = false;
+		m_pIMU->SetMagRate(MAG_RATE_80HZ);
+	}
+}
+
+/**
+ * @brief get the oldest unread reading from the stream (single consumer only)
+ *
+ * @param pMagSample pointer to the structure that receives the reading
+ * @return true if a reading was copied into pMagSample
+ * @return false if there are no unread readings
+ */
+bool MagStream::GetNext(IMU_MAG_SAMPLE *pMagSample) {
+	unsigned long long ullTail = m_ullTail.load(std::memory_order_relaxed);
+	if (ullTail==m_ullHead.load(std::memory_order_acquire)) {
+		return false;
+	}
+	memcpy(pMagSample, &m_ring[ullTail & m_uiMask], sizeof(IMU_MAG_SAMPLE));
+	m_ullTail.store(ullTail+1, std::memory_order_release);
+	return true;
+}
+
+unsigned int MagStream::GetNumPending() {//returns the number of readings waiting to be read
+	return (unsigned int)(m_ullHead.load(std::memory_order_acquire) - m_ullTail.load(std::memory_order_acquire));
+}
+
+unsigned long long MagStream::GetNumDropped() {//returns the number of readings that were dropped because the buffer was full
+	return m_ullNumDropped.load(std::memory_order_relaxed);
+}
+
+unsigned long long MagStream::GetNumOverruns() {//returns the number of readings that had the overrun flag set
+	return m_ullNumOverruns.load(std::memory_order_relaxed);
+}
+
+void *MagStream::StreamThread(void *pParam) {//thread function for collecting readings
+	MagStream *pStream = (MagStream *)pParam;
+	pStream->StreamLoop();
+	return nullptr;
+}
+
+void MagStream::StreamLoop() {//loop that runs in the stream thread until Stop is called
+	const long NSEC_PER_SEC = 1000000000L;
+	//poll slightly faster than the output data rate, so that every reading gets picked up while using as little of the bus as possible (a missed poll shows up as an overrun)
+	const double POLL_RATE_FACTOR = 1.1;
+	long lPollPeriodNs = (long)(NSEC_PER_SEC / (POLL_RATE_FACTOR * m_pIMU->GetMagODR()));
+	struct timespec nextWakeup;
+	IMU_MAG_SAMPLE magSample;
+	clock_gettime(CLOCK_MONOTONIC, &nextWakeup);
+	while (m_bRunning) {
+		nextWakeup.tv_nsec += lPollPeriodNs;
+		while (nextWakeup.tv_nsec>=NSEC_PER_SEC) {
+			nextWakeup.tv_nsec -= NSEC_PER_SEC;
+			nextWakeup.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextWakeup, nullptr);
+		bool bNewData = false;
+		if (!m_pIMU->ReadMagFast(&magSample, bNewData)||!bNewData) {
+			continue;
+		}
+		if ((magSample.quality_flags&IMU_QUALITY_MAG_OVERRUN)>0) {
+			m_ullNumOverruns.fetch_add(1, std::memory_order_relaxed);
+		}
+		unsigned long long ullHead = m_ullHead.load(std::memory_order_relaxed);
+		if (ullHead - m_ullTail.load(std::memory_order_acquire)>=m_uiCapacity) {
+			m_ullNumDropped.fetch_add(1, std::memory_order_relaxed);//consumer is not keeping up, drop the newest reading rather than overwrite one that might be getting read
+			continue;
+		}
+		memcpy(&m_ring[ullHead & m_uiMask], &magSample, sizeof(IMU_MAG_SAMPLE));
+		m_ullHead.store(ullHead+1, std::memory_order_release);
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <pthread.h>
+#include "IMU.h"
+//high-rate magnetometer stream, collects LIS3MDL readings at its FAST_ODR rate (up to 1 kHz) in a thread of its own, separate from the fused IMU samples
+
+#define MAGSTREAM_DEFAULT_CAPACITY 4096 //default number of readings held in the stream buffer (must be a power of 2)
+
+class MagStream {//thread that polls the magnetometer at its output data rate and queues each new reading for a single consumer
+public:
+	MagStream(IMU *pIMU, unsigned int uiCapacity);//constructor
+	~MagStream();//destructor
+	bool Start(int nMagRate);//switch the magnetometer to a MAG_RATE_... mode and start collecting readings
+	void Stop();//stop collecting readings and return the magnetometer to its normal 80 Hz mode
+	bool GetNext(IMU_MAG_SAMPLE *pMagSample);//get the oldest unread reading, returns false if there are none
+	unsigned int GetNumPending();//returns the number of readings waiting to be read
+	unsigned long long GetNumDropped();//returns the number of readings that were dropped because the buffer was full
+	unsigned long long GetNumOverruns();//returns the number of readings that had the overrun flag set (the magnetometer overwrote a reading before it was read)
+
+private:
+	//data
+	IMU *m_pIMU;//the IMU that readings are collected from
+	IMU_MAG_SAMPLE *m_ring;//buffer of readings waiting to be read
+	unsigned int m_uiCapacity;//number of readings that m_ring can hold (a power of 2)
+	unsigned int m_uiMask;//m_uiCapacity - 1
+	std::atomic<unsigned long long> m_ullHead;//total number of readings written to m_ring (written by the stream thread)
+	std::atomic<unsigned long long> m_ullTail;//total number of readings taken from m_ring (written by the consumer)
+	std::atomic<unsigned long long> m_ullNumDropped;//number of readings dropped because m_ring was full
+	std::atomic<unsigned long long> m_ullNumOverruns;//number of readings that had the overrun flag set
+	std::atomic<bool> m_bRunning;//true while the stream thread should keep running
+	bool m_bThreadStarted;//true if m_thread was created and has not been joined yet
+	pthread_t m_thread;//handle to the stream thread
+	char m_szErrMsg[256];//buffer space used for outputting error messages
+
+	//functions
+	static void *StreamThread(void *pParam);//thread function for collecting readings
+	void StreamLoop();//loop that runs in the stream thread until Stop is called
+};
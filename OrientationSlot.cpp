@@ -0,0 +1,86 @@
+/**
+ * @file OrientationSlot.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the OrientationSlot class (seqlock-protected latest fused sample, readable from any number of threads)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <string.h>
+#include "OrientationSlot.h"
+
+/**
+ * @brief Construct a new OrientationSlot object. The slot is empty until the first sample is published.
+ *
+ */
+OrientationSlot::OrientationSlot() {
+	memset(&m_snapshot, 0, sizeof(ORIENTATION_SNAPSHOT));
+	m_ullNumRetries.store(0, std::memory_order_relaxed);
+	m_ullSeq.store(0, std::memory_order_release);
+}
+
+/**
+ * @brief copy a fused sample into the slot, replacing the previous one. Only one thread may publish to the slot (IMU::ComputeOrientation when the slot is attached with IMU::AttachOrientationSlot). This never waits for readers: a reader that is copying the slot at the same time finds out from the sequence word and copies it again.
+ *
+ * @param pSample pointer to the sample to publish
+ */
+void OrientationSlot::Publish(const IMU_DATASAMPLE *pSample) {
+	unsigned long long ullSeq = m_ullSeq.load(std::memory_order_relaxed);
+	m_ullSeq.store(ullSeq+1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);//make sure that the "being written" marker is visible before any of the sample data changes
+	memcpy(&m_snapshot.sample, pSample, sizeof(IMU_DATASAMPLE));
+	m_snapshot.sample_num = ullSeq/2;
+	m_ullSeq.store(ullSeq+2, std::memory_order_release);
+}
+
+/**
+ * @brief get a consistent copy of the latest sample that was published to the slot. This does not take any lock and does not touch the IMU object, so it can be called from any number of threads at any rate. The copy is repeated if the writer published a new sample while it was being made (which can only happen a bounded number of times in a row, since the writer publishes at the sample rate).
+ *
+ * @param pSnapshot pointer to the structure that receives the sample and its sample number
+ * @return true if pSnapshot holds the latest sample
+ * @return false if no sample has been published yet
+ */
+bool OrientationSlot::Read(ORIENTATION_SNAPSHOT *pSnapshot) {
+	for (;;) {
+		unsigned long long ullSeq = m_ullSeq.load(std::memory_order_acquire);
+		if (ullSeq==0) {
+			return false;
+		}
+		if ((ullSeq&1)==0) {
+			memcpy(pSnapshot, &m_snapshot, sizeof(ORIENTATION_SNAPSHOT));
+			std::atomic_thread_fence(std::memory_order_acquire);//make sure that the copy is finished before the sequence word is checked again
+			if (m_ullSeq.load(std::memory_order_relaxed)==ullSeq) {
+				return true;
+			}
+		}
+		m_ullNumRetries.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief get the orientation of the latest sample that was published to the slot, extrapolated to a given time at the sample's bias-corrected angular rate (see IMU::PredictOrientation). Like Read, this does not take any lock, so a consumer running between samples (e.g. a camera frame or control loop) can get its orientation at the time it needs without waiting for the next sample.
+ *
+ * @param dQueryTimeSec the time to predict the orientation at, from the same monotonic clock as IMU::GetMonotonicTimeSec
+ * @param q the returned orientation quaternion (forward-right-down sensor axes to north-east-down world axes)
+ * @return true if q holds the predicted orientation (extrapolated by at most IMU_MAX_PREDICTION_SEC)
+ * @return false if no sample has been published yet
+ */
+bool OrientationSlot::PredictOrientation(double dQueryTimeSec, FUSION_QUAT &q) {
+	ORIENTATION_SNAPSHOT snapshot;
+	if (!Read(&snapshot)) {
+		return false;
+	}
+	IMU::PredictOrientation(&snapshot.sample, dQueryTimeSec, q);
+	return true;
+}
+
+unsigned long long OrientationSlot::GetNumPublished() {//returns the total number of samples that have been published to the slot
+	return m_ullSeq.load(std::memory_order_acquire)/2;
+}
+
+unsigned long long OrientationSlot::GetNumRetries() {//returns the total number of times that a reader had to copy the slot again because the writer was publishing
+	return m_ullNumRetries.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <atomic>
+#include "IMU.h"
+//seqlock-protected slot holding the latest fused sample, so that any number of threads (autopilot, camera stabilization, user interface, etc.) can read the current orientation at their own rates without touching the IMU object, the I2C bus, or the fusion state
+
+struct ORIENTATION_SNAPSHOT {//consistent copy of the latest fused sample
+	IMU_DATASAMPLE sample;//the sample, with its orientation quaternion (and its angles, unless lazy angles are used, see IMU::GetAngles)
+	unsigned long long sample_num;//number of the sample (0 for the first sample published to the slot)
+};
+
+class OrientationSlot {//single-writer, multi-reader slot holding the latest fused sample. The writer (IMU::ComputeOrientation) never waits for readers; readers copy the slot and retry only if the writer was in the middle of publishing.
+public:
+	OrientationSlot();//constructor
+	void Publish(const IMU_DATASAMPLE *pSample);//copy a fused sample into the slot (writer only)
+	bool Read(ORIENTATION_SNAPSHOT *pSnapshot);//get a consistent copy of the latest sample, returns false if nothing has been published yet
+	bool PredictOrientation(double dQueryTimeSec, FUSION_QUAT &q);//get the orientation of the latest sample extrapolated to a given monotonic time (see IMU::PredictOrientation), returns false if nothing has been published yet
+	unsigned long long GetNumPublished();//returns the total number of samples that have been published to the slot
+	unsigned long long GetNumRetries();//returns the total number of times that a reader had to copy the slot again because the writer was publishing
+
+private:
+	std::atomic<unsigned long long> m_ullSeq;//sequence word: odd while a sample is being written, 2 * (number of samples published) otherwise
+	ORIENTATION_SNAPSHOT m_snapshot;//the latest sample (written by Publish only)
+	std::atomic<unsigned long long> m_ullNumRetries;//number of reader retries, for monitoring contention
+};
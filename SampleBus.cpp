@@ -0,0 +1,187 @@
+/**
+ * @file SampleBus.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the SampleBus and SampleBusReader classes (single-producer, multi-consumer broadcast ring of IMU samples)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <string.h>
+#include "SampleBus.h"
+
+/**
+ * @brief Construct a new SampleBus object. All of the slots in the ring are allocated up front, so publishing and reading samples never allocates memory.
+ *
+ * @param uiCapacity the number of samples to hold in the ring. This is rounded up to the next power of 2, and should be large enough that the slowest reader can keep up with the producer.
+ */
+SampleBus::SampleBus(unsigned int uiCapacity) {
+	m_uiCapacity = 2;
+	while (m_uiCapacity<uiCapacity) {
+		m_uiCapacity<<=1;
+	}
+	m_uiMask = m_uiCapacity - 1;
+	m_slots = new SAMPLEBUS_SLOT[m_uiCapacity];
+	for (unsigned int i=0;i<m_uiCapacity;i++) {
+		m_slots[i].seq.store(0, std::memory_order_relaxed);
+		memset(&m_slots[i].sample, 0, sizeof(IMU_DATASAMPLE));
+	}
+	m_ullNumPublished.store(0, std::memory_order_release);
+}
+
+/**
+ * @brief Destroy the SampleBus object. All readers of the bus must be finished with it before it is destroyed.
+ *
+ */
+SampleBus::~SampleBus() {
+	if (m_slots!=nullptr) {
+		delete []m_slots;
+		m_slots = nullptr;
+	}
+}
+
+/**
+ * @brief get a pointer to the ring slot where the next sample should be written. The slot is marked as being written, so any reader that is still looking at the old contents of the slot will find out when it calls Release. Must be followed by a call to CommitWrite. The oldest sample in the ring is lost as soon as this is called, so a sample that might fail to be collected should be collected somewhere else first and then copied in with Publish.
+ *
+ * @return IMU_DATASAMPLE* pointer to the slot where the producer should write the next sample
+ */
+IMU_DATASAMPLE * SampleBus::BeginWrite() {
+	unsigned long long ullSampleNum = m_ullNumPublished.load(std::memory_order_relaxed);
+	SAMPLEBUS_SLOT *pSlot = &m_slots[ullSampleNum & m_uiMask];
+	pSlot->seq.store(2*ullSampleNum+1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);//make sure that the "being written" marker is visible before any of the sample data changes
+	return &pSlot->sample;
+}
+
+/**
+ * @brief publish the sample that was written to the slot returned by BeginWrite, making it visible to all readers
+ *
+ */
+void SampleBus::CommitWrite() {
+	unsigned long long ullSampleNum = m_ullNumPublished.load(std::memory_order_relaxed);
+	m_slots[ullSampleNum & m_uiMask].seq.store(2*ullSampleNum+2, std::memory_order_release);
+	m_ullNumPublished.store(ullSampleNum+1, std::memory_order_release);
+}
+
+/**
+ * @brief copy a sample into the ring and publish it. Use BeginWrite / CommitWrite instead to avoid the copy when the sample can be acquired directly into the ring.
+ *
+ * @param pSample pointer to the sample to be published
+ */
+void SampleBus::Publish(IMU_DATASAMPLE *pSample) {
+	IMU_DATASAMPLE *pSlotSample = BeginWrite();
+	memcpy(pSlotSample, pSample, sizeof(IMU_DATASAMPLE));
+	CommitWrite();
+}
+
+unsigned long long SampleBus::GetNumPublished() {//returns the total number of samples that have been published to the ring
+	return m_ullNumPublished.load(std::memory_order_acquire);
+}
+
+unsigned int SampleBus::GetCapacity() {//returns the number of samples held in the ring
+	return m_uiCapacity;
+}
+
+/**
+ * @brief Construct a new SampleBusReader object. The reader starts with the next sample that gets published after it is created.
+ *
+ * @param pBus the bus to subscribe to
+ */
+SampleBusReader::SampleBusReader(SampleBus *pBus) {
+	m_pBus = pBus;
+	m_ullCursor = pBus->GetNumPublished();
+	m_ullNumMissed = 0;
+	m_ullNumLaps = 0;
+	m_bPeeked = false;
+}
+
+/**
+ * @brief get a pointer to the next unread sample in the ring. The sample is not copied, so the caller must call Release when finished with it, and should discard whatever it read from the sample if Release returns false. If the producer has lapped this reader, the cursor is first moved forward to the oldest sample still in the ring and the skipped samples are counted as missed.
+ *
+ * @return const IMU_DATASAMPLE* pointer to the next unread sample, or nullptr if no new sample has been published yet
+ */
+const IMU_DATASAMPLE * SampleBusReader::Peek() {
+	for (;;) {
+		SAMPLEBUS_SLOT *pSlot = &m_pBus->m_slots[m_ullCursor & m_pBus->m_uiMask];
+		unsigned long long ullSeq = pSlot->seq.load(std::memory_order_acquire);
+		unsigned long long ullExpected = 2*m_ullCursor+2;
+		if (ullSeq==ullExpected) {
+			m_bPeeked = true;
+			return &pSlot->sample;
+		}
+		if (ullSeq<ullExpected) {//sample has not been committed yet
+			return nullptr;
+		}
+		Resync();//slot has already been reused for a later sample, i.e. this reader has been lapped
+	}
+}
+
+/**
+ * @brief finish with the sample returned by Peek and advance the cursor to the next sample
+ *
+ * @return true if the sample was still intact after the caller finished reading it
+ * @return false if the producer started overwriting the sample while it was being read (the data obtained from Peek should be discarded), or if Peek was not called beforehand
+ */
+bool SampleBusReader::Release() {
+	if (!m_bPeeked) return false;
+	m_bPeeked = false;
+	std::atomic_thread_fence(std::memory_order_acquire);//make sure that the caller's reads of the sample data happen before the sequence word is checked again
+	SAMPLEBUS_SLOT *pSlot = &m_pBus->m_slots[m_ullCursor & m_pBus->m_uiMask];
+	if (pSlot->seq.load(std::memory_order_relaxed)!=2*m_ullCursor+2) {
+		Resync();
+		return false;
+	}
+	m_ullCursor++;
+	return true;
+}
+
+/**
+ * @brief copy the next unread sample into pSample and advance the cursor. Samples that get overwritten during the copy are skipped over (and counted as missed).
+ *
+ * @param pSample pointer to the structure that receives the sample data
+ * @return true if a new sample was copied into pSample
+ * @return false if no new sample was available
+ */
+bool SampleBusReader::GetNext(IMU_DATASAMPLE *pSample) {
+	for (;;) {
+		const IMU_DATASAMPLE *pRingSample = Peek();
+		if (pRingSample==nullptr) return false;
+		memcpy(pSample, pRingSample, sizeof(IMU_DATASAMPLE));
+		if (Release()) return true;
+	}
+}
+
+void SampleBusReader::Resync() {//move the cursor forward to the oldest sample that is still available in the ring after being lapped by the producer
+	unsigned long long ullNumPublished = m_pBus->GetNumPublished();
+	//leave one slot of margin, since the producer may already be writing into the slot after the newest published sample
+	unsigned long long ullOldest = 0;
+	if (ullNumPublished+1>m_pBus->m_uiCapacity) {
+		ullOldest = ullNumPublished + 1 - m_pBus->m_uiCapacity;
+	}
+	if (ullOldest<=m_ullCursor) {
+		ullOldest = m_ullCursor+1;
+	}
+	m_ullNumMissed+=(ullOldest - m_ullCursor);
+	m_ullNumLaps++;
+	m_ullCursor = ullOldest;
+}
+
+unsigned long long SampleBusReader::GetNumMissed() {//returns the total number of samples that were overwritten before this reader got to them
+	return m_ullNumMissed;
+}
+
+unsigned long long SampleBusReader::GetNumLaps() {//returns the number of times that this reader was lapped by the producer
+	return m_ullNumLaps;
+}
+
+unsigned int SampleBusReader::GetNumPending() {//returns the number of published samples that this reader has not read yet
+	unsigned long long ullNumPublished = m_pBus->GetNumPublished();
+	if (ullNumPublished<=m_ullCursor) return 0;
+	unsigned long long ullPending = ullNumPublished - m_ullCursor;
+	if (ullPending>m_pBus->m_uiCapacity) {
+		ullPending = m_pBus->m_uiCapacity;
+	}
+	return (unsigned int)ullPending;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include "IMU.h"
+//broadcast ring buffer used for sharing one stream of IMU samples with any number of consumers (autopilot, logger, telemetry, camera stabilization, etc.)
+
+#define SAMPLEBUS_DEFAULT_CAPACITY 256 //default number of samples held in the broadcast ring (must be a power of 2)
+
+struct SAMPLEBUS_SLOT {//one slot of the broadcast ring
+	std::atomic<unsigned long long> seq;//sequence word for the slot: 2*n+1 while sample #n is being written, 2*n+2 once sample #n has been committed, 0 if never written
+	IMU_DATASAMPLE sample;//the sample data stored in this slot
+};
+
+class SampleBus {//single-producer, multi-consumer broadcast ring of IMU samples. The producer writes each sample once, directly into the ring, and readers access it in place without taking any lock.
+public:
+	SampleBus(unsigned int uiCapacity);//constructor
+	~SampleBus();//destructor
+	IMU_DATASAMPLE * BeginWrite();//get a pointer to the ring slot where the next sample should be written (producer only)
+	void CommitWrite();//publish the sample that was written to the slot returned by BeginWrite (producer only)
+	void Publish(IMU_DATASAMPLE *pSample);//copy a sample into the ring and publish it (producer only)
+	unsigned long long GetNumPublished();//returns the total number of samples that have been published to the ring
+	unsigned int GetCapacity();//returns the number of samples held in the ring
+
+private:
+	friend class SampleBusReader;
+	SAMPLEBUS_SLOT *m_slots;//the preallocated ring of sample slots
+	unsigned int m_uiCapacity;//number of slots in the ring (a power of 2)
+	unsigned int m_uiMask;//m_uiCapacity - 1, used for wrapping sample numbers into slot indices
+	std::atomic<unsigned long long> m_ullNumPublished;//total number of committed samples, i.e. the sample number of the next sample to be written
+};
+
+class SampleBusReader {//subscriber of a SampleBus, each consumer has its own reader with an independent cursor
+public:
+	SampleBusReader(SampleBus *pBus);//constructor, the reader starts with the next sample published after it is created
+	const IMU_DATASAMPLE * Peek();//get a pointer to the next unread sample in the ring, or nullptr if no new sample is available yet. The sample is read in place (no copy).
+	bool Release();//finish with the sample returned by Peek and advance to the next one. Returns false if the producer overwrote the sample while it was being read.
+	bool GetNext(IMU_DATASAMPLE *pSample);//copy the next unread sample into pSample and advance, returns false if no new sample is available
+	unsigned long long GetNumMissed();//returns the total number of samples that were overwritten before this reader got to them
+	unsigned long long GetNumLaps();//returns the number of times that this reader was lapped by the producer
+	unsigned int GetNumPending();//returns the number of published samples that this reader has not read yet
+
+private:
+	SampleBus *m_pBus;//the bus that this reader subscribes to
+	unsigned long long m_ullCursor;//sample number of the next sample to be read
+	unsigned long long m_ullNumMissed;//total number of samples that were lost because the producer lapped this reader
+	unsigned long long m_ullNumLaps;//number of times that this reader was lapped by the producer
+	bool m_bPeeked;//true if Peek returned a sample that has not been released yet
+	void Resync();//move the cursor forward to the oldest sample that is still available in the ring after being lapped by the producer
+};
@@ -0,0 +1,324 @@
+/**
+ * @file ShockDetector.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the ShockDetector class (shock / impact event detection with a pre-trigger capture buffer)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "ShipLog.h"
+#include "ShockDetector.h"
+
+extern ShipLog g_shiplog;//used for logging data and to assist in debugging
+
+/**
+ * @brief Construct a new ShockDetector object. The pre-trigger history and the event slots are allocated up front, so the sampling thread never allocates memory or waits on file I/O.
+ *
+ * @param pIMU the IMU whose readings are watched for shock events
+ * @param pConfig detector settings (see GetDefaultConfig)
+ * @param szOutputDir the directory that event files are written to
+ */
+ShockDetector::ShockDetector(IMU *pIMU, SHOCK_CONFIG *pConfig, const char *szOutputDir) {
+	m_pIMU = pIMU;
+	memcpy(&m_config, pConfig, sizeof(SHOCK_CONFIG));
+	strncpy(m_szOutputDir, szOutputDir, SHOCK_MAX_PATH - 1);
+	m_szOutputDir[SHOCK_MAX_PATH - 1] = 0;
+	m_uiPreReadings = (unsigned int)ceil(m_config.pre_trigger_ms * m_config.reading_rate_hz / 1000.0);
+	m_uiPostReadings = (unsigned int)ceil(m_config.post_trigger_ms * m_config.reading_rate_hz / 1000.0);
+	//the history has to hold the pre-trigger readings, the trigger, and all of the post-trigger readings until the capture is copied out
+	unsigned int uiHistorySize = 2;
+	while (uiHistorySize<m_uiPreReadings + m_uiPostReadings + 1) {
+		uiHistorySize<<=1;
+	}
+	m_history = new IMU_RAW_READING[uiHistorySize];
+	memset(m_history, 0, uiHistorySize*sizeof(IMU_RAW_READING));
+	m_uiHistoryMask = uiHistorySize - 1;
+	for (int i=0;i<SHOCK_NUM_EVENT_SLOTS;i++) {
+		m_slotReadings[i] = new IMU_RAW_READING[m_uiPreReadings + m_uiPostReadings + 1];
+		memset(&m_slotInfo[i], 0, sizeof(SHOCK_EVENT_INFO));
+		m_slotReady[i] = false;
+	}
+	m_ullNumReadings = 0;
+	m_bHavePrevReading = false;
+	memset(m_prevAcc, 0, 3*sizeof(double));
+	m_dPrevTime = 0.0;
+	m_bCapturing = false;
+	m_nPrevFullScaleG = 2;
+	m_dSaturationG = 2 * SHOCK_SATURATION_FRACTION;
+	m_ullTriggerReading = 0;
+	memset(&m_currentEvent, 0, sizeof(SHOCK_EVENT_INFO));
+	m_uiNumEvents = 0;
+	m_uiNumWritten = 0;
+	m_uiNumDropped = 0;
+	pthread_mutex_init(&m_infoMutex, nullptr);
+	memset(&m_lastEvent, 0, sizeof(SHOCK_EVENT_INFO));
+	sem_init(&m_writeSem, 0, 0);
+	m_bRunning = false;
+	m_bThreadStarted = false;
+	memset(m_szErrMsg, 0, 256);
+}
+
+/**
+ * @brief Destroy the ShockDetector object (stops the detector if it is still running)
+ *
+ */
+ShockDetector::~ShockDetector() {
+	Stop();
+	sem_destroy(&m_writeSem);
+	pthread_mutex_destroy(&m_infoMutex);
+	for (int i=0;i<SHOCK_NUM_EVENT_SLOTS;i++) {
+		delete []m_slotReadings[i];
+		m_slotReadings[i] = nullptr;
+	}
+	if (m_history!=nullptr) {
+		delete []m_history;
+		m_history = nullptr;
+	}
+}
+
+/**
+ * @brief fill a SHOCK_CONFIG structure with the default settings: trigger on 0.8 G of acceleration change from gravity, 100 G/sec of jerk, or 300 deg/sec of rotation, capture 500 ms before and 1000 ms after each event at the normal 104 Hz acc/gyro rate, and switch the accelerometer to +/- 16 G full-scale while the detector is attached, so that slams and groundings are captured without clipping
+ *
+ * @param pConfig pointer to the structure that receives the default settings
+ */
+void ShockDetector::GetDefaultConfig(SHOCK_CONFIG *pConfig) {
+	pConfig->acc_threshold_g = 0.8;
+	pConfig->jerk_threshold_g_per_sec = 100.0;
+	pConfig->gyro_threshold_dps = 300.0;
+	pConfig->pre_trigger_ms = 500;
+	pConfig->post_trigger_ms = 1000;
+	pConfig->reading_rate_hz = ACC_GYRO_ODR_HZ;
+	pConfig->acc_full_scale_g = 16;
+}
+
+/**
+ * @brief start the writer thread, switch the accelerometer to the configured full-scale range (see IMU::SetAccFullScale), and attach the detector to the reading tap of the IMU (see IMU::SetReadingTap). Events are only detected in readings that get collected, so something else (e.g. an IMUAcquisition thread) has to keep sampling the IMU; use FIFO averaging mode (IMU::EnableFifoAveraging) to have every 104 Hz reading checked when samples are averaged or collected at a lower rate.
+ *
+ * @return true if the detector was started
+ * @return false if the detector is already running, the full-scale range could not be set, or the writer thread could not be created
+ */
+bool ShockDetector::Start() {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, shock detector is already running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	m_nPrevFullScaleG = m_pIMU->GetAccFullScale();
+	if (m_config.acc_full_scale_g>0&&m_config.acc_full_scale_g!=m_nPrevFullScaleG&&!m_pIMU->SetAccFullScale(m_config.acc_full_scale_g)) {
+		return false;
+	}
+	m_dSaturationG = m_pIMU->GetAccFullScale() * SHOCK_SATURATION_FRACTION;
+	m_bRunning = true;
+	int nRetval = pthread_create(&m_thread, nullptr, WriterThread, this);
+	if (nRetval!=0) {
+		sprintf(m_szErrMsg, "Error (%s) trying to start shock event writer thread.\n", strerror(nRetval));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bRunning = false;
+		m_pIMU->SetAccFullScale(m_nPrevFullScaleG);
+		return false;
+	}
+	m_bThreadStarted = true;
+	m_ullNumReadings = 0;
+	m_bHavePrevReading = false;
+	m_bCapturing = false;
+	m_pIMU->SetReadingTap(OnReading, this);
+	return true;
+}
+
+/**
+ * @brief detach the detector from the IMU, put the accelerometer back to the full-scale range that it had before Start, write any captured events that are still waiting, and stop the writer thread. An event whose post-trigger readings have not all arrived yet is written with the readings that it has.
+ *
+ */
+void ShockDetector::Stop() {
+	if (!m_bThreadStarted) {
+		return;
+	}
+	m_pIMU->SetReadingTap(nullptr, nullptr);
+	if (m_pIMU->GetAccFullScale()!=m_nPrevFullScaleG) {
+		m_pIMU->SetAccFullScale(m_nPrevFullScaleG);
+	}
+	if (m_bCapturing) {
+		FinishCapture();
+	}
+	m_bRunning = false;
+	sem_post(&m_writeSem);
+	pthread_join(m_thread, nullptr);
+	m_bThreadStarted = false;
+}
+
+unsigned int ShockDetector::GetNumEvents() {//returns the number of events that have been triggered
+	return m_uiNumEvents.load();
+}
+
+unsigned int ShockDetector::GetNumWritten() {//returns the number of events that have been written to files
+	return m_uiNumWritten.load();
+}
+
+unsigned int ShockDetector::GetNumDropped() {//returns the number of events that were dropped because all of the event slots were waiting to be written
+	return m_uiNumDropped.load();
+}
+
+/**
+ * @brief get the summary of the most recently written event
+ *
+ * @param pInfo pointer to the structure that receives a copy of the event summary
+ * @return true if an event summary was copied into pInfo
+ * @return false if no event has been written yet
+ */
+bool ShockDetector::GetLastEvent(SHOCK_EVENT_INFO *pInfo) {
+	pthread_mutex_lock(&m_infoMutex);
+	bool bHaveEvent = m_lastEvent.event_num>0;
+	if (bHaveEvent) {
+		memcpy(pInfo, &m_lastEvent, sizeof(SHOCK_EVENT_INFO));
+	}
+	pthread_mutex_unlock(&m_infoMutex);
+	return bHaveEvent;
+}
+
+void ShockDetector::OnReading(const IMU_RAW_READING *pReading, void *pUserData) {//reading tap callback
+	ShockDetector *pDetector = (ShockDetector *)pUserData;
+	pDetector->ProcessReading(pReading);
+}
+
+void ShockDetector::ProcessReading(const IMU_RAW_READING *pReading) {//add a reading to the history, check it for a trigger, and hand off completed captures to the writer thread
+	//runs in the sampling thread: constant time per reading, no allocation, no I/O, no waiting
+	memcpy(&m_history[m_ullNumReadings & m_uiHistoryMask], pReading, sizeof(IMU_RAW_READING));
+	double dAccDev = fabs(sqrt(pReading->acc[0]*pReading->acc[0] + pReading->acc[1]*pReading->acc[1] + pReading->acc[2]*pReading->acc[2]) - 1.0);
+	double dGyro = sqrt(pReading->angular_rate[0]*pReading->angular_rate[0] + pReading->angular_rate[1]*pReading->angular_rate[1] + pReading->angular_rate[2]*pReading->angular_rate[2]);
+	bool bSaturated = fabs(pReading->acc[0])>=m_dSaturationG||fabs(pReading->acc[1])>=m_dSaturationG||fabs(pReading->acc[2])>=m_dSaturationG;
+	double dJerk = 0.0;
+	if (m_bHavePrevReading) {
+		double dt = pReading->sample_time_sec - m_dPrevTime;
+		if (dt<=0.0) {
+			dt = 1.0 / m_config.reading_rate_hz;
+		}
+		double dx = pReading->acc[0] - m_prevAcc[0];
+		double dy = pReading->acc[1] - m_prevAcc[1];
+		double dz = pReading->acc[2] - m_prevAcc[2];
+		dJerk = sqrt(dx*dx + dy*dy + dz*dz) / dt;
+	}
+	memcpy(m_prevAcc, pReading->acc, 3*sizeof(double));
+	m_dPrevTime = pReading->sample_time_sec;
+	m_bHavePrevReading = true;
+
+	if (m_bCapturing) {
+		if (dAccDev>m_currentEvent.peak_acc_g) m_currentEvent.peak_acc_g = dAccDev;
+		if (dJerk>m_currentEvent.peak_jerk_g_per_sec) m_currentEvent.peak_jerk_g_per_sec = dJerk;
+		if (dGyro>m_currentEvent.peak_gyro_dps) m_currentEvent.peak_gyro_dps = dGyro;
+		if (bSaturated) m_currentEvent.num_saturated++;
+		m_ullNumReadings++;
+		if (m_ullNumReadings - m_ullTriggerReading>m_uiPostReadings) {
+			FinishCapture();
+		}
+		return;
+	}
+	bool bTrigger = (m_config.acc_threshold_g>0.0&&dAccDev>m_config.acc_threshold_g) ||
+		(m_config.jerk_threshold_g_per_sec>0.0&&dJerk>m_config.jerk_threshold_g_per_sec) ||
+		(m_config.gyro_threshold_dps>0.0&&dGyro>m_config.gyro_threshold_dps);
+	if (bTrigger) {
+		m_bCapturing = true;
+		m_ullTriggerReading = m_ullNumReadings;
+		memset(&m_currentEvent, 0, sizeof(SHOCK_EVENT_INFO));
+		m_currentEvent.event_num = ++m_uiNumEvents;
+		m_currentEvent.trigger_time_sec = pReading->sample_time_sec;
+		m_currentEvent.peak_acc_g = dAccDev;
+		m_currentEvent.peak_jerk_g_per_sec = dJerk;
+		m_currentEvent.peak_gyro_dps = dGyro;
+		m_currentEvent.num_saturated = bSaturated ? 1 : 0;
+	}
+	m_ullNumReadings++;
+	if (bTrigger&&m_uiPostReadings==0) {
+		FinishCapture();
+	}
+}
+
+void ShockDetector::FinishCapture() {//copy the readings of the current capture into a free slot and wake up the writer thread
+	m_bCapturing = false;
+	int nSlot = -1;
+	for (int i=0;i<SHOCK_NUM_EVENT_SLOTS;i++) {
+		if (!m_slotReady[i].load(std::memory_order_acquire)) {
+			nSlot = i;
+			break;
+		}
+	}
+	if (nSlot<0) {
+		m_uiNumDropped++;//writer thread is still busy with earlier events
+		return;
+	}
+	unsigned long long ullFirst = m_ullTriggerReading>=m_uiPreReadings ? m_ullTriggerReading - m_uiPreReadings : 0;
+	unsigned int uiNumReadings = (unsigned int)(m_ullNumReadings - ullFirst);
+	for (unsigned int i=0;i<uiNumReadings;i++) {
+		memcpy(&m_slotReadings[nSlot][i], &m_history[(ullFirst + i) & m_uiHistoryMask], sizeof(IMU_RAW_READING));
+	}
+	m_currentEvent.num_readings = uiNumReadings;
+	m_currentEvent.trigger_index = (unsigned int)(m_ullTriggerReading - ullFirst);
+	memcpy(&m_slotInfo[nSlot], &m_currentEvent, sizeof(SHOCK_EVENT_INFO));
+	m_slotReady[nSlot].store(true, std::memory_order_release);
+	sem_post(&m_writeSem);
+}
+
+void *ShockDetector::WriterThread(void *pParam) {//thread function for writing events to files
+	ShockDetector *pDetector = (ShockDetector *)pParam;
+	pDetector->WriterLoop();
+	return nullptr;
+}
+
+void ShockDetector::WriterLoop() {//loop that runs in the writer thread until Stop is called
+	while (m_bRunning) {
+		sem_wait(&m_writeSem);
+		WriteSlots();
+	}
+	WriteSlots();//events that were handed off while stopping
+}
+
+void ShockDetector::WriteSlots() {//write every ready slot to a file
+	for (int i=0;i<SHOCK_NUM_EVENT_SLOTS;i++) {
+		if (!m_slotReady[i].load(std::memory_order_acquire)) {
+			continue;
+		}
+		if (WriteEvent(m_slotReadings[i], &m_slotInfo[i])) {
+			m_uiNumWritten++;
+			pthread_mutex_lock(&m_infoMutex);
+			memcpy(&m_lastEvent, &m_slotInfo[i], sizeof(SHOCK_EVENT_INFO));
+			pthread_mutex_unlock(&m_infoMutex);
+		}
+		m_slotReady[i].store(false, std::memory_order_release);
+	}
+}
+
+bool ShockDetector::WriteEvent(IMU_RAW_READING *pReadings, SHOCK_EVENT_INFO *pInfo) {//write one event to a file
+	//file name includes the wall-clock time of the write and the event number, e.g. shock_20261018_153012_3.csv
+	char szFilename[SHOCK_MAX_PATH + 64];
+	char szTime[32];
+	time_t now = time(nullptr);
+	struct tm nowTm;
+	localtime_r(&now, &nowTm);
+	strftime(szTime, sizeof(szTime), "%Y%m%d_%H%M%S", &nowTm);
+	snprintf(szFilename, sizeof(szFilename), "%s/shock_%s_%u.csv", m_szOutputDir, szTime, pInfo->event_num);
+	FILE *pFile = fopen(szFilename, "w");
+	if (pFile==nullptr) {
+		snprintf(m_szErrMsg, sizeof(m_szErrMsg), "Error (%s) trying to open shock event file for writing.\n", strerror(errno));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	double dTriggerTime = pInfo->trigger_time_sec;
+	fprintf(pFile, "Time(s), AccX(G), AccY(G), AccZ(G), GyroX(deg/s), GyroY(deg/s), GyroZ(deg/s)\n");
+	for (unsigned int i=0;i<pInfo->num_readings;i++) {
+		IMU_RAW_READING *pReading = &pReadings[i];
+		fprintf(pFile, "%.4f, %.5f, %.5f, %.5f, %.3f, %.3f, %.3f\n", pReading->sample_time_sec - dTriggerTime, pReading->acc[0], pReading->acc[1], pReading->acc[2],
+			pReading->angular_rate[0], pReading->angular_rate[1], pReading->angular_rate[2]);
+	}
+	fclose(pFile);
+	snprintf(m_szErrMsg, sizeof(m_szErrMsg), "Shock event %u: peak acc = %.2f G, peak jerk = %.1f G/sec, peak rate = %.1f deg/sec, %u clipped readings, %u readings written to %s\n", pInfo->event_num, pInfo->peak_acc_g,
+		pInfo->peak_jerk_g_per_sec, pInfo->peak_gyro_dps, pInfo->num_saturated, pInfo->num_readings, szFilename);
+	g_shiplog.LogEntry(m_szErrMsg, false);
+	return true;
+}
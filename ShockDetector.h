@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include "IMU.h"
+//shock / impact event detector, watches every full-rate acc/gyro reading (through the IMU reading tap) for threshold or jerk events, and writes the readings from before and after each event to a file from a thread of its own
+
+#define SHOCK_NUM_EVENT_SLOTS 2 //number of captured events that can be waiting to be written at the same time (events that arrive while all slots are full are dropped)
+#define SHOCK_MAX_PATH 256 //maximum length of the output directory and file names
+#define SHOCK_SATURATION_FRACTION 0.998 //fraction of the accelerometer full-scale range at which an axis is treated as clipped
+
+struct SHOCK_CONFIG {//settings for the shock detector
+	double acc_threshold_g;//trigger when the magnitude of the acceleration differs from 1 G by more than this (in G, 0 to disable)
+	double jerk_threshold_g_per_sec;//trigger when the acceleration changes faster than this between consecutive readings (in G/sec, 0 to disable)
+	double gyro_threshold_dps;//trigger when the magnitude of the angular rate is more than this (in deg/sec, 0 to disable)
+	unsigned int pre_trigger_ms;//time before each event to capture (in milliseconds)
+	unsigned int post_trigger_ms;//time after each event to capture (in milliseconds)
+	double reading_rate_hz;//rate of the readings that the detector sees (used for sizing the buffers, e.g. ACC_GYRO_ODR_HZ)
+	int acc_full_scale_g;//accelerometer full-scale range (2, 4, 8, or 16 G) to use while the detector is attached, so that impacts do not clip (0 to leave the range as it is)
+};
+
+struct SHOCK_EVENT_INFO {//summary of a captured shock event
+	unsigned int event_num;//number of the event (starting at 1)
+	double trigger_time_sec;//monotonic time of the reading that triggered the event
+	double peak_acc_g;//largest deviation of the acceleration magnitude from 1 G during the event (in G)
+	double peak_jerk_g_per_sec;//largest change in acceleration between consecutive readings during the event (in G/sec)
+	double peak_gyro_dps;//largest angular rate magnitude during the event (in deg/sec)
+	unsigned int num_readings;//number of readings captured (pre-trigger plus post-trigger)
+	unsigned int trigger_index;//index of the triggering reading within the captured readings
+	unsigned int num_saturated;//number of readings from the trigger on that had an axis at the accelerometer full-scale limit (their true peaks were higher than recorded)
+};
+
+class ShockDetector {//detects shock events in the full-rate acc/gyro readings of an IMU and writes them to files asynchronously
+public:
+	ShockDetector(IMU *pIMU, SHOCK_CONFIG *pConfig, const char *szOutputDir);//constructor
+	~ShockDetector();//destructor
+	static void GetDefaultConfig(SHOCK_CONFIG *pConfig);//fill pConfig with the default settings
+	bool Start();//start the writer thread and attach the detector to the reading tap of the IMU (call before sampling starts)
+	void Stop();//detach from the IMU, write any captured events that are still waiting, and stop the writer thread (call after sampling has stopped)
+	unsigned int GetNumEvents();//returns the number of events that have been triggered
+	unsigned int GetNumWritten();//returns the number of events that have been written to files
+	unsigned int GetNumDropped();//returns the number of events that were dropped because all of the event slots were waiting to be written
+	bool GetLastEvent(SHOCK_EVENT_INFO *pInfo);//get the summary of the most recently written event, returns false if no event has been written yet
+
+private:
+	//data
+	IMU *m_pIMU;//the IMU that readings come from
+	SHOCK_CONFIG m_config;//detector settings
+	char m_szOutputDir[SHOCK_MAX_PATH];//directory that event files are written to
+	unsigned int m_uiPreReadings;//number of readings captured before the trigger
+	unsigned int m_uiPostReadings;//number of readings captured after the trigger
+	IMU_RAW_READING *m_history;//circular buffer of the most recent readings (power of 2 size)
+	unsigned int m_uiHistoryMask;//size of m_history - 1
+	unsigned long long m_ullNumReadings;//total number of readings seen
+	bool m_bHavePrevReading;//true if m_prevAcc holds the previous reading (for jerk)
+	double m_prevAcc[3];//acceleration of the previous reading
+	double m_dPrevTime;//time of the previous reading
+	bool m_bCapturing;//true from a trigger until its post-trigger readings have all arrived
+	int m_nPrevFullScaleG;//accelerometer full-scale range of the IMU before Start changed it (restored by Stop)
+	double m_dSaturationG;//acceleration (in G) on any axis at which a reading is counted as clipped
+	unsigned long long m_ullTriggerReading;//index (in m_ullNumReadings terms) of the reading that triggered the current capture
+	SHOCK_EVENT_INFO m_currentEvent;//summary of the event being captured
+	IMU_RAW_READING *m_slotReadings[SHOCK_NUM_EVENT_SLOTS];//captured readings of each event slot
+	SHOCK_EVENT_INFO m_slotInfo[SHOCK_NUM_EVENT_SLOTS];//summary of the event in each slot
+	std::atomic<bool> m_slotReady[SHOCK_NUM_EVENT_SLOTS];//true if a slot holds an event that is waiting to be written
+	std::atomic<unsigned int> m_uiNumEvents;//number of events that have been triggered
+	std::atomic<unsigned int> m_uiNumWritten;//number of events written to files
+	std::atomic<unsigned int> m_uiNumDropped;//number of events dropped because all slots were busy
+	pthread_mutex_t m_infoMutex;//protects m_lastEvent
+	SHOCK_EVENT_INFO m_lastEvent;//summary of the most recently written event
+	sem_t m_writeSem;//posted each time that a slot becomes ready (and by Stop)
+	std::atomic<bool> m_bRunning;//true while the writer thread should keep running
+	bool m_bThreadStarted;//true if m_thread was created and has not been joined yet
+	pthread_t m_thread;//handle to the writer thread
+	char m_szErrMsg[256];//buffer space used for outputting error messages
+
+	//functions
+	static void OnReading(const IMU_RAW_READING *pReading, void *pUserData);//reading tap callback
+	void ProcessReading(const IMU_RAW_READING *pReading);//add a reading to the history, check it for a trigger, and hand off completed captures to the writer thread
+	void FinishCapture();//copy the readings of the current capture into a free slot and wake up the writer thread
+	static void *WriterThread(void *pParam);//thread function for writing events to files
+	void WriterLoop();//loop that runs in the writer thread until Stop is called
+	void WriteSlots();//write every ready slot to a file
+	bool WriteEvent(IMU_RAW_READING *pReadings, SHOCK_EVENT_INFO *pInfo);//write one event to a file
+};
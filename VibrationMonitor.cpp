@@ -0,0 +1,346 @@
+/**
+ * @file VibrationMonitor.cpp
+ * @author Murray Lowery-Simpson (murraylowerysimpson@gmail.com)
+ * @brief Implementation file for the VibrationMonitor class (vibration spectrum analysis of a 1.66 kHz accelerometer stream)
+ * @version 0.1
+ * @date 2026-10-18
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "ShipLog.h"
+#include "VibrationMonitor.h"
+
+extern ShipLog g_shiplog;//used for logging data and to assist in debugging
+
+static double MonotonicTimeSec() {//returns the time (in seconds) from the monotonic clock (same clock as the IMU sample timestamps)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1.0e9;
+}
+
+/**
+ * @brief Construct a new VibrationMonitor object. The window, twiddle factors, and all working buffers are set up here, so the analysis thread never allocates memory and each FFT costs the same amount of time.
+ *
+ * @param pIMU the IMU that accelerometer readings are collected from
+ * @param dPublishPeriodSec the time between published spectra in seconds (each spectrum is the average of all of the FFTs in its period)
+ */
+VibrationMonitor::VibrationMonitor(IMU *pIMU, double dPublishPeriodSec) {
+	m_pIMU = pIMU;
+	m_dPublishPeriodSec = dPublishPeriodSec;
+	m_nNumBands = 0;
+	memset(m_bandLowHz, 0, sizeof(m_bandLowHz));
+	memset(m_bandHighHz, 0, sizeof(m_bandHighHz));
+	memset(m_bandFirstBin, 0, sizeof(m_bandFirstBin));
+	memset(m_bandLastBin, 0, sizeof(m_bandLastBin));
+	for (int i=0;i<VIB_FFT_SIZE;i++) {
+		m_window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / VIB_FFT_SIZE);//periodic Hann window
+	}
+	for (int i=0;i<VIB_FFT_SIZE/2;i++) {
+		m_cosTable[i] = cos(2 * M_PI * i / VIB_FFT_SIZE);
+		m_sinTable[i] = -sin(2 * M_PI * i / VIB_FFT_SIZE);
+	}
+	int nNumBits = 0;
+	while ((1<<nNumBits)<VIB_FFT_SIZE) {
+		nNumBits++;
+	}
+	for (int i=0;i<VIB_FFT_SIZE;i++) {
+		int nReversed = 0;
+		for (int j=0;j<nNumBits;j++) {
+			if ((i&(1<<j))!=0) {
+				nReversed|=(1<<(nNumBits - 1 - j));
+			}
+		}
+		m_bitReverse[i] = nReversed;
+	}
+	memset(m_history, 0, sizeof(m_history));
+	m_uiHistoryPos = 0;
+	m_uiNumSinceFFT = 0;
+	m_uiNumReadings = 0;
+	memset(m_re, 0, sizeof(m_re));
+	memset(m_im, 0, sizeof(m_im));
+	memset(m_binEnergySum, 0, sizeof(m_binEnergySum));
+	m_uiNumFFTs = 0;
+	m_uiNumOverruns = 0;
+	memset(m_readBuf, 0, sizeof(m_readBuf));
+	pthread_mutex_init(&m_spectrumMutex, nullptr);
+	memset(&m_spectrum, 0, sizeof(VIB_SPECTRUM));
+	m_uiNumSpectra = 0;
+	m_bRunning = false;
+	m_bThreadStarted = false;
+	memset(m_szErrMsg, 0, 256);
+}
+
+/**
+ * @brief Destroy the VibrationMonitor object (stops the analysis thread if it is still running)
+ *
+ */
+VibrationMonitor::~VibrationMonitor() {
+	Stop();
+	pthread_mutex_destroy(&m_spectrumMutex);
+}
+
+/**
+ * @brief add a frequency band to compute the vibration energy of. If no bands are added, VIB_DEFAULT_NUM_BANDS equal-width bands from 0 Hz to the Nyquist frequency (833 Hz) are used.
+ *
+ * @param dLowHz the lower edge of the band in Hz
+ * @param dHighHz the upper edge of the band in Hz
+ * @return true if the band was added
+ * @return false if the band is invalid, VIB_MAX_BANDS bands have already been added, or the monitor is already running
+ */
+bool VibrationMonitor::AddBand(double dLowHz, double dHighHz) {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, bands cannot be added while the vibration monitor is running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (m_nNumBands>=VIB_MAX_BANDS||dLowHz<0.0||dHighHz<=dLowHz) {
+		sprintf(m_szErrMsg, "Error, invalid vibration band (%.1f to %.1f Hz) or too many bands.\n", dLowHz, dHighHz);
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	m_bandLowHz[m_nNumBands] = dLowHz;
+	m_bandHighHz[m_nNumBands] = dHighHz;
+	m_nNumBands++;
+	return true;
+}
+
+/**
+ * @brief start streaming the accelerometer at 1.66 kHz (see IMU::EnableAccStream) and start the analysis thread. The attitude path (GetSample etc.) keeps working while the monitor runs, since the stream is read in short bursts from its own thread.
+ *
+ * @return true if the monitor was started
+ * @return false if the monitor is already running, the accelerometer stream could not be started, or the thread could not be created
+ */
+bool VibrationMonitor::Start() {
+	if (m_bThreadStarted) {
+		strcpy(m_szErrMsg, (char *)"Error, vibration monitor is already running.\n");
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		return false;
+	}
+	if (m_nNumBands==0) {
+		double dBandWidthHz = ACC_STREAM_ODR_HZ / 2 / VIB_DEFAULT_NUM_BANDS;
+		for (int i=0;i<VIB_DEFAULT_NUM_BANDS;i++) {
+			AddBand(i * dBandWidthHz, (i + 1) * dBandWidthHz);
+		}
+	}
+	//convert band edges to FFT bins (the DC bin is never included)
+	double dBinHz = ACC_STREAM_ODR_HZ / VIB_FFT_SIZE;
+	for (int i=0;i<m_nNumBands;i++) {
+		int nFirstBin = (int)ceil(m_bandLowHz[i] / dBinHz);
+		int nLastBin = (int)ceil(m_bandHighHz[i] / dBinHz) - 1;
+		if (nFirstBin<1) nFirstBin = 1;
+		if (nLastBin>VIB_FFT_SIZE/2 - 1) nLastBin = VIB_FFT_SIZE/2 - 1;
+		m_bandFirstBin[i] = nFirstBin;
+		m_bandLastBin[i] = nLastBin;
+	}
+	m_uiHistoryPos = 0;
+	m_uiNumSinceFFT = 0;
+	m_uiNumReadings = 0;
+	memset(m_binEnergySum, 0, sizeof(m_binEnergySum));
+	m_uiNumFFTs = 0;
+	m_uiNumOverruns = 0;
+	pthread_mutex_lock(&m_spectrumMutex);
+	m_uiNumSpectra = 0;
+	pthread_mutex_unlock(&m_spectrumMutex);
+	if (!m_pIMU->EnableAccStream()) {
+		return false;
+	}
+	m_bRunning = true;
+	int nRetval = pthread_create(&m_thread, nullptr, AnalysisThread, this);
+	if (nRetval!=0) {
+		sprintf(m_szErrMsg, "Error (%s) trying to start vibration analysis thread.\n", strerror(nRetval));
+		g_shiplog.LogEntry(m_szErrMsg, true);
+		m_bRunning = false;
+		m_pIMU->DisableAccStream();
+		return false;
+	}
+	m_bThreadStarted = true;
+	return true;
+}
+
+/**
+ * @brief stop the analysis thread and return the accelerometer to its normal 104 Hz ODR. The last published spectrum can still be read after the monitor is stopped.
+ *
+ */
+void VibrationMonitor::Stop() {
+	m_bRunning = false;
+	if (m_bThreadStarted) {
+		pthread_join(m_thread, nullptr);
+		m_bThreadStarted = false;
+		m_pIMU->DisableAccStream();
+	}
+}
+
+/**
+ * @brief get the most recently published vibration spectrum
+ *
+ * @param pSpectrum pointer to the structure that receives a copy of the spectrum
+ * @return true if a spectrum was copied into pSpectrum
+ * @return false if no spectrum has been published yet
+ */
+bool VibrationMonitor::GetSpectrum(VIB_SPECTRUM *pSpectrum) {
+	pthread_mutex_lock(&m_spectrumMutex);
+	bool bHaveSpectrum = m_uiNumSpectra>0;
+	if (bHaveSpectrum) {
+		memcpy(pSpectrum, &m_spectrum, sizeof(VIB_SPECTRUM));
+	}
+	pthread_mutex_unlock(&m_spectrumMutex);
+	return bHaveSpectrum;
+}
+
+unsigned int VibrationMonitor::GetNumSpectra() {//returns the number of spectra published since Start was called
+	pthread_mutex_lock(&m_spectrumMutex);
+	unsigned int uiNumSpectra = m_uiNumSpectra;
+	pthread_mutex_unlock(&m_spectrumMutex);
+	return uiNumSpectra;
+}
+
+void *VibrationMonitor::AnalysisThread(void *pParam) {//thread function for collecting readings and computing spectra
+	VibrationMonitor *pMonitor = (VibrationMonitor *)pParam;
+	pMonitor->AnalysisLoop();
+	return nullptr;
+}
+
+void VibrationMonitor::AnalysisLoop() {//loop that runs in the analysis thread until Stop is called
+	const long NSEC_PER_SEC = 1000000000L;
+	struct timespec nextWakeup;
+	clock_gettime(CLOCK_MONOTONIC, &nextWakeup);
+	double dNextPublishSec = MonotonicTimeSec() + m_dPublishPeriodSec;
+	while (m_bRunning) {
+		nextWakeup.tv_nsec += VIB_POLL_PERIOD_US * 1000L;
+		while (nextWakeup.tv_nsec>=NSEC_PER_SEC) {
+			nextWakeup.tv_nsec -= NSEC_PER_SEC;
+			nextWakeup.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextWakeup, nullptr);
+		//empty the FIFO in bursts of at most VIB_MAX_READINGS_PER_BURST readings, releasing the bus in between
+		int nNumRead = 0;
+		do {
+			bool bOverrun = false;
+			nNumRead = m_pIMU->ReadAccStream(m_readBuf, VIB_MAX_READINGS_PER_BURST, bOverrun);
+			if (bOverrun) {
+				m_uiNumOverruns++;
+			}
+			for (int i=0;i<nNumRead;i++) {
+				AddReading(&m_readBuf[3*i]);
+			}
+		} while (nNumRead==VIB_MAX_READINGS_PER_BURST&&m_bRunning);
+		double dNowSec = MonotonicTimeSec();
+		if (dNowSec>=dNextPublishSec) {
+			Publish(dNowSec);
+			dNextPublishSec+=m_dPublishPeriodSec;
+			if (dNextPublishSec<dNowSec) {
+				dNextPublishSec = dNowSec + m_dPublishPeriodSec;
+			}
+		}
+	}
+}
+
+void VibrationMonitor::AddReading(double *acc_data) {//add one X, Y, Z reading to the history, and compute an FFT when VIB_HOP_SIZE new readings have arrived
+	for (int j=0;j<3;j++) {
+		m_history[j][m_uiHistoryPos] = acc_data[j];
+	}
+	m_uiHistoryPos = (m_uiHistoryPos + 1) & (VIB_FFT_SIZE - 1);
+	if (m_uiNumReadings<VIB_FFT_SIZE) {
+		m_uiNumReadings++;
+	}
+	m_uiNumSinceFFT++;
+	if (m_uiNumSinceFFT>=VIB_HOP_SIZE&&m_uiNumReadings>=VIB_FFT_SIZE) {
+		m_uiNumSinceFFT = 0;
+		ComputeFFTEnergies();
+	}
+}
+
+void VibrationMonitor::ComputeFFTEnergies() {//window the most recent VIB_FFT_SIZE readings, transform them, and add the energy of each bin to m_binEnergySum
+	//remove the mean of each axis (gravity and any static tilt) before windowing, so that the DC leakage of the window does not swamp the lowest bands
+	double dMean[3] = {0.0, 0.0, 0.0};
+	for (int j=0;j<3;j++) {
+		for (int i=0;i<VIB_FFT_SIZE;i++) {
+			dMean[j]+=m_history[j][i];
+		}
+		dMean[j]/=VIB_FFT_SIZE;
+	}
+	//two real transforms for the price of one: X goes in the real part and Y in the imaginary part of the first transform, Z in the real part of the second
+	for (int i=0;i<VIB_FFT_SIZE;i++) {
+		unsigned int uiSrc = (m_uiHistoryPos + i) & (VIB_FFT_SIZE - 1);//oldest reading first
+		int nDest = m_bitReverse[i];
+		m_re[0][nDest] = (m_history[0][uiSrc] - dMean[0]) * m_window[i];
+		m_im[0][nDest] = (m_history[1][uiSrc] - dMean[1]) * m_window[i];
+		m_re[1][nDest] = (m_history[2][uiSrc] - dMean[2]) * m_window[i];
+		m_im[1][nDest] = 0.0;
+	}
+	FFT(m_re[0], m_im[0]);
+	FFT(m_re[1], m_im[1]);
+	for (int k=1;k<VIB_FFT_SIZE/2;k++) {
+		//|X(k)|^2 + |Y(k)|^2 = (|C(k)|^2 + |C(N-k)|^2) / 2 for the packed transform C = X + iY
+		double dPackedEnergy = (m_re[0][k]*m_re[0][k] + m_im[0][k]*m_im[0][k] + m_re[0][VIB_FFT_SIZE-k]*m_re[0][VIB_FFT_SIZE-k] + m_im[0][VIB_FFT_SIZE-k]*m_im[0][VIB_FFT_SIZE-k]) / 2;
+		m_binEnergySum[k]+=dPackedEnergy + m_re[1][k]*m_re[1][k] + m_im[1][k]*m_im[1][k];
+	}
+	m_uiNumFFTs++;
+}
+
+void VibrationMonitor::FFT(double *re, double *im) {//in-place radix-2 complex FFT of VIB_FFT_SIZE points (inputs must already be in bit-reversed order)
+	for (int nSize=2;nSize<=VIB_FFT_SIZE;nSize<<=1) {
+		int nHalf = nSize / 2;
+		int nTableStep = VIB_FFT_SIZE / nSize;
+		for (int i=0;i<VIB_FFT_SIZE;i+=nSize) {
+			for (int j=0;j<nHalf;j++) {
+				double dCos = m_cosTable[j*nTableStep];
+				double dSin = m_sinTable[j*nTableStep];
+				int a = i + j;
+				int b = a + nHalf;
+				double dRe = re[b]*dCos - im[b]*dSin;
+				double dIm = re[b]*dSin + im[b]*dCos;
+				re[b] = re[a] - dRe;
+				im[b] = im[a] - dIm;
+				re[a]+=dRe;
+				im[a]+=dIm;
+			}
+		}
+	}
+}
+
+void VibrationMonitor::Publish(double dNowSec) {//convert the bin energies of the current publish period into a spectrum, and start a new period
+	//one-sided mean square from Parseval's theorem: 2 * sum(|X(k)|^2) / (N^2 * mean(w^2)), with mean(w^2) = 3/8 for the Hann window
+	const double HANN_POWER = 0.375;
+	VIB_SPECTRUM spectrum;
+	memset(&spectrum, 0, sizeof(VIB_SPECTRUM));
+	spectrum.time_sec = dNowSec;
+	spectrum.num_ffts = m_uiNumFFTs;
+	spectrum.num_bands = (unsigned int)m_nNumBands;
+	spectrum.num_overruns = m_uiNumOverruns;
+	if (m_uiNumFFTs>0) {
+		double dScale = 2.0 / ((double)VIB_FFT_SIZE * VIB_FFT_SIZE * HANN_POWER * m_uiNumFFTs);
+		double dBinHz = ACC_STREAM_ODR_HZ / VIB_FFT_SIZE;
+		double dTotal = 0.0, dPeakEnergy = 0.0;
+		for (int k=1;k<VIB_FFT_SIZE/2;k++) {
+			dTotal+=m_binEnergySum[k];
+			if (m_binEnergySum[k]>dPeakEnergy) {
+				dPeakEnergy = m_binEnergySum[k];
+				spectrum.peak_hz = k * dBinHz;
+			}
+		}
+		spectrum.total_rms = sqrt(dTotal * dScale);
+		for (int i=0;i<m_nNumBands;i++) {
+			double dBandEnergy = 0.0;
+			for (int k=m_bandFirstBin[i];k<=m_bandLastBin[i];k++) {
+				dBandEnergy+=m_binEnergySum[k];
+			}
+			spectrum.band_rms[i] = sqrt(dBandEnergy * dScale);
+		}
+	}
+	memcpy(spectrum.band_low_hz, m_bandLowHz, sizeof(m_bandLowHz));
+	memcpy(spectrum.band_high_hz, m_bandHighHz, sizeof(m_bandHighHz));
+	pthread_mutex_lock(&m_spectrumMutex);
+	memcpy(&m_spectrum, &spectrum, sizeof(VIB_SPECTRUM));
+	m_uiNumSpectra++;
+	pthread_mutex_unlock(&m_spectrumMutex);
+	memset(m_binEnergySum, 0, sizeof(m_binEnergySum));
+	m_uiNumFFTs = 0;
+	m_uiNumOverruns = 0;
+}
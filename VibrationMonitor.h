@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <pthread.h>
+#include "IMU.h"
+//vibration spectrum analysis stage, streams the accelerometer at 1.66 kHz through the LSM6DS33 FIFO in a thread of its own and computes windowed FFT band energies, separate from the fused IMU samples
+
+#define VIB_FFT_SIZE 512 //number of accelerometer readings in each FFT window (must be a power of 2), about 0.31 sec at 1.66 kHz for a bin width of about 3.3 Hz
+#define VIB_HOP_SIZE (VIB_FFT_SIZE / 2) //number of new readings between FFTs (50% overlap of consecutive windows)
+#define VIB_MAX_BANDS 16 //maximum number of frequency bands that energies are computed for
+#define VIB_DEFAULT_NUM_BANDS 8 //number of equal-width bands (from 0 Hz to the Nyquist frequency) used if no bands are added with AddBand
+#define VIB_POLL_PERIOD_US 10000 //time between FIFO reads in microseconds
+#define VIB_MAX_READINGS_PER_BURST 64 //maximum number of accelerometer readings read out of the FIFO in one burst, limits how long the bus is held at a time
+
+struct VIB_SPECTRUM {//vibration band energies averaged over one publish period
+	double time_sec;//monotonic time (in seconds) when the spectrum was published
+	unsigned int num_ffts;//number of FFT windows that were averaged for this spectrum
+	unsigned int num_bands;//number of valid entries in band_low_hz, band_high_hz, and band_rms
+	double band_low_hz[VIB_MAX_BANDS];//lower edge of each band in Hz
+	double band_high_hz[VIB_MAX_BANDS];//upper edge of each band in Hz
+	double band_rms[VIB_MAX_BANDS];//RMS vibration in each band (in G, summed over the X, Y, Z axes)
+	double total_rms;//RMS vibration over all frequencies above DC (in G, summed over the X, Y, Z axes)
+	double peak_hz;//center frequency of the FFT bin with the most energy (DC excluded)
+	unsigned int num_overruns;//number of times that the FIFO overflowed during the publish period (readings were lost)
+};
+
+class VibrationMonitor {//thread that collects a 1.66 kHz accelerometer stream and publishes vibration band energies at a low rate
+public:
+	VibrationMonitor(IMU *pIMU, double dPublishPeriodSec);//constructor
+	~VibrationMonitor();//destructor
+	bool AddBand(double dLowHz, double dHighHz);//add a frequency band to compute the vibration energy of (call before Start)
+	bool Start();//start the accelerometer stream and the analysis thread
+	void Stop();//stop the analysis thread and return the accelerometer to its normal 104 Hz ODR
+	bool GetSpectrum(VIB_SPECTRUM *pSpectrum);//get the most recently published spectrum, returns false if none has been published yet
+	unsigned int GetNumSpectra();//returns the number of spectra published since Start was called
+
+private:
+	//data
+	IMU *m_pIMU;//the IMU that accelerometer readings are collected from
+	double m_dPublishPeriodSec;//time between published spectra in seconds
+	int m_nNumBands;//number of bands added with AddBand
+	double m_bandLowHz[VIB_MAX_BANDS];//lower edge of each band in Hz
+	double m_bandHighHz[VIB_MAX_BANDS];//upper edge of each band in Hz
+	int m_bandFirstBin[VIB_MAX_BANDS];//first FFT bin of each band
+	int m_bandLastBin[VIB_MAX_BANDS];//last FFT bin of each band
+	double m_window[VIB_FFT_SIZE];//Hann window coefficients
+	double m_cosTable[VIB_FFT_SIZE / 2];//FFT twiddle factors (cosine)
+	double m_sinTable[VIB_FFT_SIZE / 2];//FFT twiddle factors (sine)
+	int m_bitReverse[VIB_FFT_SIZE];//bit-reversed index of each FFT input
+	double m_history[3][VIB_FFT_SIZE];//circular buffer of the most recent X, Y, Z readings
+	unsigned int m_uiHistoryPos;//index in m_history where the next reading goes
+	unsigned int m_uiNumSinceFFT;//number of readings since the last FFT
+	unsigned int m_uiNumReadings;//number of readings collected since Start (saturates at VIB_FFT_SIZE)
+	double m_re[2][VIB_FFT_SIZE];//FFT working space (real parts): X + iY packed into the first transform, Z into the second
+	double m_im[2][VIB_FFT_SIZE];//FFT working space (imaginary parts)
+	double m_binEnergySum[VIB_FFT_SIZE / 2];//energy of each bin summed over the FFTs of the current publish period
+	unsigned int m_uiNumFFTs;//number of FFTs in the current publish period
+	unsigned int m_uiNumOverruns;//number of FIFO overruns in the current publish period
+	double m_readBuf[3 * VIB_MAX_READINGS_PER_BURST];//accelerometer readings from the most recent FIFO burst
+	pthread_mutex_t m_spectrumMutex;//protects m_spectrum and m_uiNumSpectra
+	VIB_SPECTRUM m_spectrum;//most recently published spectrum
+	unsigned int m_uiNumSpectra;//number of spectra published since Start was called
+	std::atomic<bool> m_bRunning;//true while the analysis thread should keep running
+	bool m_bThreadStarted;//true if m_thread was created and has not been joined yet
+	pthread_t m_thread;//handle to the analysis thread
+	char m_szErrMsg[256];//buffer space used for outputting error messages
+
+	//functions
+	static void *AnalysisThread(void *pParam);//thread function for collecting readings and computing spectra
+	void AnalysisLoop();//loop that runs in the analysis thread until Stop is called
+	void AddReading(double *acc_data);//add one X, Y, Z reading to the history, and compute an FFT when VIB_HOP_SIZE new readings have arrived
+	void ComputeFFTEnergies();//window the most recent VIB_FFT_SIZE readings, transform them, and add the energy of each bin to m_binEnergySum
+	void FFT(double *re, double *im);//in-place radix-2 complex FFT of VIB_FFT_SIZE points
+	void Publish(double dNowSec);//convert the bin energies of the current publish period into a spectrum, and start a new period
+};